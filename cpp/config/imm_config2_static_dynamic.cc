@@ -23,6 +23,36 @@ namespace static_config
     //! \suggested [0.5 0.5]
     QList<float> mode_probabilities = [0.5; 0.5];
     
+    //! Bool which defines if the model matrices are cached for recurring time deltas
+    //!
+    //! \suggested false
+    bool model_matrix_cache_enabled = false;
+    
+    //! Float which defines the step in seconds time deltas are rounded to for the model matrix cache
+    //!
+    //! \suggested 0.001
+    float model_matrix_cache_quantization_step = 0.001;
+    
+    //! Integer which defines the maximum number of cached model matrix sets
+    //!
+    //! \suggested 256
+    int model_matrix_cache_capacity = 256;
+    
+    //! List which defines the sensor periods in seconds the model matrix cache is filled with on startup
+    //!
+    //! \suggested [1.0; 4.0]
+    QList<float> model_matrix_cache_prewarm_periods = [1.0; 4.0];
+    
+    //! Bool which defines if estimators with compile time dimensions are used for supported configs
+    //!
+    //! \suggested true
+    bool fixed_size_estimators_enabled = true;
+    
+    //! Bool which defines if likelihoods and mode probabilities are calculated in log space
+    //!
+    //! \suggested false
+    bool log_domain_mode_probabilities = false;
+    
     //! Matrix which defines how the state of the subfilter is expanded to full state
     //!
     //! \suggested []
@@ -0,0 +1,637 @@
+//
+// Created by felix on 8/12/20.
+//
+
+#ifndef AVIMM_BATCH_ESTIMATOR_H
+#define AVIMM_BATCH_ESTIMATOR_H
+
+#include "avimmfixedfilter.h"
+#include "utils/avimmairportconfigs.h"
+#include "utils/avimmsimd.h"
+
+#include <array>
+#include <limits>
+#include <vector>
+
+// IMM estimator for many tracks of the same area config, which are all calculated with the same subfilter models
+// and the same time delta in one pass. It implements the steps of AVIMMFixedEstimator, but the data of the tracks is
+// stored as struct of arrays: every component of x, P and the mode probabilities is a contiguous array over all
+// tracks. Each step is calculated for AVIMMSimdLane::width tracks at once, the remaining tracks with a scalar lane.
+// The model matrices only depend on the time delta, they are evaluated once per pass and used as constants, zero
+// coefficients (most of F and H) are skipped.
+// Every track needs a measurement for each pass, measurement uncertainties and inputs of the config are used.
+template<int N, int M, int MODES>
+class AVIMMBatchEstimator
+{
+    friend class TstAVIMMBatchEstimator;
+public:
+    typedef Eigen::Matrix<double, N, 1> StateVector;
+    typedef Eigen::Matrix<double, N, N> StateMatrix;
+    typedef Eigen::Matrix<double, M, 1> MeasurementVector;
+    typedef Eigen::Matrix<double, M, N> MeasurementMatrix;
+    typedef Eigen::Matrix<double, M, M> MeasurementCovariance;
+    typedef Eigen::Matrix<double, MODES, 1> ModeVector;
+    typedef Eigen::Matrix<double, MODES, MODES> ModeMatrix;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    explicit AVIMMBatchEstimator(const AVIMMConfigData& config);
+
+    // Only kalman filters and extended kalman filters with measurements in the state space are supported
+    static bool isSupported(const AVIMMConfigData& config);
+
+    // Returns the index of the new track. Removing a track moves the last track to its index.
+    int addTrack(const StateVector& initial_state);
+    void removeTrack(int track);
+    int size() const { return m_size; }
+    void reserve(int capacity);
+
+    void setMeasurement(int track, const MeasurementVector& z);
+    // Predicts all tracks by time_delta seconds and updates them with their measurement
+    void predictAndUpdate(float time_delta);
+
+    StateVector getStateVector(int track) const;
+    StateMatrix getCovarianceMatrix(int track) const;
+    ModeVector getModeProbabilityVector(int track) const;
+
+private:
+    typedef std::vector<double, Eigen::aligned_allocator<double>> Buffer;
+
+    struct Model
+    {
+        StateMatrix F; // Transition matrix
+        StateMatrix P; // Covariance matrix the mixing starts from
+        StateMatrix Q; // Process noise matrix
+        MeasurementMatrix H; // Measurement control matrix, the jacobi matrix for extended kalman filters
+        MeasurementCovariance R; // Measurement uncertainty matrix
+        bool measures_state; // The innovation is z - x like in AVIMMExtendedKalmanFilter
+    };
+
+    // Component offsets in the buffers, each component holds m_capacity values
+    enum
+    {
+        X_OFFSET      = 0,
+        P_OFFSET      = X_OFFSET + N,
+        MU_OFFSET     = P_OFFSET + N * N,
+        LOG_MU_OFFSET = MU_OFFSET + MODES,
+        MODE_X_OFFSET = LOG_MU_OFFSET + MODES,
+        Z_OFFSET      = MODE_X_OFFSET + MODES * N,
+        COMPONENTS    = Z_OFFSET + M
+    };
+
+    AVIMMConfigData m_config;
+    std::array<AVIMMCompiledSubfilterMatrices, MODES> m_programs;
+    std::array<Model, MODES> m_models;
+    ModeMatrix m_markov_transition_matrix;
+    ModeMatrix m_log_markov_transition_matrix;
+    ModeVector m_initial_mode_probabilities;
+    StateMatrix m_initial_covariance;
+    bool m_log_domain;
+
+    Buffer m_buffer;
+    int m_size;
+    int m_capacity;
+
+    double& at(int component, int track) { return m_buffer[component * m_capacity + track]; }
+    double at(int component, int track) const { return m_buffer[component * m_capacity + track]; }
+    template<typename Lane>
+    Lane load(int component, int track) const { return Lane::load(&m_buffer[component * m_capacity + track]); }
+    template<typename Lane>
+    void store(const Lane& value, int component, int track) { value.store(&m_buffer[component * m_capacity + track]); }
+
+    void evaluateModels(float time_delta);
+    // Calculates one IMM step for the tracks [track, track + Lane::width)
+    template<typename Lane>
+    void step(int track);
+};
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+AVIMMBatchEstimator<N, M, MODES>::AVIMMBatchEstimator(const AVIMMConfigData& config)
+    : m_config(config), m_size(0), m_capacity(0)
+{
+    assert(isSupported(m_config));
+
+    m_initial_mode_probabilities   = m_config.initial_mode_probabilities;
+    m_markov_transition_matrix     = m_config.markov_transition_matrix;
+    m_log_markov_transition_matrix = m_markov_transition_matrix.array().log();
+    m_log_domain = AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities;
+
+    for (int i = 0; i < MODES; i++)
+    {
+        const QString& key = m_config.sub_filter_config_keys[i];
+        m_programs[i] = m_config.compiled_map.value(key);
+        m_models[i].measures_state = AVIMMStaticConfigContainer::singleton().filter_type_map.value(key) ==
+                                     ExtendedKalmanFilter;
+    }
+    evaluateModels(0.0);
+
+    // All subfilters start at the initial state, so the covariance of a new track has no spread
+    m_initial_covariance.setZero();
+    for (int i = 0; i < MODES; i++)
+    {
+        m_initial_covariance.noalias() += m_initial_mode_probabilities[i] * m_models[i].P;
+        // Same as AVIMMFixedFilterBase::zeroSmallElements(), the batch estimator has no inputs to instantiate it with
+        m_initial_covariance = (m_initial_covariance.array() <= MIN_THRESHOLD).select(0.0, m_initial_covariance);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+bool AVIMMBatchEstimator<N, M, MODES>::isSupported(const AVIMMConfigData& config)
+{
+    if (config.sub_filter_config_keys.size() != MODES)
+        return false;
+
+    for (const QString& key : config.sub_filter_config_keys)
+    {
+        const FilterType type = AVIMMStaticConfigContainer::singleton().filter_type_map.value(key);
+        if (type != KalmanFilter && !(type == ExtendedKalmanFilter && M <= N))
+            return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+int AVIMMBatchEstimator<N, M, MODES>::addTrack(const StateVector& initial_state)
+{
+    if (m_size == m_capacity)
+        reserve(std::max(2 * m_capacity, static_cast<int>(AVIMMSimdLane::width)));
+
+    const int track = m_size++;
+    for (int i = 0; i < N; i++)
+    {
+        at(X_OFFSET + i, track) = initial_state[i];
+        for (int j = 0; j < MODES; j++)
+            at(MODE_X_OFFSET + j * N + i, track) = initial_state[i];
+    }
+    for (int i = 0; i < N * N; i++)
+        at(P_OFFSET + i, track) = m_initial_covariance(i / N, i % N);
+    for (int j = 0; j < MODES; j++)
+    {
+        at(MU_OFFSET + j, track)     = m_initial_mode_probabilities[j];
+        at(LOG_MU_OFFSET + j, track) = std::log(m_initial_mode_probabilities[j]);
+    }
+    for (int i = 0; i < M; i++)
+        at(Z_OFFSET + i, track) = 0.0;
+    return track;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+void AVIMMBatchEstimator<N, M, MODES>::removeTrack(int track)
+{
+    assert(track >= 0 && track < m_size);
+    const int last = --m_size;
+    if (track == last)
+        return;
+
+    for (int component = 0; component < COMPONENTS; component++)
+        at(component, track) = at(component, last);
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+void AVIMMBatchEstimator<N, M, MODES>::reserve(int capacity)
+{
+    // Full lanes may be loaded up to the capacity, it is kept a multiple of the lane width
+    const int width = AVIMMSimdLane::width;
+    capacity = (capacity + width - 1) / width * width;
+    if (capacity <= m_capacity)
+        return;
+
+    Buffer buffer(static_cast<size_t>(COMPONENTS) * capacity, 0.0);
+    for (int component = 0; component < COMPONENTS; component++)
+        std::copy(m_buffer.begin() + component * m_capacity, m_buffer.begin() + component * m_capacity + m_size,
+                  buffer.begin() + component * capacity);
+    m_buffer.swap(buffer);
+    m_capacity = capacity;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+void AVIMMBatchEstimator<N, M, MODES>::setMeasurement(int track, const MeasurementVector& z)
+{
+    assert(track >= 0 && track < m_size);
+    for (int i = 0; i < M; i++)
+        at(Z_OFFSET + i, track) = z[i];
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+typename AVIMMBatchEstimator<N, M, MODES>::StateVector AVIMMBatchEstimator<N, M, MODES>::getStateVector(int track) const
+{
+    assert(track >= 0 && track < m_size);
+    StateVector x;
+    for (int i = 0; i < N; i++)
+        x[i] = at(X_OFFSET + i, track);
+    return x;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+typename AVIMMBatchEstimator<N, M, MODES>::StateMatrix
+AVIMMBatchEstimator<N, M, MODES>::getCovarianceMatrix(int track) const
+{
+    assert(track >= 0 && track < m_size);
+    StateMatrix P;
+    for (int i = 0; i < N * N; i++)
+        P(i / N, i % N) = at(P_OFFSET + i, track);
+    return P;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+typename AVIMMBatchEstimator<N, M, MODES>::ModeVector
+AVIMMBatchEstimator<N, M, MODES>::getModeProbabilityVector(int track) const
+{
+    assert(track >= 0 && track < m_size);
+    ModeVector mu;
+    for (int j = 0; j < MODES; j++)
+        mu[j] = at(MU_OFFSET + j, track);
+    return mu;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+void AVIMMBatchEstimator<N, M, MODES>::evaluateModels(float time_delta)
+{
+    for (int i = 0; i < MODES; i++)
+    {
+        Model& model = m_models[i];
+        m_programs[i].F->evaluate(model.F, time_delta);
+        m_programs[i].P->evaluate(model.P, time_delta);
+        m_programs[i].Q->evaluate(model.Q, time_delta);
+        m_programs[i].R->evaluate(model.R, time_delta);
+        if (model.measures_state)
+            m_programs[i].J->evaluate(model.H);
+        else
+            m_programs[i].H->evaluate(model.H, time_delta);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+void AVIMMBatchEstimator<N, M, MODES>::predictAndUpdate(float time_delta)
+{
+    evaluateModels(time_delta);
+
+    const int width = AVIMMSimdLane::width;
+    int track = 0;
+    for (; track + width <= m_size; track += width)
+        step<AVIMMSimdLane>(track);
+    for (; track < m_size; track++)
+        step<AVIMMScalarLane>(track);
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES>
+template<typename Lane>
+void AVIMMBatchEstimator<N, M, MODES>::step(int track)
+{
+    const Lane zero = Lane::broadcast(0.0);
+
+    Lane imm_x[N];
+    Lane mode_x[MODES][N];
+    Lane mu[MODES];
+    for (int i = 0; i < N; i++)
+        imm_x[i] = load<Lane>(X_OFFSET + i, track);
+    for (int j = 0; j < MODES; j++)
+    {
+        mu[j] = load<Lane>(MU_OFFSET + j, track);
+        for (int i = 0; i < N; i++)
+            mode_x[j][i] = load<Lane>(MODE_X_OFFSET + j * N + i, track);
+    }
+
+    // Mixing probabilities mix(i,j) = T(i,j) * mu(i) / c(j) with c = T * mu, c is kept in log space in the log domain
+    Lane c[MODES];
+    Lane mix[MODES][MODES];
+    if (m_log_domain)
+    {
+        Lane log_mu[MODES];
+        for (int j = 0; j < MODES; j++)
+            log_mu[j] = load<Lane>(LOG_MU_OFFSET + j, track);
+
+        for (int i = 0; i < MODES; i++)
+        {
+            Lane terms[MODES];
+            Lane max = Lane::broadcast(-std::numeric_limits<double>::infinity());
+            for (int k = 0; k < MODES; k++)
+            {
+                terms[k] = Lane::broadcast(m_log_markov_transition_matrix(i, k)) + log_mu[k];
+                max = Lane::max(max, terms[k]);
+            }
+            Lane sum = zero;
+            for (int k = 0; k < MODES; k++)
+                sum += Lane::exp(terms[k] - max);
+            c[i] = max + Lane::log(sum);
+        }
+        for (int i = 0; i < MODES; i++)
+            for (int j = 0; j < MODES; j++)
+                mix[i][j] = Lane::exp(Lane::broadcast(m_log_markov_transition_matrix(i, j)) + log_mu[i] - c[j]);
+    }
+    else
+    {
+        for (int i = 0; i < MODES; i++)
+        {
+            c[i] = zero;
+            for (int k = 0; k < MODES; k++)
+                c[i] = Lane::fmadd(Lane::broadcast(m_markov_transition_matrix(i, k)), mu[k], c[i]);
+        }
+        for (int i = 0; i < MODES; i++)
+            for (int j = 0; j < MODES; j++)
+                mix[i][j] = Lane::broadcast(m_markov_transition_matrix(i, j)) * mu[i] / c[j];
+    }
+
+    // Differences of the subfilter states to the current IMM state, used for the spread of the mixed covariances
+    Lane diff[MODES][N];
+    for (int i = 0; i < MODES; i++)
+        for (int r = 0; r < N; r++)
+            diff[i][r] = mode_x[i][r] - imm_x[r];
+
+    Lane predicted_x[N];
+    for (int r = 0; r < N; r++)
+        predicted_x[r] = zero;
+
+    Lane post_x[MODES][N];
+    Lane post_P[MODES][N * N];
+    Lane log_likelihood[MODES];
+    for (int j = 0; j < MODES; j++)
+    {
+        const Model& model = m_models[j];
+
+        // Mixed state and covariance of the subfilter, the covariance starts from the config P like in
+        // AVIMMFixedEstimator
+        Lane x[N];
+        Lane P[N * N];
+        for (int r = 0; r < N; r++)
+        {
+            x[r] = zero;
+            for (int i = 0; i < MODES; i++)
+                x[r] = Lane::fmadd(mix[i][j], mode_x[i][r], x[r]);
+        }
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = zero;
+                for (int i = 0; i < MODES; i++)
+                {
+                    const Lane spread = Lane::fmadd(diff[i][r], diff[i][s], Lane::broadcast(m_models[i].P(r, s)));
+                    value = Lane::fmadd(mix[i][j], spread, value);
+                }
+                P[r * N + s] = value;
+            }
+
+        // x = Fx, P = FPF' + Q
+        Lane prior_x[N];
+        Lane FP[N * N];
+        for (int r = 0; r < N; r++)
+        {
+            prior_x[r] = zero;
+            for (int s = 0; s < N; s++)
+                FP[r * N + s] = zero;
+            for (int k = 0; k < N; k++)
+            {
+                if (model.F(r, k) == 0.0)
+                    continue;
+                const Lane f = Lane::broadcast(model.F(r, k));
+                prior_x[r] = Lane::fmadd(f, x[k], prior_x[r]);
+                for (int s = 0; s < N; s++)
+                    FP[r * N + s] = Lane::fmadd(f, P[k * N + s], FP[r * N + s]);
+            }
+        }
+        Lane prior_P[N * N];
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = zero;
+                for (int k = 0; k < N; k++)
+                    if (model.F(s, k) != 0.0)
+                        value = Lane::fmadd(FP[r * N + k], Lane::broadcast(model.F(s, k)), value);
+                prior_P[r * N + s] = Lane::zeroSmall(value + Lane::broadcast(model.Q(r, s)), MIN_THRESHOLD);
+            }
+
+        // The IMM state after the prediction is calculated with the old mode probabilities
+        for (int r = 0; r < N; r++)
+            predicted_x[r] = Lane::fmadd(mu[j], prior_x[r], predicted_x[r]);
+
+        // y = z - Hx, or z - x for filters measuring the state
+        Lane y[M];
+        for (int r = 0; r < M; r++)
+        {
+            y[r] = load<Lane>(Z_OFFSET + r, track);
+            if (model.measures_state)
+            {
+                y[r] -= prior_x[r];
+                continue;
+            }
+            for (int k = 0; k < N; k++)
+                if (model.H(r, k) != 0.0)
+                    y[r] -= Lane::broadcast(model.H(r, k)) * prior_x[k];
+        }
+
+        // HP' and S = HPH' + R
+        Lane HP[M * N];
+        for (int r = 0; r < M; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = zero;
+                for (int k = 0; k < N; k++)
+                    if (model.H(r, k) != 0.0)
+                        value = Lane::fmadd(Lane::broadcast(model.H(r, k)), prior_P[s * N + k], value);
+                HP[r * N + s] = value;
+            }
+        Lane S[M * M];
+        for (int r = 0; r < M; r++)
+            for (int s = 0; s < M; s++)
+            {
+                Lane value = Lane::broadcast(model.R(r, s));
+                for (int k = 0; k < N; k++)
+                    if (model.H(s, k) != 0.0)
+                        value = Lane::fmadd(HP[r * N + k], Lane::broadcast(model.H(s, k)), value);
+                S[r * M + s] = Lane::zeroSmall(value, MIN_THRESHOLD);
+            }
+
+        // S = LDL', S is positive definite so no pivoting is needed. L has a unit diagonal.
+        Lane L[M * M];
+        Lane D[M];
+        for (int k = 0; k < M; k++)
+        {
+            D[k] = S[k * M + k];
+            for (int m = 0; m < k; m++)
+                D[k] -= L[k * M + m] * L[k * M + m] * D[m];
+            for (int i = k + 1; i < M; i++)
+            {
+                Lane value = S[i * M + k];
+                for (int m = 0; m < k; m++)
+                    value -= L[i * M + m] * L[k * M + m] * D[m];
+                L[i * M + k] = value / D[k];
+            }
+        }
+
+        // K = PH'inv(S), solved column wise for each state component: S * K' = HP'
+        Lane K[N * M];
+        for (int s = 0; s < N; s++)
+        {
+            Lane w[M];
+            for (int r = 0; r < M; r++)
+            {
+                w[r] = HP[r * N + s];
+                for (int m = 0; m < r; m++)
+                    w[r] -= L[r * M + m] * w[m];
+            }
+            for (int r = 0; r < M; r++)
+                w[r] = w[r] / D[r];
+            for (int r = M - 1; r >= 0; r--)
+                for (int m = r + 1; m < M; m++)
+                    w[r] -= L[m * M + r] * w[m];
+            for (int r = 0; r < M; r++)
+                K[s * M + r] = Lane::zeroSmall(w[r], MIN_THRESHOLD);
+        }
+
+        // x = x + Ky
+        for (int r = 0; r < N; r++)
+        {
+            Lane value = prior_x[r];
+            for (int m = 0; m < M; m++)
+                value = Lane::fmadd(K[r * M + m], y[m], value);
+            post_x[j][r] = value;
+        }
+
+        // P = (I-KH)P(I-KH)' + KRK'
+        Lane I_KH[N * N];
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = Lane::broadcast(r == s ? 1.0 : 0.0);
+                for (int m = 0; m < M; m++)
+                    if (model.H(m, s) != 0.0)
+                        value -= K[r * M + m] * Lane::broadcast(model.H(m, s));
+                I_KH[r * N + s] = value;
+            }
+        Lane I_KH_P[N * N];
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = zero;
+                for (int k = 0; k < N; k++)
+                    value = Lane::fmadd(I_KH[r * N + k], prior_P[k * N + s], value);
+                I_KH_P[r * N + s] = value;
+            }
+        Lane KR[N * M];
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < M; s++)
+            {
+                Lane value = zero;
+                for (int m = 0; m < M; m++)
+                    if (model.R(m, s) != 0.0)
+                        value = Lane::fmadd(K[r * M + m], Lane::broadcast(model.R(m, s)), value);
+                KR[r * M + s] = value;
+            }
+        for (int r = 0; r < N; r++)
+            for (int s = 0; s < N; s++)
+            {
+                Lane value = zero;
+                for (int k = 0; k < N; k++)
+                    value = Lane::fmadd(I_KH_P[r * N + k], I_KH[s * N + k], value);
+                for (int m = 0; m < M; m++)
+                    value = Lane::fmadd(KR[r * M + m], K[s * M + m], value);
+                post_P[j][r * N + s] = Lane::zeroSmall(value, MIN_THRESHOLD);
+            }
+
+        // Log of the normal density N(y; 0, S) like AVIMMFilterBase::calculateLogLikelihood
+        Lane w[M];
+        Lane mahalanobis = zero;
+        Lane log_determinant = zero;
+        for (int r = 0; r < M; r++)
+        {
+            w[r] = y[r];
+            for (int m = 0; m < r; m++)
+                w[r] -= L[r * M + m] * w[m];
+            mahalanobis += w[r] * w[r] / D[r];
+            log_determinant += Lane::log(Lane::abs(D[r]));
+        }
+        log_likelihood[j] = Lane::broadcast(-0.5) *
+                            (Lane::broadcast(M * std::log(2 * M_PI)) + log_determinant + mahalanobis);
+    }
+
+    // Mode probabilities, in linear space the likelihoods have the lower bound of AVIMMFilterBase::getLikelihood
+    if (m_log_domain)
+    {
+        Lane log_mu[MODES];
+        Lane max = Lane::broadcast(-std::numeric_limits<double>::infinity());
+        for (int j = 0; j < MODES; j++)
+        {
+            log_mu[j] = c[j] + log_likelihood[j];
+            max = Lane::max(max, log_mu[j]);
+        }
+        Lane sum = zero;
+        for (int j = 0; j < MODES; j++)
+            sum += Lane::exp(log_mu[j] - max);
+        const Lane log_sum = max + Lane::log(sum);
+        for (int j = 0; j < MODES; j++)
+        {
+            log_mu[j] -= log_sum;
+            mu[j] = Lane::exp(log_mu[j]);
+            store(log_mu[j], LOG_MU_OFFSET + j, track);
+        }
+    }
+    else
+    {
+        const Lane min_likelihood = Lane::broadcast(1*exp(-18));
+        Lane sum = zero;
+        for (int j = 0; j < MODES; j++)
+        {
+            mu[j] = c[j] * Lane::max(Lane::exp(log_likelihood[j]), min_likelihood);
+            sum += mu[j];
+        }
+        for (int j = 0; j < MODES; j++)
+            mu[j] = mu[j] / sum;
+    }
+
+    // IMM state, the spread is taken relative to the IMM state after the prediction
+    for (int r = 0; r < N; r++)
+    {
+        Lane value = zero;
+        for (int j = 0; j < MODES; j++)
+            value = Lane::fmadd(mu[j], post_x[j][r], value);
+        store(value, X_OFFSET + r, track);
+    }
+    for (int j = 0; j < MODES; j++)
+        for (int r = 0; r < N; r++)
+            diff[j][r] = post_x[j][r] - predicted_x[r];
+
+    for (int r = 0; r < N; r++)
+        for (int s = 0; s < N; s++)
+        {
+            Lane value = zero;
+            for (int j = 0; j < MODES; j++)
+            {
+                const Lane spread = Lane::fmadd(diff[j][r], diff[j][s], post_P[j][r * N + s]);
+                value = Lane::zeroSmall(Lane::fmadd(mu[j], spread, value), MIN_THRESHOLD);
+            }
+            store(value, P_OFFSET + r * N + s, track);
+        }
+
+    for (int j = 0; j < MODES; j++)
+    {
+        store(mu[j], MU_OFFSET + j, track);
+        for (int r = 0; r < N; r++)
+            store(post_x[j][r], MODE_X_OFFSET + j * N + r, track);
+    }
+}
+
+#endif //AVIMM_BATCH_ESTIMATOR_H
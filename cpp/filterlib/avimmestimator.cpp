@@ -6,10 +6,23 @@
 #include "avimmfilterbase.h"
 #include "avimmkalmanfilter.h"
 #include "avimmextendedkalmanfilter.h"
+#include "utils/avimmmodelmatrixcache.h"
+#include "utils/avimmlogmath.h"
+#include "utils/avimmstagetiming.h"
+
+#include <algorithm>
 
 AVIMMEstimator::AVIMMEstimator(const Vector& initial_state)
+    : AVIMMEstimator(AVIMMAirportConfigs::singleton().getIMMConfigData(initial_state), initial_state)
+{
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMEstimator::AVIMMEstimator(const AVIMMConfigData& config, const Vector& initial_state)
+    : m_clock(nullptr)
 {
-    m_config = AVIMMAirportConfigs::singleton().getIMMConfigData(initial_state);
+    m_config = config;
     // Take those from the first sufilter since those are the same for both
     m_mode_probabilities       = m_config.initial_mode_probabilities;
     m_markov_transition_matrix = m_config.markov_transition_matrix;
@@ -17,19 +30,27 @@ AVIMMEstimator::AVIMMEstimator(const Vector& initial_state)
     
     m_mode_probabilities_matrix = Matrix::Zero(m_markov_transition_matrix.rows(), m_markov_transition_matrix.cols());
     
+    m_log_domain = AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities;
+    m_log_mode_probabilities       = m_mode_probabilities.array().log();
+    m_log_markov_transition_matrix = m_markov_transition_matrix.array().log();
+    m_log_c                        = Vector::Zero(m_mode_probabilities.size());
+    m_log_likelihoods              = Vector::Zero(m_mode_probabilities.size());
+    
     // Initialize IMM Subfilters
-    m_data.x = initial_state;
-    m_data.P = Matrix::Zero(initial_state.rows(), initial_state.rows());
+    FilterData& data = m_data.current();
+    data.x = initial_state;
+    data.P = Matrix::Zero(initial_state.rows(), initial_state.rows());
+    data.x_prior = data.x_post = data.x;
+    data.P_prior = data.P_post = data.P;
     initializeSubfilters(initial_state);
+    initializeWorkspace();
     
     // Perform initial probability calculation and set IMM state
     calculateModeProbabilityMatrix(m_mode_probabilities_matrix);
-    calculateIMMState(m_data.x, m_data.P);
-    m_last_calculation = QDateTime::currentDateTimeUtc();
-    m_previous_data = m_data;
-    
-    // Always have this on false, this can be set by the unittesthelper classes to enable special funtionality only needed for test running
-    m_test_run = false;
+    calculateIMMState(data.x, data.P);
+    m_last_calculation = getClock()->now();
+    data.time_stamp = m_last_calculation;
+    m_data.reset(data);
 }
 
 //--------------------------------------------------------------------------
@@ -45,29 +66,31 @@ void AVIMMEstimator::initializeSubfilters(const Vector& initial_state)
 {
     for (auto sub_filter_config_key : m_config.sub_filter_config_keys)
     {
-        switch(AVIMMStaticConfigContainer::singleton().filter_type_map[sub_filter_config_key])
+        m_compiled_matrices.push_back(m_config.compiled_map.value(sub_filter_config_key));
+        const AVIMMCompiledSubfilterMatrices& compiled = m_compiled_matrices.back();
+        switch(AVIMMStaticConfigContainer::singleton().filter_type_map.value(sub_filter_config_key))
         {
             case KalmanFilter: {
                 // Initialize all matrices with a dt=0.0;
-                Matrix F = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.F_map[sub_filter_config_key]);
-                Matrix P = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.P_map[sub_filter_config_key]);
-                Matrix Q = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.Q_map[sub_filter_config_key]);
-                Matrix B = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.B_map[sub_filter_config_key]);
-                Matrix H = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.H_map[sub_filter_config_key]);
-                Matrix R = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.R_map[sub_filter_config_key]);
+                Matrix F = compiled.F->evaluate();
+                Matrix P = compiled.P->evaluate();
+                Matrix Q = compiled.Q->evaluate();
+                Matrix B = compiled.B->evaluate();
+                Matrix H = compiled.H->evaluate();
+                Matrix R = compiled.R->evaluate();
                 auto* filter = new AVIMMKalmanFilter(initial_state, F, P, H, Q, R, B, sub_filter_config_key);
                 m_filters.push_back(filter);
                 break;
             }
             case ExtendedKalmanFilter: {
                 // Initialize all matrices with a dt=0.0;
-                Matrix F = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.F_map[sub_filter_config_key]);
-                Matrix P = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.P_map[sub_filter_config_key]);
-                Matrix Q = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.Q_map[sub_filter_config_key]);
-                Matrix B = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.B_map[sub_filter_config_key]);
-                Matrix H = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.H_map[sub_filter_config_key]);
-                Matrix R = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.R_map[sub_filter_config_key]);
-                Matrix J = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.J_map[sub_filter_config_key]);
+                Matrix F = compiled.F->evaluate();
+                Matrix P = compiled.P->evaluate();
+                Matrix Q = compiled.Q->evaluate();
+                Matrix B = compiled.B->evaluate();
+                Matrix H = compiled.H->evaluate();
+                Matrix R = compiled.R->evaluate();
+                Matrix J = compiled.J->evaluate();
                 auto* filter = new AVIMMExtendedKalmanFilter(initial_state, F, P, H, Q, R, B, J, sub_filter_config_key);
                 m_filters.push_back(filter);
                 break;
@@ -76,136 +99,228 @@ void AVIMMEstimator::initializeSubfilters(const Vector& initial_state)
                 assert(("Invalid Filtertype!", false));
         }
     }
+    
+    initializeModelCacheIds();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::initializeWorkspace()
+{
+    // Configs which were not loaded by AVIMMAreaConfig (e.g. created in code) have no index maps yet
+    if (m_config.expansion_map.rows() != m_config.expansion_matrix.rows())
+        m_config.expansion_map = AVIMMIndexMap(m_config.expansion_matrix);
+    if (m_config.expansion_map_covariance.rows() != m_config.expansion_matrix_covariance.rows())
+        m_config.expansion_map_covariance = AVIMMIndexMap(m_config.expansion_matrix_covariance);
+    if (m_config.shrinking_map.rows() != m_config.shrinking_matrix.rows())
+        m_config.shrinking_map = AVIMMIndexMap(m_config.shrinking_matrix);
+    
+    const int number_of_filters = m_filters.size();
+    const int state_size        = m_data.current().x.size();
+    
+    m_mixed_states.assign(number_of_filters, Vector::Zero(state_size));
+    m_mixed_covariances.assign(number_of_filters, Matrix::Zero(state_size, state_size));
+    m_workspace.expanded_states    = Matrix::Zero(state_size, number_of_filters);
+    m_workspace.spread_covariances = Matrix::Zero(state_size * state_size, number_of_filters);
+    m_workspace.mixed_states       = Matrix::Zero(state_size, number_of_filters);
+    m_workspace.mixed_covariances  = Matrix::Zero(state_size * state_size, number_of_filters);
+    m_workspace.state      = Vector::Zero(state_size);
+    m_workspace.covariance = Matrix::Zero(state_size, state_size);
+    m_workspace.state_diff = Vector::Zero(state_size);
+    m_workspace.ones        = Vector::Zero(REQUESTED_SIZE);
+    m_workspace.ones_matrix = Matrix::Zero(REQUESTED_SIZE, REQUESTED_SIZE);
+    m_workspace.expansion   = Matrix::Zero(REQUESTED_SIZE, REQUESTED_SIZE);
+    m_workspace.shrinking   = Matrix::Zero(m_config.shrinking_matrix.rows(), REQUESTED_SIZE);
+    m_workspace.z_shrunk    = Vector::Zero(m_config.shrinking_matrix.rows());
+    m_workspace.R_shrunk    = Matrix::Zero(m_config.shrinking_matrix.rows(), m_config.shrinking_matrix.rows());
+    m_workspace.probabilities = Vector::Zero(number_of_filters);
+    m_c = Vector::Zero(number_of_filters);
+    
+    // The model matrices get their sizes from a first evaluation, the prediction the ones of the subfilter
+    m_workspace.extrapolations.resize(number_of_filters);
+    int i = 0;
+    for (const auto& filter : m_filters)
+    {
+        auto& extrapolation = m_workspace.extrapolations[i];
+        const AVIMMCompiledSubfilterMatrices& compiled = m_compiled_matrices[i];
+        const int dim = filter->getData().x.size();
+        compiled.F->evaluate(extrapolation.model.F);
+        compiled.P->evaluate(extrapolation.model.P);
+        compiled.H->evaluate(extrapolation.model.H);
+        compiled.Q->evaluate(extrapolation.model.Q);
+        compiled.R->evaluate(extrapolation.model.R);
+        compiled.B->evaluate(extrapolation.model.B);
+        extrapolation.x       = Vector::Zero(dim);
+        extrapolation.P       = Matrix::Zero(dim, dim);
+        extrapolation.x_prior = Vector::Zero(dim);
+        extrapolation.P_prior = Matrix::Zero(dim, dim);
+        extrapolation.FP      = Matrix::Zero(dim, dim);
+        i++;
+    }
+    m_workspace.extrapolated_state      = Vector::Zero(state_size);
+    m_workspace.extrapolated_covariance = Matrix::Zero(state_size, state_size);
 }
 
 //--------------------------------------------------------------------------
 
-void AVIMMEstimator::predictAndUpdate(const Vector &z, const Matrix &R_in, const Vector &u)
+void AVIMMEstimator::initializeModelCacheIds()
 {
-    Matrix R = R_in;
-    prepare();
+    // Resolve the cache ids once, lookups in prepare() are done by id only
+    m_model_cache_ids.clear();
+    for (const auto& filter : m_filters)
+        m_model_cache_ids.push_back(AVIMMModelMatrixCache::getModelId(m_config.area_name, filter->getFilterKey()));
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::predictAndUpdate(const Vector &z, const Matrix &R_in, const Vector &u, qint64 timestamp)
+{
+    AVIMM_STAGE_TIMER(stage_timer);
+    prepare(timestamp);
+    AVIMM_STAGE_LAP(stage_timer, PREPARE);
     calculateMixedStates(m_mixed_states, m_mixed_covariances);
+    AVIMM_STAGE_LAP(stage_timer, MIXED_STATES);
     
     // Predict each filter
     int i = 0;
     for (const auto &filter: m_filters)
     {
         // Shrink filter state to correct size, this allows for subfilters with only a subset of the IMM state
-        filter->getData().x = shrinkVector(m_mixed_states[i], filter->getData().x.size());
-        filter->getData().P = shrinkMatrix(m_mixed_covariances[i], filter->getData().x.size());
+        auto& mixed_data = filter->getData();
+        const int dim = mixed_data.x.size();
+        shrinkVector(m_mixed_states[i], dim, mixed_data.x);
+        shrinkMatrix(m_mixed_covariances[i], dim, mixed_data.P);
+        // The prediction starts a new data slot of the filter
         filter->predict(u);
-        auto data = filter->getData();
-        data.x = filter->getData().x_prior;
-        data.P = filter->getData().P_prior;
-        filter->setData(data);
+        auto& data = filter->getData();
+        data.x = data.x_prior;
+        data.P = data.P_prior;
         i++;
     }
+    AVIMM_STAGE_LAP(stage_timer, SUBFILTER_PREDICT);
     
     // Calculate the IMM state after prediction of each filter has finished
-    calculateIMMState(m_data.x, m_data.P);
-    m_data.x_prior = m_data.x;
-    m_data.P_prior = m_data.P;
+    FilterData& imm_data = m_data.current();
+    calculateIMMState(imm_data.x, imm_data.P);
+    imm_data.x_prior = imm_data.x;
+    imm_data.P_prior = imm_data.P;
+    AVIMM_STAGE_LAP(stage_timer, IMM_STATE_PRIOR);
     
     // Update each filter
     for (const auto &filter: m_filters)
     {
-        if (R == DEFAULT_MATRIX)
-        {
-            R = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(
-                    m_config.R_map[filter->getFilterKey()]);
-        }
-        // Shrink measurement z and measurement variance R, this allows for subfilters with only a subset of the IMM state
-        Vector z_shrunk = shrinkVector(z, filter->getData().x.size());
-        Matrix R_shrunk = shrinkMatrix(R, filter->getData().x.size());
-        filter->update(z, R);
+        // Shrink measurement z and measurement variance R, this allows for subfilters with only a subset of the IMM
+        // state. Without a given measurement variance the one of the subfilter config is used.
+        auto& data = filter->getData();
+        const int dim = data.x.size();
+        const Vector& z_shrunk = shrinkVector(z, dim, m_workspace.z_shrunk);
+        if (R_in.size() == 0)
+            filter->update(z_shrunk, data.R);
+        else
+            filter->update(z_shrunk, shrinkMatrix(R_in, dim, m_workspace.R_shrunk));
     }
+    AVIMM_STAGE_LAP(stage_timer, SUBFILTER_UPDATE);
     
     // Recalculate Probabilities after update step to be prepared for the next calculation step
     calculateModeProbabilities(m_mode_probabilities);
     calculateModeProbabilityMatrix(m_mode_probabilities_matrix);
-    calculateIMMState(m_data.x, m_data.P);
+    AVIMM_STAGE_LAP(stage_timer, MODE_PROBABILITIES);
+    calculateIMMState(imm_data.x, imm_data.P);
     
-    m_data.x_post     = m_data.x;
-    m_data.P_post     = m_data.P;
-    m_data.time_stamp = QDateTime::currentDateTimeUtc();
+    imm_data.x_post     = imm_data.x;
+    imm_data.P_post     = imm_data.P;
+    imm_data.time_stamp = m_last_calculation;
+    AVIMM_STAGE_LAP(stage_timer, IMM_STATE_POST);
 }
 
 //--------------------------------------------------------------------------
 
-std::pair<Vector, Matrix> AVIMMEstimator::extrapolate(const Vector &u)
+std::pair<Vector, Matrix> AVIMMEstimator::extrapolate(const Vector &u, qint64 timestamp)
 {
-    prepare(true);
-    
-    // Calculated mixed states
-    std::vector<Vector> mixed_xs;
-    std::vector<Matrix> mixed_Ps;
-    
-    calculateMixedStates(mixed_xs, mixed_Ps);
-    
-    // Predict each filter
+    // Same steps as the prediction of predictAndUpdate(), but on copies of the subfilter states so that the
+    // estimator does not change. The result is the IMM state predictAndUpdate() calculates before the update.
+    const qint64 elapsed = std::max<qint64>(timestamp - m_last_calculation, 0);
+    const float time_delta = elapsed / 1e9;
+    
+    // Like prepare(), the model matrices of the time delta replace the ones of the subfilters before the mixing. All
+    // temporaries are workspace members, only the returned state and covariance are allocated.
+    auto& extrapolations = m_workspace.extrapolations;
     int i = 0;
     for (const auto &filter: m_filters)
     {
-        // Shrink filter state to correct size, this allows for subfilters with only a subset of the IMM state
-        filter->getData().x = shrinkVector(mixed_xs[i], filter->getData().x.size());
-        filter->getData().P = shrinkMatrix(mixed_Ps[i], filter->getData().x.size());
-        filter->predict(u);
-        auto data = filter->getData();
-        data.x = filter->getData().x_prior;
-        data.P = filter->getData().P_prior;
-        filter->setData(data);
+        evaluateModelMatrices(i, time_delta, extrapolations[i].model);
+        expandSubfilterState(i, filter->getData().x, extrapolations[i].model.P);
         i++;
     }
+    // The mixed states are calculated again by the next step, so they are used as temporaries here
+    mixExpandedStates(m_mixed_states, m_mixed_covariances);
     
-    // Calculate the IMM state and covariance after prediction of each filter has finished
-    Vector x_extrapolated = Vector::Zero(m_data.x.rows(), m_data.x.cols());
-    Matrix P_extrapolated = Matrix::Zero(m_data.P.rows(), m_data.P.cols());
+    // Predict each mixed state
+    i = 0;
+    for (const auto &filter: m_filters)
+    {
+        // Shrink the mixed state to the size of the subfilter, this allows for subfilters with only a subset of the
+        // IMM state
+        auto& extrapolation = extrapolations[i];
+        const int dim = filter->getData().x.size();
+        shrinkVector(m_mixed_states[i], dim, extrapolation.x);
+        shrinkMatrix(m_mixed_covariances[i], dim, extrapolation.P);
+        const AVIMMModelMatrices& model = extrapolation.model;
+        AVIMMFilterBase::calculatePrediction(model.F, model.Q, model.B, u, extrapolation.x, extrapolation.P,
+                                             extrapolation.x_prior, extrapolation.P_prior, extrapolation.FP);
+        expandSubfilterState(i, extrapolation.x_prior, extrapolation.P_prior);
+        i++;
+    }
     
-    calculateIMMState(x_extrapolated, P_extrapolated);
+    // Calculate the IMM state and covariance after prediction of each filter has finished
+    combineExpandedStates(m_workspace.extrapolated_state, m_workspace.extrapolated_covariance);
     
-    return std::make_pair(x_extrapolated, P_extrapolated);
+    return std::make_pair(m_workspace.extrapolated_state, m_workspace.extrapolated_covariance);
 }
 
 //--------------------------------------------------------------------------
 
 void AVIMMEstimator::calculateModeProbabilityMatrix(Matrix& mode_probability_matrix)
 {
-    Matrix probability_matrix = Matrix::Zero(m_mode_probabilities_matrix.rows(), m_mode_probabilities_matrix.cols());
-    m_c = m_markov_transition_matrix * m_mode_probabilities;
+    if (m_log_domain)
+    {
+        AVIMMLogMath::calculateMixingProbabilities(m_log_markov_transition_matrix, m_log_mode_probabilities, m_log_c,
+                                                   mode_probability_matrix);
+        return;
+    }
+    
+    m_c.noalias() = m_markov_transition_matrix * m_mode_probabilities;
     
+    mode_probability_matrix.resize(m_markov_transition_matrix.rows(), m_markov_transition_matrix.cols());
     for (int i = 0; i < m_markov_transition_matrix.cols(); i++)
         for (int j = 0; j < m_markov_transition_matrix.rows(); j++)
-            probability_matrix(i, j) = (m_markov_transition_matrix.coeff(i, j) * m_mode_probabilities[i])/m_c[j];
-    
-    mode_probability_matrix = probability_matrix;
+            mode_probability_matrix(i, j) = (m_markov_transition_matrix.coeff(i, j) * m_mode_probabilities[i])/m_c[j];
 }
 
 //--------------------------------------------------------------------------
 
 void AVIMMEstimator::calculateIMMState(Vector& imm_state, Matrix& imm_covariance)
 {
-    Vector x = Vector::Zero(m_data.x.rows(), m_data.x.cols());
-    int i = 0;
-    for (const auto &filter : m_filters)
-    {
-        auto probability = m_mode_probabilities[i];
-        const Vector& filter_state_expanded = expandVector(filter->getData().x);
-        x += filter_state_expanded * probability;
-        x = AVIMMFilterBase::zeroSmallElements(x);
-        i++;
-    }
-    
-    Matrix P = Matrix::Zero(m_data.P.rows(), m_data.P.cols());
-    i = 0;
-    for (const auto &filter : m_filters)
+    expandSubfilterStates();
+    combineExpandedStates(imm_state, imm_covariance);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::combineExpandedStates(Vector& imm_state, Matrix& imm_covariance)
+{
+    // Calculated in the workspace since imm_state may be the current IMM state, which is needed for the covariance
+    Vector& x = m_workspace.state;
+    x.noalias() = m_workspace.expanded_states * m_mode_probabilities;
+    
+    const int state_size = x.size();
+    Matrix& P = m_workspace.covariance;
+    P.setZero();
+    for (int i = 0; i < m_mode_probabilities.size(); i++)
     {
-        auto probability = m_mode_probabilities[i];
-        const Vector& filter_state_expanded = expandVector(filter->getData().x);
-        const Matrix& filter_covariance_expanded = expandCovariance(filter->getData().P);
-        const Vector& state_diff = filter_state_expanded - m_data.x;
-        P += probability * ((state_diff * state_diff.transpose()) + filter_covariance_expanded);
-        P = AVIMMFilterBase::zeroSmallElements(P);
-        i++;
+        Eigen::Map<const Matrix> spread(m_workspace.spread_covariances.col(i).data(), state_size, state_size);
+        P += m_mode_probabilities[i] * spread;
+        AVIMMFilterBase::zeroSmallElementsInPlace(P);
     }
     
     imm_state = x;
@@ -216,44 +331,76 @@ void AVIMMEstimator::calculateIMMState(Vector& imm_state, Matrix& imm_covariance
 
 void AVIMMEstimator::calculateMixedStates(std::vector<Vector>& mixed_states, std::vector<Matrix>& mixed_covariances)
 {
-    std::vector<Vector> xs;
-    std::vector<Matrix> Ps;
-    
-    for (int j = 0; j < m_mode_probabilities_matrix.cols(); j++)
+    expandSubfilterStates();
+    mixExpandedStates(mixed_states, mixed_covariances);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::mixExpandedStates(std::vector<Vector>& mixed_states, std::vector<Matrix>& mixed_covariances)
+{
+    // Mixed state j is sum_i mu(i,j) * x_i, for all modes at once
+    m_workspace.mixed_states.noalias() = m_workspace.expanded_states * m_mode_probabilities_matrix;
+    m_workspace.mixed_covariances.noalias() = m_workspace.spread_covariances * m_mode_probabilities_matrix;
+    
+    const int number_of_filters = m_mode_probabilities_matrix.cols();
+    const int state_size        = m_workspace.mixed_states.rows();
+    mixed_states.resize(number_of_filters);
+    mixed_covariances.resize(number_of_filters);
+    for (int j = 0; j < number_of_filters; j++)
     {
-        Vector col = m_mode_probabilities_matrix.col(j);
-    
-        Vector x = Vector::Zero(m_data.x.rows(), m_data.x.cols());
-        int i = 0;
-        for (const auto &filter : m_filters) {
-            auto probability = col[i];
-            const Vector& filter_state_expanded = expandVector(filter->getData().x);
-            x += filter_state_expanded * probability;
-            i++;
-        }
-        xs.push_back(x);
-        
-        Matrix P = Matrix::Zero(m_data.P.rows(), m_data.P.cols());
-        i = 0;
-        for (const auto &filter : m_filters) {
-            auto probability = col[i];
-            const Vector& filter_state_expanded = expandVector(filter->getData().x);
-            const Matrix& filter_covariance_expanded = expandCovariance(filter->getData().P);
-            const Vector& state_diff = filter_state_expanded - m_data.x;
-            P += probability * ((state_diff * state_diff.transpose()) + filter_covariance_expanded);
-            i++;
-        }
-        Ps.push_back(P);
+        mixed_states[j] = m_workspace.mixed_states.col(j);
+        mixed_covariances[j] = Eigen::Map<const Matrix>(m_workspace.mixed_covariances.col(j).data(),
+                                                        state_size, state_size);
     }
-    mixed_states = xs;
-    mixed_covariances = Ps;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::expandSubfilterStates()
+{
+    int i = 0;
+    for (const auto& filter : m_filters)
+    {
+        expandSubfilterState(i, filter->getData().x, filter->getData().P);
+        i++;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::expandSubfilterState(int i, const Vector& x, const Matrix& P)
+{
+    const Vector& imm_x = m_data.current().x;
+    const int state_size = imm_x.size();
+    Vector& state_diff = m_workspace.state_diff;
+    
+    // The spread of the subfilters is taken relative to the current IMM state
+    expandVector(x, m_workspace.state);
+    Eigen::Map<Matrix> spread(m_workspace.spread_covariances.col(i).data(), state_size, state_size);
+    expandCovariance(P, m_workspace.covariance);
+    state_diff = m_workspace.state - imm_x;
+    spread = m_workspace.covariance;
+    spread.noalias() += state_diff * state_diff.transpose();
+    m_workspace.expanded_states.col(i) = m_workspace.state;
 }
 
 //--------------------------------------------------------------------------
 
 void AVIMMEstimator::calculateModeProbabilities(Vector& mode_probabilities)
 {
-    Vector probabilities(m_filters.size(), 1);
+    if (m_log_domain)
+    {
+        int i = 0;
+        for (const auto& filter : m_filters)
+            m_log_likelihoods[i++] = filter->getLogLikelihood();
+        
+        AVIMMLogMath::calculateModeProbabilities(m_log_c, m_log_likelihoods, m_log_mode_probabilities);
+        mode_probabilities = m_log_mode_probabilities.array().exp();
+        return;
+    }
+    
+    Vector& probabilities = m_workspace.probabilities;
     int i = 0;
     auto sum = 0.0;
     for (const auto& filter : m_filters) {
@@ -270,61 +417,38 @@ void AVIMMEstimator::calculateModeProbabilities(Vector& mode_probabilities)
 
 Vector AVIMMEstimator::expandVector(const Vector &x)
 {
-    Vector new_x = x;
-    auto requested_size = REQUESTED_SIZE;
-    auto vector_size = x.size();
-    if (vector_size == requested_size)
-        return new_x;
-    
-    // Fill with one until the requested size has been reached.
-    Vector ones_x = Vector::Ones(requested_size, 1);
-    for (int i = 0; i < vector_size; i++)
-        ones_x(i) = new_x.coeff(i);
-    
-    ones_x = m_config.expansion_matrix * ones_x;
-    return ones_x;
+    Vector result;
+    expandVector(x, result);
+    return result;
 }
 
 //--------------------------------------------------------------------------
 
 Matrix AVIMMEstimator::expandMatrix(const Matrix &M)
 {
-    Matrix new_M = M;
-    auto requested_cols = REQUESTED_SIZE;
-    auto requested_rows = REQUESTED_SIZE;
-    auto matrix_cols = M.cols();
-    auto matrix_rows = M.rows();
-    
-    if (requested_cols == matrix_cols && requested_rows == matrix_rows)
-        return new_M;
-    
-    Matrix ones_M = AVIMMFilterBase::createUnityMatrix(requested_rows);
-    for (int i = 0; i < matrix_rows; i++)
-        for (int j = 0; j < matrix_cols; j++)
-            ones_M(i,j) = new_M.coeff(i, j);
-    new_M = m_config.expansion_matrix * ones_M * m_config.expansion_matrix.transpose();
-    return new_M;
+    if (M.rows() == REQUESTED_SIZE && M.cols() == REQUESTED_SIZE)
+        return M;
+    
+    Matrix result;
+    if (m_config.expansion_map.isValid())
+    {
+        m_config.expansion_map.applySymmetric(M, result);
+        return result;
+    }
+    
+    Matrix ones_M = AVIMMFilterBase::createUnityMatrix(REQUESTED_SIZE);
+    ones_M.topLeftCorner(M.rows(), M.cols()) = M;
+    result = m_config.expansion_matrix * ones_M * m_config.expansion_matrix.transpose();
+    return result;
 }
 
 //--------------------------------------------------------------------------
 
 Matrix AVIMMEstimator::expandCovariance(const Matrix &M)
 {
-    Matrix new_M = M;
-    auto requested_cols = REQUESTED_SIZE;
-    auto requested_rows = REQUESTED_SIZE;
-    auto matrix_cols = M.cols();
-    auto matrix_rows = M.rows();
-    
-    if (requested_cols == matrix_cols && requested_rows == matrix_rows)
-        return new_M;
-    
-    Matrix ones_M = AVIMMFilterBase::createUnityMatrix(requested_rows);
-    for (int i = 0; i < matrix_rows; i++)
-        for (int j = 0; j < matrix_cols; j++)
-            ones_M(i,j) = new_M.coeff(i, j);
-    new_M = m_config.expansion_matrix_covariance * ones_M * m_config.expansion_matrix_covariance.transpose();
-    return new_M;
+    Matrix result;
+    expandCovariance(M, result);
+    return result;
 }
 
 
@@ -332,51 +456,166 @@ Matrix AVIMMEstimator::expandCovariance(const Matrix &M)
 
 Vector AVIMMEstimator::shrinkVector(const Vector &x, int dim)
 {
-    if (dim == REQUESTED_SIZE)
-        return x;
-    
-    return m_config.shrinking_matrix * x;
+    Vector result;
+    return shrinkVector(x, dim, result);
 }
 
 //--------------------------------------------------------------------------
 
 Matrix AVIMMEstimator::shrinkMatrix(const Matrix &M, int dim)
+{
+    Matrix result;
+    return shrinkMatrix(M, dim, result);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::expandVector(const Vector &x, Vector &result)
+{
+    if (x.size() == REQUESTED_SIZE)
+    {
+        result = x;
+        return;
+    }
+    
+    if (m_config.expansion_map.isValid())
+    {
+        m_config.expansion_map.apply(x, result);
+        return;
+    }
+    
+    // Fill with one until the requested size has been reached.
+    m_workspace.ones.setOnes();
+    m_workspace.ones.head(x.size()) = x;
+    result.noalias() = m_config.expansion_matrix * m_workspace.ones;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::expandCovariance(const Matrix &M, Matrix &result)
+{
+    if (M.rows() == REQUESTED_SIZE && M.cols() == REQUESTED_SIZE)
+    {
+        result = M;
+        return;
+    }
+    
+    if (m_config.expansion_map_covariance.isValid())
+    {
+        m_config.expansion_map_covariance.applySymmetric(M, result);
+        return;
+    }
+    
+    m_workspace.ones_matrix.setIdentity();
+    m_workspace.ones_matrix.topLeftCorner(M.rows(), M.cols()) = M;
+    m_workspace.expansion.noalias() = m_config.expansion_matrix_covariance * m_workspace.ones_matrix;
+    result.noalias() = m_workspace.expansion * m_config.expansion_matrix_covariance.transpose();
+}
+
+//--------------------------------------------------------------------------
+
+const Vector& AVIMMEstimator::shrinkVector(const Vector &x, int dim, Vector &result)
 {
     if (dim == REQUESTED_SIZE)
-        return M;
+    {
+        // Avoid copying a vector onto itself
+        if (&x != &result)
+            result = x;
+        return result;
+    }
     
-    return m_config.shrinking_matrix * M * m_config.shrinking_matrix.transpose();
+    if (m_config.shrinking_map.isValid())
+        m_config.shrinking_map.apply(x, result);
+    else
+        result.noalias() = m_config.shrinking_matrix * x;
+    return result;
 }
 
 //--------------------------------------------------------------------------
 
-void AVIMMEstimator::prepare(bool extrapolate)
+const Matrix& AVIMMEstimator::shrinkMatrix(const Matrix &M, int dim, Matrix &result)
 {
-    // Save data into previous data struct to preserves the previous state and covariance
-    if (!extrapolate)
-        m_previous_data = m_data;
+    if (dim == REQUESTED_SIZE)
+    {
+        if (&M != &result)
+            result = M;
+        return result;
+    }
     
-    // Save time of calculation and get time delta since last calculation
-    if (!m_test_run)
-        m_now = QDateTime::currentDateTimeUtc();
+    if (m_config.shrinking_map.isValid())
+    {
+        m_config.shrinking_map.applySymmetric(M, result);
+        return result;
+    }
+    
+    m_workspace.shrinking.noalias() = m_config.shrinking_matrix * M;
+    result.noalias() = m_workspace.shrinking * m_config.shrinking_matrix.transpose();
+    return result;
+}
+
+//--------------------------------------------------------------------------
+
+template<typename Target>
+void AVIMMEstimator::evaluateModelMatrices(int i, float time_delta, Target& target)
+{
+    // Matrices are compiled once with the area config, only the new time delta has to be evaluated
+    const AVIMMCompiledSubfilterMatrices& compiled = m_compiled_matrices[i];
+    std::unique_lock<std::mutex> lock;
+    AVIMMModelMatrixCache* cache = AVIMMConfigParser::singleton().lockModelMatrixCache(lock);
+    if (cache)
+    {
+        // Recurring time deltas of fixed rate sensors are only looked up
+        const AVIMMModelMatrices& matrices = cache->getModelMatrices(m_model_cache_ids[i], compiled, time_delta);
+        target.F = matrices.F;
+        target.P = matrices.P;
+        target.H = matrices.H;
+        target.Q = matrices.Q;
+        target.R = matrices.R;
+        target.B = matrices.B;
+    }
+    else
+    {
+        compiled.F->evaluate(target.F, time_delta);
+        compiled.P->evaluate(target.P, time_delta);
+        compiled.H->evaluate(target.H, time_delta);
+        compiled.Q->evaluate(target.Q, time_delta);
+        compiled.R->evaluate(target.R, time_delta);
+        compiled.B->evaluate(target.B, time_delta);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::setTimestamp(qint64 timestamp)
+{
+    m_last_calculation = timestamp;
+    m_data.current().time_stamp = timestamp;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMEstimator::prepare(qint64 timestamp)
+{
+    // Start a new data slot, the previous slot preserves the previous state and covariance. The results of the
+    // step are calculated later on, only the IMM state is needed for the mixing.
+    const FilterData& previous = m_data.current();
+    FilterData& data = m_data.flip();
+    data.x = previous.x;
+    data.P = previous.P;
+    
+    // Time delta in seconds since the last calculation, a measurement older than the current state is not predicted
+    // backwards
+    const qint64 elapsed = std::max<qint64>(timestamp - m_last_calculation, 0);
+    const float time_delta = elapsed / 1e9;
     
-    float time_delta = m_last_calculation.msecsTo(m_now) / 1000.0;
     // Calculate all time depended matrices
+    int i = 0;
     for (auto& filter: m_filters)
     {
-        const QString filter_key = filter->getFilterKey();
-        auto new_data = filter->getData();
-        new_data.F = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.F_map[filter_key], time_delta);
-        new_data.P = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.P_map[filter_key], time_delta);
-        new_data.H = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.H_map[filter_key], time_delta);
-        new_data.Q = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.Q_map[filter_key], time_delta);
-        new_data.R = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.R_map[filter_key], time_delta);
-        new_data.B = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(m_config.B_map[filter_key], time_delta);
-        
-        filter->setData(new_data);
+        evaluateModelMatrices(i, time_delta, filter->getData());
+        i++;
     }
     
-    // Save now as las calculation step
-    if (!extrapolate)
-        m_last_calculation = m_now;
+    // Save the time of the calculation step
+    m_last_calculation += elapsed;
 }
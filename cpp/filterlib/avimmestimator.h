@@ -6,13 +6,16 @@
 #define AVIMM_ESTIMATOR_H
 
 #include "avimmfilterbase.h"
+#include "avimmestimatorinterface.h"
 #include <vector>
 #include "utils/avimmairportconfigs.h"
+#include "utils/avimmmodelmatrixcache.h"
 
-class AVIMMEstimator
+class AVIMMEstimator : public AVIMMEstimatorInterface
 {
     friend class AVIMMTester;
     friend class TstAVIMMEstimator;
+    friend class TstAVIMMAllocation;
     struct FilterData
     {
         Vector x; // State
@@ -21,8 +24,10 @@ class AVIMMEstimator
         Matrix P; // Covariance matrix
         Matrix P_prior; // Covariance matrix after prediction
         Matrix P_post; // Covariance matrix after update
-        QDateTime time_stamp; // Timestep for which the filter data is valid
-    } m_data, m_previous_data;  // data containter for current calculation and previous calculation
+        qint64 time_stamp; // Time in nanoseconds since epoch for which the filter data is valid
+    };
+    // Data of the current and the previous calculation, prepare() flips between the two
+    AVIMMDoubleBuffer<FilterData> m_data;
     
     // Vector which holds the probabilities of each filter
     Vector m_mode_probabilities;
@@ -35,28 +40,91 @@ class AVIMMEstimator
     
     // Container to hold the subfilters for the IMM
     std::list<AVIMMFilterBase*> m_filters;
+    // Compiled matrices of the subfilters, in the same order as m_filters
+    std::vector<AVIMMCompiledSubfilterMatrices> m_compiled_matrices;
+    // Ids of the subfilter models in the model matrix cache, in the same order as m_filters. Resolved even if the
+    // cache is disabled, it may be enabled later on
+    std::vector<int> m_model_cache_ids;
     
     // Constant useful for probability calculation
     Vector m_c;
     Matrix m_mode_probabilities_matrix;
+    // Log space versions of the probabilities, only used if log_domain_mode_probabilities is configured
+    bool m_log_domain;
+    Vector m_log_mode_probabilities;
+    Vector m_log_c;
+    Vector m_log_likelihoods;
+    Matrix m_log_markov_transition_matrix;
     std::vector<Vector> m_mixed_states;
     std::vector<Matrix> m_mixed_covariances;
-    QDateTime m_last_calculation;
-    QDateTime m_now;
-    bool m_test_run;
+    // Time of the current state in nanoseconds since epoch
+    qint64 m_last_calculation;
+    // Clock used without a measurement time, nullptr uses the default clock
+    const AVIMMClock* m_clock;
+    
+    // Temporaries of a calculation step, sized in the constructor so that predictAndUpdate() does not allocate
+    struct Workspace
+    {
+        // Column i holds the state of subfilter i expanded to the IMM state size
+        Matrix expanded_states;
+        // Column i holds the expanded covariance of subfilter i plus the spread of its state around the IMM state,
+        // stored column major. The mixing of all modes is a single product of those columns with the mixing
+        // probabilities.
+        Matrix spread_covariances;
+        Matrix mixed_states;
+        Matrix mixed_covariances;
+        Vector state;
+        Matrix covariance;
+        Vector state_diff;
+        Vector ones;
+        Matrix ones_matrix;
+        Matrix expansion;
+        Matrix shrinking;
+        Vector z_shrunk;
+        Matrix R_shrunk;
+        Vector probabilities;
+        // Model and prediction of one subfilter in extrapolate(), kept per subfilter so that their sizes never change
+        struct Extrapolation
+        {
+            AVIMMModelMatrices model;
+            Vector x;
+            Matrix P;
+            Vector x_prior;
+            Matrix P_prior;
+            Matrix FP;
+        };
+        std::vector<Extrapolation> extrapolations;
+        Vector extrapolated_state;
+        Matrix extrapolated_covariance;
+    } m_workspace;
     
     // Used in constructor to initialize the subfilters according to the given m_filter_type
     void initializeSubfilters(const Vector& initial_state);
+    // Sizes the workspace and the mixed states, called once the subfilters are initialized
+    void initializeWorkspace();
+    // Resolves the ids of the subfilter models in the model matrix cache
+    void initializeModelCacheIds();
     // Compute the mixing probability for each filter.
     void calculateModeProbabilityMatrix(Matrix& mode_probability_matrix);
     // Computes the IMM's mixed state estimate from each filter using the mode probability to weight the estimates.
     void calculateIMMState(Vector& imm_state, Matrix& imm_covariance);
     // Calculate the mixed states and covariances of the filters
     void calculateMixedStates(std::vector<Vector>& mixed_states, std::vector<Matrix>& mixed_covariances);
+    // Expands the states and covariances of all subfilters into the workspace, once per calculation
+    void expandSubfilterStates();
+    // Expands the state and covariance of subfilter i into the workspace
+    void expandSubfilterState(int i, const Vector& x, const Matrix& P);
+    // Versions of calculateIMMState() and calculateMixedStates() for states already expanded into the workspace
+    void combineExpandedStates(Vector& imm_state, Matrix& imm_covariance);
+    void mixExpandedStates(std::vector<Vector>& mixed_states, std::vector<Matrix>& mixed_covariances);
     // Calculate the Probabilities of each Mode/Subfilter
     void calculateModeProbabilities(Vector& mode_probabilities);
-    // Prepare the filter for the next calculation step
-    void prepare(bool extrapolate=false);
+    // Prepare the filter for the next calculation step at the given time
+    void prepare(qint64 timestamp);
+    // Evaluates the model matrices of subfilter i for the time delta into the members F, P, H, Q, R and B of target
+    template<typename Target>
+    void evaluateModelMatrices(int i, float time_delta, Target& target);
+    const AVIMMClock* getClock() const { return m_clock ? m_clock : AVIMMClock::getDefault(); }
     
     // Functions used to expand and shrink subfilter matrices and vectors
     Vector expandVector(const Vector& x);
@@ -64,17 +132,38 @@ class AVIMMEstimator
     Matrix expandCovariance(const Matrix& M);
     Vector shrinkVector(const Vector& x, int dim);
     Matrix shrinkMatrix(const Matrix& M, int dim);
+    // Versions which write into a preallocated result, the shrink functions return x or M if no shrinking is needed
+    void expandVector(const Vector& x, Vector& result);
+    void expandCovariance(const Matrix& M, Matrix& result);
+    const Vector& shrinkVector(const Vector& x, int dim, Vector& result);
+    const Matrix& shrinkMatrix(const Matrix& M, int dim, Matrix& result);
     
 public:
     AVIMMEstimator(const Vector& initial_state=DEFAULT_VECTOR);
+    // Uses the given config instead of looking it up by the initial state
+    AVIMMEstimator(const AVIMMConfigData& config, const Vector& initial_state);
     virtual ~AVIMMEstimator();
     // This function makes a prediction of each filter using their respective predict function and updates their states
     // and covariances aswell
-    void predictAndUpdate(const Vector& z, const Matrix& R=DEFAULT_MATRIX, const Vector& u=DEFAULT_VECTOR);
-    std::pair<Vector, Matrix> extrapolate(const Vector& u=DEFAULT_VECTOR);
+    void predictAndUpdate(const Vector& z, const Matrix& R=DEFAULT_MATRIX, const Vector& u=DEFAULT_VECTOR) override
+    { predictAndUpdate(z, R, u, getClock()->now()); }
+    void predictAndUpdate(const Vector& z, const Matrix& R, const Vector& u, qint64 timestamp) override;
+    std::pair<Vector, Matrix> extrapolate(const Vector& u=DEFAULT_VECTOR) override
+    { return extrapolate(u, getClock()->now()); }
+    std::pair<Vector, Matrix> extrapolate(const Vector& u, qint64 timestamp) override;
+    
+    void setClock(const AVIMMClock* clock) override { m_clock = clock; }
+    qint64 getTimestamp() const override { return m_last_calculation; }
+    void setTimestamp(qint64 timestamp) override;
+    
+    Vector getStateVector() const override { return m_data.current().x; }
+    Matrix getCovarianceMatrix() const override { return m_data.current().P; }
+    Vector getModeProbabilityVector() const override { return m_mode_probabilities; }
+    QString getEstimatorInfo() const override { return QString("IMM Estimator"); }
     
-    DEFINE_GET(Data, FilterData, m_data);
-    DEFINE_GET(PreviousData, FilterData, m_previous_data);
+    FilterData& getData() { return m_data.current(); }
+    const FilterData& getData() const { return m_data.current(); }
+    const FilterData& getPreviousData() const { return m_data.previous(); }
     DEFINE_GET(ModeProbabilities, Vector, m_mode_probabilities);
 };
 
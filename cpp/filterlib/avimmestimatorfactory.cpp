@@ -0,0 +1,90 @@
+//
+// Created by felix on 7/28/20.
+//
+
+#include "avimmestimatorfactory.h"
+#include "avimmestimator.h"
+#include "avimmfixedestimator.h"
+
+// Creates the fixed estimator if the dimensions of the config match the template arguments
+#define AVIMM_CREATE_FIXED_ESTIMATOR(STATE_DIM, MEASUREMENT_DIM, MODES, INPUT_DIM)                                \
+    if (state_dim == STATE_DIM && measurement_dim == MEASUREMENT_DIM && modes == MODES && input_dim == INPUT_DIM)  \
+        return AVIMMEstimatorPtr(                                                                                 \
+            new AVIMMFixedEstimator<STATE_DIM, MEASUREMENT_DIM, MODES, INPUT_DIM>(config, initial_state));
+
+AVIMMEstimatorPtr AVIMMEstimatorFactory::createEstimator(const Vector &initial_state)
+{
+    return createEstimator(AVIMMAirportConfigs::singleton().getIMMConfigData(initial_state), initial_state);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMEstimatorPtr AVIMMEstimatorFactory::createEstimator(const AVIMMConfigData &config, const Vector &initial_state)
+{
+    int state_dim = 0;
+    int measurement_dim = 0;
+    int input_dim = 0;
+    const int modes = config.sub_filter_config_keys.size();
+    if (!AVIMMStaticConfigContainer::singleton().fixed_size_estimators_enabled ||
+        !getFixedDimensions(config, state_dim, measurement_dim, input_dim) || initial_state.size() != state_dim)
+        return createDynamicEstimator(config, initial_state);
+
+    // AVIMMEstimator expands smaller states to REQUESTED_SIZE and pads the error and innovation, which changes the
+    // likelihood. Only configs it runs unchanged get a fixed estimator, the inputs are the accelerations in x and y
+    // like in the airport configs.
+    AVIMM_CREATE_FIXED_ESTIMATOR(REQUESTED_SIZE, REQUESTED_SIZE, 2, 2)
+    AVIMM_CREATE_FIXED_ESTIMATOR(REQUESTED_SIZE, REQUESTED_SIZE, 3, 2)
+
+    return createDynamicEstimator(config, initial_state);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMEstimatorPtr AVIMMEstimatorFactory::createDynamicEstimator(const AVIMMConfigData &config,
+                                                                const Vector &initial_state)
+{
+    return AVIMMEstimatorPtr(new AVIMMEstimator(config, initial_state));
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMEstimatorFactory::getFixedDimensions(const AVIMMConfigData &config, int &state_dim, int &measurement_dim,
+                                               int &input_dim)
+{
+    if (config.sub_filter_config_keys.isEmpty())
+        return false;
+
+    state_dim = -1;
+    measurement_dim = -1;
+    input_dim = -1;
+    for (const auto& key : config.sub_filter_config_keys)
+    {
+        if (!config.compiled_map.contains(key))
+            return false;
+
+        const AVIMMCompiledSubfilterMatrices compiled = config.compiled_map.value(key);
+        const int n = compiled.F->rows();
+        const int m = compiled.H->rows();
+        const int u = compiled.B->cols();
+        if (state_dim < 0)
+        {
+            state_dim = n;
+            measurement_dim = m;
+            input_dim = u;
+        }
+
+        // All subfilters must have the same dimensions, otherwise their states have to be expanded and shrunk
+        if (n != state_dim || m != measurement_dim || u != input_dim)
+            return false;
+        if (compiled.F->cols() != n || compiled.P->rows() != n || compiled.P->cols() != n ||
+            compiled.Q->rows() != n || compiled.Q->cols() != n || compiled.B->rows() != n ||
+            compiled.H->cols() != n || compiled.R->rows() != m || compiled.R->cols() != m)
+            return false;
+
+        // The extended kalman filter only supports measurements in the state space for now
+        if (AVIMMStaticConfigContainer::singleton().filter_type_map.value(key) == ExtendedKalmanFilter &&
+            (m != n || compiled.J->rows() != m || compiled.J->cols() != n))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+//
+// Created by felix on 7/28/20.
+//
+
+#ifndef AVIMM_ESTIMATOR_FACTORY_H
+#define AVIMM_ESTIMATOR_FACTORY_H
+
+#include "avimmestimatorinterface.h"
+#include "utils/avimmairportconfigs.h"
+
+// Creates the estimator for a target. If all subfilters of the config share one of the supported state, measurement
+// and input dimensions, a fixed size AVIMMFixedEstimator is created, otherwise the dynamic AVIMMEstimator.
+// Supported are 2 or 3 modes with 2 inputs, which measure the full state of REQUESTED_SIZE elements.
+class AVIMMEstimatorFactory
+{
+public:
+    // Looks up the config by the initial state like AVIMMEstimator does
+    static AVIMMEstimatorPtr createEstimator(const Vector& initial_state);
+    static AVIMMEstimatorPtr createEstimator(const AVIMMConfigData& config, const Vector& initial_state);
+    // Always creates the dynamic AVIMMEstimator
+    static AVIMMEstimatorPtr createDynamicEstimator(const AVIMMConfigData& config, const Vector& initial_state);
+
+    // Returns the state, measurement and input dimension shared by all subfilters of the config, or false if they
+    // differ or the subfilters cannot be run by a fixed size estimator
+    static bool getFixedDimensions(const AVIMMConfigData& config, int& state_dim, int& measurement_dim,
+                                   int& input_dim);
+};
+
+#endif //AVIMM_ESTIMATOR_FACTORY_H
@@ -0,0 +1,46 @@
+//
+// Created by felix on 7/28/20.
+//
+
+#ifndef AVIMM_ESTIMATOR_INTERFACE_H
+#define AVIMM_ESTIMATOR_INTERFACE_H
+
+#include "utils/avimmclock.h"
+#include "utils/avimmtypedefs.h"
+
+#include <QString>
+
+// Common interface of the dynamically sized AVIMMEstimator and the fixed size AVIMMFixedEstimator specializations.
+// Use AVIMMEstimatorFactory to create the fastest estimator available for a config.
+class AVIMMEstimatorInterface
+{
+public:
+    virtual ~AVIMMEstimatorInterface() = default;
+
+    // Predicts and updates all subfilters with the measurement z and combines their results into the IMM state
+    virtual void predictAndUpdate(const Vector& z, const Matrix& R=DEFAULT_MATRIX, const Vector& u=DEFAULT_VECTOR) = 0;
+    // Same with the time of the measurement in nanoseconds since epoch instead of the current time of the clock.
+    // Measurements older than the current state are applied without prediction.
+    virtual void predictAndUpdate(const Vector& z, const Matrix& R, const Vector& u, qint64 timestamp) = 0;
+    // Predicts the IMM state to the current time without changing the estimator
+    virtual std::pair<Vector, Matrix> extrapolate(const Vector& u=DEFAULT_VECTOR) = 0;
+    // Predicts the IMM state to the given time in nanoseconds since epoch without changing the estimator
+    virtual std::pair<Vector, Matrix> extrapolate(const Vector& u, qint64 timestamp) = 0;
+
+    // Sets the clock which gives the current time, it is not owned. nullptr uses AVIMMClock::getDefault().
+    virtual void setClock(const AVIMMClock* clock) = 0;
+    // Time of the current state in nanoseconds since epoch, initially the time of construction
+    virtual qint64 getTimestamp() const = 0;
+    // Sets the time of the current state, e.g. the time of the measurement used as initial state
+    virtual void setTimestamp(qint64 timestamp) = 0;
+
+    virtual Vector getStateVector() const = 0;
+    virtual Matrix getCovarianceMatrix() const = 0;
+    virtual Vector getModeProbabilityVector() const = 0;
+    // Returns a string giving information about which estimator is used, useful for logging
+    virtual QString getEstimatorInfo() const = 0;
+};
+
+typedef std::unique_ptr<AVIMMEstimatorInterface> AVIMMEstimatorPtr;
+
+#endif //AVIMM_ESTIMATOR_INTERFACE_H
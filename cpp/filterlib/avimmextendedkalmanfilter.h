@@ -32,10 +32,10 @@ public:
     QString getFilterInfo() override { return QString("IMM Extended Kalman Filter"); }
     
 private:
-    const Matrix& m_jacobi_matrix;
+    Matrix m_jacobi_matrix;
     
-    Vector Hx(const Vector& x) { return x; }// Todo: For now assume we are in the same space}
-    Matrix HJacobian(const Vector& x) { Q_UNUSED(x); return m_jacobi_matrix; } // Todo: For now multiply with jacobi matrix
+    const Vector& Hx(const Vector& x) { return x; }// Todo: For now assume we are in the same space}
+    const Matrix& HJacobian(const Vector& x) { Q_UNUSED(x); return m_jacobi_matrix; } // Todo: For now multiply with jacobi matrix
     
     friend class TstAVIMMExtendedKalmanFilter;
 };
@@ -8,6 +8,7 @@
 #include "utils/avimmmakros.h"
 #include "utils/avimmtypedefs.h"
 #include "utils/avimmconfig.h"
+#include "utils/avimmdoublebuffer.h"
 #define M_PI 3.14159265358979323846  /* pi needs to be defined manually since VS compiler somehow gets rid of the M_PI constant of cmath*/
 #define REQUESTED_SIZE  6
 #define MIN_THRESHOLD 1*exp(-6)
@@ -46,23 +47,41 @@ public:
                            const Matrix &measurement_matrix, const Matrix &process_noise, const Matrix &state_uncertainty,
                            const Matrix &control_input_matrix, const QString& filter_key)
      {
-        m_data.x       = initial_state;
-        m_data.x_prior = DEFAULT_VECTOR;
-        m_data.x_post  = DEFAULT_VECTOR;
-        m_data.F       = transitions_matrix;
-        m_data.P       = covariance_matrix;
-        m_data.P_prior = DEFAULT_MATRIX;
-        m_data.P_post  = DEFAULT_MATRIX;
-        m_data.H       = measurement_matrix;
-        m_data.Q       = process_noise;
-        m_data.R       = state_uncertainty;
-        m_data.B       = control_input_matrix;
-        m_data.S       = DEFAULT_MATRIX;
-        m_data.error   = DEFAULT_VECTOR;
-        m_filter_key   = filter_key;
+        FilterData data;
+        data.x       = initial_state;
+        data.x_prior = DEFAULT_VECTOR;
+        data.x_post  = DEFAULT_VECTOR;
+        data.F       = transitions_matrix;
+        data.P       = covariance_matrix;
+        data.P_prior = DEFAULT_MATRIX;
+        data.P_post  = DEFAULT_MATRIX;
+        data.H       = measurement_matrix;
+        data.Q       = process_noise;
+        data.R       = state_uncertainty;
+        data.B       = control_input_matrix;
+        data.S       = DEFAULT_MATRIX;
+        data.error   = DEFAULT_VECTOR;
+        m_filter_key = filter_key;
         
         // Initialize previous data with current data, avoid having issue in starting phase
-        m_previous_data = m_data;
+        m_data.reset(data);
+        
+        // Size the temporaries of predict and update once, steps with the same dimensions do not allocate
+        const int state_size       = initial_state.size();
+        const int measurement_size = measurement_matrix.rows();
+        m_workspace.y.resize(measurement_size);
+        m_workspace.FP.resize(state_size, state_size);
+        m_workspace.HP.resize(measurement_size, state_size);
+        m_workspace.S.resize(measurement_size, measurement_size);
+        m_workspace.KT.resize(measurement_size, state_size);
+        m_workspace.K.resize(state_size, measurement_size);
+        m_workspace.IKH.resize(state_size, state_size);
+        m_workspace.IKHP.resize(state_size, state_size);
+        m_workspace.KR.resize(state_size, measurement_size);
+        m_workspace.ones.resize(REQUESTED_SIZE);
+        m_workspace.ones_matrix.resize(REQUESTED_SIZE, REQUESTED_SIZE);
+        m_workspace.expansion.resize(REQUESTED_SIZE, REQUESTED_SIZE);
+        m_likelihood_workspace.resize(REQUESTED_SIZE);
      };
     
     virtual ~AVIMMFilterBase() = default;
@@ -83,8 +102,30 @@ protected:
         Matrix H; // Measurement control matrix
         Matrix B; // Input control matrix
         Matrix S; // Innovation matrix, used for calculation of likelihood
+        Eigen::LDLT<Matrix> S_factor; // Factorization of S, computed once in the update step
         Vector error; // Error of the prediction, , used for calculation of likelihood
-    } m_data, m_previous_data;  // data containter for current calculation and previous calculation
+    };
+    // Data of the current and the previous calculation, predict() flips between the two
+    AVIMMDoubleBuffer<FilterData> m_data;
+    
+    // Temporaries of predict and update, sized in the constructor
+    struct Workspace
+    {
+        Vector y; // Innovation
+        Matrix FP; // F*P
+        Matrix HP; // H*P
+        Matrix S; // Innovation matrix
+        Matrix KT; // Transposed gain, solved from S
+        Matrix K; // Gain
+        Matrix IKH; // I-KH
+        Matrix IKHP; // (I-KH)P
+        Matrix KR; // KR
+        Vector ones; // Used to expand the error vector
+        Matrix ones_matrix; // Used to expand the innovation matrix
+        Matrix expansion; // Used to expand the innovation matrix
+    } m_workspace;
+    // Used by getLogLikelihood() for the triangular solve
+    mutable Vector m_likelihood_workspace;
     
     QString m_filter_key;
     
@@ -92,47 +133,156 @@ protected:
     
     Matrix expandInnovation(const Matrix &M)
     {
-        Matrix new_M = M;
-        auto requested_cols = REQUESTED_SIZE;
-        auto requested_rows = REQUESTED_SIZE;
-        auto matrix_cols = M.cols();
-        auto matrix_rows = M.rows();
+        if (M.rows() == REQUESTED_SIZE && M.cols() == REQUESTED_SIZE)
+            return M;
         
-        if (requested_cols == matrix_cols && requested_rows == matrix_rows)
-            return new_M;
+        const Config& config = Config::singleton();
+        Matrix result;
+        if (config.expansion_map_innovation.isValid())
+        {
+            config.expansion_map_innovation.applySymmetric(M, result);
+            return result;
+        }
         
-        Matrix ones_M = createUnityMatrix(requested_rows);
-        for (int i = 0; i < matrix_rows; i++)
-            for (int j = 0; j < matrix_cols; j++)
-                ones_M(i,j) = new_M.coeff(i, j);
-        new_M = Config::singleton().expansion_matrix_innovation * ones_M * Config::singleton().expansion_matrix_innovation.transpose();
-        return new_M;
+        Matrix ones_M = createUnityMatrix(REQUESTED_SIZE);
+        ones_M.topLeftCorner(M.rows(), M.cols()) = M;
+        result = config.expansion_matrix_innovation * ones_M * config.expansion_matrix_innovation.transpose();
+        return result;
     }
     
     //--------------------------------------------------------------------------
     
     Vector expandErrorVector(const Vector &x)
     {
-        Vector new_x = x;
-        auto requested_size = REQUESTED_SIZE;
-        auto vector_size = x.size();
-        if (vector_size == requested_size)
-            return new_x;
+        if (x.size() == REQUESTED_SIZE)
+            return x;
+        
+        const Config& config = Config::singleton();
+        Vector result;
+        if (config.expansion_map.isValid())
+        {
+            config.expansion_map.apply(x, result);
+            return result;
+        }
         
         // Fill with one until the requested size has been reached.
-        Vector ones_x = Vector::Ones(requested_size, 1);
-        for (int i = 0; i < vector_size; i++)
-            ones_x(i) = new_x.coeff(i);
+        Vector ones_x = Vector::Ones(REQUESTED_SIZE, 1);
+        ones_x.head(x.size()) = x;
+        result = config.expansion_matrix * ones_x;
+        return result;
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // Saves error and innovation of the update step. S_factor must already hold the factorization of S, it is only
+    // recomputed if S has to be expanded to the requested size
+    void saveInnovation(const Vector& y, const Matrix& S)
+    {
+        FilterData& data = m_data.current();
+        if (S.rows() == REQUESTED_SIZE && S.cols() == REQUESTED_SIZE)
+        {
+            data.error = y;
+            data.S     = S;
+            return;
+        }
+        
+        // Same as expandErrorVector() and expandInnovation(), but using the workspace
+        const Config& config = Config::singleton();
+        if (config.expansion_map.isValid())
+        {
+            config.expansion_map.apply(y, data.error);
+        }
+        else
+        {
+            m_workspace.ones.setOnes();
+            m_workspace.ones.head(y.size()) = y;
+            data.error.noalias() = config.expansion_matrix * m_workspace.ones;
+        }
+        
+        if (config.expansion_map_innovation.isValid())
+        {
+            config.expansion_map_innovation.applySymmetric(S, data.S);
+        }
+        else
+        {
+            m_workspace.ones_matrix.setIdentity();
+            m_workspace.ones_matrix.topLeftCorner(S.rows(), S.cols()) = S;
+            m_workspace.expansion.noalias() = config.expansion_matrix_innovation * m_workspace.ones_matrix;
+            data.S.noalias() = m_workspace.expansion * config.expansion_matrix_innovation.transpose();
+        }
+        data.S_factor.compute(data.S);
+    }
+    
+    //--------------------------------------------------------------------------
     
-        ones_x = Config::singleton().expansion_matrix * ones_x;
-        return ones_x;
+    // Prediction step shared by the kalman filters, x = Fx + Bu and P = FPF' + Q
+    void predictState(const Vector& u)
+    {
+        // Keep the state of the last step as previous data and carry over what this step reads, the results of the
+        // last step are overwritten anyway. The model matrices are moved into the new slot, swapping dynamic
+        // matrices only exchanges their storage. The previous slot keeps the state and covariance only.
+        FilterData& previous = m_data.current();
+        FilterData& data = m_data.flip();
+        data.x = previous.x;
+        data.P = previous.P;
+        data.F.swap(previous.F);
+        data.Q.swap(previous.Q);
+        data.H.swap(previous.H);
+        data.R.swap(previous.R);
+        data.B.swap(previous.B);
+        calculatePrediction(data.F, data.Q, data.B, u, data.x, data.P, data.x_prior, data.P_prior, m_workspace.FP);
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // Update step shared by the kalman filters, m_workspace.y must hold the innovation and H is the (linearized)
+    // measurement matrix
+    void updateState(const Matrix& H, const Matrix& R)
+    {
+        FilterData& data = m_data.current();
+        const Matrix& P = data.P_prior;
+        const Vector& y = m_workspace.y;
+        Matrix& S       = m_workspace.S;
+        Matrix& K       = m_workspace.K;
+        
+        // S = HPH' + R
+        m_workspace.HP.noalias() = H * P;
+        S.noalias() = m_workspace.HP * H.transpose();
+        S += R;
+        zeroSmallElementsInPlace(S);
+        // K = PH'inv(S), solved with the factorization of S which is kept for the likelihood. Since P is symmetric
+        // HP' = HP.
+        data.S_factor.compute(S);
+        m_workspace.KT = data.S_factor.solve(m_workspace.HP);
+        K = m_workspace.KT.transpose();
+        zeroSmallElementsInPlace(K);
+        
+        // x = x + Ky
+        data.x_post = data.x_prior;
+        data.x_post.noalias() += K * y;
+        // P = (I-KH)P(I-KH)' + KRK'
+        m_workspace.IKH.noalias() = -K * H;
+        m_workspace.IKH.diagonal().array() += 1.0;
+        m_workspace.IKHP.noalias() = m_workspace.IKH * P;
+        data.P_post.noalias() = m_workspace.IKHP * m_workspace.IKH.transpose();
+        m_workspace.KR.noalias() = K * R;
+        data.P_post.noalias() += m_workspace.KR * K.transpose();
+        zeroSmallElementsInPlace(data.P_post);
+        
+        // Save results, error and innovation
+        data.x      = data.x_post;
+        data.P      = data.P_post;
+        data.R      = R;
+        saveInnovation(y, S);
     }
     
     
 public:
     // Accessors
-    DEFINE_ACCESSORS_VAL(Data, FilterData, m_data)
-    DEFINE_ACCESSORS_VAL(PreviousData, FilterData, m_previous_data)
+    // The data is returned by reference, the estimator modifies the state of its subfilters in place
+    FilterData& getData() { return m_data.current(); }
+    const FilterData& getData() const { return m_data.current(); }
+    const FilterData& getPreviousData() const { return m_data.previous(); }
     Vector expandVector(const Vector& x) { return expandErrorVector(x); }
     Matrix expandMatrix(const Matrix& M) { return expandInnovation(M); }
     
@@ -150,11 +300,42 @@ public:
     
     // Likelihood functions which should be the same for each filter
     double getLogLikelihood() const {
-        const Vector mean  = Vector::Zero(m_data.error.size(), 1);
-        const Matrix sigma = m_data.S;
-        const Vector y     = m_data.error;
-        Mvn mvn(mean, sigma);
-        return mvn.logpdf(y);
+        const FilterData& data = m_data.current();
+        if (data.error.size() == 0)
+            return 0.0;
+        return calculateLogLikelihood(data.S_factor, data.error, m_likelihood_workspace);
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // Log of the normal density N(y; 0, S) using the LDLT factorization of S. The mahalanobis term is calculated by
+    // a triangular solve and the log determinant from the diagonal, so neither an inverse nor the density itself
+    // (which underflows for large errors) is needed
+    template<typename Factor, typename VectorType>
+    static double calculateLogLikelihood(const Factor& S_factor, const VectorType& y, VectorType& w)
+    {
+        w = S_factor.transpositionsP() * y;
+        S_factor.matrixL().solveInPlace(w);
+        const double mahalanobis = (w.array().square() / S_factor.vectorD().array()).sum();
+        const double log_determinant = S_factor.vectorD().array().abs().log().sum();
+        return -0.5 * (y.size() * std::log(2 * M_PI) + log_determinant + mahalanobis);
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // x_prior = Fx + Bu and P_prior = FPF' + Q, FP is a temporary. Also used by the estimators to predict copies of
+    // the subfilter states.
+    static void calculatePrediction(const Matrix& F, const Matrix& Q, const Matrix& B, const Vector& u,
+                                    const Vector& x, const Matrix& P, Vector& x_prior, Matrix& P_prior, Matrix& FP)
+    {
+        x_prior.noalias() = F * x;
+        if (&u != &DEFAULT_VECTOR)
+            x_prior.noalias() += B * u;
+        
+        FP.noalias() = F * P;
+        P_prior.noalias() = FP * F.transpose();
+        P_prior += Q;
+        zeroSmallElementsInPlace(P_prior);
     }
     
     //--------------------------------------------------------------------------
@@ -206,6 +387,14 @@ public:
     
     //--------------------------------------------------------------------------
     
+    // Same as zeroSmallElements(const Matrix&) without creating a new matrix
+    static void zeroSmallElementsInPlace(Matrix &M)
+    {
+        M = (M.array() <= MIN_THRESHOLD).select(0.0, M);
+    }
+    
+    //--------------------------------------------------------------------------
+    
     static Vector zeroSmallElements(const Vector &M)
     {
         // Find all elements below a certain threshold and set them to zero to gain numerical stability
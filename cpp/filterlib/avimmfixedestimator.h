@@ -0,0 +1,445 @@
+//
+// Created by felix on 7/28/20.
+//
+
+#ifndef AVIMM_FIXED_ESTIMATOR_H
+#define AVIMM_FIXED_ESTIMATOR_H
+
+#include "avimmestimatorinterface.h"
+#include "avimmfixedfilter.h"
+#include "utils/avimmairportconfigs.h"
+#include "utils/avimmmodelmatrixcache.h"
+#include "utils/avimmlogmath.h"
+#include "utils/avimmstagetiming.h"
+
+#include <algorithm>
+#include <array>
+
+// IMM estimator specialized for N states, M measurements, U inputs and MODES subfilters of the same dimension. It
+// implements the same steps as AVIMMEstimator, but all vectors and matrices have a size known at compile time and no
+// expansion or shrinking of subfilter states is needed. Instances are created by AVIMMEstimatorFactory if the config
+// allows it.
+template<int N, int M, int MODES, int U>
+class AVIMMFixedEstimator : public AVIMMEstimatorInterface
+{
+    friend class AVIMMTester;
+    friend class TstAVIMMFixedEstimator;
+    friend class TstAVIMMBatchEstimator;
+public:
+    typedef AVIMMFixedFilterBase<N, M, U> Filter;
+    typedef typename Filter::StateVector StateVector;
+    typedef typename Filter::StateMatrix StateMatrix;
+    typedef typename Filter::MeasurementVector MeasurementVector;
+    typedef typename Filter::MeasurementCovariance MeasurementCovariance;
+    typedef typename Filter::InputVector InputVector;
+    typedef Eigen::Matrix<double, MODES, 1> ModeVector;
+    typedef Eigen::Matrix<double, MODES, MODES> ModeMatrix;
+    // Data of the subfilters a calculation works on, either the subfilters themselves or copies
+    typedef std::array<const typename Filter::FilterData*, MODES> SubfilterData;
+
+    struct FilterData
+    {
+        StateVector x; // State
+        StateVector x_prior; // State after prediction
+        StateVector x_post; // State after update
+        StateMatrix P; // Covariance matrix
+        StateMatrix P_prior; // Covariance matrix after prediction
+        StateMatrix P_post; // Covariance matrix after update
+        qint64 time_stamp; // Time in nanoseconds since epoch for which the filter data is valid
+    };
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    AVIMMFixedEstimator(const AVIMMConfigData& config, const Vector& initial_state);
+    virtual ~AVIMMFixedEstimator() = default;
+
+    void predictAndUpdate(const Vector& z, const Matrix& R=DEFAULT_MATRIX, const Vector& u=DEFAULT_VECTOR) override
+    { predictAndUpdate(z, R, u, getClock()->now()); }
+    void predictAndUpdate(const Vector& z, const Matrix& R, const Vector& u, qint64 timestamp) override;
+    std::pair<Vector, Matrix> extrapolate(const Vector& u=DEFAULT_VECTOR) override
+    { return extrapolate(u, getClock()->now()); }
+    std::pair<Vector, Matrix> extrapolate(const Vector& u, qint64 timestamp) override;
+
+    void setClock(const AVIMMClock* clock) override { m_clock = clock; }
+    qint64 getTimestamp() const override { return m_last_calculation; }
+    void setTimestamp(qint64 timestamp) override
+    {
+        m_last_calculation = timestamp;
+        m_data.current().time_stamp = timestamp;
+    }
+
+    Vector getStateVector() const override { return m_data.current().x; }
+    Matrix getCovarianceMatrix() const override { return m_data.current().P; }
+    Vector getModeProbabilityVector() const override { return m_mode_probabilities; }
+    QString getEstimatorInfo() const override
+    { return QString("IMM Fixed Estimator %1x%2, %3 modes, %4 inputs").arg(N).arg(M).arg(MODES).arg(U); }
+
+    FilterData& getData() { return m_data.current(); }
+    const FilterData& getData() const { return m_data.current(); }
+    const FilterData& getPreviousData() const { return m_data.previous(); }
+    DEFINE_GET(ModeProbabilities, ModeVector, m_mode_probabilities);
+
+private:
+    // Data of the current and the previous calculation, prepare() flips between the two
+    AVIMMDoubleBuffer<FilterData> m_data;
+    ModeVector m_mode_probabilities;
+    ModeVector m_c;
+    ModeMatrix m_markov_transition_matrix;
+    ModeMatrix m_mode_probabilities_matrix;
+    // Log space versions of the probabilities, only used if log_domain_mode_probabilities is configured
+    bool m_log_domain;
+    ModeVector m_log_mode_probabilities;
+    ModeVector m_log_c;
+    ModeVector m_log_likelihoods;
+    ModeMatrix m_log_markov_transition_matrix;
+    std::array<StateVector, MODES> m_mixed_states;
+    std::array<StateMatrix, MODES> m_mixed_covariances;
+
+    AVIMMConfigData m_config;
+    std::array<AVIMMCompiledSubfilterMatrices, MODES> m_programs;
+    std::array<std::unique_ptr<Filter>, MODES> m_filters;
+    std::array<int, MODES> m_model_cache_ids;
+
+    // Time of the current state in nanoseconds since epoch
+    qint64 m_last_calculation;
+    // Clock used without a measurement time, nullptr uses the default clock
+    const AVIMMClock* m_clock;
+
+    void initializeModelCacheIds();
+    void calculateModeProbabilityMatrix();
+    void calculateIMMState(StateVector& imm_state, StateMatrix& imm_covariance) const
+    { calculateIMMState(getSubfilterData(), imm_state, imm_covariance); }
+    void calculateIMMState(const SubfilterData& subfilters, StateVector& imm_state, StateMatrix& imm_covariance) const;
+    void calculateMixedStates() { calculateMixedStates(getSubfilterData()); }
+    void calculateMixedStates(const SubfilterData& subfilters);
+    void calculateModeProbabilities();
+    void predictSubfilters(const Vector& u);
+    void prepare(qint64 timestamp);
+    // Evaluates the model matrices of subfilter i for the time delta into data
+    void evaluateModelMatrices(int i, float time_delta, typename Filter::FilterData& data);
+    // Elapsed time since the current state in seconds, measurements older than the current state are not predicted
+    // backwards
+    float getTimeDelta(qint64 timestamp) const { return std::max<qint64>(timestamp - m_last_calculation, 0) / 1e9; }
+    SubfilterData getSubfilterData() const
+    {
+        SubfilterData subfilters;
+        for (int i = 0; i < MODES; i++)
+            subfilters[i] = &m_filters[i]->getData();
+        return subfilters;
+    }
+    const AVIMMClock* getClock() const { return m_clock ? m_clock : AVIMMClock::getDefault(); }
+};
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+AVIMMFixedEstimator<N, M, MODES, U>::AVIMMFixedEstimator(const AVIMMConfigData& config, const Vector& initial_state)
+    : m_config(config), m_clock(nullptr)
+{
+    assert(initial_state.size() == N);
+    assert(m_config.sub_filter_config_keys.size() == MODES);
+
+    m_mode_probabilities       = m_config.initial_mode_probabilities;
+    m_markov_transition_matrix = m_config.markov_transition_matrix;
+
+    m_log_domain = AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities;
+    m_log_mode_probabilities       = m_mode_probabilities.array().log();
+    m_log_markov_transition_matrix = m_markov_transition_matrix.array().log();
+    m_log_c.setZero();
+    m_log_likelihoods.setZero();
+
+    FilterData& imm_data = m_data.current();
+    imm_data.x = initial_state;
+    imm_data.P.setZero();
+    imm_data.x_prior.setZero();
+    imm_data.x_post.setZero();
+    imm_data.P_prior.setZero();
+    imm_data.P_post.setZero();
+
+    // Initialize all subfilters with a dt=0.0
+    for (int i = 0; i < MODES; i++)
+    {
+        const QString& key = m_config.sub_filter_config_keys[i];
+        m_programs[i] = m_config.compiled_map.value(key);
+        if (AVIMMStaticConfigContainer::singleton().filter_type_map.value(key) == ExtendedKalmanFilter)
+        {
+            typename Filter::MeasurementMatrix J;
+            m_programs[i].J->evaluate(J);
+            m_filters[i].reset(new AVIMMFixedExtendedKalmanFilter<N, M, U>(imm_data.x, J, key));
+        }
+        else
+        {
+            m_filters[i].reset(new AVIMMFixedKalmanFilter<N, M, U>(imm_data.x, key));
+        }
+
+        typename Filter::FilterData& data = m_filters[i]->getData();
+        m_programs[i].F->evaluate(data.F);
+        m_programs[i].P->evaluate(data.P);
+        m_programs[i].Q->evaluate(data.Q);
+        m_programs[i].B->evaluate(data.B);
+        m_programs[i].H->evaluate(data.H);
+        m_programs[i].R->evaluate(data.R);
+    }
+    initializeModelCacheIds();
+
+    // Perform initial probability calculation and set IMM state
+    calculateModeProbabilityMatrix();
+    calculateIMMState(imm_data.x, imm_data.P);
+    m_last_calculation = getClock()->now();
+    imm_data.time_stamp = m_last_calculation;
+    m_data.reset(imm_data);
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::initializeModelCacheIds()
+{
+    for (int i = 0; i < MODES; i++)
+        m_model_cache_ids[i] = AVIMMModelMatrixCache::getModelId(m_config.area_name, m_filters[i]->getFilterKey());
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::predictAndUpdate(const Vector &z, const Matrix &R_in, const Vector &u,
+                                                        qint64 timestamp)
+{
+    assert(z.size() == M);
+    const MeasurementVector z_fixed = z;
+
+    AVIMM_STAGE_TIMER(stage_timer);
+    prepare(timestamp);
+    AVIMM_STAGE_LAP(stage_timer, PREPARE);
+    calculateMixedStates();
+    AVIMM_STAGE_LAP(stage_timer, MIXED_STATES);
+    predictSubfilters(u);
+    AVIMM_STAGE_LAP(stage_timer, SUBFILTER_PREDICT);
+
+    // Calculate the IMM state after prediction of each filter has finished
+    FilterData& imm_data = m_data.current();
+    calculateIMMState(imm_data.x, imm_data.P);
+    imm_data.x_prior = imm_data.x;
+    imm_data.P_prior = imm_data.P;
+    AVIMM_STAGE_LAP(stage_timer, IMM_STATE_PRIOR);
+
+    // Update each filter, without a given measurement uncertainty the one of the subfilter config is used
+    for (int i = 0; i < MODES; i++)
+    {
+        if (R_in.size() == 0)
+            m_filters[i]->update(z_fixed, m_filters[i]->getData().R);
+        else
+            m_filters[i]->update(z_fixed, MeasurementCovariance(R_in));
+    }
+    AVIMM_STAGE_LAP(stage_timer, SUBFILTER_UPDATE);
+
+    // Recalculate Probabilities after update step to be prepared for the next calculation step
+    calculateModeProbabilities();
+    calculateModeProbabilityMatrix();
+    AVIMM_STAGE_LAP(stage_timer, MODE_PROBABILITIES);
+    calculateIMMState(imm_data.x, imm_data.P);
+
+    imm_data.x_post     = imm_data.x;
+    imm_data.P_post     = imm_data.P;
+    imm_data.time_stamp = m_last_calculation;
+    AVIMM_STAGE_LAP(stage_timer, IMM_STATE_POST);
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+std::pair<Vector, Matrix> AVIMMFixedEstimator<N, M, MODES, U>::extrapolate(const Vector &u, qint64 timestamp)
+{
+    // Same steps as the prediction of predictAndUpdate(), but on copies of the subfilter data so that the estimator
+    // does not change. The result is the IMM state predictAndUpdate() calculates before the update.
+    const float time_delta = getTimeDelta(timestamp);
+
+    std::array<typename Filter::FilterData, MODES> copies;
+    SubfilterData subfilters;
+    for (int i = 0; i < MODES; i++)
+    {
+        copies[i] = m_filters[i]->getData();
+        evaluateModelMatrices(i, time_delta, copies[i]);
+        subfilters[i] = &copies[i];
+    }
+    calculateMixedStates(subfilters);
+
+    InputVector u_fixed;
+    const bool has_input = u.size() != 0;
+    if (has_input)
+        u_fixed = u;
+    for (int i = 0; i < MODES; i++)
+    {
+        copies[i].x = m_mixed_states[i];
+        copies[i].P = m_mixed_covariances[i];
+        Filter::predict(copies[i], has_input ? &u_fixed : nullptr);
+        copies[i].x = copies[i].x_prior;
+        copies[i].P = copies[i].P_prior;
+    }
+
+    StateVector x_extrapolated;
+    StateMatrix P_extrapolated;
+    calculateIMMState(subfilters, x_extrapolated, P_extrapolated);
+
+    return std::make_pair(Vector(x_extrapolated), Matrix(P_extrapolated));
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::predictSubfilters(const Vector &u)
+{
+    InputVector u_fixed;
+    const bool has_input = u.size() != 0;
+    if (has_input)
+        u_fixed = u;
+
+    for (int i = 0; i < MODES; i++)
+    {
+        typename Filter::FilterData& data = m_filters[i]->getData();
+        data.x = m_mixed_states[i];
+        data.P = m_mixed_covariances[i];
+        m_filters[i]->predict(has_input ? &u_fixed : nullptr);
+        data.x = data.x_prior;
+        data.P = data.P_prior;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::calculateModeProbabilityMatrix()
+{
+    if (m_log_domain)
+    {
+        AVIMMLogMath::calculateMixingProbabilities(m_log_markov_transition_matrix, m_log_mode_probabilities, m_log_c,
+                                                   m_mode_probabilities_matrix);
+        return;
+    }
+
+    m_c.noalias() = m_markov_transition_matrix * m_mode_probabilities;
+
+    for (int i = 0; i < MODES; i++)
+        for (int j = 0; j < MODES; j++)
+            m_mode_probabilities_matrix(i, j) = (m_markov_transition_matrix(i, j) * m_mode_probabilities[i]) / m_c[j];
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::calculateIMMState(const SubfilterData& subfilters, StateVector& imm_state,
+                                                         StateMatrix& imm_covariance) const
+{
+    StateVector x = StateVector::Zero();
+    for (int i = 0; i < MODES; i++)
+        x += m_mode_probabilities[i] * subfilters[i]->x;
+
+    // The spread of the subfilters is taken relative to the current IMM state, like in AVIMMEstimator
+    StateMatrix P = StateMatrix::Zero();
+    for (int i = 0; i < MODES; i++)
+    {
+        const typename Filter::FilterData& data = *subfilters[i];
+        const StateVector state_diff = data.x - m_data.current().x;
+        P.noalias() += m_mode_probabilities[i] * (state_diff * state_diff.transpose() + data.P);
+        Filter::zeroSmallElements(P);
+    }
+
+    imm_state = x;
+    imm_covariance = P;
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::calculateMixedStates(const SubfilterData& subfilters)
+{
+    for (int j = 0; j < MODES; j++)
+    {
+        StateVector& x = m_mixed_states[j];
+        x.setZero();
+        for (int i = 0; i < MODES; i++)
+            x += m_mode_probabilities_matrix(i, j) * subfilters[i]->x;
+
+        StateMatrix& P = m_mixed_covariances[j];
+        P.setZero();
+        for (int i = 0; i < MODES; i++)
+        {
+            const typename Filter::FilterData& data = *subfilters[i];
+            const StateVector state_diff = data.x - m_data.current().x;
+            P.noalias() += m_mode_probabilities_matrix(i, j) * (state_diff * state_diff.transpose() + data.P);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::calculateModeProbabilities()
+{
+    if (m_log_domain)
+    {
+        for (int i = 0; i < MODES; i++)
+            m_log_likelihoods[i] = m_filters[i]->getLogLikelihood();
+
+        AVIMMLogMath::calculateModeProbabilities(m_log_c, m_log_likelihoods, m_log_mode_probabilities);
+        m_mode_probabilities = m_log_mode_probabilities.array().exp();
+        return;
+    }
+
+    for (int i = 0; i < MODES; i++)
+        m_mode_probabilities[i] = m_c[i] * m_filters[i]->getLikelihood();
+    m_mode_probabilities /= m_mode_probabilities.sum();
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::prepare(qint64 timestamp)
+{
+    // Start a new data slot, the previous slot preserves the previous state and covariance. The results of the
+    // step are calculated later on, only the IMM state is needed for the mixing.
+    const FilterData& previous = m_data.current();
+    FilterData& data = m_data.flip();
+    data.x = previous.x;
+    data.P = previous.P;
+
+    const float time_delta = getTimeDelta(timestamp);
+
+    // Calculate all time depended matrices directly into the fixed size matrices of the subfilters
+    for (int i = 0; i < MODES; i++)
+        evaluateModelMatrices(i, time_delta, m_filters[i]->getData());
+
+    // Save the time of the calculation step
+    m_last_calculation = std::max(timestamp, m_last_calculation);
+}
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int MODES, int U>
+void AVIMMFixedEstimator<N, M, MODES, U>::evaluateModelMatrices(int i, float time_delta,
+                                                             typename Filter::FilterData& data)
+{
+    std::unique_lock<std::mutex> lock;
+    AVIMMModelMatrixCache* cache = AVIMMConfigParser::singleton().lockModelMatrixCache(lock);
+    if (cache)
+    {
+        const AVIMMModelMatrices& matrices = cache->getModelMatrices(m_model_cache_ids[i], m_programs[i], time_delta);
+        data.F = matrices.F;
+        data.P = matrices.P;
+        data.H = matrices.H;
+        data.Q = matrices.Q;
+        data.R = matrices.R;
+        data.B = matrices.B;
+    }
+    else
+    {
+        m_programs[i].F->evaluate(data.F, time_delta);
+        m_programs[i].P->evaluate(data.P, time_delta);
+        m_programs[i].H->evaluate(data.H, time_delta);
+        m_programs[i].Q->evaluate(data.Q, time_delta);
+        m_programs[i].R->evaluate(data.R, time_delta);
+        m_programs[i].B->evaluate(data.B, time_delta);
+    }
+}
+
+#endif //AVIMM_FIXED_ESTIMATOR_H
@@ -0,0 +1,195 @@
+//
+// Created by felix on 7/28/20.
+//
+
+#ifndef AVIMM_FIXED_FILTER_H
+#define AVIMM_FIXED_FILTER_H
+
+#include "avimmfilterbase.h"
+
+// Fixed size counterpart of AVIMMFilterBase. The state dimension N, the measurement dimension M and the input
+// dimension U are known at compile time, so all matrices live on the stack and eigen can unroll the small products.
+template<int N, int M, int U>
+class AVIMMFixedFilterBase
+{
+public:
+    typedef Eigen::Matrix<double, N, 1> StateVector;
+    typedef Eigen::Matrix<double, N, N> StateMatrix;
+    typedef Eigen::Matrix<double, M, 1> MeasurementVector;
+    typedef Eigen::Matrix<double, M, N> MeasurementMatrix;
+    typedef Eigen::Matrix<double, M, M> MeasurementCovariance;
+    typedef Eigen::Matrix<double, N, M> GainMatrix;
+    typedef Eigen::Matrix<double, U, 1> InputVector;
+    typedef Eigen::Matrix<double, N, U> InputMatrix;
+
+    struct FilterData
+    {
+        StateVector x; // State
+        StateVector x_prior; // State after prediction
+        StateVector x_post; // State after update
+        StateMatrix F; // Transition matrix
+        StateMatrix P; // Covariance matrix
+        StateMatrix P_prior; // Covariance matrix after prediction
+        StateMatrix P_post; // Covariance matrix after update
+        StateMatrix Q; // Process noise matrix
+        MeasurementCovariance R; // Measurement uncertainty matrix
+        MeasurementMatrix H; // Measurement control matrix
+        InputMatrix B; // Input control matrix
+        MeasurementCovariance S; // Innovation matrix, used for calculation of likelihood
+        Eigen::LDLT<MeasurementCovariance> S_factor; // Factorization of S, computed once in the update step
+        MeasurementVector error; // Error of the prediction, used for calculation of likelihood
+    };
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    AVIMMFixedFilterBase(const StateVector& initial_state, const QString& filter_key) : m_filter_key(filter_key)
+    {
+        m_data.x = initial_state;
+        m_data.x_prior.setZero();
+        m_data.x_post.setZero();
+        m_data.P_prior.setZero();
+        m_data.P_post.setZero();
+        m_data.S.setIdentity();
+        m_data.error.setZero();
+        m_log_likelihood = 0.0;
+    }
+
+    virtual ~AVIMMFixedFilterBase() = default;
+
+    DEFINE_GET(Data, FilterData, m_data);
+    const QString& getFilterKey() const { return m_filter_key; }
+    virtual QString getFilterInfo() const = 0;
+
+    //--------------------------------------------------------------------------
+
+    // x = Fx + Bu, P = FPF' + Q
+    void predict(const InputVector* u=nullptr) { predict(m_data, u); }
+
+    //--------------------------------------------------------------------------
+
+    // Prediction of the given data, also used by the estimator to predict copies of the subfilter data
+    static void predict(FilterData& data, const InputVector* u)
+    {
+        if (u)
+            data.x_prior.noalias() = data.F * data.x + data.B * (*u);
+        else
+            data.x_prior.noalias() = data.F * data.x;
+
+        data.P_prior.noalias() = data.F * data.P * data.F.transpose();
+        data.P_prior += data.Q;
+        zeroSmallElements(data.P_prior);
+    }
+
+    //--------------------------------------------------------------------------
+
+    virtual void update(const MeasurementVector& z, const MeasurementCovariance& R) = 0;
+
+    //--------------------------------------------------------------------------
+
+    double getLogLikelihood() const { return m_log_likelihood; }
+
+    double getLikelihood() const
+    {
+        double likelihood = exp(m_log_likelihood);
+        // Same lower bound as AVIMMFilterBase, no filter must have excactly 0 probability
+        if (likelihood <= 1*exp(-18))
+            likelihood = 1*exp(-18);
+        return likelihood;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Same threshold as AVIMMFilterBase::zeroSmallElements(const Matrix&), but in place
+    template<typename Derived>
+    static void zeroSmallElements(Eigen::MatrixBase<Derived>& matrix)
+    {
+        matrix = (matrix.array() <= MIN_THRESHOLD).select(0.0, matrix);
+    }
+
+protected:
+    // Shared update step of the Kalman filters, y is the innovation and H the (linearized) measurement matrix
+    void updateWithInnovation(const MeasurementVector& y, const MeasurementMatrix& H, const MeasurementCovariance& R)
+    {
+        const StateMatrix& P = m_data.P_prior;
+
+        // S = HPH' + R
+        MeasurementCovariance S = H * P * H.transpose() + R;
+        zeroSmallElements(S);
+        // K = PH'inv(S), solved with the factorization of S instead of inverting it
+        Eigen::LDLT<MeasurementCovariance>& S_factor = m_data.S_factor;
+        S_factor.compute(S);
+        GainMatrix K = S_factor.solve(H * P.transpose()).transpose();
+        zeroSmallElements(K);
+
+        // x = x + Ky
+        m_data.x_post.noalias() = m_data.x_prior + K * y;
+        // P = (I-KH)P(I-KH)' + KRK'
+        StateMatrix I_KH = StateMatrix::Identity();
+        I_KH.noalias() -= K * H;
+        m_data.P_post.noalias() = I_KH * P * I_KH.transpose();
+        m_data.P_post.noalias() += K * R * K.transpose();
+        zeroSmallElements(m_data.P_post);
+
+        m_data.x     = m_data.x_post;
+        m_data.P     = m_data.P_post;
+        m_data.R     = R;
+        m_data.S     = S;
+        m_data.error = y;
+
+        MeasurementVector w;
+        m_log_likelihood = AVIMMFilterBase::calculateLogLikelihood(S_factor, y, w);
+    }
+
+    FilterData m_data;
+    QString m_filter_key;
+    double m_log_likelihood;
+};
+
+//--------------------------------------------------------------------------
+
+template<int N, int M, int U>
+class AVIMMFixedKalmanFilter : public AVIMMFixedFilterBase<N, M, U>
+{
+    typedef AVIMMFixedFilterBase<N, M, U> Base;
+public:
+    AVIMMFixedKalmanFilter(const typename Base::StateVector& initial_state, const QString& filter_key)
+        : Base(initial_state, filter_key) {}
+
+    // y = z - Hx
+    void update(const typename Base::MeasurementVector& z, const typename Base::MeasurementCovariance& R) override
+    {
+        typename Base::MeasurementVector y = z - this->m_data.H * this->m_data.x_prior;
+        this->updateWithInnovation(y, this->m_data.H, R);
+    }
+
+    QString getFilterInfo() const override { return QString("IMM Fixed Kalman Filter"); }
+};
+
+//--------------------------------------------------------------------------
+
+// Like AVIMMExtendedKalmanFilter the measurement function is assumed to be the identity for now, the factory only
+// creates it for measurements in the state space
+template<int N, int M, int U>
+class AVIMMFixedExtendedKalmanFilter : public AVIMMFixedFilterBase<N, M, U>
+{
+    typedef AVIMMFixedFilterBase<N, M, U> Base;
+public:
+    AVIMMFixedExtendedKalmanFilter(const typename Base::StateVector& initial_state,
+                                   const typename Base::MeasurementMatrix& jacobi_matrix, const QString& filter_key)
+        : Base(initial_state, filter_key), m_jacobi_matrix(jacobi_matrix) {}
+
+    void update(const typename Base::MeasurementVector& z, const typename Base::MeasurementCovariance& R) override
+    {
+        typename Base::MeasurementVector y = z - this->m_data.x_prior.template head<M>();
+        this->updateWithInnovation(y, m_jacobi_matrix, R);
+    }
+
+    QString getFilterInfo() const override { return QString("IMM Fixed Extended Kalman Filter"); }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    typename Base::MeasurementMatrix m_jacobi_matrix;
+};
+
+#endif //AVIMM_FIXED_FILTER_H
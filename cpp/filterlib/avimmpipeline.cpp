@@ -0,0 +1,363 @@
+//
+// Created by felix on 8/26/20.
+//
+
+#include "avimmpipeline.h"
+
+#include <algorithm>
+
+AVIMMPipeline::AVIMMPipeline(const Decoder& decoder, const Publisher& publisher, double track_timeout,
+                             int queue_capacity)
+    : m_decoder(decoder), m_publisher(publisher), m_queue_capacity(queue_capacity),
+      m_target_timeout(static_cast<qint64>(track_timeout * 1e9)), m_free_batches(queue_capacity), m_stop(false),
+      m_pushed(0), m_published(0), m_decode_errors(0), m_gated_plots(0), m_late_plots(0), m_merge_newest_time(-1),
+      m_merge_prune_time(-1), m_gate_newest_time(-1), m_gate_prune_time(-1), m_table(track_timeout),
+      m_filter_newest_time(-1), m_filter_prune_time(-1)
+{
+    initialize();
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMPipeline::AVIMMPipeline(const AVIMMConfigData& config, const Decoder& decoder, const Publisher& publisher,
+                             double track_timeout, int queue_capacity)
+    : m_decoder(decoder), m_publisher(publisher), m_queue_capacity(queue_capacity),
+      m_target_timeout(static_cast<qint64>(track_timeout * 1e9)), m_free_batches(queue_capacity), m_stop(false),
+      m_pushed(0), m_published(0), m_decode_errors(0), m_gated_plots(0), m_late_plots(0), m_merge_newest_time(-1),
+      m_merge_prune_time(-1), m_gate_newest_time(-1), m_gate_prune_time(-1), m_table(config, track_timeout),
+      m_filter_newest_time(-1), m_filter_prune_time(-1)
+{
+    initialize();
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMPipeline::~AVIMMPipeline()
+{
+    flush();
+    m_stop.store(true, std::memory_order_release);
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::initialize()
+{
+    assert(m_queue_capacity > 0);
+
+    // Every queue can hold all batches, so only the producer has to wait
+    for (int stage = 0; stage < NUMBER_OF_STAGES; stage++)
+        m_queues.emplace_back(new AVIMMSpscQueue<Batch*>(m_queue_capacity));
+    for (int i = 0; i < m_queue_capacity; i++)
+    {
+        m_batches.emplace_back(new Batch);
+        Batch* batch = m_batches.back().get();
+        m_free_batches.tryPush(batch);
+    }
+
+    for (int stage = 0; stage < NUMBER_OF_STAGES; stage++)
+        m_threads.emplace_back(&AVIMMPipeline::runStage, this, static_cast<Stage>(stage));
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::push(std::vector<QByteArray>& records, qint64 extrapolation_time)
+{
+    // Backpressure, wait for the oldest batch to be published
+    AVIMMBackoff backoff;
+    while (!tryPush(records, extrapolation_time))
+        backoff.wait();
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMPipeline::tryPush(std::vector<QByteArray>& records, qint64 extrapolation_time)
+{
+    return tryPushBatch(records, extrapolation_time, false);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::releaseMergedPlots()
+{
+    std::vector<QByteArray> records;
+    AVIMMBackoff backoff;
+    while (!tryPushBatch(records, -1, true))
+        backoff.wait();
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMPipeline::tryPushBatch(std::vector<QByteArray>& records, qint64 extrapolation_time,
+                                 bool release_merged_plots)
+{
+    Batch* batch;
+    if (!m_free_batches.tryPop(batch))
+        return false;
+
+    batch->records.swap(records);
+    records.clear();
+    batch->extrapolation_time   = extrapolation_time;
+    batch->release_merged_plots = release_merged_plots;
+    m_pushed++;
+    forward(INGEST, batch);
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::flush()
+{
+    AVIMMBackoff backoff;
+    while (m_published.load(std::memory_order_acquire) != m_pushed)
+        backoff.wait();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::runStage(Stage stage)
+{
+    AVIMMSpscQueue<Batch*>& queue = *m_queues[stage];
+    StageMetrics& metrics = m_metrics[stage];
+
+    Batch* batch;
+    AVIMMBackoff backoff;
+    while (true)
+    {
+        if (!queue.tryPop(batch))
+        {
+            // All batches are published before the pipeline stops
+            if (m_stop.load(std::memory_order_acquire))
+                break;
+            backoff.wait();
+            continue;
+        }
+        backoff.reset();
+
+        switch (stage)
+        {
+            case INGEST:  ingest(*batch);  break;
+            case GATE:    gate(*batch);    break;
+            case FILTER:  filter(*batch);  break;
+            case PUBLISH: publish(*batch); break;
+            default:      assert(false);
+        }
+        metrics.batches.fetch_add(1, std::memory_order_relaxed);
+        metrics.plots.fetch_add(batch->plots.size(), std::memory_order_relaxed);
+
+        if (stage == PUBLISH)
+        {
+            m_published.fetch_add(1, std::memory_order_release);
+            m_free_batches.tryPush(batch);
+        }
+        else
+            forward(static_cast<Stage>(stage + 1), batch);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::forward(Stage next_stage, Batch* batch)
+{
+    AVIMMSpscQueue<Batch*>& queue = *m_queues[next_stage];
+    AVIMMBackoff backoff;
+    while (!queue.tryPush(batch))
+        backoff.wait();
+
+    std::atomic<int>& max_queue_depth = m_metrics[next_stage].max_queue_depth;
+    const int queue_depth = queue.size();
+    if (queue_depth > max_queue_depth.load(std::memory_order_relaxed))
+        max_queue_depth.store(queue_depth, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::ingest(Batch& batch)
+{
+    const int number_of_records = batch.records.size();
+    batch.targets.resize(number_of_records);
+    batch.plots.resize(number_of_records);
+
+    int count = 0;
+    for (const auto& record : batch.records)
+    {
+        if (m_decoder(record, batch.targets[count], batch.plots[count]))
+            count++;
+        else
+            m_decode_errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    batch.targets.resize(count);
+    batch.plots.resize(count);
+    batch.records.clear();
+
+    if (m_sensor_merge)
+        mergeSensors(batch);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::mergeSensors(Batch& batch)
+{
+    for (size_t i = 0; i < batch.plots.size(); i++)
+    {
+        AVIMMPlot& plot = batch.plots[i];
+        auto stream = m_merge_streams.constFind(plot.sensor);
+        if (stream == m_merge_streams.constEnd())
+            stream = m_merge_streams.insert(plot.sensor, m_sensor_merge->addSensor(plot.sensor));
+
+        // The merge only keeps plots, the target is passed as handle
+        auto handle = m_merge_handles.constFind(batch.targets[i]);
+        if (handle == m_merge_handles.constEnd())
+        {
+            int new_handle;
+            if (m_free_merge_handles.empty())
+            {
+                new_handle = m_merge_targets.size();
+                m_merge_targets.emplace_back();
+            }
+            else
+            {
+                new_handle = m_free_merge_handles.back();
+                m_free_merge_handles.pop_back();
+            }
+            m_merge_targets[new_handle].target    = batch.targets[i];
+            m_merge_targets[new_handle].last_time = plot.time;
+            handle = m_merge_handles.insert(batch.targets[i], new_handle);
+        }
+        plot.handle = handle.value();
+        MergeTarget& target = m_merge_targets[plot.handle];
+        target.last_time = std::max(target.last_time, plot.time);
+
+        if (!m_sensor_merge->addPlot(stream.value(), plot))
+            m_late_plots.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    batch.plots.clear();
+    batch.targets.clear();
+    if (batch.extrapolation_time >= 0)
+        m_sensor_merge->advanceTime(batch.extrapolation_time);
+    if (batch.release_merged_plots)
+        m_sensor_merge->releaseAllPlots(batch.plots);
+    else
+        m_sensor_merge->releasePlots(batch.plots);
+
+    batch.targets.reserve(batch.plots.size());
+    for (const auto& plot : batch.plots)
+        batch.targets.push_back(m_merge_targets[plot.handle].target);
+
+    // A timed out target is only forgotten once all of its plots were released, its handle is still in use before
+    if (!isPruneDue(batch, m_merge_newest_time, m_merge_prune_time))
+        return;
+    const qint64 release_time = m_sensor_merge->getReleaseTime();
+    for (auto it = m_merge_handles.begin(); it != m_merge_handles.end();)
+    {
+        MergeTarget& target = m_merge_targets[it.value()];
+        if (m_merge_newest_time - target.last_time >= m_target_timeout && target.last_time < release_time)
+        {
+            target.target.clear();
+            m_free_merge_handles.push_back(it.value());
+            it = m_merge_handles.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::gate(Batch& batch)
+{
+    int count = 0;
+    for (int i = 0; i < static_cast<int>(batch.plots.size()); i++)
+    {
+        const AVIMMPlot& plot = batch.plots[i];
+        bool accepted = plot.z.allFinite() && plot.R.allFinite();
+        if (accepted)
+        {
+            auto it = m_last_plots.find(batch.targets[i]);
+            if (it == m_last_plots.end())
+                m_last_plots.insert(batch.targets[i], plot);
+            else if ((accepted = m_gate ? m_gate(it.value(), plot) : plot.time > it.value().time))
+                it.value() = plot;
+        }
+
+        if (!accepted)
+        {
+            m_gated_plots.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Accepted plots are moved to the front, keeping their order
+        if (count != i)
+        {
+            std::swap(batch.plots[count], batch.plots[i]);
+            std::swap(batch.targets[count], batch.targets[i]);
+        }
+        count++;
+    }
+
+    batch.targets.resize(count);
+    batch.plots.resize(count);
+
+    if (!isPruneDue(batch, m_gate_newest_time, m_gate_prune_time))
+        return;
+    for (auto it = m_last_plots.begin(); it != m_last_plots.end();)
+    {
+        if (m_gate_newest_time - it.value().time >= m_target_timeout)
+            it = m_last_plots.erase(it);
+        else
+            ++it;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::filter(Batch& batch)
+{
+    for (size_t i = 0; i < batch.plots.size(); i++)
+        batch.plots[i].handle = m_table.internTarget(batch.targets[i]);
+    m_table.addPlots(batch.plots);
+
+    batch.output.clear();
+    batch.output_targets.clear();
+    if (batch.extrapolation_time >= 0)
+    {
+        m_table.extrapolateAll(batch.extrapolation_time, batch.output);
+        batch.output_targets.reserve(batch.output.size());
+        for (const auto& output : batch.output)
+            batch.output_targets.push_back(m_table.getTarget(output.handle));
+    }
+
+    // Released after the targets of the output were looked up
+    if (isPruneDue(batch, m_filter_newest_time, m_filter_prune_time))
+        m_table.releaseIdleTargets(m_filter_newest_time, m_target_timeout / 1e9);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMPipeline::publish(Batch& batch)
+{
+    if (batch.extrapolation_time >= 0 && m_publisher)
+        m_publisher(batch.output, batch.output_targets);
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMPipeline::isPruneDue(const Batch& batch, qint64& newest_time, qint64& prune_time) const
+{
+    newest_time = std::max(newest_time, batch.extrapolation_time);
+    for (const auto& plot : batch.plots)
+        newest_time = std::max(newest_time, plot.time);
+
+    if (newest_time < 0)
+        return false;
+    if (prune_time < 0)
+        prune_time = newest_time;
+    if (newest_time - prune_time < m_target_timeout)
+        return false;
+
+    prune_time = newest_time;
+    return true;
+}
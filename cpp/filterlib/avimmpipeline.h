@@ -0,0 +1,179 @@
+//
+// Created by felix on 8/26/20.
+//
+
+#ifndef AVIMM_PIPELINE_H
+#define AVIMM_PIPELINE_H
+
+#include "avimmsensormerge.h"
+#include "avimmtracktable.h"
+#include "utils/avimmspscqueue.h"
+
+#include <QByteArray>
+#include <functional>
+#include <thread>
+
+// Streaming track processing in four stages, each running in its own thread:
+//   INGEST  decodes the raw records of a batch into plots and optionally merges the sensors,
+//   GATE    drops invalid plots and plots rejected by the gate function,
+//   FILTER  updates the tracks with the plots and extrapolates them if requested,
+//   PUBLISH passes the extrapolated tracks to the publisher.
+// Records are pushed in batches, a batch moves through all stages as a whole. The stages are connected by lock free
+// single producer single consumer queues, so decoding and publishing of other batches overlap with the filtering.
+// The number of batches is bounded by the queue capacity, push() waits until the oldest batch was published.
+// Targets without a plot for the target timeout are forgotten by the gate and the filter stage, a later plot starts a
+// new track.
+// All calls have to be made from a single producer thread.
+class AVIMMPipeline
+{
+    friend class TstAVIMMPipeline;
+public:
+    enum Stage
+    {
+        INGEST,
+        GATE,
+        FILTER,
+        PUBLISH,
+        NUMBER_OF_STAGES
+    };
+
+    // Decodes one record into the target identifier and the plot, returns false if the record is invalid. The
+    // handle of the plot is ignored.
+    typedef std::function<bool(const QByteArray& record, QString& target, AVIMMPlot& plot)> Decoder;
+    // Returns false if the plot is rejected, given the last accepted plot of the same target
+    typedef std::function<bool(const AVIMMPlot& last_plot, const AVIMMPlot& plot)> Gate;
+    // Receives the extrapolated tracks of one batch and the identifiers of their targets
+    typedef std::function<void(const std::vector<AVIMMTrackOutput>& output,
+                               const std::vector<QString>& targets)> Publisher;
+
+    // Looks up the config of each new track by its initial state, see AVIMMTrackTable
+    AVIMMPipeline(const Decoder& decoder, const Publisher& publisher, double track_timeout=1.0,
+                  int queue_capacity=64);
+    // Uses the given config for all tracks
+    AVIMMPipeline(const AVIMMConfigData& config, const Decoder& decoder, const Publisher& publisher,
+                  double track_timeout=1.0, int queue_capacity=64);
+    // Waits until all batches are published
+    virtual ~AVIMMPipeline();
+
+    // Sets the gate function, without one a plot is rejected if it is not newer than the last plot of its target.
+    // Plots with non finite values are always rejected. Has to be called before the first batch is pushed.
+    void setGate(const Gate& gate) { m_gate = gate; }
+    // Sets the time in seconds after the last plot of a target when the gate and the filter stage forget it, the track
+    // timeout by default. Has to be called before the first batch is pushed.
+    void setTargetTimeout(double target_timeout) { m_target_timeout = static_cast<qint64>(target_timeout * 1e9); }
+    // Sets the pool used by the filter stage, see AVIMMTrackTable::setThreadPool(). Has to be called before the
+    // first batch is pushed.
+    void setThreadPool(AVIMMThreadPool* thread_pool) { m_table.setThreadPool(thread_pool); }
+    // Merges the plots of all sensors into one stream ordered by time in the ingest stage, see AVIMMSensorMerge. The
+    // decoder has to set the sensor of the plots. Plots are held back for the reorder window (nanoseconds), the
+    // extrapolation time of a batch counts as newest time. Has to be called before the first batch is pushed.
+    void enableSensorMerge(qint64 reorder_window) { m_sensor_merge.reset(new AVIMMSensorMerge(reorder_window)); }
+
+    // Queues the records as one batch. The records are swapped with the (empty) records of a published batch, so
+    // their memory is reused. With an extrapolation time >= 0 (nanoseconds since epoch), all tracks are
+    // extrapolated to this time after the plots of the batch and the output is published.
+    // Waits while the maximum number of batches is queued.
+    void push(std::vector<QByteArray>& records, qint64 extrapolation_time=-1);
+    // Returns false instead of waiting, the records are left untouched then
+    bool tryPush(std::vector<QByteArray>& records, qint64 extrapolation_time=-1);
+    // Queues an empty batch which releases all plots held back by the sensor merge, e.g. at the end of a recording
+    void releaseMergedPlots();
+    // Waits until all pushed batches are published
+    void flush();
+
+    int getQueueCapacity() const { return m_queue_capacity; }
+    // Number of batches waiting for the stage, respectively the maximum since construction
+    int getQueueDepth(Stage stage) const { return m_queues[stage]->size(); }
+    int getMaxQueueDepth(Stage stage) const { return m_metrics[stage].max_queue_depth.load(std::memory_order_relaxed); }
+    // Number of batches and plots which passed the stage
+    quint64 getNumberOfBatches(Stage stage) const { return m_metrics[stage].batches.load(std::memory_order_relaxed); }
+    quint64 getNumberOfPlots(Stage stage) const { return m_metrics[stage].plots.load(std::memory_order_relaxed); }
+    quint64 getNumberOfDecodeErrors() const { return m_decode_errors.load(std::memory_order_relaxed); }
+    quint64 getNumberOfGatedPlots() const { return m_gated_plots.load(std::memory_order_relaxed); }
+    // Number of plots dropped by the sensor merge because they arrived too late
+    quint64 getNumberOfLatePlots() const { return m_late_plots.load(std::memory_order_relaxed); }
+
+private:
+    struct Batch
+    {
+        std::vector<QByteArray> records;
+        std::vector<QString> targets; // Target of each plot
+        std::vector<AVIMMPlot> plots;
+        qint64 extrapolation_time;
+        bool release_merged_plots;
+        std::vector<AVIMMTrackOutput> output;
+        std::vector<QString> output_targets;
+    };
+
+    struct MergeTarget
+    {
+        QString target;   // Empty if the handle is free
+        qint64 last_time; // Time of the newest plot passed to the sensor merge
+    };
+
+    struct StageMetrics
+    {
+        StageMetrics() : batches(0), plots(0), max_queue_depth(0) {}
+
+        std::atomic<quint64> batches;
+        std::atomic<quint64> plots;
+        std::atomic<int> max_queue_depth; // Only written by the thread which pushes to the queue of the stage
+    };
+
+    void initialize();
+    bool tryPushBatch(std::vector<QByteArray>& records, qint64 extrapolation_time, bool release_merged_plots);
+    void runStage(Stage stage);
+    // Passes the batch to the queue of the next stage
+    void forward(Stage next_stage, Batch* batch);
+
+    void ingest(Batch& batch);
+    // Replaces the plots of the batch by the plots released by the sensor merge
+    void mergeSensors(Batch& batch);
+    void gate(Batch& batch);
+    void filter(Batch& batch);
+    void publish(Batch& batch);
+    // Advances the newest time of a stage by the batch, returns true if the stage should forget its timed out targets.
+    // This is done at most once per target timeout, so the cost is independent of the batch size.
+    bool isPruneDue(const Batch& batch, qint64& newest_time, qint64& prune_time) const;
+
+    Decoder m_decoder;
+    Gate m_gate;
+    Publisher m_publisher;
+    int m_queue_capacity;
+    qint64 m_target_timeout; // Nanoseconds
+
+    // Input queue of each stage, published batches are returned to the producer through the free queue
+    std::vector<std::unique_ptr<AVIMMSpscQueue<Batch*>>> m_queues;
+    AVIMMSpscQueue<Batch*> m_free_batches;
+    std::vector<std::unique_ptr<Batch>> m_batches;
+    std::vector<std::thread> m_threads;
+    std::atomic<bool> m_stop;
+
+    quint64 m_pushed; // Only used by the producer
+    std::atomic<quint64> m_published;
+    StageMetrics m_metrics[NUMBER_OF_STAGES];
+    std::atomic<quint64> m_decode_errors;
+    std::atomic<quint64> m_gated_plots;
+    std::atomic<quint64> m_late_plots;
+
+    // Only used by the ingest stage. The targets of the merged plots are given by their handle in m_merge_targets,
+    // the handles of timed out targets are reused. The newest and prune time are the ones of the released plots.
+    std::unique_ptr<AVIMMSensorMerge> m_sensor_merge;
+    QHash<int, int> m_merge_streams; // Stream by sensor id
+    QHash<QString, int> m_merge_handles;
+    std::vector<MergeTarget> m_merge_targets;
+    std::vector<int> m_free_merge_handles;
+    qint64 m_merge_newest_time;
+    qint64 m_merge_prune_time;
+    // Only used by the gate stage. The newest time is the one of the newest plot or extrapolation, the prune time the
+    // newest time when the timed out targets were forgotten last, both are -1 before the first batch.
+    QHash<QString, AVIMMPlot> m_last_plots;
+    qint64 m_gate_newest_time;
+    qint64 m_gate_prune_time;
+    // Only used by the filter stage
+    AVIMMTrackTable m_table;
+    qint64 m_filter_newest_time;
+    qint64 m_filter_prune_time;
+};
+
+#endif //AVIMM_PIPELINE_H
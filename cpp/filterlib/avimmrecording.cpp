@@ -0,0 +1,406 @@
+//
+// Created by felix on 9/2/20.
+//
+
+#include "avimmrecording.h"
+
+#include <cstring>
+
+const quint32 AVIMMRecording::VERSION             = 1;
+const quint32 AVIMMRecording::BYTE_ORDER_MARK     = 0x01020304;
+const char AVIMMRecording::MAGIC[8]               = { 'A', 'V', 'I', 'M', 'M', 'R', 'E', 'C' };
+const quint32 AVIMMRecording::BLOCK_MAGIC         = 0x4b4c4241; // "ABLK" in little endian
+const quint32 AVIMMRecording::MAX_DIMENSION       = 64;
+const quint32 AVIMMRecording::MAX_NUMBER_OF_MODES = 64;
+
+static_assert(sizeof(AVIMMRecordingHeader) == 32, "The header is part of the file format");
+static_assert(sizeof(AVIMMRecordingBlockHeader) == 16, "The block header is part of the file format");
+
+namespace
+{
+    qint64 alignColumn(qint64 size) { return (size + 7) & ~7LL; }
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMRecording::getNumberOfValueColumns(Type type, int dimension, int number_of_modes, bool covariance)
+{
+    const int covariance_columns = dimension * (dimension + 1) / 2;
+    if (type == TRACKS)
+        return dimension + covariance_columns + number_of_modes;
+    return dimension + (covariance ? covariance_columns : 0);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMRecording::getCovarianceColumn(int dimension, int i, int j)
+{
+    if (i > j)
+        std::swap(i, j);
+    // Rows of the upper triangle before row i have dimension, dimension - 1, ... elements
+    return dimension + i * dimension - i * (i - 1) / 2 + (j - i);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMRecording::getModeProbabilityColumn(int dimension, int mode)
+{
+    return dimension + dimension * (dimension + 1) / 2 + mode;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMRecording::BlockLayout::BlockLayout(Type type, int number_of_value_columns, int rows, bool has_row_flags)
+{
+    times             = 0;
+    targets           = times + alignColumn(rows * sizeof(qint64));
+    sensors           = type == PLOTS ? targets + alignColumn(rows * sizeof(qint32)) : -1;
+    values            = (type == PLOTS ? sensors : targets) + alignColumn(rows * sizeof(qint32));
+    row_flags         = has_row_flags ? values : -1;
+    if (has_row_flags)
+        values += alignColumn(rows * sizeof(quint8));
+    value_column_size = alignColumn(rows * sizeof(double));
+    size              = values + number_of_value_columns * value_column_size;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMRecordingWriter::AVIMMRecordingWriter(const QString& file_name, AVIMMRecording::Type type, int dimension,
+                                           int number_of_modes, bool covariance, int block_rows)
+    : m_block_rows(block_rows), m_rows(0), m_block_size(0)
+{
+    assert(dimension > 0 && dimension <= static_cast<int>(AVIMMRecording::MAX_DIMENSION));
+    assert(number_of_modes >= 0 && number_of_modes <= static_cast<int>(AVIMMRecording::MAX_NUMBER_OF_MODES));
+    assert(block_rows > 0);
+
+    std::memset(&m_header, 0, sizeof(m_header));
+    std::memcpy(m_header.magic, AVIMMRecording::MAGIC, sizeof(m_header.magic));
+    m_header.version         = AVIMMRecording::VERSION;
+    m_header.byte_order_mark = AVIMMRecording::BYTE_ORDER_MARK;
+    m_header.type            = type;
+    m_header.dimension       = dimension;
+    m_header.number_of_modes = type == AVIMMRecording::TRACKS ? number_of_modes : 0;
+    m_header.flags           = (covariance || type == AVIMMRecording::TRACKS) ? AVIMMRecording::COVARIANCE : 0;
+    m_number_of_value_columns = AVIMMRecording::getNumberOfValueColumns(type, dimension, number_of_modes, covariance);
+
+    m_times.resize(block_rows);
+    m_targets.resize(block_rows);
+    if (type == AVIMMRecording::PLOTS)
+        m_sensors.resize(block_rows);
+    if (hasRowFlags())
+        m_row_flags.resize(block_rows);
+    m_values.resize(static_cast<size_t>(block_rows) * m_number_of_value_columns);
+
+    open(file_name);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMRecordingWriter::~AVIMMRecordingWriter()
+{
+    close();
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMRecordingWriter::open(const QString& file_name)
+{
+    m_file.setFileName(file_name);
+
+    // Continue an existing recording after its last complete block
+    qint64 valid_size = 0;
+    if (m_file.exists() && m_file.size() > 0)
+    {
+        AVIMMRecordingReader reader(file_name);
+        const AVIMMRecordingHeader& header = reader.getHeader();
+        if (!reader.isValid() || header.version != m_header.version || header.type != m_header.type ||
+            header.dimension != m_header.dimension || header.number_of_modes != m_header.number_of_modes ||
+            header.flags != m_header.flags)
+        {
+            return false;
+        }
+        valid_size = reader.getValidSize();
+        m_rows     = reader.getNumberOfRows();
+    }
+
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    if (valid_size == 0)
+    {
+        m_file.resize(0);
+        if (m_file.write(reinterpret_cast<const char*>(&m_header), sizeof(m_header)) != sizeof(m_header))
+        {
+            m_file.close();
+            return false;
+        }
+    }
+    else
+    {
+        m_file.resize(valid_size);
+        m_file.seek(valid_size);
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingWriter::addRow(qint64 time, int target)
+{
+    if (m_block_size == m_block_rows)
+        flush();
+    m_times[m_block_size]   = time;
+    m_targets[m_block_size] = target;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingWriter::addPlot(const AVIMMPlot& plot)
+{
+    assert(m_header.type == AVIMMRecording::PLOTS);
+    const int dimension = m_header.dimension;
+    assert(plot.z.size() == dimension);
+
+    addRow(plot.time, plot.handle);
+    m_sensors[m_block_size] = plot.sensor;
+    for (int i = 0; i < dimension; i++)
+        rowValue(AVIMMRecording::getValueColumn(i)) = plot.z(i);
+
+    if (m_header.flags & AVIMMRecording::COVARIANCE)
+    {
+        assert(plot.R.size() == 0 || (plot.R.rows() == dimension && plot.R.cols() == dimension));
+        const bool has_covariance = plot.R.size() > 0;
+        m_row_flags[m_block_size] = has_covariance ? AVIMMRecording::ROW_COVARIANCE : 0;
+        for (int i = 0; i < dimension; i++)
+            for (int j = i; j < dimension; j++)
+                rowValue(AVIMMRecording::getCovarianceColumn(dimension, i, j)) = has_covariance ? plot.R(i, j) : 0.0;
+    }
+    m_block_size++;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingWriter::addTrack(const AVIMMTrackOutput& track)
+{
+    assert(m_header.type == AVIMMRecording::TRACKS);
+    const int dimension = m_header.dimension;
+    const int number_of_modes = m_header.number_of_modes;
+    assert(track.x.size() == dimension && track.P.rows() == dimension && track.P.cols() == dimension);
+    assert(track.mode_probabilities.size() == number_of_modes);
+
+    addRow(track.time, track.handle);
+    for (int i = 0; i < dimension; i++)
+    {
+        rowValue(AVIMMRecording::getValueColumn(i)) = track.x(i);
+        for (int j = i; j < dimension; j++)
+            rowValue(AVIMMRecording::getCovarianceColumn(dimension, i, j)) = track.P(i, j);
+    }
+    for (int mode = 0; mode < number_of_modes; mode++)
+        rowValue(AVIMMRecording::getModeProbabilityColumn(dimension, mode)) = track.mode_probabilities(mode);
+    m_block_size++;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMRecordingWriter::flush()
+{
+    if (!isOpen())
+    {
+        m_block_size = 0;
+        return false;
+    }
+    if (m_block_size == 0)
+        return true;
+
+    // The block is assembled in memory and written with a single call
+    const AVIMMRecording::Type type = static_cast<AVIMMRecording::Type>(m_header.type);
+    const AVIMMRecording::BlockLayout layout(type, m_number_of_value_columns, m_block_size, hasRowFlags());
+    AVIMMRecordingBlockHeader block_header;
+    block_header.magic = AVIMMRecording::BLOCK_MAGIC;
+    block_header.rows  = m_block_size;
+    block_header.size  = layout.size;
+
+    m_buffer.fill(0, sizeof(block_header) + layout.size);
+    char* data = m_buffer.data();
+    std::memcpy(data, &block_header, sizeof(block_header));
+    data += sizeof(block_header);
+    std::memcpy(data + layout.times, m_times.data(), m_block_size * sizeof(qint64));
+    std::memcpy(data + layout.targets, m_targets.data(), m_block_size * sizeof(qint32));
+    if (layout.sensors >= 0)
+        std::memcpy(data + layout.sensors, m_sensors.data(), m_block_size * sizeof(qint32));
+    if (layout.row_flags >= 0)
+        std::memcpy(data + layout.row_flags, m_row_flags.data(), m_block_size * sizeof(quint8));
+    for (int column = 0; column < m_number_of_value_columns; column++)
+        std::memcpy(data + layout.values + column * layout.value_column_size,
+                    m_values.data() + static_cast<size_t>(column) * m_block_rows, m_block_size * sizeof(double));
+
+    const bool written = m_file.write(m_buffer) == m_buffer.size() && m_file.flush();
+    m_rows += m_block_size;
+    m_block_size = 0;
+    return written;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingWriter::close()
+{
+    if (!isOpen())
+        return;
+    flush();
+    m_file.close();
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMRecordingReader::AVIMMRecordingReader(const QString& file_name)
+    : m_file(file_name), m_data(nullptr), m_number_of_value_columns(0), m_has_row_flags(false), m_rows(0),
+      m_valid_size(0)
+{
+    std::memset(&m_header, 0, sizeof(m_header));
+    if (!m_file.open(QIODevice::ReadOnly) || m_file.size() < static_cast<qint64>(sizeof(m_header)))
+        return;
+
+    const qint64 file_size = m_file.size();
+    const uchar* data = m_file.map(0, file_size);
+    if (data == nullptr)
+        return;
+
+    std::memcpy(&m_header, data, sizeof(m_header));
+    if (std::memcmp(m_header.magic, AVIMMRecording::MAGIC, sizeof(m_header.magic)) != 0 ||
+        m_header.version != AVIMMRecording::VERSION || m_header.byte_order_mark != AVIMMRecording::BYTE_ORDER_MARK ||
+        (m_header.type != AVIMMRecording::PLOTS && m_header.type != AVIMMRecording::TRACKS) ||
+        m_header.dimension == 0 || m_header.dimension > AVIMMRecording::MAX_DIMENSION ||
+        m_header.number_of_modes > AVIMMRecording::MAX_NUMBER_OF_MODES)
+    {
+        m_file.unmap(const_cast<uchar*>(data));
+        return;
+    }
+
+    const AVIMMRecording::Type type = getType();
+    m_number_of_value_columns = AVIMMRecording::getNumberOfValueColumns(type, m_header.dimension,
+                                                                        m_header.number_of_modes, hasCovariance());
+    m_has_row_flags = type == AVIMMRecording::PLOTS && hasCovariance();
+
+    // Index the blocks, stopping at the first incomplete or corrupt one
+    qint64 offset = sizeof(m_header);
+    while (offset + static_cast<qint64>(sizeof(AVIMMRecordingBlockHeader)) <= file_size)
+    {
+        AVIMMRecordingBlockHeader block_header;
+        std::memcpy(&block_header, data + offset, sizeof(block_header));
+        const qint64 columns = offset + sizeof(block_header);
+        if (block_header.magic != AVIMMRecording::BLOCK_MAGIC || block_header.rows == 0 ||
+            static_cast<qint64>(block_header.size) !=
+            AVIMMRecording::BlockLayout(type, m_number_of_value_columns, block_header.rows, m_has_row_flags).size ||
+            columns + static_cast<qint64>(block_header.size) > file_size)
+        {
+            break;
+        }
+
+        m_blocks.push_back({ data + columns, static_cast<int>(block_header.rows) });
+        m_rows += block_header.rows;
+        offset = columns + block_header.size;
+    }
+    m_valid_size = offset;
+    m_data = data;
+}
+
+//--------------------------------------------------------------------------
+
+const qint64* AVIMMRecordingReader::getTimes(int block) const
+{
+    const AVIMMRecording::BlockLayout layout(getType(), m_number_of_value_columns, m_blocks[block].rows,
+                                             m_has_row_flags);
+    return reinterpret_cast<const qint64*>(m_blocks[block].data + layout.times);
+}
+
+//--------------------------------------------------------------------------
+
+const qint32* AVIMMRecordingReader::getTargets(int block) const
+{
+    const AVIMMRecording::BlockLayout layout(getType(), m_number_of_value_columns, m_blocks[block].rows,
+                                             m_has_row_flags);
+    return reinterpret_cast<const qint32*>(m_blocks[block].data + layout.targets);
+}
+
+//--------------------------------------------------------------------------
+
+const qint32* AVIMMRecordingReader::getSensors(int block) const
+{
+    const AVIMMRecording::BlockLayout layout(getType(), m_number_of_value_columns, m_blocks[block].rows,
+                                             m_has_row_flags);
+    if (layout.sensors < 0)
+        return nullptr;
+    return reinterpret_cast<const qint32*>(m_blocks[block].data + layout.sensors);
+}
+
+//--------------------------------------------------------------------------
+
+const quint8* AVIMMRecordingReader::getRowFlags(int block) const
+{
+    const AVIMMRecording::BlockLayout layout(getType(), m_number_of_value_columns, m_blocks[block].rows,
+                                             m_has_row_flags);
+    if (layout.row_flags < 0)
+        return nullptr;
+    return m_blocks[block].data + layout.row_flags;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMRecordingReader::Column AVIMMRecordingReader::getColumn(int block, int column) const
+{
+    assert(column >= 0 && column < m_number_of_value_columns);
+    const int rows = m_blocks[block].rows;
+    const AVIMMRecording::BlockLayout layout(getType(), m_number_of_value_columns, rows, m_has_row_flags);
+    return Column(reinterpret_cast<const double*>(m_blocks[block].data + layout.values +
+                                                  column * layout.value_column_size), rows);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingReader::getPlot(int block, int row, AVIMMPlot& plot) const
+{
+    assert(getType() == AVIMMRecording::PLOTS);
+    const int dimension = getDimension();
+    plot.time   = getTimes(block)[row];
+    plot.handle = getTargets(block)[row];
+    plot.sensor = getSensors(block)[row];
+    plot.z.resize(dimension);
+    for (int i = 0; i < dimension; i++)
+        plot.z(i) = getColumn(block, AVIMMRecording::getValueColumn(i))(row);
+
+    if (!hasCovariance() || !(getRowFlags(block)[row] & AVIMMRecording::ROW_COVARIANCE))
+    {
+        plot.R.resize(0, 0);
+        return;
+    }
+    plot.R.resize(dimension, dimension);
+    for (int i = 0; i < dimension; i++)
+        for (int j = i; j < dimension; j++)
+            plot.R(i, j) = plot.R(j, i) = getColumn(block, AVIMMRecording::getCovarianceColumn(dimension, i, j))(row);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMRecordingReader::getTrack(int block, int row, AVIMMTrackOutput& track) const
+{
+    assert(getType() == AVIMMRecording::TRACKS);
+    const int dimension = getDimension();
+    track.time   = getTimes(block)[row];
+    track.handle = getTargets(block)[row];
+    track.x.resize(dimension);
+    track.P.resize(dimension, dimension);
+    for (int i = 0; i < dimension; i++)
+    {
+        track.x(i) = getColumn(block, AVIMMRecording::getValueColumn(i))(row);
+        for (int j = i; j < dimension; j++)
+            track.P(i, j) = track.P(j, i) =
+                getColumn(block, AVIMMRecording::getCovarianceColumn(dimension, i, j))(row);
+    }
+
+    track.mode_probabilities.resize(getNumberOfModes());
+    for (int mode = 0; mode < getNumberOfModes(); mode++)
+    {
+        track.mode_probabilities(mode) =
+            getColumn(block, AVIMMRecording::getModeProbabilityColumn(dimension, mode))(row);
+    }
+}
@@ -0,0 +1,203 @@
+//
+// Created by felix on 9/2/20.
+//
+
+#ifndef AVIMM_RECORDING_H
+#define AVIMM_RECORDING_H
+
+#include "avimmtracktable.h"
+
+#include <QFile>
+
+// Binary recording of plots or of IMM track output, replacing the CSV files for long recordings.
+// The file starts with an AVIMMRecordingHeader, followed by blocks of rows. Each block starts with an
+// AVIMMRecordingBlockHeader and stores its rows column by column, every column padded to 8 bytes:
+//   time     qint64, nanoseconds since epoch
+//   target   qint32, handle of the target
+//   sensor   qint32, only in plot recordings
+//   flags    quint8, see RowFlags, only in plot recordings with covariance
+//   values   double, one column per value, see the get...Column() functions
+// The values of a plot are the measurement and optionally the upper triangle of its covariance, the values of a
+// track are the state, the upper triangle of the covariance and the mode probabilities. The covariance columns of a
+// plot without covariance are zero and its row flags tell the reader to restore an empty R.
+// All numbers are stored in host byte order, files of the other byte order are rejected. The format is append only,
+// an incomplete block at the end (e.g. after a crash) is ignored by the reader and dropped by the next writer.
+class AVIMMRecording
+{
+public:
+    enum Type
+    {
+        PLOTS  = 1,
+        TRACKS = 2
+    };
+
+    enum Flags
+    {
+        COVARIANCE = 1 // Plots contain the measurement covariance, it is always stored for tracks
+    };
+
+    enum RowFlags
+    {
+        ROW_COVARIANCE = 1 // The plot has a measurement covariance, otherwise its R is empty
+    };
+
+    static const quint32 VERSION;
+    static const quint32 BYTE_ORDER_MARK;
+    static const char MAGIC[8];
+    static const quint32 BLOCK_MAGIC;
+    // Limits of the header, the reader rejects larger recordings before calculating the size of their columns
+    static const quint32 MAX_DIMENSION;
+    static const quint32 MAX_NUMBER_OF_MODES;
+
+    // Number of double columns of a recording
+    static int getNumberOfValueColumns(Type type, int dimension, int number_of_modes, bool covariance);
+    // Column of the i-th measurement or state value
+    static int getValueColumn(int i) { return i; }
+    // Column of the covariance element (i, j), the matrix is symmetric
+    static int getCovarianceColumn(int dimension, int i, int j);
+    // Column of the probability of the mode, only in track recordings
+    static int getModeProbabilityColumn(int dimension, int mode);
+
+    // Byte offsets of the columns within a block with the given number of rows, relative to the block header end
+    struct BlockLayout
+    {
+        BlockLayout(Type type, int number_of_value_columns, int rows, bool has_row_flags=false);
+
+        qint64 times;
+        qint64 targets;
+        qint64 sensors;   // -1 if the recording has no sensor column
+        qint64 row_flags; // -1 if the recording has no row flags column
+        qint64 values;
+        qint64 value_column_size;
+        qint64 size;
+    };
+};
+
+struct AVIMMRecordingHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byte_order_mark;
+    quint32 type;
+    quint32 dimension;       // Measurement dimension of plots, state dimension of tracks
+    quint32 number_of_modes; // 0 for plots
+    quint32 flags;
+};
+
+struct AVIMMRecordingBlockHeader
+{
+    quint32 magic;
+    quint32 rows;
+    quint64 size; // Bytes of the columns, without this header
+};
+
+//--------------------------------------------------------------------------
+
+// Appends plots or tracks to a recording. Rows are buffered and written as one block when the block is full, on
+// flush() and on destruction. An existing recording is continued if its header matches, otherwise the writer stays
+// closed.
+class AVIMMRecordingWriter
+{
+public:
+    AVIMMRecordingWriter(const QString& file_name, AVIMMRecording::Type type, int dimension, int number_of_modes=0,
+                         bool covariance=true, int block_rows=4096);
+    virtual ~AVIMMRecordingWriter();
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    // The size of z, respectively x, has to match the dimension. A plot without R is read back without R.
+    void addPlot(const AVIMMPlot& plot);
+    void addTrack(const AVIMMTrackOutput& track);
+
+    // Writes the buffered rows as one block, returns false on a write error
+    bool flush();
+    void close();
+
+    // Number of rows in the file, including the buffered rows
+    quint64 getNumberOfRows() const { return m_rows + m_block_size; }
+
+private:
+    bool open(const QString& file_name);
+    void addRow(qint64 time, int target);
+    bool hasRowFlags() const
+    {
+        return m_header.type == AVIMMRecording::PLOTS && (m_header.flags & AVIMMRecording::COVARIANCE);
+    }
+    // Value of the current row in the given column
+    double& rowValue(int column) { return m_values[static_cast<size_t>(column) * m_block_rows + m_block_size]; }
+
+    QFile m_file;
+    AVIMMRecordingHeader m_header;
+    int m_number_of_value_columns;
+    int m_block_rows;
+    quint64 m_rows;
+
+    // Rows of the current block, the values column by column with m_block_rows per column
+    int m_block_size;
+    std::vector<qint64> m_times;
+    std::vector<qint32> m_targets;
+    std::vector<qint32> m_sensors;
+    std::vector<quint8> m_row_flags;
+    std::vector<double> m_values;
+    QByteArray m_buffer;
+};
+
+//--------------------------------------------------------------------------
+
+// Maps a recording into memory, the columns are accessed in place without copying or parsing.
+class AVIMMRecordingReader
+{
+public:
+    // Map of a value column of one block, valid as long as the reader exists
+    typedef Eigen::Map<const Vector> Column;
+
+    explicit AVIMMRecordingReader(const QString& file_name);
+    virtual ~AVIMMRecordingReader() = default;
+
+    // False if the file cannot be mapped or is no recording of the current version and byte order
+    bool isValid() const { return m_data != nullptr; }
+
+    AVIMMRecording::Type getType() const { return static_cast<AVIMMRecording::Type>(m_header.type); }
+    quint32 getVersion() const { return m_header.version; }
+    int getDimension() const { return m_header.dimension; }
+    int getNumberOfModes() const { return m_header.number_of_modes; }
+    bool hasCovariance() const { return m_header.flags & AVIMMRecording::COVARIANCE; }
+    int getNumberOfValueColumns() const { return m_number_of_value_columns; }
+    const AVIMMRecordingHeader& getHeader() const { return m_header; }
+
+    int getNumberOfBlocks() const { return m_blocks.size(); }
+    quint64 getNumberOfRows() const { return m_rows; }
+    // Size of the header and all complete blocks, an incomplete block after it is ignored
+    qint64 getValidSize() const { return m_valid_size; }
+
+    int getBlockRows(int block) const { return m_blocks[block].rows; }
+    const qint64* getTimes(int block) const;
+    const qint32* getTargets(int block) const;
+    // nullptr for track recordings
+    const qint32* getSensors(int block) const;
+    // See AVIMMRecording::RowFlags, nullptr if the recording has none
+    const quint8* getRowFlags(int block) const;
+    Column getColumn(int block, int column) const;
+
+    // Copies one row, R is left empty if the recording or the plot has no covariance
+    void getPlot(int block, int row, AVIMMPlot& plot) const;
+    void getTrack(int block, int row, AVIMMTrackOutput& track) const;
+
+private:
+    struct Block
+    {
+        const uchar* data; // Start of the columns
+        int rows;
+    };
+
+    QFile m_file;
+    const uchar* m_data;
+    AVIMMRecordingHeader m_header;
+    int m_number_of_value_columns;
+    bool m_has_row_flags;
+    quint64 m_rows;
+    qint64 m_valid_size;
+    std::vector<Block> m_blocks;
+};
+
+#endif //AVIMM_RECORDING_H
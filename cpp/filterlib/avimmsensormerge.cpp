@@ -0,0 +1,131 @@
+//
+// Created by felix on 8/28/20.
+//
+
+#include "avimmsensormerge.h"
+
+#include <algorithm>
+#include <limits>
+
+AVIMMSensorMerge::AVIMMSensorMerge(qint64 reorder_window)
+    : m_reorder_window(reorder_window), m_newest_time(std::numeric_limits<qint64>::min()),
+      m_release_time(std::numeric_limits<qint64>::min()), m_number_of_buffered_plots(0)
+{
+    assert(reorder_window >= 0);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMSensorMerge::addSensor(int sensor_id)
+{
+    Stream stream;
+    stream.sensor_id       = sensor_id;
+    stream.late_plots      = 0;
+    stream.reordered_plots = 0;
+    m_streams.push_back(stream);
+    return m_streams.size() - 1;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMSensorMerge::addPlot(int stream, const AVIMMPlot& plot)
+{
+    assert(stream >= 0 && stream < static_cast<int>(m_streams.size()));
+    Stream& current_stream = m_streams[stream];
+
+    if (plot.time < m_release_time)
+    {
+        current_stream.late_plots++;
+        return false;
+    }
+
+    // Out of order plots are usually close to the end of the buffer
+    auto it = current_stream.plots.end();
+    while (it != current_stream.plots.begin() && (it - 1)->time > plot.time)
+        --it;
+    if (it != current_stream.plots.end())
+        current_stream.reordered_plots++;
+
+    const bool new_head = it == current_stream.plots.begin();
+    current_stream.plots.insert(it, plot);
+    m_number_of_buffered_plots++;
+    m_newest_time = std::max(m_newest_time, plot.time);
+
+    if (!new_head)
+        return true;
+
+    if (current_stream.plots.size() == 1)
+    {
+        m_heads.push_back({ plot.time, stream });
+        std::push_heap(m_heads.begin(), m_heads.end());
+        return true;
+    }
+
+    // The oldest plot of the stream was replaced, the heap only has one entry per sensor
+    for (auto& head : m_heads)
+        if (head.stream == stream)
+            head.time = plot.time;
+    std::make_heap(m_heads.begin(), m_heads.end());
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMSensorMerge::advanceTime(qint64 time)
+{
+    m_newest_time = std::max(m_newest_time, time);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMSensorMerge::releasePlots(std::vector<AVIMMPlot>& plots, std::vector<int>* streams)
+{
+    if (m_newest_time == std::numeric_limits<qint64>::min())
+        return;
+    release(m_newest_time - m_reorder_window, plots, streams);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMSensorMerge::releaseAllPlots(std::vector<AVIMMPlot>& plots, std::vector<int>* streams)
+{
+    release(std::numeric_limits<qint64>::max(), plots, streams);
+}
+
+//--------------------------------------------------------------------------
+
+quint64 AVIMMSensorMerge::getNumberOfLatePlots() const
+{
+    quint64 late_plots = 0;
+    for (const auto& stream : m_streams)
+        late_plots += stream.late_plots;
+    return late_plots;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMSensorMerge::release(qint64 max_time, std::vector<AVIMMPlot>& plots, std::vector<int>* streams)
+{
+    while (!m_heads.empty() && m_heads.front().time <= max_time)
+    {
+        std::pop_heap(m_heads.begin(), m_heads.end());
+        Head& head = m_heads.back();
+        Stream& stream = m_streams[head.stream];
+
+        plots.push_back(std::move(stream.plots.front()));
+        stream.plots.pop_front();
+        if (streams)
+            streams->push_back(head.stream);
+        m_release_time = head.time;
+        m_number_of_buffered_plots--;
+
+        // The next plot of the stream takes its place in the heap
+        if (stream.plots.empty())
+        {
+            m_heads.pop_back();
+            continue;
+        }
+        head.time = stream.plots.front().time;
+        std::push_heap(m_heads.begin(), m_heads.end());
+    }
+}
@@ -0,0 +1,86 @@
+//
+// Created by felix on 8/28/20.
+//
+
+#ifndef AVIMM_SENSOR_MERGE_H
+#define AVIMM_SENSOR_MERGE_H
+
+#include "avimmtracktable.h"
+
+#include <deque>
+
+// Merges the plot streams of several sensors (e.g. ADS-B, MLAT and radar) with different latencies into one stream
+// ordered by time. Plots are buffered until they are older than the newest plot of all sensors minus the reorder
+// window, then they are released by a k-way merge of the per-sensor buffers. A heap holds the oldest buffered plot of
+// every sensor, so releasing a plot costs O(log k) for k sensors and no batch is ever sorted as a whole.
+// Slightly out of order plots of one sensor are inserted at their place in the buffer of the sensor. Plots older than
+// the last released plot arrived too late and are dropped, so the released times never decrease and the estimators
+// never see a negative time delta.
+class AVIMMSensorMerge
+{
+    friend class TstAVIMMSensorMerge;
+public:
+    // The reorder window is given in nanoseconds
+    explicit AVIMMSensorMerge(qint64 reorder_window);
+    virtual ~AVIMMSensorMerge() = default;
+
+    // Adds the stream of a sensor and returns its index
+    int addSensor(int sensor_id);
+    int getSensorId(int stream) const { return m_streams[stream].sensor_id; }
+    int getNumberOfSensors() const { return m_streams.size(); }
+
+    // Buffers the plot of the stream, returns false if the plot is late and was dropped
+    bool addPlot(int stream, const AVIMMPlot& plot);
+    // Advances the newest time without a plot, e.g. with the current time in live operation, so plots are released
+    // even if all sensors are silent
+    void advanceTime(qint64 time);
+
+    // Appends all plots older than the newest time minus the reorder window to plots, ordered by time. Plots with the
+    // same time are ordered by stream. If given, the stream of every plot is appended to streams.
+    void releasePlots(std::vector<AVIMMPlot>& plots, std::vector<int>* streams=nullptr);
+    // Appends all buffered plots, e.g. at the end of a recording
+    void releaseAllPlots(std::vector<AVIMMPlot>& plots, std::vector<int>* streams=nullptr);
+
+    qint64 getReorderWindow() const { return m_reorder_window; }
+    // Time of the last released plot
+    qint64 getReleaseTime() const { return m_release_time; }
+    int getNumberOfBufferedPlots() const { return m_number_of_buffered_plots; }
+    // Number of plots dropped because they were older than the last released plot
+    quint64 getNumberOfLatePlots(int stream) const { return m_streams[stream].late_plots; }
+    quint64 getNumberOfLatePlots() const;
+    // Number of plots which were older than the previous plot of the same sensor, but still in time
+    quint64 getNumberOfReorderedPlots(int stream) const { return m_streams[stream].reordered_plots; }
+
+private:
+    struct Stream
+    {
+        int sensor_id;
+        std::deque<AVIMMPlot> plots; // Buffered plots ordered by time
+        quint64 late_plots;
+        quint64 reordered_plots;
+    };
+
+    // Oldest buffered plot of a stream
+    struct Head
+    {
+        qint64 time;
+        int stream;
+
+        // Orders the heap with the oldest head on top
+        bool operator<(const Head& other) const
+        {
+            return time > other.time || (time == other.time && stream > other.stream);
+        }
+    };
+
+    void release(qint64 max_time, std::vector<AVIMMPlot>& plots, std::vector<int>* streams);
+
+    qint64 m_reorder_window;
+    qint64 m_newest_time;
+    qint64 m_release_time;
+    int m_number_of_buffered_plots;
+    std::vector<Stream> m_streams;
+    std::vector<Head> m_heads;
+};
+
+#endif //AVIMM_SENSOR_MERGE_H
@@ -0,0 +1,321 @@
+//
+// Created by felix on 8/24/20.
+//
+
+#include "avimmshardedtracktable.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+AVIMMShardedTrackTable::AVIMMShardedTrackTable(int number_of_shards, double track_timeout, bool pin_threads,
+                                               int queue_capacity)
+    : m_pin_threads(pin_threads), m_stop(false)
+{
+    initialize(nullptr, number_of_shards, track_timeout, queue_capacity);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMShardedTrackTable::AVIMMShardedTrackTable(const AVIMMConfigData& config, int number_of_shards,
+                                               double track_timeout, bool pin_threads, int queue_capacity)
+    : m_pin_threads(pin_threads), m_stop(false)
+{
+    initialize(&config, number_of_shards, track_timeout, queue_capacity);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMShardedTrackTable::~AVIMMShardedTrackTable()
+{
+    // The shard threads process their remaining commands before they stop
+    m_stop.store(true, std::memory_order_release);
+    for (auto& shard : m_shards)
+        shard->thread.join();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::initialize(const AVIMMConfigData* config, int number_of_shards, double track_timeout,
+                                        int queue_capacity)
+{
+    if (number_of_shards <= 0)
+        number_of_shards = std::max(1u, std::thread::hardware_concurrency());
+
+    const AVIMMModelMatrixCache* global_cache = AVIMMConfigParser::singleton().getGlobalModelMatrixCache();
+    for (int i = 0; i < number_of_shards; i++)
+    {
+        m_shards.emplace_back(new Shard(queue_capacity));
+        Shard& shard = *m_shards.back();
+        shard.table.reset(config ? new AVIMMTrackTable(*config, track_timeout) : new AVIMMTrackTable(track_timeout));
+
+        // Every shard gets its own cache with the settings of the global one
+        if (global_cache)
+        {
+            shard.cache.reset(new AVIMMModelMatrixCache(global_cache->getQuantizationStep(),
+                                                        global_cache->getCapacity()));
+            if (config)
+                AVIMMAirportConfigs::prewarmModelMatrixCache(*shard.cache, *config);
+            else
+                AVIMMAirportConfigs::singleton().prewarmModelMatrixCache(*shard.cache);
+        }
+    }
+
+    for (int i = 0; i < number_of_shards; i++)
+        m_shards[i]->thread = std::thread(&AVIMMShardedTrackTable::runShard, this, i);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMShardedTrackTable::internTarget(const QString& target)
+{
+    auto it = m_handles.constFind(target);
+    if (it != m_handles.constEnd())
+        return it.value();
+
+    int handle;
+    if (m_free_handles.empty())
+    {
+        handle = m_targets.size();
+        m_targets.emplace_back();
+        m_announced.push_back(false);
+    }
+    else
+    {
+        handle = m_free_handles.back();
+        m_free_handles.pop_back();
+    }
+
+    m_targets[handle]   = target;
+    m_announced[handle] = false;
+    m_handles.insert(target, handle);
+    return handle;
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMShardedTrackTable::findTarget(const QString& target) const
+{
+    return m_handles.value(target, -1);
+}
+
+//--------------------------------------------------------------------------
+
+const QString& AVIMMShardedTrackTable::getTarget(int handle) const
+{
+    assert(handle >= 0 && handle < static_cast<int>(m_targets.size()));
+    return m_targets[handle];
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::releaseTarget(int handle)
+{
+    assert(handle >= 0 && handle < static_cast<int>(m_targets.size()));
+
+    // The handle maps to the same shard when it is reused, so the release is processed before any new plot
+    if (m_announced[handle])
+    {
+        Command command;
+        command.type   = Command::RELEASE;
+        command.handle = handle;
+        push(getShard(handle), command);
+    }
+
+    m_handles.remove(m_targets[handle]);
+    m_targets[handle].clear();
+    m_announced[handle] = false;
+    m_free_handles.push_back(handle);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMShardedTrackTable::getShard(int handle) const
+{
+    // Fibonacci hashing spreads neighbouring handles over the shards
+    const quint32 hash = static_cast<quint32>(handle) * 2654435761u;
+    return (hash >> 16) % m_shards.size();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::addPlot(const AVIMMPlot& plot)
+{
+    assert(plot.handle >= 0 && plot.handle < static_cast<int>(m_targets.size()));
+
+    Command command;
+    command.type   = Command::PLOT;
+    command.handle = plot.handle;
+    command.plot   = plot;
+    if (!m_announced[plot.handle])
+    {
+        command.target = m_targets[plot.handle];
+        m_announced[plot.handle] = true;
+    }
+    push(getShard(plot.handle), command);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::addPlots(const AVIMMPlot* plots, int count)
+{
+    for (int i = 0; i < count; i++)
+        addPlot(plots[i]);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::extrapolateAll(qint64 time)
+{
+    for (int i = 0; i < getNumberOfShards(); i++)
+    {
+        Command command;
+        command.type = Command::EXTRAPOLATE;
+        command.time = time;
+        push(i, command);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::collectOutput(std::vector<AVIMMTrackOutput>& output)
+{
+    flush();
+
+    const size_t begin = output.size();
+    for (auto& shard : m_shards)
+    {
+        output.insert(output.end(), std::make_move_iterator(shard->output.begin()),
+                      std::make_move_iterator(shard->output.end()));
+        shard->output.clear();
+    }
+
+    // The order does not depend on the number of shards
+    std::sort(output.begin() + begin, output.end(), [](const AVIMMTrackOutput& a, const AVIMMTrackOutput& b) {
+        return a.time < b.time || (a.time == b.time && a.handle < b.handle);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::flush()
+{
+    for (auto& shard : m_shards)
+        while (shard->processed.load(std::memory_order_acquire) != shard->pushed)
+            std::this_thread::yield();
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMShardedTrackTable::getNumberOfTracks()
+{
+    flush();
+
+    int number_of_tracks = 0;
+    for (const auto& shard : m_shards)
+        number_of_tracks += shard->table->getNumberOfTracks();
+    return number_of_tracks;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::push(int shard, Command& command)
+{
+    Shard& target_shard = *m_shards[shard];
+
+    // Backpressure, wait for the shard if its queue is full
+    while (!target_shard.queue.tryPush(command))
+        std::this_thread::yield();
+    target_shard.pushed++;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::runShard(int index)
+{
+    Shard& shard = *m_shards[index];
+    if (m_pin_threads)
+        pinThread(index % std::max(1u, std::thread::hardware_concurrency()));
+
+    // All estimators of this shard are calculated in this thread and use the cache of the shard
+    AVIMMConfigParser::setThreadModelMatrixCache(shard.cache.get());
+
+    Command command;
+    AVIMMBackoff backoff;
+    while (true)
+    {
+        if (shard.queue.tryPop(command))
+        {
+            backoff.reset();
+            execute(shard, command);
+            shard.processed.fetch_add(1, std::memory_order_release);
+            continue;
+        }
+
+        // Stop only once the queue is drained
+        if (m_stop.load(std::memory_order_acquire))
+            break;
+
+        backoff.wait();
+    }
+
+    AVIMMConfigParser::setThreadModelMatrixCache(nullptr);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMShardedTrackTable::execute(Shard& shard, Command& command)
+{
+    switch (command.type)
+    {
+        case Command::PLOT: {
+            // The first plot of a target interns it in the table of the shard
+            if (!command.target.isEmpty())
+            {
+                const int local = shard.table->internTarget(command.target);
+                if (static_cast<int>(shard.local_handles.size()) <= command.handle)
+                    shard.local_handles.resize(command.handle + 1, -1);
+                if (static_cast<int>(shard.global_handles.size()) <= local)
+                    shard.global_handles.resize(local + 1, -1);
+                shard.local_handles[command.handle] = local;
+                shard.global_handles[local] = command.handle;
+            }
+
+            command.plot.handle = shard.local_handles[command.handle];
+            shard.table->addPlot(command.plot);
+            break;
+        }
+        case Command::EXTRAPOLATE: {
+            const size_t begin = shard.output.size();
+            shard.table->extrapolateAll(command.time, shard.output);
+            for (size_t i = begin; i < shard.output.size(); i++)
+                shard.output[i].handle = shard.global_handles[shard.output[i].handle];
+            break;
+        }
+        case Command::RELEASE: {
+            const int local = shard.local_handles[command.handle];
+            shard.table->releaseTarget(local);
+            shard.local_handles[command.handle] = -1;
+            shard.global_handles[local] = -1;
+            break;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMShardedTrackTable::pinThread(int core)
+{
+#ifdef __linux__
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(core, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    Q_UNUSED(core);
+    return false;
+#endif
+}
@@ -0,0 +1,116 @@
+//
+// Created by felix on 8/24/20.
+//
+
+#ifndef AVIMM_SHARDED_TRACK_TABLE_H
+#define AVIMM_SHARDED_TRACK_TABLE_H
+
+#include "avimmtracktable.h"
+#include "utils/avimmmodelmatrixcache.h"
+#include "utils/avimmspscqueue.h"
+
+#include <thread>
+
+// Track store partitioned into shards by a hash of the target handle. Every shard is owned by one worker thread,
+// optionally pinned to its own core, which holds an AVIMMTrackTable with the estimators of its targets, its own
+// model matrix cache (if the global cache is enabled) and its own output buffer. Estimators are created and
+// calculated by their shard thread only, so their memory is never shared between cores.
+// All calls have to be made from a single producer thread. Plots and commands are routed to the shards through lock
+// free single producer single consumer queues, the producer waits if a queue is full. Output of extrapolateAll() is
+// collected with collectOutput(), which waits until all shards have processed their queues.
+class AVIMMShardedTrackTable
+{
+    friend class TstAVIMMShardedTrackTable;
+public:
+    // A number of shards <= 0 uses one shard per core. Without a config, the config of each new track is looked up
+    // by its initial state.
+    explicit AVIMMShardedTrackTable(int number_of_shards=0, double track_timeout=1.0, bool pin_threads=true,
+                                    int queue_capacity=4096);
+    AVIMMShardedTrackTable(const AVIMMConfigData& config, int number_of_shards=0, double track_timeout=1.0,
+                           bool pin_threads=true, int queue_capacity=4096);
+    virtual ~AVIMMShardedTrackTable();
+
+    // Returns the handle of the target, a new handle is created for unknown targets
+    int internTarget(const QString& target);
+    // Returns the handle of the target or -1 if it is unknown
+    int findTarget(const QString& target) const;
+    const QString& getTarget(int handle) const;
+    // Drops the track of the target and releases the handle, it may be reused by the next interned target
+    void releaseTarget(int handle);
+    // Returns the shard which owns the track of the target
+    int getShard(int handle) const;
+
+    // Routes the plot to the shard of its target
+    void addPlot(const AVIMMPlot& plot);
+    void addPlots(const AVIMMPlot* plots, int count);
+    void addPlots(const std::vector<AVIMMPlot>& plots) { addPlots(plots.data(), plots.size()); }
+
+    // Requests the extrapolation of all tracks to the given time, see AVIMMTrackTable::extrapolateAll()
+    void extrapolateAll(qint64 time);
+    // Waits for all shards and appends the output of all extrapolations since the last call, ordered by time and
+    // handle
+    void collectOutput(std::vector<AVIMMTrackOutput>& output);
+    // Waits until all shards have processed their queues
+    void flush();
+
+    int getNumberOfShards() const { return m_shards.size(); }
+    // Waits for all shards and returns the number of tracks of all shards
+    int getNumberOfTracks();
+    // Returns the number of queued commands of the shard
+    int getQueueDepth(int shard) const { return m_shards[shard]->queue.size(); }
+
+private:
+    struct Command
+    {
+        enum Type
+        {
+            PLOT,
+            EXTRAPOLATE,
+            RELEASE
+        };
+
+        Type type;
+        int handle; // Global handle of the target
+        QString target; // Only set with the first plot of a target in the shard
+        AVIMMPlot plot;
+        qint64 time;
+    };
+
+    struct Shard
+    {
+        explicit Shard(int queue_capacity) : queue(queue_capacity), processed(0), pushed(0) {}
+
+        AVIMMSpscQueue<Command> queue;
+        std::thread thread;
+
+        // Only used by the shard thread
+        std::unique_ptr<AVIMMTrackTable> table;
+        std::unique_ptr<AVIMMModelMatrixCache> cache;
+        std::vector<int> local_handles; // Handle in the table by global handle, -1 if not interned
+        std::vector<int> global_handles; // Global handle by handle in the table
+        // Written by the shard thread, read by the producer once processed == pushed
+        std::vector<AVIMMTrackOutput> output;
+
+        std::atomic<quint64> processed;
+        quint64 pushed; // Only used by the producer
+    };
+
+    void initialize(const AVIMMConfigData* config, int number_of_shards, double track_timeout, int queue_capacity);
+    void push(int shard, Command& command);
+    void runShard(int index);
+    void execute(Shard& shard, Command& command);
+    // Pins the calling thread to the given core, returns false if not supported
+    static bool pinThread(int core);
+
+    bool m_pin_threads;
+    std::atomic<bool> m_stop;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+
+    // Global handles of the targets, only used by the producer
+    QHash<QString, int> m_handles;
+    std::vector<QString> m_targets;
+    std::vector<bool> m_announced; // The shard has interned the target
+    std::vector<int> m_free_handles;
+};
+
+#endif //AVIMM_SHARDED_TRACK_TABLE_H
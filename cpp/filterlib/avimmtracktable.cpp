@@ -0,0 +1,268 @@
+//
+// Created by felix on 8/18/20.
+//
+
+#include "avimmtracktable.h"
+#include "avimmestimatorfactory.h"
+
+#include <algorithm>
+
+AVIMMTrackTable::AVIMMTrackTable(double track_timeout)
+    : m_use_fixed_config(false), m_track_timeout(track_timeout),
+      m_track_timeout_ns(static_cast<qint64>(track_timeout * 1e9)), m_number_of_tracks(0), m_thread_pool(nullptr)
+{
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMTrackTable::AVIMMTrackTable(const AVIMMConfigData& config, double track_timeout)
+    : AVIMMTrackTable(track_timeout)
+{
+    m_use_fixed_config = true;
+    m_config = config;
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMTrackTable::internTarget(const QString& target)
+{
+    auto it = m_handles.constFind(target);
+    if (it != m_handles.constEnd())
+        return it.value();
+
+    int handle;
+    if (m_free_handles.empty())
+    {
+        handle = m_slots.size();
+        m_slots.emplace_back();
+    }
+    else
+    {
+        handle = m_free_handles.back();
+        m_free_handles.pop_back();
+    }
+
+    Slot& slot = m_slots[handle];
+    slot.target      = target;
+    slot.last_update = 0;
+    slot.used        = true;
+    m_handles.insert(target, handle);
+    return handle;
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMTrackTable::findTarget(const QString& target) const
+{
+    return m_handles.value(target, -1);
+}
+
+//--------------------------------------------------------------------------
+
+const QString& AVIMMTrackTable::getTarget(int handle) const
+{
+    assert(handle >= 0 && handle < static_cast<int>(m_slots.size()) && m_slots[handle].used);
+    return m_slots[handle].target;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::releaseTarget(int handle)
+{
+    assert(handle >= 0 && handle < static_cast<int>(m_slots.size()) && m_slots[handle].used);
+    Slot& slot = m_slots[handle];
+    dropTrack(slot);
+    m_handles.remove(slot.target);
+    slot.target.clear();
+    slot.used = false;
+    m_free_handles.push_back(handle);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMTrackTable::releaseIdleTargets(qint64 time, double timeout)
+{
+    const qint64 timeout_ns = static_cast<qint64>(timeout * 1e9);
+    int released = 0;
+    for (int handle = 0; handle < static_cast<int>(m_slots.size()); handle++)
+        if (m_slots[handle].used && time - m_slots[handle].last_update >= timeout_ns)
+        {
+            releaseTarget(handle);
+            released++;
+        }
+    return released;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::addPlot(const AVIMMPlot& plot)
+{
+    assert(plot.handle >= 0 && plot.handle < static_cast<int>(m_slots.size()) && m_slots[plot.handle].used);
+    Slot& slot = m_slots[plot.handle];
+
+    // The first plot of a target initializes its track
+    if (!slot.estimator)
+    {
+        slot.estimator = m_use_fixed_config ? AVIMMEstimatorFactory::createEstimator(m_config, plot.z)
+                                            : AVIMMEstimatorFactory::createEstimator(plot.z);
+        slot.estimator->setTimestamp(plot.time);
+        slot.last_update = plot.time;
+        m_number_of_tracks++;
+        return;
+    }
+
+    slot.estimator->predictAndUpdate(plot.z, plot.R, DEFAULT_VECTOR, plot.time);
+    slot.last_update = plot.time;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::addPlots(const AVIMMPlot* plots, int count)
+{
+    if (!m_thread_pool || count < 2)
+    {
+        for (int i = 0; i < count; i++)
+            addPlot(plots[i]);
+        return;
+    }
+
+    // Group the plots by target, a stable sort keeps the order of the plots of each target
+    m_plot_order.resize(count);
+    for (int i = 0; i < count; i++)
+        m_plot_order[i] = i;
+    std::stable_sort(m_plot_order.begin(), m_plot_order.end(),
+                     [plots](int a, int b) { return plots[a].handle < plots[b].handle; });
+
+    m_plot_groups.clear();
+    for (int i = 0; i < count; i++)
+        if (i == 0 || plots[m_plot_order[i]].handle != plots[m_plot_order[i - 1]].handle)
+            m_plot_groups.push_back(i);
+    m_plot_groups.push_back(count);
+
+    // Each target is calculated by one thread only
+    forEach(m_plot_groups.size() - 1, [&](int group) {
+        for (int i = m_plot_groups[group]; i < m_plot_groups[group + 1]; i++)
+            addPlot(plots[m_plot_order[i]]);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::extrapolateAll(qint64 time, std::vector<AVIMMTrackOutput>& output)
+{
+    m_track_handles.clear();
+    for (int handle = 0; handle < static_cast<int>(m_slots.size()); handle++)
+        if (m_slots[handle].estimator)
+            m_track_handles.push_back(handle);
+
+    // Every track writes its own result, they are collected in the order of the handles afterwards
+    m_extrapolations.resize(m_track_handles.size());
+    forEach(m_track_handles.size(), [&](int i) {
+        const int handle = m_track_handles[i];
+        Slot& slot = m_slots[handle];
+        Extrapolation& extrapolation = m_extrapolations[i];
+
+        // Track is finished
+        extrapolation.valid = time - slot.last_update < m_track_timeout_ns;
+        if (!extrapolation.valid)
+        {
+            dropTrack(slot);
+            return;
+        }
+
+        const std::pair<Vector, Matrix> result = slot.estimator->extrapolate(DEFAULT_VECTOR, time);
+        extrapolation.output.handle = handle;
+        extrapolation.output.time   = time;
+        extrapolation.output.x      = result.first;
+        extrapolation.output.P      = result.second;
+        extrapolation.output.mode_probabilities = slot.estimator->getModeProbabilityVector();
+    });
+
+    output.reserve(output.size() + m_track_handles.size());
+    for (const auto& extrapolation : m_extrapolations)
+        if (extrapolation.valid)
+            output.push_back(extrapolation.output);
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMTrackTable::hasTrack(int handle) const
+{
+    return getEstimator(handle) != nullptr;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMEstimatorInterface* AVIMMTrackTable::getEstimator(int handle) const
+{
+    if (handle < 0 || handle >= static_cast<int>(m_slots.size()))
+        return nullptr;
+    return m_slots[handle].estimator.get();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::forEach(int count, const std::function<void(int)>& function)
+{
+    if (m_thread_pool)
+    {
+        updateThreadCaches();
+        if (m_thread_caches.empty())
+        {
+            m_thread_pool->parallelFor(count, function);
+            return;
+        }
+
+        // A cache shared by the pool threads would serialize them on its mutex
+        m_thread_pool->parallelFor(count, [&](int i) {
+            AVIMMModelMatrixCache* previous_cache = AVIMMConfigParser::getThreadModelMatrixCache();
+            AVIMMConfigParser::setThreadModelMatrixCache(m_thread_caches[AVIMMThreadPool::getCurrentThread()].get());
+            function(i);
+            AVIMMConfigParser::setThreadModelMatrixCache(previous_cache);
+        });
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        function(i);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::updateThreadCaches()
+{
+    const AVIMMModelMatrixCache* global_cache = AVIMMConfigParser::singleton().getGlobalModelMatrixCache();
+    if (!global_cache)
+    {
+        m_thread_caches.clear();
+        return;
+    }
+
+    // The caches are kept as long as the pool and the settings of the global cache stay the same
+    if (static_cast<int>(m_thread_caches.size()) == m_thread_pool->getNumberOfThreads() &&
+        m_thread_caches.front()->getQuantizationStep() == global_cache->getQuantizationStep() &&
+        m_thread_caches.front()->getCapacity() == global_cache->getCapacity())
+        return;
+
+    // Every thread gets a prewarmed cache with the settings of the global one, like the shards of a sharded table
+    m_thread_caches.clear();
+    for (int i = 0; i < m_thread_pool->getNumberOfThreads(); i++)
+    {
+        m_thread_caches.emplace_back(new AVIMMModelMatrixCache(global_cache->getQuantizationStep(),
+                                                               global_cache->getCapacity()));
+        if (m_use_fixed_config)
+            AVIMMAirportConfigs::prewarmModelMatrixCache(*m_thread_caches.back(), m_config);
+        else
+            AVIMMAirportConfigs::singleton().prewarmModelMatrixCache(*m_thread_caches.back());
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrackTable::dropTrack(Slot& slot)
+{
+    if (!slot.estimator)
+        return;
+    slot.estimator.reset();
+    m_number_of_tracks--;
+}
@@ -0,0 +1,131 @@
+//
+// Created by felix on 8/18/20.
+//
+
+#ifndef AVIMM_TRACK_TABLE_H
+#define AVIMM_TRACK_TABLE_H
+
+#include "avimmestimatorinterface.h"
+#include "utils/avimmairportconfigs.h"
+#include "utils/avimmmodelmatrixcache.h"
+#include "utils/avimmthreadpool.h"
+
+#include <QHash>
+#include <atomic>
+#include <vector>
+
+// A measurement of one target. The target is given by its handle in the track table, see
+// AVIMMTrackTable::internTarget().
+struct AVIMMPlot
+{
+    int handle;
+    int sensor; // Id of the measuring sensor, only used to merge sensor streams, see AVIMMSensorMerge
+    qint64 time; // Time of the measurement in nanoseconds since epoch
+    Vector z;
+    Matrix R; // Measurement uncertainty, if empty the one of the subfilter config is used
+};
+
+// Extrapolated state of one track
+struct AVIMMTrackOutput
+{
+    int handle;
+    qint64 time;
+    Vector x;
+    Matrix P;
+    Vector mode_probabilities;
+};
+
+// Holds the estimators of all targets. Target identifiers are interned into dense integer handles once, all further
+// calls use the handles. The tracks are stored in a slot map indexed by the handle, released handles are reused.
+// A track is created with the first plot of a target, the plot is used as initial state. Tracks which were not
+// updated for the track timeout are dropped on extrapolation, the handle of the target stays valid.
+// With a thread pool the tracks are updated and extrapolated in parallel. Plots of the same target are always
+// processed in their given order on one thread, so the results do not depend on the number of threads. If the global
+// model matrix cache is enabled, every pool thread uses its own cache with the same settings.
+class AVIMMTrackTable
+{
+    friend class TstAVIMMTrackTable;
+    friend class TstAVIMMThreadPool;
+public:
+    // Looks up the config of each new track by its initial state, like AVIMMEstimatorFactory
+    explicit AVIMMTrackTable(double track_timeout=1.0);
+    // Uses the given config for all tracks
+    explicit AVIMMTrackTable(const AVIMMConfigData& config, double track_timeout=1.0);
+    virtual ~AVIMMTrackTable() = default;
+
+    // Returns the handle of the target, a new handle is created for unknown targets
+    int internTarget(const QString& target);
+    // Returns the handle of the target or -1 if it is unknown
+    int findTarget(const QString& target) const;
+    const QString& getTarget(int handle) const;
+    // Drops the track of the target and releases the handle, it may be reused by the next interned target
+    void releaseTarget(int handle);
+    // Releases all targets which were not updated for the timeout in seconds before the given time (nanoseconds since
+    // epoch), returns the number of released targets
+    int releaseIdleTargets(qint64 time, double timeout);
+
+    // Creates the track of the plot's target or predicts and updates it
+    void addPlot(const AVIMMPlot& plot);
+    void addPlots(const AVIMMPlot* plots, int count);
+    void addPlots(const std::vector<AVIMMPlot>& plots) { addPlots(plots.data(), plots.size()); }
+
+    // Extrapolates all tracks to the given time (nanoseconds since epoch) and appends the results to output. Tracks
+    // which were not updated for the track timeout are dropped instead.
+    void extrapolateAll(qint64 time, std::vector<AVIMMTrackOutput>& output);
+
+    // Sets the pool used for bulk updates and extrapolations, the pool is not owned. nullptr calculates all tracks
+    // in the calling thread.
+    void setThreadPool(AVIMMThreadPool* thread_pool) { m_thread_pool = thread_pool; }
+    AVIMMThreadPool* getThreadPool() const { return m_thread_pool; }
+
+    bool hasTrack(int handle) const;
+    // Returns the estimator of the target's track or nullptr if it has no track
+    AVIMMEstimatorInterface* getEstimator(int handle) const;
+    int getNumberOfTracks() const { return m_number_of_tracks; }
+    int getNumberOfTargets() const { return m_handles.size(); }
+    double getTrackTimeout() const { return m_track_timeout; }
+
+private:
+    struct Slot
+    {
+        QString target;
+        AVIMMEstimatorPtr estimator; // nullptr if the target has no track
+        qint64 last_update;
+        bool used;
+    };
+
+    // Extrapolation of one track, written by the thread which calculated the track
+    struct Extrapolation
+    {
+        bool valid;
+        AVIMMTrackOutput output;
+    };
+
+    void dropTrack(Slot& slot);
+    // Runs function(i) for all i in [0, count), on the thread pool if one is set
+    void forEach(int count, const std::function<void(int)>& function);
+    // Creates the model matrix caches of the pool threads, or drops them if the global cache is disabled
+    void updateThreadCaches();
+
+    bool m_use_fixed_config;
+    AVIMMConfigData m_config;
+    double m_track_timeout;
+    qint64 m_track_timeout_ns;
+
+    QHash<QString, int> m_handles;
+    std::vector<Slot> m_slots;
+    std::vector<int> m_free_handles;
+    std::atomic<int> m_number_of_tracks;
+
+    AVIMMThreadPool* m_thread_pool;
+    // Model matrix cache of every pool thread, indexed by AVIMMThreadPool::getCurrentThread(). Empty without a pool
+    // or a global cache.
+    std::vector<std::unique_ptr<AVIMMModelMatrixCache>> m_thread_caches;
+    // Buffers of the bulk calls, kept to avoid allocations on every call
+    std::vector<int> m_plot_order;
+    std::vector<int> m_plot_groups;
+    std::vector<int> m_track_handles;
+    std::vector<Extrapolation> m_extrapolations;
+};
+
+#endif //AVIMM_TRACK_TABLE_H
@@ -0,0 +1,312 @@
+//
+// Created by felix on 9/4/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Microbenchmarks of the filter and estimator hot paths, reporting the cost per call as JSON
+ */
+
+// Counts the allocations of Eigen as well, see avimmallocationcounter.h
+#define AVIMM_COUNT_MALLOC
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <chrono>
+#include <iostream>
+
+#include "testhelper/avimmtester.h"
+#include "testhelper/avimmallocationcounter.h"
+#include "testhelper/avimmperfcounters.h"
+
+namespace
+{
+    // Keeps the compiler from removing calls whose results are not used otherwise
+    volatile double benchmark_sink = 0.0;
+
+    const qint64 SECOND = 1000000000LL;
+}
+
+// Runs operations repeatedly and reports nanoseconds, heap allocations and, if the hardware counters are available,
+// instructions and cycles per call. The number of calls is chosen so that each benchmark runs for the minimum time.
+class AVIMMBenchmark
+{
+public:
+    AVIMMBenchmark(double min_time, const QString& filter) : m_min_time(min_time), m_filter(filter) {}
+    virtual ~AVIMMBenchmark() = default;
+
+    // Runs the operation if the name contains the filter. The state dimension and the number of modes are reported
+    // as parameters of the benchmark, 0 if they do not apply.
+    template<typename Operation>
+    void run(const QString& name, int dimension, int modes, Operation operation);
+
+    QJsonObject getResults() const;
+
+private:
+    template<typename Operation>
+    static double time(Operation& operation, quint64 iterations);
+
+    double m_min_time;
+    QString m_filter;
+    AVIMMPerfCounters m_counters;
+    QJsonArray m_results;
+};
+
+//--------------------------------------------------------------------------
+
+template<typename Operation>
+double AVIMMBenchmark::time(Operation& operation, quint64 iterations)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (quint64 i = 0; i < iterations; i++)
+        operation();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------
+
+template<typename Operation>
+void AVIMMBenchmark::run(const QString& name, int dimension, int modes, Operation operation)
+{
+    if (!name.contains(m_filter))
+        return;
+
+    // Warms up and increases the number of calls until a tenth of the minimum time is reached
+    quint64 iterations = 1;
+    double elapsed = time(operation, iterations);
+    while (elapsed < m_min_time / 10.0)
+    {
+        iterations *= 10;
+        elapsed = time(operation, iterations);
+    }
+    iterations = std::max<quint64>(1, static_cast<quint64>(iterations * m_min_time / elapsed));
+
+    AVIMMAllocationCounter::start();
+    m_counters.start();
+    elapsed = time(operation, iterations);
+    m_counters.stop();
+    const int allocations = AVIMMAllocationCounter::stop();
+
+    QJsonObject result;
+    result["name"]                = name;
+    result["state_dimension"]     = dimension;
+    result["modes"]               = modes;
+    result["iterations"]          = static_cast<double>(iterations);
+    result["ns_per_op"]           = elapsed * 1e9 / iterations;
+    result["allocations_per_op"]  = static_cast<double>(allocations) / iterations;
+    result["instructions_per_op"] = m_counters.isAvailable(AVIMMPerfCounters::INSTRUCTIONS) ?
+        QJsonValue(static_cast<double>(m_counters.getValue(AVIMMPerfCounters::INSTRUCTIONS)) / iterations) :
+        QJsonValue();
+    result["cycles_per_op"]       = m_counters.isAvailable(AVIMMPerfCounters::CYCLES) ?
+        QJsonValue(static_cast<double>(m_counters.getValue(AVIMMPerfCounters::CYCLES)) / iterations) :
+        QJsonValue();
+    m_results.append(result);
+
+    std::cerr << name.toStdString() << " (dimension " << dimension << ", modes " << modes << "): "
+              << elapsed * 1e9 / iterations << " ns" << std::endl;
+}
+
+//--------------------------------------------------------------------------
+
+QJsonObject AVIMMBenchmark::getResults() const
+{
+    QJsonObject results;
+    results["min_time"]           = m_min_time;
+    results["counts_malloc"]      = AVIMMAllocationCounter::countsMalloc();
+    results["counters_available"] = m_counters.isAvailable(AVIMMPerfCounters::INSTRUCTIONS);
+    results["benchmarks"]         = m_results;
+    return results;
+}
+
+//--------------------------------------------------------------------------
+
+// Moves the positions of the true state by the velocities for one second, pairs of position and velocity indices
+void moveTruth(Vector& truth, const std::vector<std::pair<int, int>>& axes)
+{
+    for (const auto& axis : axes)
+        truth(axis.first) += truth(axis.second);
+}
+
+//--------------------------------------------------------------------------
+
+void benchmarkFilters(AVIMMBenchmark& benchmark, int dimension)
+{
+    const Matrix I = Matrix::Identity(dimension, dimension);
+    Matrix F = I;
+    Matrix Q = Matrix::Zero(dimension, dimension);
+    for (int i = 0; i < dimension; i += 2)
+    {
+        F(i,i+1) = 1.0;
+        Q.block(i,i, 2,2) << 1.0/3.0, 0.5, 0.5, 1.0;
+    }
+    Vector x = Vector::Zero(dimension);
+    Vector z = Vector::Constant(dimension, 0.5);
+
+    AVIMMKalmanFilter kalman_filter(x, F, I, I, Q, I, I, "benchmark");
+    benchmark.run("AVIMMKalmanFilter::predict", dimension, 0, [&]() { kalman_filter.predict(); });
+    benchmark.run("AVIMMKalmanFilter::update", dimension, 0, [&]() { kalman_filter.update(z, I); });
+
+    AVIMMExtendedKalmanFilter extended_kalman_filter(x, F, I, I, Q, I, I, I, "benchmark");
+    benchmark.run("AVIMMExtendedKalmanFilter::update", dimension, 0, [&]() { extended_kalman_filter.update(z, I); });
+
+    Matrix sigma = 2.0 * I;
+    sigma.diagonal(1).setConstant(0.5);
+    sigma.diagonal(-1).setConstant(0.5);
+    const Mvn mvn(x, sigma);
+    benchmark.run("Mvn::pdf", dimension, 0, [&]() { benchmark_sink = benchmark_sink + mvn.pdf(z); });
+
+    auto& parser = AVIMMConfigParser::singleton();
+    const AVMatrix<QString> process_noise = AVIMMTester::createProcessNoise(dimension, "0.1");
+    const AVIMMCompiledMatrixPtr compiled_process_noise = parser.compileMatrix(process_noise);
+    float dt = 1.0f;
+    benchmark.run("AVIMMConfigParser::calculateTimeDependentMatrices(uncompiled)", dimension, 0, [&]()
+    {
+        benchmark_sink = benchmark_sink + parser.calculateTimeDependentMatrices(process_noise, dt)(0, 0);
+    });
+    benchmark.run("AVIMMConfigParser::calculateTimeDependentMatrices(compiled)", dimension, 0, [&]()
+    {
+        benchmark_sink = benchmark_sink + parser.calculateTimeDependentMatrices(compiled_process_noise, dt)(0, 0);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+void benchmarkEstimator(AVIMMBenchmark& benchmark, const AVIMMConfigData& config, const Vector& initial_state,
+                        const std::vector<std::pair<int, int>>& axes)
+{
+    const int dimension = initial_state.size();
+    const int modes = config.sub_filter_config_keys.size();
+
+    AVIMMEstimator estimator(config, initial_state);
+    estimator.setTimestamp(0);
+    Vector truth = initial_state;
+    benchmark.run("AVIMMEstimator::predictAndUpdate", dimension, modes, [&]()
+    {
+        moveTruth(truth, axes);
+        estimator.predictAndUpdate(truth, DEFAULT_MATRIX, DEFAULT_VECTOR, estimator.getTimestamp() + SECOND);
+    });
+
+    benchmark.run("AVIMMEstimator::extrapolate", dimension, modes, [&]()
+    {
+        const std::pair<Vector, Matrix> result = estimator.extrapolate(DEFAULT_VECTOR,
+                                                                       estimator.getTimestamp() + SECOND);
+        benchmark_sink = benchmark_sink + result.first(0);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("avimmbenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the cost of single calls of the filters, the estimator and the config "
+                                     "in nanoseconds, heap allocations, instructions and cycles and writes the "
+                                     "results as JSON. The instructions and cycles are null if the hardware "
+                                     "counters cannot be read.");
+    parser.addHelpOption();
+    QCommandLineOption min_time_option("min-time", "Minimum duration of each benchmark in seconds, default 0.5.",
+                                       "seconds", "0.5");
+    QCommandLineOption filter_option("filter", "Only runs the benchmarks whose name contains the text.", "text");
+    QCommandLineOption output_option("output", "Writes the results to the file instead of stdout.", "file");
+    parser.addOptions({ min_time_option, filter_option, output_option });
+    parser.process(app);
+
+    bool min_time_ok = false;
+    const double min_time = parser.value(min_time_option).toDouble(&min_time_ok);
+    if (!min_time_ok || min_time <= 0.0)
+        parser.showHelp(1);
+
+    // Set singletons, the program name is ignored by the config
+    std::vector<char*> args;
+    QByteArray         dummy_arg("dummy");
+    args.push_back(dummy_arg.data());
+
+    AVEnvironment::setProcessName("imm_tester");
+    AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+    AVConfig2Global::singleton().initialize();
+
+    // Reads the airport areas and their configs, the synthetic configs are added to the same containers
+    AVIMMAirportConfigs::initializeSingleton();
+
+    AVIMMBenchmark benchmark(min_time, parser.value(filter_option));
+
+    for (int dimension : { 4, 6 })
+        benchmarkFilters(benchmark, dimension);
+
+    // Estimators with the configs of the airport areas, the target starts at the origin like in the test data
+    const QStringList& state_definition = AVIMMStaticConfigContainer::singleton().state_definition;
+    Vector initial_state = Vector::Zero(state_definition.size());
+    std::vector<std::pair<int, int>> airport_axes;
+    for (const QString& axis : { QString("x"), QString("y") })
+    {
+        const int position = state_definition.indexOf("pos_" + axis);
+        const int velocity = state_definition.indexOf("vel_" + axis);
+        if (position >= 0 && velocity >= 0)
+            airport_axes.emplace_back(position, velocity);
+    }
+    if (airport_axes.size() == 2)
+    {
+        initial_state(airport_axes[0].second) = 10.0;
+        initial_state(airport_axes[1].second) = 5.0;
+    }
+
+    benchmark.run("AVIMMAirportConfigs::getIMMConfigData", initial_state.size(), 0, [&]()
+    {
+        const AVIMMConfigData config = AVIMMAirportConfigs::singleton().getIMMConfigData(initial_state);
+        benchmark_sink = benchmark_sink + config.sub_filter_config_keys.size();
+    });
+
+    const AVIMMConfigData airport_config = AVIMMAirportConfigs::singleton().getIMMConfigData(initial_state);
+    if (!airport_config.sub_filter_config_keys.isEmpty())
+        benchmarkEstimator(benchmark, airport_config, initial_state, airport_axes);
+    else
+        std::cerr << "No airport area contains the origin, skipping the estimator with the airport config"
+                  << std::endl;
+
+    // Estimators with synthetic constant velocity configs of growing size
+    for (int dimension : { 4, 6 })
+    {
+        Vector state = Vector::Zero(dimension);
+        std::vector<std::pair<int, int>> axes;
+        for (int i = 0; i < dimension; i += 2)
+        {
+            axes.emplace_back(i, i + 1);
+            state(i + 1) = 10.0 / (i + 1);
+        }
+        for (int modes : { 2, 3, 4 })
+            benchmarkEstimator(benchmark, AVIMMTester::createConfigData(dimension, modes), state, axes);
+    }
+
+    int result = 0;
+    const QByteArray json = QJsonDocument(benchmark.getResults()).toJson();
+    if (parser.isSet(output_option))
+    {
+        QFile file(parser.value(output_option));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+        {
+            std::cerr << "Cannot write " << file.fileName().toStdString() << std::endl;
+            result = 1;
+        }
+    }
+    else
+        std::cout << json.constData();
+
+    AVIMMAirportConfigs::deleteSingleton();
+    AVConfig2Global::deleteSingleton();
+    return result;
+}
@@ -0,0 +1,57 @@
+//
+// Created by felix on 9/2/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Command line tool converting test data files into a binary plot recording
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <iostream>
+
+#include "testhelper/avimmtester.h"
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("avimmconvert");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts test data files into one binary plot recording, see AVIMMRecording. "
+                                     "The target of the plots is the index of their file.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("recording", "Binary recording to write, an existing file is replaced.");
+    parser.addPositionalArgument("test_data", "Test data files to convert.", "<test_data>...");
+    QCommandLineOption sensor_option("sensor", "Sensor id of all plots, default 0.", "id", "0");
+    parser.addOption(sensor_option);
+    parser.process(app);
+
+    bool sensor_ok = false;
+    const int sensor = parser.value(sensor_option).toInt(&sensor_ok);
+    QStringList arguments = parser.positionalArguments();
+    if (!sensor_ok || arguments.size() < 2)
+        parser.showHelp(1);
+
+    const QString recording = arguments.takeFirst();
+    if (!AVIMMTester::convertToRecording(arguments, recording, sensor))
+    {
+        std::cerr << "Cannot convert into " << recording.toStdString() << std::endl;
+        return 1;
+    }
+
+    AVIMMRecordingReader reader(recording);
+    std::cout << "Wrote " << reader.getNumberOfRows() << " plots in " << reader.getNumberOfBlocks() << " blocks to "
+              << recording.toStdString() << std::endl;
+    return 0;
+}
@@ -0,0 +1,110 @@
+//
+// Created by felix on 9/1/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Command line tool replaying recordings through IMM estimators, e.g. to check the capacity of a config
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <iostream>
+
+#include "testhelper/avimmreplay.h"
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("avimmreplay");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays recordings through IMM estimators and reports throughput, step "
+                                     "latency, peak memory usage and optionally hardware performance counters. Each "
+                                     "recording holds the initial state in the first line and one measurement per "
+                                     "following line, given as milliseconds since the start followed by the values.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("recordings", "Recordings to replay, all start at the same time.",
+                                 "<recording>...");
+    QCommandLineOption real_time_option("real-time", "Replays the recordings in real time instead of as fast as "
+                                                     "possible.");
+    QCommandLineOption speed_option("speed", "Speed factor of the real time replay, default 1.", "factor", "1");
+    QCommandLineOption estimators_option("estimators", "Number of estimators replaying each recording, default 1.",
+                                         "count", "1");
+    QCommandLineOption dynamic_option("dynamic", "Uses the dynamically sized estimator for all configs.");
+    QCommandLineOption perf_counters_option("perf-counters", "Reads the hardware performance counters (cycles, "
+                                                             "instructions, cache misses, branch misses, floating "
+                                                             "point operations) around every estimator step or "
+                                                             "around batches of steps. Needs perf_event_open.",
+                                            "step|batch");
+    QCommandLineOption batch_size_option("batch-size", "Steps per batch of the performance counters, default 100.",
+                                         "steps", QString::number(AVIMMPerfProfile::DEFAULT_BATCH_SIZE));
+    parser.addOptions({ real_time_option, speed_option, estimators_option, dynamic_option, perf_counters_option,
+                        batch_size_option });
+    parser.process(app);
+
+    bool speed_ok = false;
+    bool estimators_ok = false;
+    bool batch_size_ok = false;
+    const double speed = parser.value(speed_option).toDouble(&speed_ok);
+    const int number_of_estimators = parser.value(estimators_option).toInt(&estimators_ok);
+    const int batch_size = parser.value(batch_size_option).toInt(&batch_size_ok);
+    AVIMMPerfProfile::Mode perf_counter_mode = AVIMMPerfProfile::DISABLED;
+    if (parser.value(perf_counters_option) == "step")
+        perf_counter_mode = AVIMMPerfProfile::PER_STEP;
+    else if (parser.value(perf_counters_option) == "batch")
+        perf_counter_mode = AVIMMPerfProfile::PER_BATCH;
+    if (!speed_ok || speed <= 0.0 || !estimators_ok || number_of_estimators <= 0 || !batch_size_ok ||
+        batch_size <= 0 || (parser.isSet(perf_counters_option) && perf_counter_mode == AVIMMPerfProfile::DISABLED) ||
+        parser.positionalArguments().isEmpty())
+    {
+        parser.showHelp(1);
+    }
+
+    // Set singletons, the program name is ignored by the config
+    std::vector<char*> args;
+    QByteArray         dummy_arg("dummy");
+    args.push_back(dummy_arg.data());
+
+    AVEnvironment::setProcessName("imm_tester");
+    AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+    AVConfig2Global::singleton().initialize();
+
+    // Reads the airport areas and their configs, the estimators are created with the config of their area
+    AVIMMAirportConfigs::initializeSingleton();
+
+    int result = 0;
+    {
+        AVIMMReplay replay(parser.isSet(real_time_option) ? AVIMMReplay::REAL_TIME : AVIMMReplay::AS_FAST_AS_POSSIBLE,
+                           speed);
+        replay.setDynamicEstimators(parser.isSet(dynamic_option));
+        replay.setPerfCounterMode(perf_counter_mode, batch_size);
+        for (const QString& recording : parser.positionalArguments())
+        {
+            if (!replay.addRecording(recording, number_of_estimators))
+            {
+                std::cerr << "Cannot read recording " << recording.toStdString() << std::endl;
+                result = 1;
+            }
+        }
+
+        if (result == 0)
+        {
+            replay.run();
+            replay.printReport(std::cout);
+        }
+    }
+
+    AVIMMAirportConfigs::deleteSingleton();
+    AVConfig2Global::deleteSingleton();
+    return result;
+}
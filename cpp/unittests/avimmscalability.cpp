@@ -0,0 +1,157 @@
+//
+// Created by felix on 9/7/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Command line tool measuring how the estimators scale with the number of targets and threads
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QProcess>
+#include <iostream>
+
+#include "testhelper/avimmscalability.h"
+
+namespace
+{
+    // Parses a comma separated list of positive numbers, returns an empty list on errors
+    std::vector<int> parseList(const QString& text)
+    {
+        std::vector<int> values;
+        for (const QString& item : text.split(',', QString::SkipEmptyParts))
+        {
+            bool ok = false;
+            const int value = item.trimmed().toInt(&ok);
+            if (!ok || value <= 0)
+                return std::vector<int>();
+            values.push_back(value);
+        }
+        return values;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("avimmscalability");
+
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    QStringList default_threads;
+    for (int threads = 1; threads < cores; threads *= 2)
+        default_threads << QString::number(threads);
+    default_threads << QString::number(cores);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Tracks deterministic synthetic traffic spread over the airport areas with one "
+                                     "estimator per target as fast as possible. Prints the sustained throughput, "
+                                     "the percentiles of the update latency, the memory per track and the "
+                                     "contended locks of the model matrix caches for every combination of target "
+                                     "and thread count.");
+    parser.addHelpOption();
+    QCommandLineOption targets_option("targets", "Comma separated target counts, default "
+                                                 "1000,2000,5000,10000,20000,50000.",
+                                      "counts", "1000,2000,5000,10000,20000,50000");
+    QCommandLineOption threads_option("threads", "Comma separated thread counts, default powers of two up to the "
+                                                 "number of cores.", "counts", default_threads.join(','));
+    QCommandLineOption duration_option("duration", "Simulated seconds of traffic, default 30.", "seconds", "30");
+    QCommandLineOption seed_option("seed", "Seed of the traffic, default 1.", "seed", "1");
+    QCommandLineOption dynamic_option("dynamic", "Uses the dynamically sized estimator for all configs.");
+    QCommandLineOption shared_cache_option("shared-cache", "All threads use the global model matrix cache instead "
+                                                           "of one cache per thread.");
+    QCommandLineOption single_option("single", "Runs the first combination in this process and prints its result "
+                                               "without header. Used internally, every combination is run in its "
+                                               "own process so that the memory of one run does not hide the growth "
+                                               "of the next one.");
+    single_option.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOptions({ targets_option, threads_option, duration_option, seed_option, dynamic_option,
+                        shared_cache_option, single_option });
+    parser.process(app);
+
+    bool duration_ok = false;
+    bool seed_ok = false;
+    const double duration = parser.value(duration_option).toDouble(&duration_ok);
+    const quint64 seed = parser.value(seed_option).toULongLong(&seed_ok);
+    const std::vector<int> target_counts = parseList(parser.value(targets_option));
+    const std::vector<int> thread_counts = parseList(parser.value(threads_option));
+    if (!duration_ok || duration <= 0.0 || !seed_ok || target_counts.empty() || thread_counts.empty())
+        parser.showHelp(1);
+
+    if (!parser.isSet(single_option))
+    {
+        // Every combination runs in a child process with the same options, the target and thread counts appended
+        // last replace the lists
+        QStringList arguments = app.arguments().mid(1);
+        arguments << "--single";
+        AVIMMScalability::printHeader(std::cout);
+        std::cout << std::flush;
+
+        int result = 0;
+        for (int targets : target_counts)
+            for (int threads : thread_counts)
+            {
+                const QStringList combination = QStringList(arguments) << "--targets" << QString::number(targets)
+                                                                       << "--threads" << QString::number(threads);
+                QProcess process;
+                process.setProcessChannelMode(QProcess::ForwardedChannels);
+                process.start(app.applicationFilePath(), combination);
+                if (!process.waitForFinished(-1) || process.exitStatus() != QProcess::NormalExit ||
+                    process.exitCode() != 0)
+                    result = 1;
+            }
+        return result;
+    }
+
+    // Set singletons, the program name is ignored by the config
+    std::vector<char*> args;
+    QByteArray         dummy_arg("dummy");
+    args.push_back(dummy_arg.data());
+
+    AVEnvironment::setProcessName("imm_tester");
+    AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+    AVConfig2Global::singleton().initialize();
+
+    // Reads the airport areas and their configs, the estimators are created with the config of their area
+    AVIMMAirportConfigs::initializeSingleton();
+
+    int result = 0;
+    const QList<QPolygon> areas = AVIMMTrafficGenerator::getAirportAreas();
+    if (areas.isEmpty())
+    {
+        std::cerr << "No airport areas are configured" << std::endl;
+        result = 1;
+    }
+    else
+    {
+        AVIMMScalability scalability(areas, AVIMMStaticConfigContainer::singleton().state_definition, seed);
+        scalability.setDynamicEstimators(parser.isSet(dynamic_option));
+        scalability.setSharedModelMatrixCache(parser.isSet(shared_cache_option));
+
+        const int targets = target_counts.front();
+        const int threads = thread_counts.front();
+        const AVIMMScalability::Result run_result = scalability.run(targets, threads, duration);
+        AVIMMScalability::printResult(std::cout, run_result);
+
+        // With a cache per thread no thread ever waits for the lock of another one
+        if (!parser.isSet(shared_cache_option) && run_result.cache_contentions > 0)
+        {
+            std::cerr << run_result.cache_contentions << " contended model matrix cache locks with "
+                      << threads << " threads" << std::endl;
+            result = 1;
+        }
+    }
+
+    AVIMMAirportConfigs::deleteSingleton();
+    AVConfig2Global::deleteSingleton();
+    return result;
+}
@@ -0,0 +1,226 @@
+//
+// Created by felix on 8/6/20.
+//
+
+#ifndef AVIMMALLOCATIONCOUNTER_H
+#define AVIMMALLOCATIONCOUNTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations of the test process by replacing the global operator new, including the nothrow and
+// aligned versions. Must only be included by a single unit test, the replacement is global for the whole executable.
+// Eigen allocates with malloc and is checked with EIGEN_RUNTIME_NO_MALLOC instead. If AVIMM_COUNT_MALLOC is defined
+// before the include and the C library is glibc, malloc itself is replaced and all allocations including the ones of
+// Eigen are counted.
+class AVIMMAllocationCounter
+{
+public:
+    static void start()
+    {
+        allocations() = 0;
+        enabled()     = true;
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // Returns the number of allocations since start()
+    static int stop()
+    {
+        enabled() = false;
+        return allocations();
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    // True if the allocations with malloc are counted as well
+    static bool countsMalloc()
+    {
+#if defined(AVIMM_COUNT_MALLOC) && defined(__GLIBC__)
+        return true;
+#else
+        return false;
+#endif
+    }
+    
+    //--------------------------------------------------------------------------
+    
+    static void count()
+    {
+        if (enabled())
+            allocations()++;
+    }
+
+private:
+    static std::atomic<bool>& enabled()
+    {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+    
+    static std::atomic<int>& allocations()
+    {
+        static std::atomic<int> allocations(0);
+        return allocations;
+    }
+};
+
+//--------------------------------------------------------------------------
+
+#if defined(AVIMM_COUNT_MALLOC) && defined(__GLIBC__)
+
+// The allocator of glibc may be replaced by defining these functions, the replacements forward to its implementation.
+// operator new of the C++ library allocates with malloc.
+extern "C"
+{
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void __libc_free(void* pointer);
+
+void* malloc(std::size_t size)
+{
+    AVIMMAllocationCounter::count();
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t count, std::size_t size)
+{
+    AVIMMAllocationCounter::count();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, std::size_t size)
+{
+    AVIMMAllocationCounter::count();
+    return __libc_realloc(pointer, size);
+}
+
+void free(void* pointer)
+{
+    __libc_free(pointer);
+}
+}
+
+#else
+
+void* operator new(std::size_t size)
+{
+    AVIMMAllocationCounter::count();
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+// The nothrow versions are replaced separately, the default ones do not call the replaced operator new
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    AVIMMAllocationCounter::count();
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& nothrow) noexcept
+{
+    return operator new(size, nothrow);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+#if defined(__cpp_aligned_new)
+
+// Over aligned types, e.g. fixed size Eigen members with alignment requirements above the one of malloc
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    AVIMMAllocationCounter::count();
+    // aligned_alloc requires the size to be a multiple of the alignment
+    const std::size_t align = std::max(static_cast<std::size_t>(alignment), sizeof(void*));
+    return std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    if (void* pointer = operator new(size, alignment, std::nothrow))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& nothrow) noexcept
+{
+    return operator new(size, alignment, nothrow);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+#endif
+
+#endif
+
+#endif //AVIMMALLOCATIONCOUNTER_H
@@ -0,0 +1,493 @@
+//
+// Created by felix on 9/4/20.
+//
+
+#ifndef AVIMMPERFCOUNTERS_H
+#define AVIMMPERFCOUNTERS_H
+
+#include <QtGlobal>
+#include <cassert>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+
+#include "../../utils/avimmlatencyhistogram.h"
+
+#ifdef __linux__
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// Hardware performance counters of the calling thread, only counting user space. Uses perf_event_open on linux.
+// Events which cannot be opened (e.g. on other platforms, in virtual machines or if perf_event_paranoid forbids it)
+// are not available and always read as 0, the callers have to check isAvailable(). The events are opened as one
+// group so that all of them count the same instructions. If the CPU has too few counters for the group, they are
+// opened separately instead and multiplexed by the kernel, the values are then scaled estimates.
+class AVIMMPerfCounters
+{
+public:
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_READ_MISSES,
+        LLC_MISSES,
+        BRANCH_MISSES,
+        FP_OPERATIONS,   // Retired floating point arithmetic instructions, a SIMD instruction counts once. Only on the
+                         // Intel models listed in hasFpArithEvent().
+        NUMBER_OF_EVENTS
+    };
+
+    AVIMMPerfCounters() : m_leader(-1)
+    {
+        for (int event = 0; event < NUMBER_OF_EVENTS; event++)
+        {
+            m_fds[event]    = -1;
+            m_values[event] = 0;
+        }
+#ifdef __linux__
+        m_group_size      = 0;
+        m_group_scheduled = false;
+
+        // A group which can never be scheduled does not count at all, checked by measuring once
+        openEvents(true);
+        start();
+        stop();
+        if (m_leader >= 0 && !m_group_scheduled)
+        {
+            closeEvents();
+            openEvents(false);
+        }
+        for (quint64& value : m_values)
+            value = 0;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+
+    virtual ~AVIMMPerfCounters()
+    {
+#ifdef __linux__
+        closeEvents();
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+
+    bool isAvailable(Event event) const { return m_fds[event] >= 0; }
+
+    //--------------------------------------------------------------------------
+
+    // True if at least one event is available
+    bool isAvailable() const
+    {
+        for (int fd : m_fds)
+            if (fd >= 0)
+                return true;
+        return false;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // True if the events are counted as one group, false if they are multiplexed or not available
+    bool isGrouped() const { return m_leader >= 0; }
+
+    //--------------------------------------------------------------------------
+
+    static const char* getEventName(Event event)
+    {
+        static const char* const NAMES[NUMBER_OF_EVENTS] = {
+            "cycles", "instructions", "l1d read misses", "llc misses", "branch misses", "fp operations"
+        };
+        return NAMES[event];
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Resets and starts all available counters
+    void start()
+    {
+#ifdef __linux__
+        if (m_leader >= 0)
+        {
+            ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            return;
+        }
+        for (int fd : m_fds)
+        {
+            if (fd < 0)
+                continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Stops all counters and reads their values
+    void stop()
+    {
+#ifdef __linux__
+        if (m_leader >= 0)
+        {
+            ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            readGroup();
+            return;
+        }
+        for (int fd : m_fds)
+            if (fd >= 0)
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        for (int event = 0; event < NUMBER_OF_EVENTS; event++)
+            m_values[event] = read(m_fds[event]);
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Value counted between the last start() and stop()
+    quint64 getValue(Event event) const { return m_values[event]; }
+
+private:
+#ifdef __linux__
+    // Opens all events the CPU supports, as a group with the first opened event as leader or separately
+    void openEvents(bool grouped)
+    {
+        // Generic events of the kernel, the cache events map to the model specific events of the CPU
+        static const quint64 L1D_READ_MISS = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        const quint32 types[NUMBER_OF_EVENTS] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_RAW
+        };
+        const quint64 configs[NUMBER_OF_EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, L1D_READ_MISS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+            0xffc7 // FP_ARITH_INST_RETIRED with all umask bits (scalar and packed, single and double precision)
+        };
+
+        m_group_size = 0;
+        for (int event = 0; event < NUMBER_OF_EVENTS; event++)
+        {
+            // There is no generic event for floating point operations, the raw event is only opened on the models
+            // which define it. On other CPUs the same code may count something else or nothing at all.
+            if (event == FP_OPERATIONS && !hasFpArithEvent())
+                continue;
+            m_fds[event] = open(types[event], configs[event], grouped, m_leader);
+            if (m_fds[event] < 0 || !grouped)
+                continue;
+            if (m_leader < 0)
+                m_leader = m_fds[event];
+            m_group_events[m_group_size++] = static_cast<Event>(event);
+        }
+    }
+
+    //--------------------------------------------------------------------------
+
+    void closeEvents()
+    {
+        // The members of a group are closed before the leader
+        for (int& fd : m_fds)
+        {
+            if (fd >= 0 && fd != m_leader)
+                close(fd);
+            fd = -1;
+        }
+        if (m_leader >= 0)
+            close(m_leader);
+        m_leader = -1;
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Opens an event disabled, the members of a group (leader >= 0) are enabled and disabled with their leader
+    static int open(quint32 type, quint64 config, bool grouped, int leader)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.disabled       = leader < 0 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        if (grouped)
+            attr.read_format |= PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Reads a counter, scaled up if the kernel multiplexed it with other events
+    static quint64 read(int fd)
+    {
+        quint64 data[3] = { 0, 0, 0 }; // value, time enabled, time running
+        if (fd < 0 || ::read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0)
+            return 0;
+        if (data[2] >= data[1])
+            return data[0];
+        return static_cast<quint64>(static_cast<double>(data[0]) * data[1] / data[2]);
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Reads all counters of the group at once, they are in the order in which they were opened
+    void readGroup()
+    {
+        quint64 data[3 + NUMBER_OF_EVENTS]; // number of values, time enabled, time running, values
+        const ssize_t size = static_cast<ssize_t>((3 + m_group_size) * sizeof(quint64));
+        m_group_scheduled = ::read(m_leader, data, sizeof(data)) == size && data[2] > 0;
+        for (int i = 0; i < m_group_size; i++)
+        {
+            quint64 value = m_group_scheduled ? data[3 + i] : 0;
+            if (m_group_scheduled && data[2] < data[1])
+                value = static_cast<quint64>(static_cast<double>(value) * data[1] / data[2]);
+            m_values[m_group_events[i]] = value;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+
+    static bool isIntel()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+            return false;
+        // "GenuineIntel"
+        return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e;
+#else
+        return false;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+
+    // True if the CPU defines FP_ARITH_INST_RETIRED as event 0xc7, like the Intel big cores since Broadwell. Hybrid
+    // CPUs are excluded, they have one PMU per core type instead of the "cpu" PMU and the raw event could be opened
+    // on the wrong one.
+    static bool hasFpArithEvent()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        if (!isIntel() || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        const unsigned int family = (eax >> 8) & 0xf;
+        const unsigned int model  = ((eax >> 4) & 0xf) | (((eax >> 16) & 0xf) << 4);
+        if (family != 6)
+            return false;
+
+        static const unsigned int MODELS[] = {
+            0x3d, 0x47, 0x4f, 0x56,             // Broadwell
+            0x4e, 0x5e, 0x55,                   // Skylake, Cascade Lake, Cooper Lake
+            0x8e, 0x9e, 0xa5, 0xa6,             // Kaby Lake, Coffee Lake, Comet Lake
+            0x66, 0x7d, 0x7e, 0x6a, 0x6c,       // Cannon Lake, Ice Lake
+            0x8c, 0x8d, 0xa7,                   // Tiger Lake, Rocket Lake
+            0x8f, 0xcf, 0xad, 0xae              // Sapphire Rapids, Emerald Rapids, Granite Rapids
+        };
+        bool known = false;
+        for (unsigned int known_model : MODELS)
+            known = known || model == known_model;
+        return known && access("/sys/bus/event_source/devices/cpu", F_OK) == 0;
+#else
+        return false;
+#endif
+    }
+
+    Event m_group_events[NUMBER_OF_EVENTS];
+    int m_group_size;
+    bool m_group_scheduled;
+#endif
+
+    int m_leader;
+    int m_fds[NUMBER_OF_EVENTS];
+    quint64 m_values[NUMBER_OF_EVENTS];
+};
+
+//--------------------------------------------------------------------------
+
+// Sums the hardware counters over the estimator steps of a test harness run. PER_STEP reads the counters around
+// every single step and keeps the distribution of the cycles, the counted code then includes a few instructions of
+// the ioctl calls. PER_BATCH reads them around batches of steps, which only gives totals and includes the work of
+// the harness between the steps, but hardly disturbs the caches and branch predictors. Nothing is opened or counted
+// if the profile is disabled.
+class AVIMMPerfProfile
+{
+public:
+    enum Mode
+    {
+        DISABLED,
+        PER_STEP,
+        PER_BATCH
+    };
+
+    static const int DEFAULT_BATCH_SIZE = 100;
+
+    explicit AVIMMPerfProfile(Mode mode=DISABLED, int batch_size=DEFAULT_BATCH_SIZE)
+    {
+        setMode(mode, batch_size);
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Opens the counters for the mode if needed and clears the totals
+    void setMode(Mode mode, int batch_size=DEFAULT_BATCH_SIZE)
+    {
+        assert(batch_size > 0);
+        m_mode       = mode;
+        m_batch_size = mode == PER_BATCH ? batch_size : 1;
+        if (mode == DISABLED)
+            m_counters.reset();
+        else if (!m_counters)
+            m_counters.reset(new AVIMMPerfCounters());
+        reset();
+    }
+
+    //--------------------------------------------------------------------------
+
+    Mode getMode() const { return m_mode; }
+    int getBatchSize() const { return m_batch_size; }
+    bool isEnabled() const { return m_mode != DISABLED; }
+    bool isAvailable(AVIMMPerfCounters::Event event) const { return m_counters && m_counters->isAvailable(event); }
+    bool isAvailable() const { return m_counters && m_counters->isAvailable(); }
+
+    //--------------------------------------------------------------------------
+
+    void reset()
+    {
+        for (quint64& total : m_totals)
+            total = 0;
+        m_steps       = 0;
+        m_batch_steps = 0;
+        m_batches     = 0;
+        m_cycles.reset();
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Called before every step, starts the counters for the step or the first step of a batch
+    void beginStep()
+    {
+        if (m_mode != DISABLED && m_batch_steps == 0)
+            m_counters->start();
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Called after every step, reads the counters after the step or the last step of a batch
+    void endStep()
+    {
+        if (m_mode == DISABLED)
+            return;
+        m_steps++;
+        if (++m_batch_steps == m_batch_size)
+            readCounters();
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Reads the counters of an incomplete last batch, called after the last step of a run
+    void finish()
+    {
+        if (m_mode != DISABLED && m_batch_steps > 0)
+            readCounters();
+    }
+
+    //--------------------------------------------------------------------------
+
+    quint64 getNumberOfSteps() const { return m_steps; }
+    quint64 getNumberOfBatches() const { return m_batches; }
+    quint64 getTotal(AVIMMPerfCounters::Event event) const { return m_totals[event]; }
+    double getPerStep(AVIMMPerfCounters::Event event) const
+    {
+        return m_steps > 0 ? static_cast<double>(m_totals[event]) / m_steps : 0.0;
+    }
+    // Cycles of the single steps, only recorded in PER_STEP mode
+    const AVIMMLatencyHistogram& getCyclesPerStep() const { return m_cycles; }
+
+    //--------------------------------------------------------------------------
+
+    // Prints the counters per step and the ratios showing whether the steps are bound by memory or by computation
+    void print(std::ostream& stream) const
+    {
+        if (m_mode == DISABLED)
+            return;
+        stream << "perf counters: ";
+        if (m_mode == PER_STEP)
+            stream << "per step\n";
+        else
+            stream << "per batch of " << m_batch_size << " steps\n";
+        if (!isAvailable())
+        {
+            stream << "  unavailable, see /proc/sys/kernel/perf_event_paranoid\n";
+            return;
+        }
+        if (!m_counters->isGrouped())
+            stream << "  multiplexed, the values are estimates\n";
+
+        stream << std::fixed << std::setprecision(1);
+        for (int i = 0; i < AVIMMPerfCounters::NUMBER_OF_EVENTS; i++)
+        {
+            const AVIMMPerfCounters::Event event = static_cast<AVIMMPerfCounters::Event>(i);
+            stream << "  " << std::left << std::setw(17) << AVIMMPerfCounters::getEventName(event) << std::right;
+            if (!isAvailable(event))
+            {
+                stream << "unavailable\n";
+                continue;
+            }
+            stream << getPerStep(event) << " per step";
+            if (event == AVIMMPerfCounters::CYCLES && m_mode == PER_STEP)
+            {
+                stream << "  p50 " << m_cycles.getPercentile(50.0) << "  p99 " << m_cycles.getPercentile(99.0)
+                       << "  max " << m_cycles.getMax();
+            }
+            else if (event != AVIMMPerfCounters::CYCLES && event != AVIMMPerfCounters::INSTRUCTIONS &&
+                     getTotal(AVIMMPerfCounters::INSTRUCTIONS) > 0)
+            {
+                stream << "  " << std::setprecision(2)
+                       << 1000.0 * getTotal(event) / getTotal(AVIMMPerfCounters::INSTRUCTIONS)
+                       << " per 1000 instructions" << std::setprecision(1);
+            }
+            stream << "\n";
+        }
+        if (getTotal(AVIMMPerfCounters::CYCLES) > 0 && getTotal(AVIMMPerfCounters::INSTRUCTIONS) > 0)
+        {
+            stream << "  instructions per cycle " << std::setprecision(2)
+                   << static_cast<double>(getTotal(AVIMMPerfCounters::INSTRUCTIONS)) /
+                      getTotal(AVIMMPerfCounters::CYCLES) << "\n";
+        }
+    }
+
+private:
+    void readCounters()
+    {
+        m_counters->stop();
+        for (int event = 0; event < AVIMMPerfCounters::NUMBER_OF_EVENTS; event++)
+            m_totals[event] += m_counters->getValue(static_cast<AVIMMPerfCounters::Event>(event));
+        if (m_mode == PER_STEP && m_counters->isAvailable(AVIMMPerfCounters::CYCLES))
+            m_cycles.record(m_counters->getValue(AVIMMPerfCounters::CYCLES));
+        m_batch_steps = 0;
+        m_batches++;
+    }
+
+    Mode m_mode;
+    int m_batch_size;
+    std::unique_ptr<AVIMMPerfCounters> m_counters;
+    quint64 m_totals[AVIMMPerfCounters::NUMBER_OF_EVENTS];
+    quint64 m_steps;
+    int m_batch_steps;
+    quint64 m_batches;
+    AVIMMLatencyHistogram m_cycles;
+};
+
+#endif //AVIMMPERFCOUNTERS_H
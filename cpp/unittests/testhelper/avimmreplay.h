@@ -0,0 +1,257 @@
+//
+// Created by felix on 9/1/20.
+//
+
+#ifndef AVIMMREPLAY_H
+#define AVIMMREPLAY_H
+
+#include "avimmperfcounters.h"
+#include "avimmtester.h"
+#include "../../utils/avimmlatencyhistogram.h"
+#include "../../utils/avimmstagetiming.h"
+
+#include <chrono>
+#include <iomanip>
+#include <queue>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+// Streams recordings in the AVIMMTester format through estimators, the files are mapped and parsed in place by
+// AVIMMCsvReader and the results are not kept. Each recording is replayed by one or more estimators, the plots of
+// all recordings are processed in the order of their time. Every recording starts at time 0. Measures the duration
+// of every estimator step.
+class AVIMMReplay
+{
+public:
+    enum Mode
+    {
+        AS_FAST_AS_POSSIBLE,
+        REAL_TIME           // Waits until the time of each plot, scaled by the speed factor
+    };
+
+    explicit AVIMMReplay(Mode mode=AS_FAST_AS_POSSIBLE, double speed=1.0);
+    virtual ~AVIMMReplay() = default;
+
+    // Always uses AVIMMEstimator instead of the fastest estimator given by AVIMMEstimatorFactory
+    void setDynamicEstimators(bool dynamic) { m_dynamic_estimators = dynamic; }
+    // Adds a recording replayed by the given number of estimators. Returns false if it cannot be read.
+    bool addRecording(const QString& file_name, int number_of_estimators=1);
+    // Reads the hardware performance counters around the estimator steps, disabled by default. In PER_STEP mode the
+    // counted code includes the two clock reads for the latency.
+    void setPerfCounterMode(AVIMMPerfProfile::Mode mode, int batch_size=AVIMMPerfProfile::DEFAULT_BATCH_SIZE)
+    {
+        m_perf_profile.setMode(mode, batch_size);
+    }
+
+    void run();
+    // Prints throughput, step latency percentiles, the stage timing if compiled in, the performance counters if
+    // enabled and peak memory usage
+    void printReport(std::ostream& stream) const;
+
+    // Number of lines read from the recordings, without the initial states
+    quint64 getNumberOfRecords() const { return m_records; }
+    // Number of plots processed by all estimators
+    quint64 getNumberOfPlots() const { return m_latency.getCount(); }
+    int getNumberOfEstimators() const;
+    double getElapsedTime() const { return m_elapsed_time; }
+    double getPlotsPerSecond() const { return m_elapsed_time > 0.0 ? getNumberOfPlots() / m_elapsed_time : 0.0; }
+    // Step durations in nanoseconds
+    const AVIMMLatencyHistogram& getLatency() const { return m_latency; }
+    // Maximum delay of a plot behind its scheduled time in real time mode, in seconds
+    double getMaxLag() const { return m_max_lag; }
+    const AVIMMPerfProfile& getPerfProfile() const { return m_perf_profile; }
+    const AVIMMEstimatorInterface& getEstimator(int recording, int index) const
+    {
+        return *m_recordings[recording]->estimators[index];
+    }
+
+    // Maximum resident set size of the process in kilobytes, -1 if unknown
+    static long getPeakRss();
+
+private:
+    struct Recording
+    {
+        explicit Recording(const QString& file_name) : file(file_name) {}
+
+        AVIMMCsvReader file;
+        double time_ms; // Time and measurement of the next record
+        Vector z;
+        std::vector<AVIMMEstimatorPtr> estimators;
+    };
+
+    // Next plot of a recording, the recording with the oldest plot is replayed first
+    typedef std::pair<double, int> Head;
+
+    Mode m_mode;
+    double m_speed;
+    bool m_dynamic_estimators;
+    std::vector<std::unique_ptr<Recording>> m_recordings;
+
+    quint64 m_records;
+    double m_elapsed_time;
+    double m_max_lag;
+    AVIMMLatencyHistogram m_latency;
+    AVIMMPerfProfile m_perf_profile;
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMReplay::AVIMMReplay(Mode mode, double speed)
+    : m_mode(mode), m_speed(speed), m_dynamic_estimators(false), m_records(0), m_elapsed_time(0.0), m_max_lag(0.0)
+{
+    assert(speed > 0.0);
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMReplay::addRecording(const QString& file_name, int number_of_estimators)
+{
+    assert(number_of_estimators > 0);
+    std::unique_ptr<Recording> recording(new Recording(file_name));
+
+    // The first record is the initial state, like in AVIMMTester
+    Vector initial_state;
+    double time_ms;
+    if (!recording->file.readRecord(time_ms, initial_state))
+        return false;
+
+    for (int i = 0; i < number_of_estimators; i++)
+    {
+        AVIMMEstimatorPtr estimator = m_dynamic_estimators ?
+                                      AVIMMEstimatorPtr(new AVIMMEstimator(initial_state)) :
+                                      AVIMMEstimatorFactory::createEstimator(initial_state);
+        estimator->setTimestamp(0);
+        recording->estimators.push_back(std::move(estimator));
+    }
+    m_recordings.push_back(std::move(recording));
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMReplay::getNumberOfEstimators() const
+{
+    int number_of_estimators = 0;
+    for (const auto& recording : m_recordings)
+        number_of_estimators += recording->estimators.size();
+    return number_of_estimators;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMReplay::run()
+{
+    typedef std::chrono::steady_clock Clock;
+
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (int i = 0; i < static_cast<int>(m_recordings.size()); i++)
+    {
+        Recording& recording = *m_recordings[i];
+        if (recording.file.readRecord(recording.time_ms, recording.z))
+            heads.push(Head(recording.time_ms, i));
+    }
+
+    AVIMMStageTiming::reset();
+    m_perf_profile.reset();
+    const Clock::time_point start = Clock::now();
+    while (!heads.empty())
+    {
+        const int index = heads.top().second;
+        Recording& recording = *m_recordings[index];
+        heads.pop();
+        m_records++;
+
+        if (m_mode == REAL_TIME)
+        {
+            const Clock::time_point scheduled =
+                start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double, std::milli>(recording.time_ms / m_speed));
+            const Clock::time_point now = Clock::now();
+            if (now < scheduled)
+                std::this_thread::sleep_until(scheduled);
+            else
+                m_max_lag = std::max(m_max_lag, std::chrono::duration<double>(now - scheduled).count());
+        }
+
+        const qint64 timestamp = static_cast<qint64>(recording.time_ms * 1e6);
+        for (auto& estimator : recording.estimators)
+        {
+            // The ioctl calls of the counters are not part of the latency
+            m_perf_profile.beginStep();
+            const Clock::time_point step_start = Clock::now();
+            estimator->predictAndUpdate(recording.z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+            const Clock::time_point step_end = Clock::now();
+            m_perf_profile.endStep();
+            m_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(step_end - step_start).count());
+        }
+
+        if (recording.file.readRecord(recording.time_ms, recording.z))
+            heads.push(Head(recording.time_ms, index));
+    }
+    m_perf_profile.finish();
+    m_elapsed_time = std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMReplay::printReport(std::ostream& stream) const
+{
+    stream << std::fixed << std::setprecision(1);
+    stream << "recordings:   " << m_recordings.size() << "\n";
+    stream << "estimators:   " << getNumberOfEstimators() << "\n";
+    stream << "records:      " << m_records << "\n";
+    stream << "plots:        " << getNumberOfPlots() << "\n";
+    stream << "elapsed:      " << std::setprecision(3) << m_elapsed_time << " s\n";
+    stream << "throughput:   " << std::setprecision(1) << getPlotsPerSecond() << " plots/s\n";
+    if (m_mode == REAL_TIME)
+        stream << "max lag:      " << std::setprecision(3) << m_max_lag * 1e3 << " ms\n";
+    stream << "latency [ns]: min " << m_latency.getMin()
+           << "  mean " << std::setprecision(1) << m_latency.getMean()
+           << "  p50 " << m_latency.getPercentile(50.0)
+           << "  p90 " << m_latency.getPercentile(90.0)
+           << "  p99 " << m_latency.getPercentile(99.0)
+           << "  p99.9 " << m_latency.getPercentile(99.9)
+           << "  max " << m_latency.getMax() << "\n";
+
+    // Stages of all estimator steps of the process since the start of the replay
+    if (AVIMMStageTiming::isEnabled())
+    {
+        const AVIMMStageTiming::Snapshot stages = AVIMMStageTiming::getSnapshot();
+        stream << "stages [ticks]:\n";
+        for (int stage = 0; stage < AVIMMStageTiming::NUMBER_OF_STAGES; stage++)
+        {
+            const AVIMMLatencyHistogram& histogram = stages[stage];
+            stream << "  " << std::left << std::setw(20)
+                   << AVIMMStageTiming::getStageName(static_cast<AVIMMStageTiming::Stage>(stage)) << std::right
+                   << "mean " << std::setprecision(1) << histogram.getMean()
+                   << "  p50 " << histogram.getPercentile(50.0)
+                   << "  p99 " << histogram.getPercentile(99.0)
+                   << "  max " << histogram.getMax() << "\n";
+        }
+    }
+
+    m_perf_profile.print(stream);
+
+    const long peak_rss = getPeakRss();
+    if (peak_rss >= 0)
+        stream << "peak rss:     " << peak_rss << " kB\n";
+    else
+        stream << "peak rss:     unknown\n";
+}
+
+//--------------------------------------------------------------------------
+
+long AVIMMReplay::getPeakRss()
+{
+#ifdef __linux__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+    return -1;
+}
+
+#endif //AVIMMREPLAY_H
@@ -0,0 +1,267 @@
+//
+// Created by felix on 9/7/20.
+//
+
+#ifndef AVIMMSCALABILITY_H
+#define AVIMMSCALABILITY_H
+
+#include "avimmtraffic.h"
+#include "../../utils/avimmlatencyhistogram.h"
+
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// Drives one estimator per target of synthetic airport traffic as fast as possible, to find the number of targets
+// one process can track. The targets are split into contiguous ranges, one per thread, and every thread creates
+// and updates the estimators of its targets. The threads advance their targets through the simulated time in slices,
+// so every estimator is touched once per sensor period like in live operation.
+// If the model matrix cache is enabled, every thread uses its own cache like the pool threads of AVIMMTrackTable.
+// Reports the throughput, the latency of every estimator update, the memory used per track and how often the threads
+// had to wait for the lock of a model matrix cache.
+class AVIMMScalability
+{
+public:
+    struct Result
+    {
+        int targets;
+        int threads;
+        double duration; // Simulated seconds
+        quint64 plots;   // Updates of existing tracks, the first plot of each target only creates its track
+        double elapsed;  // Wall clock seconds
+        double plots_per_second;
+        // Update latency in nanoseconds
+        double latency_mean;
+        quint64 latency_p50;
+        quint64 latency_p99;
+        quint64 latency_p999;
+        quint64 latency_max;
+        // Growth of the resident set size divided by the targets, -1 if unknown. Memory freed by an earlier run stays
+        // resident and is reused, so only the first run of a process measures the growth reliably.
+        double bytes_per_track;
+        quint64 cache_contentions; // Locks of the model matrix caches which had to wait for another thread
+        double position_error;  // Root mean square distance of the tracks to the true position at the end in metres
+    };
+
+    AVIMMScalability(const QList<QPolygon>& areas, const QStringList& state_definition, quint64 seed=1);
+    virtual ~AVIMMScalability() = default;
+
+    // Always uses AVIMMEstimator instead of the fastest estimator given by AVIMMEstimatorFactory
+    void setDynamicEstimators(bool dynamic) { m_dynamic_estimators = dynamic; }
+    // All threads use the global model matrix cache instead of their own one, to measure the contention on its lock
+    void setSharedModelMatrixCache(bool shared) { m_shared_model_matrix_cache = shared; }
+
+    // Runs the given number of targets for the simulated duration in seconds
+    Result run(int targets, int threads, double duration) const;
+
+    static void printHeader(std::ostream& stream);
+    static void printResult(std::ostream& stream, const Result& result);
+
+    // Current resident set size of the process in bytes, -1 if unknown
+    static qint64 getResidentSize();
+
+private:
+    // Estimators and measurements of the targets of one thread
+    struct Worker
+    {
+        int first_target;
+        int last_target; // Exclusive
+        std::vector<AVIMMEstimatorPtr> estimators;
+        // nullptr if the global cache is used
+        std::unique_ptr<AVIMMModelMatrixCache> cache;
+        AVIMMLatencyHistogram latency;
+        double squared_error;
+        int tracks;
+    };
+
+    void runWorker(AVIMMTrafficGenerator& traffic, Worker& worker, double duration) const;
+
+    QList<QPolygon> m_areas;
+    QStringList m_state_definition;
+    quint64 m_seed;
+    bool m_dynamic_estimators;
+    bool m_shared_model_matrix_cache;
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMScalability::AVIMMScalability(const QList<QPolygon>& areas, const QStringList& state_definition, quint64 seed)
+    : m_areas(areas), m_state_definition(state_definition), m_seed(seed), m_dynamic_estimators(false),
+      m_shared_model_matrix_cache(false)
+{
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMScalability::Result AVIMMScalability::run(int targets, int threads, double duration) const
+{
+    assert(targets > 0 && threads > 0 && duration > 0.0);
+    AVIMMTrafficGenerator traffic(m_areas, m_state_definition, targets, m_seed);
+    AVIMMModelMatrixCache* global_cache = AVIMMConfigParser::singleton().getGlobalModelMatrixCache();
+    if (global_cache)
+        global_cache->resetStatistics();
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < threads; i++)
+    {
+        std::unique_ptr<Worker> worker(new Worker);
+        worker->first_target  = static_cast<qint64>(targets) * i / threads;
+        worker->last_target   = static_cast<qint64>(targets) * (i + 1) / threads;
+        worker->squared_error = 0.0;
+        worker->tracks        = 0;
+        if (global_cache && !m_shared_model_matrix_cache)
+        {
+            worker->cache.reset(new AVIMMModelMatrixCache(global_cache->getQuantizationStep(),
+                                                          global_cache->getCapacity()));
+            AVIMMAirportConfigs::singleton().prewarmModelMatrixCache(*worker->cache);
+        }
+        workers.push_back(std::move(worker));
+    }
+
+    const qint64 resident_size = getResidentSize();
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> worker_threads;
+    for (auto& worker : workers)
+        worker_threads.emplace_back(&AVIMMScalability::runWorker, this, std::ref(traffic), std::ref(*worker), duration);
+    for (auto& thread : worker_threads)
+        thread.join();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Measured while the estimators still exist
+    const qint64 grown_resident_size = getResidentSize();
+
+    AVIMMLatencyHistogram latency;
+    double squared_error = 0.0;
+    int tracks = 0;
+    quint64 cache_contentions = global_cache ? global_cache->getContentions() : 0;
+    for (const auto& worker : workers)
+    {
+        latency.merge(worker->latency);
+        squared_error += worker->squared_error;
+        tracks += worker->tracks;
+        if (worker->cache)
+            cache_contentions += worker->cache->getContentions();
+    }
+
+    Result result;
+    result.targets          = targets;
+    result.threads          = threads;
+    result.duration         = duration;
+    result.plots            = latency.getCount();
+    result.elapsed          = elapsed;
+    result.plots_per_second = elapsed > 0.0 ? result.plots / elapsed : 0.0;
+    result.latency_mean     = latency.getMean();
+    result.latency_p50      = latency.getPercentile(50.0);
+    result.latency_p99      = latency.getPercentile(99.0);
+    result.latency_p999     = latency.getPercentile(99.9);
+    result.latency_max      = latency.getMax();
+    result.bytes_per_track  = resident_size >= 0 && grown_resident_size >= 0 ?
+                              static_cast<double>(grown_resident_size - resident_size) / targets : -1.0;
+    result.cache_contentions = cache_contentions;
+    result.position_error   = tracks > 0 ? std::sqrt(squared_error / tracks) : 0.0;
+    return result;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMScalability::runWorker(AVIMMTrafficGenerator& traffic, Worker& worker, double duration) const
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // The shortest sensor period, so that a target gets about one plot per slice
+    const double SLICE = 0.5;
+
+    const int pos_x = m_state_definition.indexOf("pos_x");
+    const int pos_y = m_state_definition.indexOf("pos_y");
+    worker.estimators.resize(worker.last_target - worker.first_target);
+    AVIMMConfigParser::setThreadModelMatrixCache(worker.cache.get());
+
+    Vector z;
+    for (double slice_end = SLICE; slice_end < duration + SLICE; slice_end += SLICE)
+    {
+        const double end = std::min(slice_end, duration);
+        for (int target = worker.first_target; target < worker.last_target; target++)
+        {
+            AVIMMEstimatorPtr& estimator = worker.estimators[target - worker.first_target];
+            while (traffic.getNextPlotTime(target) < end)
+            {
+                const qint64 timestamp = static_cast<qint64>(traffic.getNextPlotTime(target) * 1e9);
+                traffic.nextPlot(target, z);
+
+                // The first plot is the initial state of the track
+                if (!estimator)
+                {
+                    estimator = m_dynamic_estimators ? AVIMMEstimatorPtr(new AVIMMEstimator(z)) :
+                                                       AVIMMEstimatorFactory::createEstimator(z);
+                    estimator->setTimestamp(timestamp);
+                    continue;
+                }
+
+                const Clock::time_point step_start = Clock::now();
+                estimator->predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+                worker.latency.record(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - step_start).count());
+            }
+        }
+    }
+    AVIMMConfigParser::setThreadModelMatrixCache(nullptr);
+
+    // Distance of the tracks to the true position at their last plot
+    if (pos_x < 0 || pos_y < 0)
+        return;
+    for (int target = worker.first_target; target < worker.last_target; target++)
+    {
+        const AVIMMEstimatorPtr& estimator = worker.estimators[target - worker.first_target];
+        if (!estimator)
+            continue;
+        const Vector x = estimator->getStateVector();
+        const QPointF position = traffic.getTruePosition(target);
+        const double dx = x(pos_x) - position.x();
+        const double dy = x(pos_y) - position.y();
+        worker.squared_error += dx * dx + dy * dy;
+        worker.tracks++;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMScalability::printHeader(std::ostream& stream)
+{
+    stream << std::setw(8) << "targets" << std::setw(8) << "threads" << std::setw(11) << "plots"
+           << std::setw(13) << "plots/s" << std::setw(10) << "p50 ns" << std::setw(10) << "p99 ns"
+           << std::setw(10) << "p999 ns" << std::setw(11) << "max ns" << std::setw(13) << "bytes/track"
+           << std::setw(11) << "contended" << std::setw(10) << "error m" << "\n";
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMScalability::printResult(std::ostream& stream, const Result& result)
+{
+    stream << std::fixed << std::setprecision(0)
+           << std::setw(8) << result.targets << std::setw(8) << result.threads << std::setw(11) << result.plots
+           << std::setw(13) << result.plots_per_second << std::setw(10) << result.latency_p50
+           << std::setw(10) << result.latency_p99 << std::setw(10) << result.latency_p999
+           << std::setw(11) << result.latency_max << std::setw(13) << result.bytes_per_track
+           << std::setw(11) << result.cache_contentions
+           << std::setw(10) << std::setprecision(2) << result.position_error << std::endl;
+}
+
+//--------------------------------------------------------------------------
+
+qint64 AVIMMScalability::getResidentSize()
+{
+#ifdef __linux__
+    // The second number is the resident set size in pages
+    std::ifstream statm("/proc/self/statm");
+    qint64 size = 0;
+    qint64 resident = 0;
+    if (statm >> size >> resident)
+        return resident * sysconf(_SC_PAGESIZE);
+#endif
+    return -1;
+}
+
+#endif //AVIMMSCALABILITY_H
@@ -5,20 +5,34 @@
 #ifndef QT3_SVN_AVIMMTESTER_H
 #define QT3_SVN_AVIMMTESTER_H
 
+#include <QDateTime>
 #include <avenvironment.h>
 #include <avmacros.h>
+#include <cmath>
 #include <fstream>
 #include <list>
+#include <queue>
 
 #include "../../filterlib/avimmextendedkalmanfilter.cpp"
 #include "../../filterlib/avimmkalmanfilter.cpp"
 #include "../../filterlib/avimmestimator.cpp"
+#include "../../filterlib/avimmestimatorfactory.cpp"
+#include "../../filterlib/avimmpipeline.cpp"
+#include "../../filterlib/avimmrecording.cpp"
+#include "../../filterlib/avimmsensormerge.cpp"
+#include "../../filterlib/avimmshardedtracktable.cpp"
+#include "../../filterlib/avimmtracktable.cpp"
 #include "../../utils/avimmconfig.cpp"
 #include "../../utils/avimmconfigparser.h"
+#include "../../utils/avimmcsvreader.cpp"
+#include "../../utils/avimmindexmap.cpp"
+#include "../../utils/avimmmatrixprogram.cpp"
+#include "../../utils/avimmmodelmatrixcache.cpp"
+#include "../../utils/avimmstagetiming.cpp"
+#include "../../utils/avimmthreadpool.cpp"
 
 #include "avimmlibunittesthelperlib_export.h"
-
-#define DELIMITER ","
+#include "avimmperfcounters.h"
 
 class AVIMMLIBUNITTESTHELPERLIB_EXPORT AVIMMTester
 {
@@ -30,6 +44,27 @@ public:
     void perform_single_calculation_step();
     bool dump_results(const QString& imm_data_file);
     static Vector zeroSmallElements(const Vector &M);
+    // Converts test data files into one binary plot recording, see AVIMMRecording. The target of the plots is the
+    // index of their file, the plots of all files are ordered by time. The first line of each file (the initial
+    // state) is kept as first plot. Returns false if a file cannot be read or written.
+    static bool convertToRecording(const QStringList& test_data_files, const QString& recording_file, int sensor=0);
+
+    // Sets the config, config container and parser singletons of the tests which create their configs in code
+    static void initializeSingletons();
+    static void deleteSingletons();
+    // Process noise of a constant velocity model with the state [x, vx, y, vy, ...] and the given noise factor
+    static AVMatrix<QString> createProcessNoise(int dimension, const QString& factor);
+    // Constant velocity models with the state [x, vx, y, vy, ...] of the given dimension. The first mode has the
+    // process noise factor 0.01, the following ones 10, 100, ... If measure_positions is set only the positions are
+    // measured, otherwise the whole state. The inputs are accelerations along the first two axes.
+    static AVIMMConfigData createConfigData(int dimension, int modes=2, bool measure_positions=false);
+    // Reads the hardware performance counters around the estimator steps of run_sim(), disabled by default. The
+    // batches of PER_BATCH include storing the results. The counters are cleared by every call.
+    void setPerfCounterMode(AVIMMPerfProfile::Mode mode, int batch_size=AVIMMPerfProfile::DEFAULT_BATCH_SIZE)
+    {
+        m_perf_profile.setMode(mode, batch_size);
+    }
+    const AVIMMPerfProfile& getPerfProfile() const { return m_perf_profile; }
     
     DEFINE_GET(ResultingStates, QVector<Vector>, m_resulting_states);
     DEFINE_GET(MeasurementData, QVector<Vector>, m_measurement_data);
@@ -55,17 +90,18 @@ public:
     
 private:
     Vector load_test_data(const QString& test_data_file);
-    std::vector<double> split(const std::string& str, const std::string& delim);
     
-    QDateTime m_start_time;
+    // Times in nanoseconds since epoch
+    qint64 m_start_time;
     QString m_test_data_file;
-    QVector<QDateTime> m_time_stamps;
-    QVector<QDateTime> m_time_stamps_single_step_calc;;
+    QVector<qint64> m_time_stamps;
+    QVector<qint64> m_time_stamps_single_step_calc;
     QVector<Vector> m_resulting_states;
     QVector<Vector> m_error_to_measurement;
     QVector<Vector> m_measurement_data;
     QVector<Vector> m_measurement_data_single_step_calc;
     AVIMMEstimator *m_avimm_estimator;
+    AVIMMPerfProfile m_perf_profile;
 };
 //--------------------------------------------------------------------------
 
@@ -82,15 +118,114 @@ Vector AVIMMTester::zeroSmallElements(const Vector &M)
 }
 //--------------------------------------------------------------------------
 
+void AVIMMTester::initializeSingletons()
+{
+    std::vector<char*> args;
+    QByteArray         dummy_arg("dummy");  // program name, is ignored by config
+    args.push_back(dummy_arg.data());
+
+    AVEnvironment::setProcessName("imm_tester");
+    AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+    AVConfig2Global::singleton().initialize();
+
+    AVIMMStaticConfigContainer::initializeSingleton();
+    AVIMMConfigParser::setSingleton(new AVIMMConfigParser());
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTester::deleteSingletons()
+{
+    AVIMMConfigParser::deleteSingleton();
+    AVIMMStaticConfigContainer::deleteSingleton();
+    AVConfig2Global::deleteSingleton();
+}
+
+//--------------------------------------------------------------------------
+
+AVMatrix<QString> AVIMMTester::createProcessNoise(int dimension, const QString& factor)
+{
+    AVMatrix<QString> Q(dimension, dimension, "0");
+    for (int i = 0; i < dimension; i += 2)
+    {
+        Q.set(i,i,     factor + "*dt^3/3");
+        Q.set(i,i+1,   factor + "*dt^2/2");
+        Q.set(i+1,i,   factor + "*dt^2/2");
+        Q.set(i+1,i+1, factor + "*dt");
+    }
+    return Q;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMConfigData AVIMMTester::createConfigData(int dimension, int modes, bool measure_positions)
+{
+    AVMatrix<QString> F(dimension, dimension, "0");
+    AVMatrix<QString> I(dimension, dimension, "0");
+    for (int i = 0; i < dimension; i++)
+    {
+        F.set(i,i, "1");
+        I.set(i,i, "1");
+    }
+    for (int i = 0; i < dimension; i += 2)
+        F.set(i,i+1, "dt");
+
+    // Two inputs like the accelerations of the airport configs, they change the velocities of the first two axes
+    AVMatrix<QString> B(dimension, 2, "0");
+    B.set(1,0, "dt");
+    B.set(3,1, "dt");
+    AVMatrix<QString> H = I;
+    AVMatrix<QString> R = I;
+    if (measure_positions)
+    {
+        H = AVMatrix<QString>(dimension / 2, dimension, "0");
+        R = AVMatrix<QString>(dimension / 2, dimension / 2, "0");
+        for (int i = 0; i < dimension / 2; i++)
+        {
+            H.set(i,2*i, "1");
+            R.set(i,i,   "1");
+        }
+    }
+
+    AVIMMConfigData config;
+    config.area_name = "Test";
+    config.initial_mode_probabilities = Vector::Constant(modes, 1.0 / modes);
+    config.markov_transition_matrix = Matrix::Constant(modes, modes, 0.03 / std::max(modes - 1, 1));
+    config.markov_transition_matrix.diagonal().setConstant(0.97);
+
+    // The keys contain the dimensions, the model matrix cache identifies the models by area and key
+    auto& parser = AVIMMConfigParser::singleton();
+    for (int mode = 0; mode < modes; mode++)
+    {
+        const QString key = QString("cv_%1_%2_%3").arg(dimension).arg(H.getRows()).arg(mode);
+        config.sub_filter_config_keys << key;
+
+        AVIMMCompiledSubfilterMatrices compiled;
+        compiled.F = parser.compileMatrixProgram(F);
+        compiled.P = parser.compileMatrixProgram(I);
+        compiled.H = parser.compileMatrixProgram(H);
+        compiled.B = parser.compileMatrixProgram(B);
+        compiled.R = parser.compileMatrixProgram(R);
+        compiled.J = parser.compileMatrixProgram(H);
+        const QString factor = mode == 0 ? QString("0.01") : QString::number(std::pow(10.0, mode));
+        compiled.Q = parser.compileMatrixProgram(createProcessNoise(dimension, factor));
+        config.compiled_map[key] = compiled;
+        AVIMMStaticConfigContainer::singleton().filter_type_map[key] = KalmanFilter;
+    }
+    return config;
+}
+
+//--------------------------------------------------------------------------
+
 AVIMMTester::AVIMMTester(const QString& test_data_file)
         : m_test_data_file(test_data_file)
 {
-    m_start_time = QDateTime::currentDateTimeUtc();
+    m_start_time = AVIMMClock::getDefault()->now();
     Vector initial_state = this->load_test_data(m_test_data_file);
     m_measurement_data_single_step_calc = m_measurement_data;
+    m_time_stamps_single_step_calc = m_time_stamps;
     m_avimm_estimator = new AVIMMEstimator(initial_state);
-    m_avimm_estimator->m_test_run = true;
-    m_avimm_estimator->m_last_calculation= m_start_time;
+    m_avimm_estimator->setTimestamp(m_start_time);
 }
 
 //--------------------------------------------------------------------------
@@ -114,7 +249,7 @@ bool AVIMMTester::dump_results(const QString& imm_data_file)
     for (auto &result : m_resulting_states)
     {
         QString result_string;
-        result_string += time_iterator->toString("hh:mm:ss.zzz");
+        result_string += QDateTime::fromMSecsSinceEpoch(*time_iterator / 1000000, Qt::UTC).toString("hh:mm:ss.zzz");
         for (int i = 0; i < result.size(); i++)
         {
             result_string += ", ";
@@ -132,20 +267,54 @@ bool AVIMMTester::dump_results(const QString& imm_data_file)
 
 //--------------------------------------------------------------------------
 
-std::vector<double> AVIMMTester::split(const std::string &str, const std::string &delim)
+bool AVIMMTester::convertToRecording(const QStringList& test_data_files, const QString& recording_file, int sensor)
 {
-    std::vector<double> tokens;
-    size_t prev = 0, pos = 0;
-    do
+    // Merge the files by the time of their next plot
+    typedef std::pair<double, int> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::vector<std::unique_ptr<AVIMMCsvReader>> files;
+    std::vector<Vector> values(test_data_files.size());
+    int dimension = 0;
+    for (int i = 0; i < test_data_files.size(); i++)
     {
-        pos = str.find(delim, prev);
-        if (pos == std::string::npos) pos = str.length();
-        std::string token = str.substr(prev, pos-prev);
-        if (!token.empty()) tokens.push_back(std::stod(token));
-        prev = pos + delim.length();
+        files.emplace_back(new AVIMMCsvReader(test_data_files[i]));
+        double time_ms;
+        if (!files.back()->readRecord(time_ms, values[i]) ||
+            (dimension > 0 && values[i].size() != dimension))
+        {
+            return false;
+        }
+        dimension = values[i].size();
+        heads.push(Head(time_ms, i));
     }
-    while (pos < str.length() && prev < str.length());
-    return tokens;
+    if (dimension == 0)
+        return false;
+    
+    QFile::remove(recording_file);
+    AVIMMRecordingWriter writer(recording_file, AVIMMRecording::PLOTS, dimension, 0, false);
+    if (!writer.isOpen())
+        return false;
+    
+    AVIMMPlot plot;
+    plot.sensor = sensor;
+    while (!heads.empty())
+    {
+        const Head head = heads.top();
+        heads.pop();
+        plot.handle = head.second;
+        plot.time   = static_cast<qint64>(head.first * 1e6);
+        plot.z      = values[head.second];
+        writer.addPlot(plot);
+        
+        double time_ms;
+        if (files[head.second]->readRecord(time_ms, values[head.second]))
+        {
+            if (values[head.second].size() != dimension)
+                return false;
+            heads.push(Head(time_ms, head.second));
+        }
+    }
+    return writer.flush();
 }
 
 //--------------------------------------------------------------------------
@@ -153,44 +322,18 @@ std::vector<double> AVIMMTester::split(const std::string &str, const std::string
 Vector AVIMMTester::load_test_data(const QString &test_data_file)
 {
     Vector initial_state;
-    std::ifstream file(test_data_file.toStdString());
-    std::string line = "";
-    // Iterate through each line and split the content using delimiter
-    bool first_data_point = true;
-    if (file.is_open())
+    AVIMMCsvReader file(test_data_file);
+    // The first data point is used as initial state for setting up IMMEstimator, its time is ignored
+    double mseconds_since_start;
+    if (!file.readRecord(mseconds_since_start, initial_state))
+        return initial_state;
+    
+    Vector measurement;
+    while (file.readRecord(mseconds_since_start, measurement))
     {
-        while (getline(file, line)) {
-            std::vector<double> vec = split(line, DELIMITER);
-            // Special handling for first data pint, use this as initial state for setting up IMMEstimator
-            if (first_data_point) {
-                // Remove timestamp
-                vec.erase(vec.begin());
-                initial_state.resize(vec.size(), 1);
-                int i = 0;
-                for (auto &elem : vec) {
-                    initial_state(i) = elem;
-                    i++;
-                }
-                first_data_point = false;
-                continue;
-            }
-            double mseconds_since_start = vec.front();
-            QDateTime time_stamp = m_start_time.addMSecs(mseconds_since_start);
-            m_time_stamps.push_back(time_stamp);
-            // Remove timestamp
-            vec.erase(vec.begin());
-        
-            int i = 0;
-            Vector measurement(vec.size(), 1);;
-            for (auto &elem : vec) {
-                measurement(i) = elem;
-                i++;
-            }
-            m_measurement_data.push_back(measurement);
-        }
+        m_time_stamps.push_back(m_start_time + static_cast<qint64>(mseconds_since_start * 1e6));
+        m_measurement_data.push_back(measurement);
     }
-    // Close the File
-    file.close();
     
     return initial_state;
 }
@@ -202,13 +345,15 @@ void AVIMMTester::run_sim()
     auto time_iterator = m_time_stamps.constBegin();
     for (const auto &measurement : m_measurement_data)
     {
-        // Manipulate time here manually to avoid having "real time" problems
-        m_avimm_estimator->m_now = *time_iterator;
-        m_avimm_estimator->predictAndUpdate(measurement);
+        // The recorded times are used instead of the real time
+        m_perf_profile.beginStep();
+        m_avimm_estimator->predictAndUpdate(measurement, DEFAULT_MATRIX, DEFAULT_VECTOR, *time_iterator);
+        m_perf_profile.endStep();
         m_resulting_states.push_back(m_avimm_estimator->getData().x);
         m_error_to_measurement.push_back(zeroSmallElements(m_avimm_estimator->getData().x - measurement));
         time_iterator++;
     }
+    m_perf_profile.finish();
 }
 
 //--------------------------------------------------------------------------
@@ -217,12 +362,11 @@ void AVIMMTester::perform_single_calculation_step()
 {
     // Take measurement and time from seperate array
     Vector z = m_measurement_data_single_step_calc.front();
-    QDateTime now = m_time_stamps_single_step_calc.front();
+    qint64 timestamp = m_time_stamps_single_step_calc.front();
     m_measurement_data_single_step_calc.pop_front();
     m_time_stamps_single_step_calc.pop_front();
     
-    m_avimm_estimator->m_now = now;
-    m_avimm_estimator->predictAndUpdate(z);
+    m_avimm_estimator->predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
 }
 
 #endif //QT3_SVN_AVIMMTESTER_H
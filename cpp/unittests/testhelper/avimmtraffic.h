@@ -0,0 +1,345 @@
+//
+// Created by felix on 9/7/20.
+//
+
+#ifndef AVIMMTRAFFIC_H
+#define AVIMMTRAFFIC_H
+
+#include "avimmtester.h"
+
+#include <QPolygon>
+#include <cmath>
+#include <limits>
+
+// Generates deterministic synthetic airport surface traffic. Each target starts at a random position inside one of
+// the areas, assigned round robin. Stationary targets stand on the apron, all others drive a sequence of straight
+// legs, turns with a constant turn rate and accelerations along their heading. Every target is observed by one
+// sensor with its own period and noise.
+// Each target has its own random generator seeded by the seed and its index, so the traffic of a target does not
+// depend on the other targets or on the order in which the targets are advanced. Different targets may be advanced
+// by different threads concurrently.
+// Plots are given in the layout of the state definition: pos_x, vel_x, acc_x, pos_y, vel_y and acc_y are filled in,
+// all other elements are 0.
+class AVIMMTrafficGenerator
+{
+public:
+    enum Segment
+    {
+        STANDING,
+        STRAIGHT,
+        TURN,
+        ACCELERATION
+    };
+
+    struct Sensor
+    {
+        int id;
+        double period;             // Seconds between two plots of a target
+        double position_sigma;     // Standard deviation of the noise in metres
+        double velocity_sigma;     // m/s
+        double acceleration_sigma; // m/s^2
+    };
+
+    AVIMMTrafficGenerator(const QList<QPolygon>& areas, const QStringList& state_definition, int number_of_targets,
+                          quint64 seed=1, double stationary_fraction=0.2);
+    virtual ~AVIMMTrafficGenerator() = default;
+
+    // Polygons of the areas of the airport config
+    static QList<QPolygon> getAirportAreas();
+    static const std::vector<Sensor>& getSensors();
+
+    int getNumberOfTargets() const { return m_targets.size(); }
+    int getDimension() const { return m_dimension; }
+    // Time of the next plot of the target in seconds since the start
+    double getNextPlotTime(int target) const { return m_targets[target].next_plot; }
+    const Sensor& getSensor(int target) const { return getSensors()[m_targets[target].sensor]; }
+    Segment getSegment(int target) const { return m_targets[target].segment; }
+    bool isStationary(int target) const { return m_targets[target].stationary; }
+
+    // Moves the target to the time of its next plot, writes the noisy measurement into z and schedules the
+    // following plot
+    void nextPlot(int target, Vector& z);
+    // True state of the target at its last plot
+    void getTrueState(int target, Vector& x) const;
+    // True position of the target at its last plot
+    QPointF getTruePosition(int target) const { return QPointF(m_targets[target].x, m_targets[target].y); }
+
+private:
+    struct Target
+    {
+        quint64 random; // State of the random generator
+        int sensor;
+        bool stationary;
+        Segment segment;
+        double time; // Time of the true state
+        double segment_end;
+        double next_plot;
+        double x, y, vx, vy, ax, ay;
+        double turn_rate;    // rad/s during a turn
+        double acceleration; // m/s^2 along the heading during an acceleration
+    };
+
+    // Advances the true state of the target to the time, starting new segments on the way
+    void advance(Target& target, double time) const;
+    void move(Target& target, double dt) const;
+    void startSegment(Target& target) const;
+    void writeState(const Target& target, Vector& x, double position_sigma, double velocity_sigma,
+                    double acceleration_sigma, quint64& random) const;
+
+    // Random numbers of the splitmix64 generator, which only needs a single word of state
+    static quint64 nextRandom(quint64& state);
+    static double uniform(quint64& state, double low, double high);
+    static double normal(quint64& state);
+
+    int m_dimension;
+    // Index of the element in the state definition or -1
+    int m_pos_x, m_vel_x, m_acc_x, m_pos_y, m_vel_y, m_acc_y;
+    std::vector<Target> m_targets;
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMTrafficGenerator::AVIMMTrafficGenerator(const QList<QPolygon>& areas, const QStringList& state_definition,
+                                             int number_of_targets, quint64 seed, double stationary_fraction)
+    : m_dimension(state_definition.size()),
+      m_pos_x(state_definition.indexOf("pos_x")),
+      m_vel_x(state_definition.indexOf("vel_x")),
+      m_acc_x(state_definition.indexOf("acc_x")),
+      m_pos_y(state_definition.indexOf("pos_y")),
+      m_vel_y(state_definition.indexOf("vel_y")),
+      m_acc_y(state_definition.indexOf("acc_y"))
+{
+    assert(!areas.isEmpty());
+    const std::vector<Sensor>& sensors = getSensors();
+
+    m_targets.resize(number_of_targets);
+    for (int i = 0; i < number_of_targets; i++)
+    {
+        Target& target = m_targets[i];
+        target.random = seed * 0x9E3779B97F4A7C15ULL + static_cast<quint64>(i);
+        nextRandom(target.random);
+
+        // Random point inside the area, the centre of its bounds if none is found
+        const QPolygon& area = areas[i % areas.size()];
+        const QRect bounds = area.boundingRect();
+        target.x = bounds.center().x();
+        target.y = bounds.center().y();
+        for (int attempt = 0; attempt < 100; attempt++)
+        {
+            const double x = uniform(target.random, bounds.left(), bounds.right());
+            const double y = uniform(target.random, bounds.top(), bounds.bottom());
+            if (area.containsPoint(QPoint(qRound(x), qRound(y)), Qt::OddEvenFill))
+            {
+                target.x = x;
+                target.y = y;
+                break;
+            }
+        }
+
+        target.sensor     = std::min(static_cast<int>(uniform(target.random, 0.0, sensors.size())),
+                                     static_cast<int>(sensors.size()) - 1);
+        target.stationary = uniform(target.random, 0.0, 1.0) < stationary_fraction;
+        target.time       = 0.0;
+        target.next_plot  = uniform(target.random, 0.0, sensors[target.sensor].period);
+
+        // Moving targets start taxiing with a random heading
+        const double speed   = target.stationary ? 0.0 : uniform(target.random, 5.0, 15.0);
+        const double heading = uniform(target.random, 0.0, 2.0 * M_PI);
+        target.vx = speed * std::cos(heading);
+        target.vy = speed * std::sin(heading);
+        target.ax = 0.0;
+        target.ay = 0.0;
+        startSegment(target);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+QList<QPolygon> AVIMMTrafficGenerator::getAirportAreas()
+{
+    QList<QPolygon> areas;
+    for (const AVIMMAreaConfig& area : AVIMMAirportConfigs::singleton().getAirportAreaConfigs())
+        areas << area.getArea();
+    return areas;
+}
+
+//--------------------------------------------------------------------------
+
+const std::vector<AVIMMTrafficGenerator::Sensor>& AVIMMTrafficGenerator::getSensors()
+{
+    // Multilateration, ADS-B and surface movement radar
+    static const std::vector<Sensor> sensors = {
+        { 1, 1.0, 7.5,  1.0, 0.5 },
+        { 2, 0.5, 3.0,  0.3, 0.2 },
+        { 3, 1.0, 10.0, 1.5, 0.8 }
+    };
+    return sensors;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::nextPlot(int target_index, Vector& z)
+{
+    Target& target = m_targets[target_index];
+    const Sensor& sensor = getSensors()[target.sensor];
+    advance(target, target.next_plot);
+
+    if (z.size() != m_dimension)
+        z.resize(m_dimension);
+    writeState(target, z, sensor.position_sigma, sensor.velocity_sigma, sensor.acceleration_sigma, target.random);
+
+    // The period jitters by one percent
+    target.next_plot += sensor.period * uniform(target.random, 0.99, 1.01);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::getTrueState(int target_index, Vector& x) const
+{
+    quint64 unused = 0;
+    x.resize(m_dimension);
+    writeState(m_targets[target_index], x, 0.0, 0.0, 0.0, unused);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::advance(Target& target, double time) const
+{
+    while (target.segment_end < time)
+    {
+        move(target, target.segment_end - target.time);
+        target.time = target.segment_end;
+        startSegment(target);
+    }
+    move(target, time - target.time);
+    target.time = time;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::move(Target& target, double dt) const
+{
+    switch (target.segment)
+    {
+    case STANDING:
+        break;
+    case STRAIGHT:
+        target.x += target.vx * dt;
+        target.y += target.vy * dt;
+        break;
+    case TURN:
+    {
+        // Exact constant turn, the acceleration is the centripetal one
+        const double angle = target.turn_rate * dt;
+        const double s = std::sin(angle);
+        const double c = std::cos(angle);
+        target.x += (target.vx * s - target.vy * (1.0 - c)) / target.turn_rate;
+        target.y += (target.vx * (1.0 - c) + target.vy * s) / target.turn_rate;
+        const double vx = target.vx * c - target.vy * s;
+        const double vy = target.vx * s + target.vy * c;
+        target.vx = vx;
+        target.vy = vy;
+        target.ax = -target.turn_rate * vy;
+        target.ay = target.turn_rate * vx;
+        break;
+    }
+    case ACCELERATION:
+        target.x  += target.vx * dt + 0.5 * target.ax * dt * dt;
+        target.y  += target.vy * dt + 0.5 * target.ay * dt * dt;
+        target.vx += target.ax * dt;
+        target.vy += target.ay * dt;
+        break;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::startSegment(Target& target) const
+{
+    target.ax = 0.0;
+    target.ay = 0.0;
+    if (target.stationary)
+    {
+        target.segment     = STANDING;
+        target.segment_end = std::numeric_limits<double>::infinity();
+        return;
+    }
+
+    const double choice = uniform(target.random, 0.0, 1.0);
+    const double speed  = std::hypot(target.vx, target.vy);
+    if (choice < 0.5)
+    {
+        target.segment     = STRAIGHT;
+        target.segment_end = target.time + uniform(target.random, 10.0, 60.0);
+    }
+    else if (choice < 0.8)
+    {
+        // Turns of 30 to 180 degrees with 3 to 10 degrees per second to either side
+        const double rate  = uniform(target.random, 3.0, 10.0) * M_PI / 180.0;
+        const double angle = uniform(target.random, 30.0, 180.0) * M_PI / 180.0;
+        target.segment     = TURN;
+        target.turn_rate   = uniform(target.random, 0.0, 1.0) < 0.5 ? -rate : rate;
+        target.segment_end = target.time + angle / rate;
+        target.ax          = -target.turn_rate * target.vy;
+        target.ay          = target.turn_rate * target.vx;
+    }
+    else
+    {
+        // Accelerates or brakes along the heading to a speed between taxiing and take off
+        const double new_speed = uniform(target.random, 3.0, 80.0);
+        target.segment         = ACCELERATION;
+        target.acceleration    = new_speed > speed ? 2.0 : -2.0;
+        target.segment_end     = target.time + std::abs(new_speed - speed) / 2.0;
+        target.ax              = target.acceleration * target.vx / speed;
+        target.ay              = target.acceleration * target.vy / speed;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMTrafficGenerator::writeState(const Target& target, Vector& x, double position_sigma, double velocity_sigma,
+                                       double acceleration_sigma, quint64& random) const
+{
+    x.setZero();
+    auto write = [&](int index, double value, double sigma)
+    {
+        if (index >= 0)
+            x(index) = sigma > 0.0 ? value + sigma * normal(random) : value;
+    };
+    write(m_pos_x, target.x,  position_sigma);
+    write(m_vel_x, target.vx, velocity_sigma);
+    write(m_acc_x, target.ax, acceleration_sigma);
+    write(m_pos_y, target.y,  position_sigma);
+    write(m_vel_y, target.vy, velocity_sigma);
+    write(m_acc_y, target.ay, acceleration_sigma);
+}
+
+//--------------------------------------------------------------------------
+
+quint64 AVIMMTrafficGenerator::nextRandom(quint64& state)
+{
+    quint64 z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//--------------------------------------------------------------------------
+
+double AVIMMTrafficGenerator::uniform(quint64& state, double low, double high)
+{
+    // 53 random bits give a uniform double in [0, 1)
+    return low + (high - low) * (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//--------------------------------------------------------------------------
+
+double AVIMMTrafficGenerator::normal(quint64& state)
+{
+    // Box-Muller transform, the first number is in (0, 1] to avoid the logarithm of 0
+    const double u1 = 1.0 - uniform(state, 0.0, 1.0);
+    const double u2 = uniform(state, 0.0, 1.0);
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+#endif //AVIMMTRAFFIC_H
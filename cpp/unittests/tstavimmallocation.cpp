@@ -0,0 +1,115 @@
+//
+// Created by felix on 8/6/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Checks that the calculation steps of the estimators do not allocate
+ */
+
+// Let eigen assert on every heap allocation while Eigen::internal::set_is_malloc_allowed(false)
+#define EIGEN_RUNTIME_NO_MALLOC
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+#include "testhelper/avimmallocationcounter.h"
+
+class TstAVIMMAllocation : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMAllocation() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMEstimator_predictAndUpdate();
+    void test_AVIMMFixedEstimator_predictAndUpdate();
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMAllocation::test_AVIMMEstimator_predictAndUpdate()
+{
+    Vector x = Vector::Zero(6);
+    x << 0, 10, 0, 5, 0, 0;
+    AVIMMEstimator estimator(AVIMMTester::createConfigData(6), x);
+    estimator.setTimestamp(0);
+
+    Vector z = x;
+    const Matrix R;
+    const Vector u = Vector::Zero(2);
+    auto step = [&](int i)
+    {
+        z << 10.0 * i, 10, 5.0 * i, 5, (i % 2) * 0.5, 0;
+        estimator.predictAndUpdate(z, R, u, estimator.getTimestamp() + 1000000000LL);
+    };
+
+    // The first steps may still size the matrices of the subfilters
+    for (int i = 1; i <= 2; i++)
+        step(i);
+
+    Eigen::internal::set_is_malloc_allowed(false);
+    AVIMMAllocationCounter::start();
+    for (int i = 3; i <= 12; i++)
+        step(i);
+    int allocations = AVIMMAllocationCounter::stop();
+    Eigen::internal::set_is_malloc_allowed(true);
+
+    QCOMPARE(allocations, 0);
+    QVERIFY(std::abs(estimator.getStateVector()[0] - 120.0) < 1.0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMAllocation::test_AVIMMFixedEstimator_predictAndUpdate()
+{
+    Vector x = Vector::Zero(4);
+    x << 0, 10, 0, 5;
+    // Allocated with the aligned operator new if the fixed size members are over aligned
+    std::unique_ptr<AVIMMFixedEstimator<4,2,2,2>> estimator(
+        new AVIMMFixedEstimator<4,2,2,2>(AVIMMTester::createConfigData(4, 2, true), x));
+    estimator->setTimestamp(0);
+
+    Vector z = Vector::Zero(2);
+    const Matrix R;
+    const Vector u = Vector::Zero(2);
+    auto step = [&](int i)
+    {
+        z << 10.0 * i + (i % 2) * 0.5, 5.0 * i;
+        estimator->predictAndUpdate(z, R, u, estimator->getTimestamp() + 1000000000LL);
+    };
+
+    step(1);
+
+    Eigen::internal::set_is_malloc_allowed(false);
+    AVIMMAllocationCounter::start();
+    for (int i = 2; i <= 12; i++)
+        step(i);
+    int allocations = AVIMMAllocationCounter::stop();
+    Eigen::internal::set_is_malloc_allowed(true);
+
+    QCOMPARE(allocations, 0);
+    QVERIFY(std::abs(estimator->getStateVector()[0] - 120.0) < 1.0);
+}
+
+AV_QTEST_MAIN(TstAVIMMAllocation)
+#include "tstavimmallocation.moc"
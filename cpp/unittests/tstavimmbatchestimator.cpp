@@ -0,0 +1,189 @@
+//
+// Created by felix on 8/12/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMBatchEstimator
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+#include "../filterlib/avimmbatchestimator.h"
+
+class TstAVIMMBatchEstimator : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMBatchEstimator() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMBatchEstimator_addAndRemoveTracks();
+    void test_AVIMMBatchEstimator_predictAndUpdate();
+    void test_AVIMMBatchEstimator_logDomainModeProbabilities();
+    void test_AVIMMBatchEstimator_extendedKalmanFilter();
+    void test_AVIMMBatchEstimator_laneWidth();
+
+private:
+    // Runs TRACKS tracks in the batch and in one AVIMMFixedEstimator each, the results must be the same. With M == 4
+    // the whole state [x, vx, y, vy] is measured, with M == 2 the positions.
+    template<int M>
+    static bool compareWithFixedEstimators(const AVIMMConfigData& config);
+};
+
+//--------------------------------------------------------------------------
+
+template<int M>
+bool TstAVIMMBatchEstimator::compareWithFixedEstimators(const AVIMMConfigData& config)
+{
+    // Not a multiple of any lane width, so the scalar tail is calculated as well
+    const int TRACKS = 13;
+    typedef AVIMMBatchEstimator<4,M,2> Batch;
+    typedef AVIMMFixedEstimator<4,M,2,2> Reference;
+    if (!Batch::isSupported(config))
+        return false;
+
+    Batch batch(config);
+    std::vector<std::unique_ptr<Reference>> references;
+    for (int track = 0; track < TRACKS; track++)
+    {
+        typename Batch::StateVector initial_state;
+        initial_state << track, 10 + track, -track, -5;
+        batch.addTrack(initial_state);
+        references.emplace_back(new Reference(config, initial_state));
+        references.back()->setTimestamp(0);
+    }
+
+    Vector measured_state(4,1);
+    Vector z(M,1);
+    for (int step = 1; step <= 15; step++)
+    {
+        for (int track = 0; track < TRACKS; track++)
+        {
+            // Some tracks start to turn, so the models have different probabilities
+            const double turn = track % 3 == 0 && step > 8 ? 2.0 * (step - 8) * (step - 8) : 0.0;
+            const double turn_rate = track % 3 == 0 && step > 8 ? 4.0 * (step - 8) : 0.0;
+            measured_state << track + (10.0 + track) * step + (step % 2 ? 0.5 : -0.5), 10.0 + track,
+                              -track - 5.0 * step + turn, -5.0 + turn_rate;
+            for (int r = 0; r < M; r++)
+                z(r) = measured_state(M == 4 ? r : 2 * r);
+            batch.setMeasurement(track, z);
+
+            references[track]->predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, step * 1000000000LL);
+        }
+        batch.predictAndUpdate(1.0);
+
+        for (int track = 0; track < TRACKS; track++)
+        {
+            const Reference& reference = *references[track];
+            if (!AVIMMTester::getMatricesEqual(batch.getStateVector(track), reference.getStateVector()).first ||
+                !AVIMMTester::getMatricesEqual(batch.getCovarianceMatrix(track), reference.getCovarianceMatrix()).first ||
+                !AVIMMTester::getMatricesEqual(batch.getModeProbabilityVector(track),
+                                               reference.getModeProbabilityVector()).first)
+                return false;
+        }
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMBatchEstimator::test_AVIMMBatchEstimator_addAndRemoveTracks()
+{
+    typedef AVIMMBatchEstimator<4,2,2> Batch;
+    typedef AVIMMBatchEstimator<4,2,3> ThreeModeBatch;
+    AVIMMConfigData config = AVIMMTester::createConfigData(4, 2, true);
+    QVERIFY(Batch::isSupported(config));
+    QVERIFY(!ThreeModeBatch::isSupported(config));
+
+    Batch batch(config);
+    AVIMMFixedEstimator<4,2,2,2> reference(config, Vector::Zero(4));
+
+    Eigen::Vector4d state;
+    for (int track = 0; track < 20; track++)
+    {
+        state << track, 1, 2, 3;
+        QVERIFY(batch.addTrack(state) == track);
+    }
+    QVERIFY(batch.size() == 20);
+    QVERIFY(batch.getCovarianceMatrix(7) == reference.getCovarianceMatrix());
+    QVERIFY(batch.getModeProbabilityVector(7) == reference.getModeProbabilityVector());
+
+    // The last track takes the index of the removed one
+    batch.removeTrack(7);
+    QVERIFY(batch.size() == 19);
+    QVERIFY(batch.getStateVector(7)[0] == 19.0);
+    batch.removeTrack(18);
+    QVERIFY(batch.size() == 18);
+    QVERIFY(batch.getStateVector(17)[0] == 17.0);
+
+    // Growing the capacity keeps the tracks
+    batch.reserve(1000);
+    QVERIFY(batch.getStateVector(7)[0] == 19.0);
+    QVERIFY(batch.getStateVector(0)[0] == 0.0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMBatchEstimator::test_AVIMMBatchEstimator_predictAndUpdate()
+{
+    QVERIFY(compareWithFixedEstimators<2>(AVIMMTester::createConfigData(4, 2, true)));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMBatchEstimator::test_AVIMMBatchEstimator_logDomainModeProbabilities()
+{
+    AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities = true;
+    const bool equal = compareWithFixedEstimators<2>(AVIMMTester::createConfigData(4, 2, true));
+    AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities = false;
+    QVERIFY(equal);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMBatchEstimator::test_AVIMMBatchEstimator_extendedKalmanFilter()
+{
+    // The extended kalman filter measures the state, one mode of each kind
+    const AVIMMConfigData config = AVIMMTester::createConfigData(4);
+    auto& filter_types = AVIMMStaticConfigContainer::singleton().filter_type_map;
+    filter_types[config.sub_filter_config_keys[1]] = ExtendedKalmanFilter;
+    const bool equal = compareWithFixedEstimators<4>(config);
+    filter_types[config.sub_filter_config_keys[1]] = KalmanFilter;
+    QVERIFY(equal);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMBatchEstimator::test_AVIMMBatchEstimator_laneWidth()
+{
+    // Builds for an instruction set define the lane width they have to use
+#if defined(AVIMM_EXPECTED_LANE_WIDTH)
+    QCOMPARE(static_cast<int>(AVIMMSimdLane::width), AVIMM_EXPECTED_LANE_WIDTH);
+#else
+    QVERIFY(AVIMMSimdLane::width >= 1);
+#endif
+}
+
+AV_QTEST_MAIN(TstAVIMMBatchEstimator)
+#include "tstavimmbatchestimator.moc"
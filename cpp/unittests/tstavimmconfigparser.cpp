@@ -0,0 +1,285 @@
+//
+// Created by felix on 6/3/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMConfigParser
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include <clocale>
+#include <future>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMConfigParser : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMConfigParser() {}
+
+public slots:
+    void initTestCase()
+    {
+        AVIMMConfigParser::setSingleton(new AVIMMConfigParser());
+    }
+    void cleanupTestCase()
+    {
+        AVIMMConfigParser::deleteSingleton();
+    };
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMConfigParser_calculateTimeDependentMatrices();
+    void test_AVIMMConfigParser_compileMatrix();
+    void test_AVIMMConfigParser_compileMatrixReevaluate();
+    void test_AVIMMMatrixProgram_evaluate();
+    void test_AVIMMMatrixProgram_constantFolding();
+    void test_AVIMMMatrixProgram_fallbackCells();
+    void test_AVIMMMatrixProgram_concurrentEvaluation();
+    void test_AVIMMMatrixProgram_localeIndependentNumbers();
+    void test_AVIMMMatrixProgram_destroyWhileThreadRuns();
+
+private:
+    static AVMatrix<QString> createTestMatrix();
+};
+
+//--------------------------------------------------------------------------
+
+AVMatrix<QString> TstAVIMMConfigParser::createTestMatrix()
+{
+    AVMatrix<QString> M(2,3, "0");
+    M.set(0,0, "1");
+    M.set(0,1, "dt");
+    M.set(0,2, "dt^2/2");
+    M.set(1,1, "sigma*dt^3/6");
+    M.set(1,2, "sigma*dt");
+    return M;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMConfigParser_calculateTimeDependentMatrices()
+{
+    Matrix ref(2,3);
+    ref << 1, 2, 2,
+           0, 4, 6;
+
+    Matrix calculated = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(createTestMatrix(), 2.0, 3.0);
+
+    QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMConfigParser_compileMatrix()
+{
+    AVMatrix<QString> M = createTestMatrix();
+    AVIMMCompiledMatrixPtr compiled = AVIMMConfigParser::singleton().compileMatrix(M);
+
+    QVERIFY(compiled->rows() == 2);
+    QVERIFY(compiled->cols() == 3);
+
+    Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, 0.5, 2.0);
+    Matrix calculated = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(compiled, 0.5, 2.0);
+
+    QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).second == 0.0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMConfigParser_compileMatrixReevaluate()
+{
+    AVMatrix<QString> M = createTestMatrix();
+    AVIMMCompiledMatrixPtr compiled = AVIMMConfigParser::singleton().compileMatrix(M);
+
+    // Evaluating the same compiled matrix repeatedly must only depend on the latest dt and sigma
+    Matrix calculated;
+    for (float dt : {0.0f, 1.0f, 4.2f, 0.1f})
+    {
+        compiled->evaluate(calculated, dt);
+        Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, dt);
+        QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).first);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_evaluate()
+{
+    AVMatrix<QString> M = createTestMatrix();
+    AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+
+    QVERIFY(program->rows() == 2);
+    QVERIFY(program->cols() == 3);
+
+    Matrix calculated;
+    for (float dt : {0.0f, 1.0f, 4.2f, 0.1f})
+    {
+        program->evaluate(calculated, dt, 2.0);
+        Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, dt, 2.0);
+        QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).first);
+    }
+
+    // Only writing the time dependent cells must give the same result once the template has been written
+    Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, 3.0, 2.0);
+    program->evaluateTimeDependentCells(calculated, 3.0, 2.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(calculated, ref).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_constantFolding()
+{
+    AVMatrix<QString> M(3,3, "0");
+    M.set(0,0, "1");
+    M.set(1,1, "2*(3+1)/4");
+    M.set(2,2, "dt - dt + 5");
+    M.set(0,2, "sigma*dt^4/8");
+    M.set(2,0, "sigma*dt^4/8 + dt^2/2");
+
+    Matrix ref(3,3);
+    ref << 1, 0, 0.5,
+           0, 2, 0,
+           1, 0, 5;
+
+    AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+
+    // Only the two cells containing dt remain, all others are folded into the template
+    QVERIFY(!program->isConstant());
+    QVERIFY(program->getNumberOfTimeDependentCells() == 2);
+    QVERIFY(AVIMMTester::getMatricesEqual(program->evaluate(1.0, 4.0), ref).first);
+
+    AVMatrix<QString> C(2,2, "0");
+    C.set(0,0, "1");
+    C.set(1,1, "1000");
+    QVERIFY(AVIMMConfigParser::singleton().compileMatrixProgram(C)->isConstant());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_fallbackCells()
+{
+    // Cells which are no polynomial of dt and sigma are evaluated by exprtk
+    AVMatrix<QString> M(2,2, "0");
+    M.set(0,0, "sin(dt)");
+    M.set(0,1, "1/dt");
+    M.set(1,1, "dt^2");
+
+    AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+    QVERIFY(program->getNumberOfTimeDependentCells() == 3);
+
+    for (float dt : {0.5f, 1.0f, 2.0f})
+    {
+        Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, dt);
+        QVERIFY(AVIMMTester::getMatricesEqual(program->evaluate(dt), ref).first);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_concurrentEvaluation()
+{
+    AVMatrix<QString> M(2,2, "0");
+    M.set(0,0, "sin(dt)");
+    M.set(0,1, "sigma*dt^2/2");
+    M.set(1,1, "dt^3");
+    const AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+
+    // Every thread evaluates the shared program with its own time delta, the results must not interfere
+    const int THREADS = 4;
+    std::vector<int> errors(THREADS, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++)
+        threads.emplace_back([&, t]() {
+            const float dt = 0.25f * (t + 1);
+            const Matrix ref = AVIMMConfigParser::singleton().calculateTimeDependentMatrices(M, dt, 2.0);
+            Matrix result;
+            for (int i = 0; i < 1000; i++)
+            {
+                program->evaluate(result, dt, 2.0);
+                if (!AVIMMTester::getMatricesEqual(result, ref).first)
+                    errors[t]++;
+            }
+        });
+    for (auto& thread : threads)
+        thread.join();
+
+    for (int t = 0; t < THREADS; t++)
+        QVERIFY(errors[t] == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_localeIndependentNumbers()
+{
+    // Qt applications run with the locale of the user, which may use a comma as decimal point
+    const std::string previous_locale = std::setlocale(LC_NUMERIC, nullptr);
+    if (!std::setlocale(LC_NUMERIC, "de_DE.UTF-8") && !std::setlocale(LC_NUMERIC, "de_AT.UTF-8"))
+        QSKIP("No locale with a comma as decimal point is installed");
+
+    AVMatrix<QString> M(2,2, "0");
+    M.set(0,0, "0.5*dt");
+    M.set(0,1, "1.5e-1");
+    M.set(1,0, "2.5E+1*sigma");
+    M.set(1,1, ".25");
+    const AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+    const Matrix result = program->evaluate(2.0, 2.0);
+    std::setlocale(LC_NUMERIC, previous_locale.c_str());
+
+    Matrix ref(2,2);
+    ref << 1.0, 0.15,
+           50.0, 0.25;
+    QVERIFY(program->getNumberOfTimeDependentCells() == 2);
+    QVERIFY(AVIMMTester::getMatricesEqual(result, ref).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMConfigParser::test_AVIMMMatrixProgram_destroyWhileThreadRuns()
+{
+    AVMatrix<QString> M(1,1, "sin(dt)");
+    AVIMMMatrixProgramPtr program = AVIMMConfigParser::singleton().compileMatrixProgram(M);
+
+    // The worker evaluates a program which is destroyed while the worker still runs, its context is removed then.
+    // A new program evaluated afterwards by the worker reuses the slot of the destroyed one and gets its own context.
+    std::promise<void> evaluated;
+    std::promise<void> destroyed;
+    std::future<void> destroyed_future = destroyed.get_future();
+    double first = 0.0;
+    double second = 0.0;
+    std::thread worker([&]() {
+        first = program->evaluate(1.0)(0,0);
+        evaluated.set_value();
+        destroyed_future.wait();
+        AVMatrix<QString> N(1,1, "cos(dt)");
+        second = AVIMMConfigParser::singleton().compileMatrixProgram(N)->evaluate(1.0)(0,0);
+    });
+    evaluated.get_future().wait();
+    program.reset();
+    destroyed.set_value();
+    worker.join();
+
+    QVERIFY(std::abs(first - std::sin(1.0)) < 1e-9);
+    QVERIFY(std::abs(second - std::cos(1.0)) < 1e-9);
+}
+
+AV_QTEST_MAIN(TstAVIMMConfigParser)
+#include "tstavimmconfigparser.moc"
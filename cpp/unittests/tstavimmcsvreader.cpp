@@ -0,0 +1,212 @@
+//
+// Created by felix on 9/3/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMCsvReader
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+#include <QTemporaryDir>
+
+#include "testhelper/avimmtester.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+class TstAVIMMCsvReader : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMCsvReader() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMCsvReader_parseDouble();
+    void test_AVIMMCsvReader_roundTrip();
+    void test_AVIMMCsvReader_rows();
+    void test_AVIMMCsvReader_readRecord();
+    void test_AVIMMCsvReader_file();
+
+private:
+    static bool parse(const char* text, double& value);
+};
+
+//--------------------------------------------------------------------------
+
+bool TstAVIMMCsvReader::parse(const char* text, double& value)
+{
+    return AVIMMCsvReader::parseDouble(text, text + std::strlen(text), value);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMCsvReader::test_AVIMMCsvReader_parseDouble()
+{
+    // Same value as strtod, also beyond 15 significant digits and for subnormal numbers
+    const char* valid[] = { "0", "1", "-1", "+1", "0.1", "-0.25", ".5", "1.", "1e5", "1E-5", "2.5e+3",
+                            "00012.5000", "123456789012345", "1234567890123456789", "0.30000000000000004",
+                            "1e-300", "4.9e-324", "1.7976931348623157e308" };
+    for (const char* text : valid)
+    {
+        double value;
+        QVERIFY(parse(text, value));
+        QVERIFY(value == std::strtod(text, nullptr));
+    }
+
+    double value;
+    QVERIFY(parse("-0", value));
+    QVERIFY(value == 0.0 && std::signbit(value));
+
+    // The whole field has to be a number
+    const char* invalid[] = { "", "-", "+", ".", "abc", "1.2.3", "1e", "e5", "1x", "+-1", "1 2" };
+    for (const char* text : invalid)
+        QVERIFY(!parse(text, value));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMCsvReader::test_AVIMMCsvReader_roundTrip()
+{
+    // Numbers printed with full precision are read back exactly
+    std::mt19937_64 generator(42);
+    std::uniform_real_distribution<double> distribution(-1e6, 1e6);
+    char text[64];
+    for (int i = 0; i < 10000; i++)
+    {
+        const double expected = distribution(generator);
+        std::snprintf(text, sizeof(text), i % 2 == 0 ? "%.17g" : "%.6f", expected);
+        double value;
+        QVERIFY(parse(text, value));
+        QVERIFY(value == std::strtod(text, nullptr));
+        if (i % 2 == 0)
+            QVERIFY(value == expected);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMCsvReader::test_AVIMMCsvReader_rows()
+{
+    const char data[] = "time,x,y\n"
+                        "0, 1 ,2\r\n"
+                        "\n"
+                        "100,1.5,,2.5\n"
+                        "200,abc,3\n"
+                        "300;4;5";
+    AVIMMCsvReader reader(data, std::strlen(data));
+    QVERIFY(reader.isValid());
+
+    // The header line is no number
+    QVERIFY(reader.readRow());
+    QVERIFY(reader.getLineNumber() == 2);
+    QVERIFY(reader.getNumberOfErrors() == 1);
+    QVERIFY(reader.getNumberOfFields() == 3);
+    QVERIFY(reader.getField(1) == 1.0);
+    QVERIFY(reader.getField(2) == 2.0);
+
+    // Empty lines and empty fields are skipped
+    QVERIFY(reader.readRow());
+    QVERIFY(reader.getLineNumber() == 4);
+    QVERIFY(reader.getNumberOfFields() == 3);
+    QVERIFY(reader.getFields()[2] == 2.5);
+
+    // Wrong delimiter
+    QVERIFY(!reader.readRow());
+    QVERIFY(reader.getNumberOfErrors() == 3);
+    QVERIFY(reader.getNumberOfFields() == 0);
+
+    reader.reset();
+    QVERIFY(reader.readRow());
+    QVERIFY(reader.getLineNumber() == 2);
+
+    AVIMMCsvReader semicolon_reader(data, std::strlen(data), ';');
+    int rows = 0;
+    while (semicolon_reader.readRow())
+        rows++;
+    QVERIFY(rows == 1);
+    QVERIFY(semicolon_reader.getField(2) == 5.0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMCsvReader::test_AVIMMCsvReader_readRecord()
+{
+    const char data[] = "0,0,1,0,0,1,0\n"
+                        "100,0.1,1,0,0.1,1,0\n"
+                        "200,0.2,1,0,0.2,1,0\n";
+    AVIMMCsvReader reader(data, std::strlen(data));
+
+    double time_ms;
+    Vector values;
+    QVERIFY(reader.readRecord(time_ms, values));
+    QVERIFY(time_ms == 0.0);
+    QVERIFY(values.size() == 6);
+
+    // The values are not reallocated for rows of the same size
+    const double* memory = values.data();
+    QVERIFY(reader.readRecord(time_ms, values));
+    QVERIFY(reader.readRecord(time_ms, values));
+    QVERIFY(values.data() == memory);
+    QVERIFY(time_ms == 200.0);
+    QVERIFY(values(0) == 0.2);
+    QVERIFY(values(4) == 1.0);
+    QVERIFY(!reader.readRecord(time_ms, values));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMCsvReader::test_AVIMMCsvReader_file()
+{
+    QTemporaryDir dir;
+    const QString file_name = dir.path() + "/data.csv";
+    QFile file(file_name);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write("0,1,2\n5,6,7");
+    file.close();
+
+    // The last line has no line break
+    AVIMMCsvReader reader(file_name);
+    QVERIFY(reader.isValid());
+    double time_ms;
+    Vector values;
+    QVERIFY(reader.readRecord(time_ms, values));
+    QVERIFY(reader.readRecord(time_ms, values));
+    QVERIFY(time_ms == 5.0);
+    QVERIFY(values(1) == 7.0);
+    QVERIFY(!reader.readRow());
+
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.close();
+    AVIMMCsvReader empty_reader(file_name);
+    QVERIFY(empty_reader.isValid());
+    QVERIFY(!empty_reader.readRow());
+
+    AVIMMCsvReader missing_reader(dir.path() + "/missing.csv");
+    QVERIFY(!missing_reader.isValid());
+    QVERIFY(!missing_reader.readRow());
+}
+
+AV_QTEST_MAIN(TstAVIMMCsvReader)
+#include "tstavimmcsvreader.moc"
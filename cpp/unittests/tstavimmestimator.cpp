@@ -69,6 +69,8 @@ private slots:
     void test_IMMEstimator_shrinkMatrix();
     void test_IMMEstimator_predictAndUpdate();
     void test_IMMEstimator_extrapolate();
+    void test_IMMEstimator_extrapolateKeepsSubfilters();
+    void test_IMMEstimator_timestamps();
 };
 
 //--------------------------------------------------------------------------
@@ -86,12 +88,17 @@ void TstAVIMMEstimator::test_IMMEstimator_constructor()
            0,0,0,0,1,0,
            0,0,0,0,0,1;
     
+    // The initial time is taken from the default clock
+    AVIMMManualClock clock(42000000000LL);
+    AVIMMClock::setDefault(&clock);
     AVIMMEstimator tester(initial_state);
+    AVIMMClock::setDefault(nullptr);
     QVERIFY(tester.getData().x == initial_state);
     QVERIFY(tester.getData().P == ref);
     QVERIFY(tester.getPreviousData().x == initial_state);
     QVERIFY(tester.getPreviousData().P == ref);
-    QVERIFY(tester.m_last_calculation == QDateTime::currentDateTimeUtc());
+    QVERIFY(tester.getTimestamp() == 42000000000LL);
+    QVERIFY(tester.getData().time_stamp == 42000000000LL);
 }
 
 //--------------------------------------------------------------------------
@@ -265,12 +272,12 @@ void TstAVIMMEstimator::test_IMMEstimator_calculateIMMState()
     int i = 0;
     for (auto& filter: tester.m_filters)
     {
-        filter->m_data.x = xs[i];
-        filter->m_data.P = Ps[i];
+        filter->getData().x = xs[i];
+        filter->getData().P = Ps[i];
         i++;
     }
     
-    tester.calculateIMMState(tester.m_data.x, tester.m_data.P);
+    tester.calculateIMMState(tester.getData().x, tester.getData().P);
     
     QVERIFY(AVIMMTester::getMatricesEqual(x_ref, tester.getData().x).first);
     QVERIFY(AVIMMTester::getMatricesEqual(P_ref, tester.getData().P).first);
@@ -347,8 +354,8 @@ void TstAVIMMEstimator::test_IMMEstimator_calculateMixedStates()
     int i = 0;
     for (auto& filter: tester.m_filters)
     {
-        filter->m_data.x = x_filters[i];
-        filter->m_data.P = P_filters[i];
+        filter->getData().x = x_filters[i];
+        filter->getData().P = P_filters[i];
         i++;
     }
     
@@ -400,9 +407,10 @@ void TstAVIMMEstimator::test_IMMEstimator_calculateModeProbabilities()
     int i = 0;
     for (auto& filter: tester.m_filters)
     {
-        filter->m_data.S = S_filters[i];
-        filter->m_data.S.resize(6,6);
-        filter->m_data.error = error_filters[i];
+        filter->getData().S = S_filters[i];
+        filter->getData().S.resize(6,6);
+        filter->getData().S_factor.compute(filter->getData().S);
+        filter->getData().error = error_filters[i];
         i++;
     }
     
@@ -601,12 +609,13 @@ void TstAVIMMEstimator::test_IMMEstimator_predictAndUpdate()
     AVIMMEstimator tester_R(initial_state);
     AVIMMEstimator tester_input(initial_state);
     
-    tester.m_test_run = true;
-    tester.m_now = QDateTime::currentDateTimeUtc().addSecs(1);
-    tester_R.m_test_run = true;
-    tester_R.m_now = QDateTime::currentDateTimeUtc().addSecs(1);
-    tester_input.m_test_run = true;
-    tester_input.m_now = QDateTime::currentDateTimeUtc().addSecs(1);
+    // All steps are made one second after construction
+    AVIMMManualClock clock(tester.getTimestamp() + 1000000000LL);
+    tester.setClock(&clock);
+    tester_R.setClock(&clock);
+    tester_input.setClock(&clock);
+    tester_R.setTimestamp(tester.getTimestamp());
+    tester_input.setTimestamp(tester.getTimestamp());
     
     Vector modes(2,1);
     modes << 0.5, 0.5;
@@ -626,24 +635,24 @@ void TstAVIMMEstimator::test_IMMEstimator_predictAndUpdate()
     int i = 0;
     for (auto& filter: tester.m_filters)
     {
-        filter->m_data.P = P_filters[i];
-        filter->m_data.P.resize(6,6);
+        filter->getData().P = P_filters[i];
+        filter->getData().P.resize(6,6);
         i++;
     }
     
     i = 0;
     for (auto& filter: tester_R.m_filters)
     {
-        filter->m_data.P = P_filters[i];
-        filter->m_data.P.resize(6,6);
+        filter->getData().P = P_filters[i];
+        filter->getData().P.resize(6,6);
         i++;
     }
     
     i = 0;
     for (auto& filter: tester_input.m_filters)
     {
-        filter->m_data.P = P_filters[i];
-        filter->m_data.P.resize(6,6);
+        filter->getData().P = P_filters[i];
+        filter->getData().P.resize(6,6);
         i++;
     }
     
@@ -743,16 +752,16 @@ void TstAVIMMEstimator::test_IMMEstimator_extrapolate()
     int i = 0;
     for (auto& filter: tester.m_filters)
     {
-        filter->m_data.P = P_filters[i];
-        filter->m_data.P.resize(6,6);
+        filter->getData().P = P_filters[i];
+        filter->getData().P.resize(6,6);
         i++;
     }
     
     i = 0;
     for (auto& filter: tester_input.m_filters)
     {
-        filter->m_data.P = P_filters[i];
-        filter->m_data.P.resize(6,6);
+        filter->getData().P = P_filters[i];
+        filter->getData().P.resize(6,6);
         i++;
     }
     
@@ -767,9 +776,7 @@ void TstAVIMMEstimator::test_IMMEstimator_extrapolate()
                0,             0,       0, 1.16917,   2.503,   3.001;
                
                
-    tester.m_test_run = true;
-    tester.m_now = QDateTime::currentDateTimeUtc().addSecs(1);
-    auto ret = tester.extrapolate();
+    auto ret = tester.extrapolate(DEFAULT_VECTOR, tester.getTimestamp() + 1000000000LL);
     
     QVERIFY(((ret.first - ref_state).norm() < 0.1));
     QVERIFY(((ret.second - ref_cov).norm() < 0.1));
@@ -787,13 +794,92 @@ void TstAVIMMEstimator::test_IMMEstimator_extrapolate()
                      10.5255, 9.01801,       0,  13.656, 13.5235,   2.503,
                      0,             0,       0, 1.16917,   2.503,   3.001;
     
-    tester_input.m_test_run = true;
-    tester_input.m_now = QDateTime::currentDateTimeUtc().addSecs(1);
-    auto ret_input = tester_input.extrapolate(input);
+    auto ret_input = tester_input.extrapolate(input, tester_input.getTimestamp() + 1000000000LL);
     
     QVERIFY(((ret_input.first - ref_state_input).norm() < 0.1));
     QVERIFY(((ret_input.second - ref_cov_input).norm() < 0.1));
 }
 
+//--------------------------------------------------------------------------
+
+void TstAVIMMEstimator::test_IMMEstimator_extrapolateKeepsSubfilters()
+{
+    Vector initial_state(6,1);
+    initial_state << 0,10,0,0,-5,0;
+    
+    // Extrapolating between the steps must neither change the subfilters nor the following updates
+    AVIMMEstimator extrapolated(initial_state);
+    AVIMMEstimator reference(initial_state);
+    extrapolated.setTimestamp(0);
+    reference.setTimestamp(0);
+    
+    Vector z(6,1);
+    for (int step = 1; step <= 10; step++)
+    {
+        const qint64 timestamp = step * 1000000000LL;
+        extrapolated.extrapolate(DEFAULT_VECTOR, timestamp - 300000000LL);
+        extrapolated.extrapolate(DEFAULT_VECTOR, timestamp + 2000000000LL);
+        
+        auto filter = extrapolated.m_filters.begin();
+        for (const auto& reference_filter : reference.m_filters)
+        {
+            QVERIFY((*filter)->getData().x == reference_filter->getData().x);
+            QVERIFY((*filter)->getData().P == reference_filter->getData().P);
+            QVERIFY((*filter)->getData().F == reference_filter->getData().F);
+            QVERIFY((*filter)->getData().Q == reference_filter->getData().Q);
+            ++filter;
+        }
+        QVERIFY(extrapolated.getTimestamp() == reference.getTimestamp());
+        
+        z << 10.0 * step + (step % 2 ? 0.5 : -0.5), 10, 0, -5.0 * step, -5, 0;
+        extrapolated.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+        reference.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+        
+        QVERIFY(extrapolated.getStateVector() == reference.getStateVector());
+        QVERIFY(extrapolated.getCovarianceMatrix() == reference.getCovarianceMatrix());
+        QVERIFY(extrapolated.getModeProbabilityVector() == reference.getModeProbabilityVector());
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMEstimator::test_IMMEstimator_timestamps()
+{
+    Vector initial_state(6,1);
+    initial_state << 0,10,0,0,-5,0;
+    
+    // Measurement times give the same results as a clock which is advanced for every step
+    AVIMMManualClock clock(0);
+    AVIMMEstimator clocked(initial_state);
+    AVIMMEstimator timestamped(initial_state);
+    clocked.setClock(&clock);
+    clocked.setTimestamp(0);
+    timestamped.setTimestamp(0);
+    
+    Vector z(6,1);
+    for (int step = 1; step <= 10; step++)
+    {
+        z << 10.0 * step + (step % 2 ? 0.5 : -0.5), 10, 0, -5.0 * step, -5, 0;
+        clock.advance(500000000LL);
+        clocked.predictAndUpdate(z);
+        timestamped.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, step * 500000000LL);
+        QVERIFY(timestamped.getTimestamp() == step * 500000000LL);
+        QVERIFY(timestamped.getData().time_stamp == step * 500000000LL);
+        QVERIFY(timestamped.getStateVector() == clocked.getStateVector());
+    }
+    
+    clock.advance(1000000000LL);
+    auto clocked_extrapolation = clocked.extrapolate();
+    auto extrapolation = timestamped.extrapolate(DEFAULT_VECTOR, 6000000000LL);
+    QVERIFY(extrapolation.first == clocked_extrapolation.first);
+    QVERIFY(extrapolation.second == clocked_extrapolation.second);
+    QVERIFY(timestamped.getTimestamp() == 5000000000LL);
+    
+    // A measurement older than the current state is not predicted backwards
+    timestamped.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, 4000000000LL);
+    QVERIFY(timestamped.getTimestamp() == 5000000000LL);
+    QVERIFY(timestamped.getStateVector().allFinite());
+}
+
 AV_QTEST_MAIN(TstAVIMMEstimator)
 #include "tstavimmestimator.moc"
@@ -129,10 +129,10 @@ void TstAVIMMExtendedKalmanFilter::test_AVIMMKalmanFilter_predict()
     QVERIFY(AVIMMTester::getMatricesEqual(tester.getData().x_prior, ref_state).first);
     QVERIFY(AVIMMTester::getMatricesEqual(tester.getData().P_prior, ref_cov).first);
     
-    tester.m_data.x = ini_state;
-    tester.m_data.x_prior = ini_state;
-    tester.m_data.P = covariance_matrix;
-    tester.m_data.P_prior = covariance_matrix;
+    tester.getData().x = ini_state;
+    tester.getData().x_prior = ini_state;
+    tester.getData().P = covariance_matrix;
+    tester.getData().P_prior = covariance_matrix;
     
     Vector ref_state_input(3,1);
     ref_state_input << 8,6,3;
@@ -188,8 +188,8 @@ void TstAVIMMExtendedKalmanFilter::test_AVIMMKalmanFilter_update()
     Vector measurement(3,1);
     measurement << 4,4,4;
     
-    tester.m_data.x_prior = ini_state;
-    tester.m_data.P_prior = covariance_matrix;
+    tester.getData().x_prior = ini_state;
+    tester.getData().P_prior = covariance_matrix;
     
     tester.update(measurement, R);
     
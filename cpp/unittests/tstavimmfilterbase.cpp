@@ -66,6 +66,7 @@ private slots:
     void test_AVIMMFilterBase_getFilterKey();
     void test_AVIMMFilterBase_getLogLikelihood();
     void test_AVIMMFilterBase_getLikelihood();
+    void test_AVIMMFilterBase_calculateLogLikelihood();
     void test_AVIMMFilterBase_createUnityMatrix();
     void test_AVIMMFilterBase_zeroSmallElements();
 };
@@ -90,9 +91,9 @@ public:
     virtual ~FilterMock() {};
     
     // Implementation of the prediction step of the Kalman Filter
-    void predict(const Vector& u=DEFAULT_VECTOR) override { Q_UNUSED(u); Vector state(3,1); state << 3,3,3; m_data.x = state;}
+    void predict(const Vector& u=DEFAULT_VECTOR) override { Q_UNUSED(u); Vector state(3,1); state << 3,3,3; m_data.current().x = state;}
     // Implementation of the update step of the Kalman Filter
-    void update(const Vector& z, const Matrix& R=DEFAULT_MATRIX) { Q_UNUSED(z); Q_UNUSED(R); Vector state(3,1); state << 4,4,4; m_data.x = state;}
+    void update(const Vector& z, const Matrix& R=DEFAULT_MATRIX) { Q_UNUSED(z); Q_UNUSED(R); Vector state(3,1); state << 4,4,4; m_data.current().x = state;}
     // Returns a string giving Information about which Filter is currently used
     QString getFilterInfo() override { return QString("Filter Mock"); }
 };
@@ -506,8 +507,9 @@ void TstAVIMMFilterBase::test_AVIMMFilterBase_getLogLikelihood()
     Vector error(3,1);
     error << 0,0,0;
     
-    tester.m_data.S = S;
-    tester.m_data.error = error;
+    tester.getData().S = S;
+    tester.getData().S_factor.compute(S);
+    tester.getData().error = error;
     
     QVERIFY((tester.getLogLikelihood() - (-2.75682)) < 1*exp(-5));
 }
@@ -542,8 +544,9 @@ void TstAVIMMFilterBase::test_AVIMMFilterBase_getLikelihood()
     Vector error(3,1);
     error << 0,0,0;
     
-    tester.m_data.S = S;
-    tester.m_data.error = error;
+    tester.getData().S = S;
+    tester.getData().S_factor.compute(S);
+    tester.getData().error = error;
     
     QVERIFY((tester.getLogLikelihood() - (0.0634936) )< 1*exp(-5));
 }
@@ -598,5 +601,28 @@ void TstAVIMMFilterBase::test_AVIMMFilterBase_zeroSmallElements()
     QVERIFY(AVIMMTester::getMatricesEqual(zeroed_vec, ref_vec).first);
 }
 
+//--------------------------------------------------------------------------
+
+void TstAVIMMFilterBase::test_AVIMMFilterBase_calculateLogLikelihood()
+{
+    Matrix S(2,2);
+    S << 4,1,
+         1,3;
+    Vector error(2,1);
+    error << 3,-2;
+    
+    // Must match the density of Mvn
+    const Vector mean = Vector::Zero(2,1);
+    Mvn mvn(mean, S);
+    Eigen::LDLT<Matrix> S_factor(S);
+    Vector workspace;
+    QVERIFY(std::abs(AVIMMFilterBase::calculateLogLikelihood(S_factor, error, workspace) - mvn.logpdf(error)) < 1e-12);
+    
+    // The density underflows for large errors, the log likelihood must stay finite
+    error << 300,-200;
+    QVERIFY(mvn.pdf(error) == 0.0);
+    QVERIFY(std::isfinite(AVIMMFilterBase::calculateLogLikelihood(S_factor, error, workspace)));
+}
+
 AV_QTEST_MAIN(TstAVIMMFilterBase)
 #include "tstavimmfilterbase.moc"
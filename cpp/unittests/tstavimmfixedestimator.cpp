@@ -0,0 +1,375 @@
+//
+// Created by felix on 7/28/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMFixedEstimator and AVIMMEstimatorFactory
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMFixedEstimator : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMFixedEstimator() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMFixedKalmanFilter_predict();
+    void test_AVIMMFixedKalmanFilter_update();
+    void test_AVIMMEstimatorFactory_getFixedDimensions();
+    void test_AVIMMEstimatorFactory_createEstimator();
+    void test_AVIMMEstimatorFactory_createEstimatorForAirportConfig();
+    void test_AVIMMFixedEstimator_predictAndUpdate();
+    void test_AVIMMFixedEstimator_extrapolate();
+    void test_AVIMMFixedEstimator_extrapolateKeepsSubfilters();
+    void test_AVIMMFixedEstimator_logDomainModeProbabilities();
+    void test_AVIMMFixedEstimator_matchesDynamicEstimator();
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedKalmanFilter_predict()
+{
+    Eigen::Vector3d ini_state;
+    ini_state << 1,2,3;
+
+    AVIMMFixedKalmanFilter<3,3,1> tester(ini_state, "Test");
+    auto& data = tester.getData();
+    data.F << 2,0,0,0,3,0,0,0,1;
+    data.P << 2,0,0,0,2,0,0,0,2;
+    data.Q << 4,0,0,0,4,0,0,0,4;
+    data.B << 6,0,0;
+
+    Vector ref_state(3,1);
+    ref_state << 2,6,3;
+    Matrix ref_cov(3,3);
+    ref_cov << 12,0,0,0,22,0,0,0,6;
+
+    tester.predict();
+    QVERIFY(AVIMMTester::getMatricesEqual(data.x_prior, ref_state).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.P_prior, ref_cov).first);
+
+    Eigen::Matrix<double,1,1> input;
+    input << 1;
+    ref_state << 8,6,3;
+
+    tester.predict(&input);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.x, ini_state).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.x_prior, ref_state).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.P_prior, ref_cov).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedKalmanFilter_update()
+{
+    // The fixed filter must give the same results as the dynamic one, the full state size avoids expanding the
+    // innovation of the dynamic filter
+    Vector ini_state(6,1);
+    ini_state << 1,2,3,4,5,6;
+    Matrix F = Matrix::Identity(6,6);
+    F(0,1) = 1.0;
+    F(2,3) = 1.0;
+    Matrix P = 2.0 * Matrix::Identity(6,6);
+    P(0,1) = P(1,0) = 0.5;
+    Matrix H = Matrix::Identity(6,6);
+    Matrix Q = 0.5 * Matrix::Identity(6,6);
+    Matrix R = 5.0 * Matrix::Identity(6,6);
+    Matrix B = Matrix::Identity(6,2);
+    Vector z(6,1);
+    z << 4,1,8,3,5,7;
+
+    AVIMMKalmanFilter dynamic_filter(ini_state, F, P, H, Q, R, B, "Test");
+    dynamic_filter.predict();
+    dynamic_filter.update(z, R);
+
+    AVIMMFixedKalmanFilter<6,6,2> fixed_filter(ini_state, "Test");
+    auto& data = fixed_filter.getData();
+    data.F = F;
+    data.P = P;
+    data.H = H;
+    data.Q = Q;
+    data.B = B;
+    fixed_filter.predict();
+    fixed_filter.update(z, R);
+
+    QVERIFY(AVIMMTester::getMatricesEqual(data.x_post, dynamic_filter.getData().x_post).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.P_post, dynamic_filter.getData().P_post).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(data.S, dynamic_filter.getData().S).first);
+    QVERIFY(std::abs(fixed_filter.getLogLikelihood() - dynamic_filter.getLogLikelihood()) < 1e-9);
+    QVERIFY(std::abs(fixed_filter.getLikelihood() - dynamic_filter.getLikelihood()) < 1e-12);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMEstimatorFactory_getFixedDimensions()
+{
+    AVIMMConfigData config = AVIMMTester::createConfigData(4, 2, true);
+    int state_dim = 0;
+    int measurement_dim = 0;
+    int input_dim = 0;
+    QVERIFY(AVIMMEstimatorFactory::getFixedDimensions(config, state_dim, measurement_dim, input_dim));
+    QVERIFY(state_dim == 4);
+    QVERIFY(measurement_dim == 2);
+    QVERIFY(input_dim == 2);
+
+    // Subfilters with different dimensions need the dynamic estimator
+    const QString key = config.sub_filter_config_keys[1];
+    AVMatrix<QString> F6(6,6, "0");
+    config.compiled_map[key].F = AVIMMConfigParser::singleton().compileMatrixProgram(F6);
+    QVERIFY(!AVIMMEstimatorFactory::getFixedDimensions(config, state_dim, measurement_dim, input_dim));
+
+    // The extended kalman filter needs measurements in the state space
+    config = AVIMMTester::createConfigData(4, 2, true);
+    AVIMMStaticConfigContainer::singleton().filter_type_map[key] = ExtendedKalmanFilter;
+    QVERIFY(!AVIMMEstimatorFactory::getFixedDimensions(config, state_dim, measurement_dim, input_dim));
+    AVIMMStaticConfigContainer::singleton().filter_type_map[key] = KalmanFilter;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMEstimatorFactory_createEstimator()
+{
+    Vector initial_state(6,1);
+    initial_state << 1,2,3,4,5,6;
+
+    AVIMMEstimatorPtr estimator =
+        AVIMMEstimatorFactory::createEstimator(AVIMMTester::createConfigData(6), initial_state);
+    auto* fixed_estimator = dynamic_cast<AVIMMFixedEstimator<6,6,2,2>*>(estimator.get());
+    QVERIFY(fixed_estimator != nullptr);
+    QVERIFY(AVIMMTester::getMatricesEqual(estimator->getStateVector(), initial_state).first);
+    QVERIFY(std::abs(estimator->getModeProbabilityVector().sum() - 1.0) < 1e-12);
+
+    // The dynamic estimator would expand the states and pad the innovation, smaller configs are not run fixed size
+    estimator = AVIMMEstimatorFactory::createEstimator(AVIMMTester::createConfigData(4, 2, true),
+                                                       initial_state.head(4));
+    QVERIFY(dynamic_cast<AVIMMEstimator*>(estimator.get()) != nullptr);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMEstimatorFactory_createEstimatorForAirportConfig()
+{
+    // The airport configs replace the singletons of the test case
+    AVIMMConfigParser::deleteSingleton();
+    AVIMMStaticConfigContainer::deleteSingleton();
+    AVIMMAirportConfigs::initializeSingleton();
+
+    const QStringList& state_definition = AVIMMStaticConfigContainer::singleton().state_definition;
+    const Vector initial_state = Vector::Zero(state_definition.size());
+    AVIMMEstimatorPtr estimator = AVIMMEstimatorFactory::createEstimator(initial_state);
+    const bool fixed = dynamic_cast<AVIMMFixedEstimator<6,6,2,2>*>(estimator.get()) != nullptr;
+
+    // The input control matrix of the config takes the accelerations in x and y
+    Vector z = Vector::Zero(state_definition.size());
+    Vector u(2,1);
+    u << 0.5, -0.5;
+    estimator->predictAndUpdate(z, DEFAULT_MATRIX, u, estimator->getTimestamp() + 1000000000LL);
+    const bool finite = estimator->getStateVector().allFinite();
+
+    AVIMMAirportConfigs::deleteSingleton();
+    AVIMMStaticConfigContainer::initializeSingleton();
+    AVIMMConfigParser::setSingleton(new AVIMMConfigParser());
+
+    QVERIFY(fixed);
+    QVERIFY(finite);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedEstimator_predictAndUpdate()
+{
+    Vector initial_state(4,1);
+    initial_state << 0,10,0,-5;
+
+    AVIMMFixedEstimator<4,2,2,2> tester(AVIMMTester::createConfigData(4, 2, true), initial_state);
+    tester.setTimestamp(0);
+
+    // Target moving with constant velocity, the low noise model has to take over
+    Vector z(2,1);
+    for (int step = 1; step <= 30; step++)
+    {
+        z << 10.0 * step, -5.0 * step;
+        tester.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, step * 1000000000LL);
+
+        QVERIFY(std::abs(tester.getModeProbabilities().sum() - 1.0) < 1e-9);
+    }
+
+    Vector ref(4,1);
+    ref << 300,10,-150,-5;
+    QVERIFY((tester.getStateVector() - ref).norm() < 0.5);
+    QVERIFY(tester.getModeProbabilities()[0] > tester.getModeProbabilities()[1]);
+    QVERIFY(tester.getData().x_post == tester.getData().x);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedEstimator_extrapolate()
+{
+    Vector initial_state(4,1);
+    initial_state << 0,10,0,-5;
+
+    AVIMMFixedEstimator<4,2,2,2> tester(AVIMMTester::createConfigData(4, 2, true), initial_state);
+    auto state_before = tester.getStateVector();
+    auto extrapolated = tester.extrapolate(DEFAULT_VECTOR, tester.getTimestamp() + 2000000000LL);
+
+    Vector ref(4,1);
+    ref << 20,10,-10,-5;
+    QVERIFY(AVIMMTester::getMatricesEqual(extrapolated.first, ref).first);
+    QVERIFY(extrapolated.second.rows() == 4);
+    // Extrapolation must not change the IMM state
+    QVERIFY(tester.getStateVector() == state_before);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedEstimator_extrapolateKeepsSubfilters()
+{
+    Vector initial_state(4,1);
+    initial_state << 0,10,0,-5;
+
+    // Extrapolating between the steps must neither change the subfilters nor the following updates
+    const AVIMMConfigData config = AVIMMTester::createConfigData(4, 2, true);
+    AVIMMFixedEstimator<4,2,2,2> extrapolated(config, initial_state);
+    AVIMMFixedEstimator<4,2,2,2> reference(config, initial_state);
+    extrapolated.setTimestamp(0);
+    reference.setTimestamp(0);
+
+    Vector z(2,1);
+    for (int step = 1; step <= 10; step++)
+    {
+        const qint64 timestamp = step * 1000000000LL;
+        extrapolated.extrapolate(DEFAULT_VECTOR, timestamp - 300000000LL);
+        extrapolated.extrapolate(DEFAULT_VECTOR, timestamp + 2000000000LL);
+
+        for (int i = 0; i < 2; i++)
+        {
+            const auto& data = extrapolated.m_filters[i]->getData();
+            const auto& reference_data = reference.m_filters[i]->getData();
+            QVERIFY(data.x == reference_data.x);
+            QVERIFY(data.P == reference_data.P);
+            QVERIFY(data.F == reference_data.F);
+            QVERIFY(data.Q == reference_data.Q);
+        }
+        QVERIFY(extrapolated.getTimestamp() == reference.getTimestamp());
+
+        z << 10.0 * step + (step % 2 ? 0.5 : -0.5), -5.0 * step;
+        extrapolated.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+        reference.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+
+        QVERIFY(extrapolated.getStateVector() == reference.getStateVector());
+        QVERIFY(extrapolated.getCovarianceMatrix() == reference.getCovarianceMatrix());
+        QVERIFY(extrapolated.getModeProbabilityVector() == reference.getModeProbabilityVector());
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedEstimator_logDomainModeProbabilities()
+{
+    Vector initial_state(4,1);
+    initial_state << 0,10,0,-5;
+
+    AVIMMFixedEstimator<4,2,2,2> linear(AVIMMTester::createConfigData(4, 2, true), initial_state);
+    AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities = true;
+    AVIMMFixedEstimator<4,2,2,2> log_domain(AVIMMTester::createConfigData(4, 2, true), initial_state);
+    AVIMMStaticConfigContainer::singleton().log_domain_mode_probabilities = false;
+
+    linear.setTimestamp(0);
+    log_domain.setTimestamp(0);
+
+    // As long as no likelihood is clamped both must give the same results
+    Vector z(2,1);
+    for (int step = 1; step <= 10; step++)
+    {
+        z << 10.0 * step + (step % 2 ? 0.5 : -0.5), -5.0 * step;
+        linear.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, step * 1000000000LL);
+        log_domain.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, step * 1000000000LL);
+
+        QVERIFY(AVIMMTester::getMatricesEqual(log_domain.getModeProbabilityVector(),
+                                              linear.getModeProbabilityVector()).first);
+        QVERIFY(AVIMMTester::getMatricesEqual(log_domain.getStateVector(), linear.getStateVector()).first);
+    }
+
+    // An outlier makes both likelihoods tiny, in log space the better model still wins
+    z << 5000.0, 5000.0;
+    log_domain.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, log_domain.getTimestamp() + 1000000000LL);
+    QVERIFY(std::abs(log_domain.getModeProbabilities().sum() - 1.0) < 1e-9);
+    QVERIFY(log_domain.getModeProbabilities()[1] > 0.99);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMFixedEstimator::test_AVIMMFixedEstimator_matchesDynamicEstimator()
+{
+    // The dynamic estimator expands all subfilters to the full state size, so both estimators are compared with the
+    // full state measured
+    const AVIMMConfigData config = AVIMMTester::createConfigData(6);
+    Vector initial_state(6,1);
+    initial_state << 0,10,0,-5,0,0;
+
+    AVIMMFixedEstimator<6,6,2,2> fixed(config, initial_state);
+    AVIMMEstimator dynamic(config, initial_state);
+    fixed.setTimestamp(0);
+    dynamic.setTimestamp(0);
+
+    // Varying time deltas, inputs and a turn after 15 steps, so that both modes contribute
+    Vector z(6,1);
+    Vector u(2,1);
+    Vector position(6,1);
+    position << 0,10,0,-5,0,0;
+    qint64 timestamp = 0;
+    for (int step = 1; step <= 30; step++)
+    {
+        const qint64 time_delta = step % 3 == 0 ? 500000000LL : 1000000000LL;
+        timestamp += time_delta;
+        if (step == 15)
+            position << position(0), -5, position(2), 10, 0, 0;
+        position(0) += position(1) * time_delta / 1e9;
+        position(2) += position(3) * time_delta / 1e9;
+        z = position;
+        z(0) += step % 2 ? 0.5 : -0.5;
+        z(2) += step % 3 ? -0.3 : 0.3;
+
+        u << (step % 4) * 0.1, -(step % 5) * 0.1;
+
+        fixed.predictAndUpdate(z, DEFAULT_MATRIX, u, timestamp);
+        dynamic.predictAndUpdate(z, DEFAULT_MATRIX, u, timestamp);
+
+        const auto state = AVIMMTester::getMatricesEqual(fixed.getStateVector(), dynamic.getStateVector());
+        const auto covariance = AVIMMTester::getMatricesEqual(fixed.getCovarianceMatrix(),
+                                                              dynamic.getCovarianceMatrix());
+        const auto probabilities = AVIMMTester::getMatricesEqual(fixed.getModeProbabilityVector(),
+                                                                 dynamic.getModeProbabilityVector());
+        QVERIFY(state.first && state.second < 1e-6);
+        QVERIFY(covariance.first && covariance.second < 1e-6);
+        QVERIFY(probabilities.first && probabilities.second < 1e-9);
+    }
+    QVERIFY(fixed.getTimestamp() == dynamic.getTimestamp());
+}
+
+AV_QTEST_MAIN(TstAVIMMFixedEstimator)
+#include "tstavimmfixedestimator.moc"
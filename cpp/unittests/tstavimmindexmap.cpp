@@ -0,0 +1,178 @@
+//
+// Created by felix on 8/10/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMIndexMap
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMIndexMap : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMIndexMap() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMIndexMap_constructor();
+    void test_AVIMMIndexMap_apply();
+    void test_AVIMMIndexMap_applySymmetric();
+    void test_AVIMMIndexMap_shrink();
+
+private:
+    // Expansion of a [x, vx, y, vy] subfilter to [x, vx, ax, y, vy, ay] like in imm_config2_static_dynamic.cc
+    static Matrix createExpansionMatrix(double fill);
+    // Inverse selection of createExpansionMatrix()
+    static Matrix createShrinkingMatrix();
+    // Dense reference of AVIMMIndexMap::applySymmetric(), M padded with the identity
+    static Matrix expandDense(const Matrix& map, const Matrix& M);
+};
+
+//--------------------------------------------------------------------------
+
+Matrix TstAVIMMIndexMap::createExpansionMatrix(double fill)
+{
+    Matrix map = Matrix::Zero(6,6);
+    map(0,0) = 1;
+    map(1,1) = 1;
+    map(2,4) = fill;
+    map(3,2) = 1;
+    map(4,3) = 1;
+    map(5,5) = fill;
+    return map;
+}
+
+//--------------------------------------------------------------------------
+
+Matrix TstAVIMMIndexMap::createShrinkingMatrix()
+{
+    Matrix map = Matrix::Zero(4,6);
+    map(0,0) = 1;
+    map(1,1) = 1;
+    map(2,3) = 1;
+    map(3,4) = 1;
+    return map;
+}
+
+//--------------------------------------------------------------------------
+
+Matrix TstAVIMMIndexMap::expandDense(const Matrix& map, const Matrix& M)
+{
+    Matrix padded = Matrix::Identity(map.cols(), map.cols());
+    padded.topLeftCorner(M.rows(), M.cols()) = M;
+    return map * padded * map.transpose();
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMIndexMap::test_AVIMMIndexMap_constructor()
+{
+    AVIMMIndexMap empty;
+    QVERIFY(!empty.isValid());
+    QVERIFY(empty.rows() == 0);
+    QVERIFY(!AVIMMIndexMap(Matrix()).isValid());
+
+    AVIMMIndexMap expansion(createExpansionMatrix(9));
+    QVERIFY(expansion.isValid());
+    QVERIFY(expansion.rows() == 6);
+
+    // A row combining two states can not be gathered
+    Matrix combination = createExpansionMatrix(1);
+    combination(0,1) = 0.5;
+    QVERIFY(!AVIMMIndexMap(combination).isValid());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMIndexMap::test_AVIMMIndexMap_apply()
+{
+    const Matrix map = createExpansionMatrix(1);
+    AVIMMIndexMap index_map(map);
+
+    Vector x(4,1);
+    x << 1,2,3,4;
+    Vector padded = Vector::Ones(6);
+    padded.head(4) = x;
+
+    Vector result;
+    index_map.apply(x, result);
+    QVERIFY(AVIMMTester::getMatricesEqual(result, Vector(map * padded)).first);
+
+    Vector ref(6,1);
+    ref << 1,2,1,3,4,1;
+    QVERIFY(result == ref);
+
+    // A full size source is only permuted
+    Vector full(6,1);
+    full << 1,2,3,4,5,6;
+    index_map.apply(full, result);
+    QVERIFY(AVIMMTester::getMatricesEqual(result, Vector(map * full)).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMIndexMap::test_AVIMMIndexMap_applySymmetric()
+{
+    const Matrix map = createExpansionMatrix(9);
+    AVIMMIndexMap index_map(map);
+
+    Matrix P(4,4);
+    P << 4,1,0,0,
+         1,2,0,0,
+         0,0,5,3,
+         0,0,3,7;
+
+    Matrix result;
+    index_map.applySymmetric(P, result);
+    QVERIFY(AVIMMTester::getMatricesEqual(result, expandDense(map, P)).first);
+    // Fill value of the acceleration variance
+    QVERIFY(result(2,2) == 81.0);
+    QVERIFY(result(2,5) == 0.0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMIndexMap::test_AVIMMIndexMap_shrink()
+{
+    const Matrix map = createShrinkingMatrix();
+    AVIMMIndexMap index_map(map);
+    QVERIFY(index_map.rows() == 4);
+
+    Vector x(6,1);
+    x << 1,2,3,4,5,6;
+    Vector x_shrunk;
+    index_map.apply(x, x_shrunk);
+    QVERIFY(AVIMMTester::getMatricesEqual(x_shrunk, Vector(map * x)).first);
+
+    Matrix P = Matrix::Random(6,6);
+    P = P * P.transpose();
+    Matrix P_shrunk;
+    index_map.applySymmetric(P, P_shrunk);
+    QVERIFY(AVIMMTester::getMatricesEqual(P_shrunk, Matrix(map * P * map.transpose())).first);
+}
+
+AV_QTEST_MAIN(TstAVIMMIndexMap)
+#include "tstavimmindexmap.moc"
@@ -58,6 +58,7 @@ private slots:
     void test_AVIMMKalmanFilter_getFilterInfo();
     void test_AVIMMKalmanFilter_predict();
     void test_AVIMMKalmanFilter_update();
+    void test_AVIMMKalmanFilter_previousData();
 };
 
 //--------------------------------------------------------------------------
@@ -96,10 +97,10 @@ void TstAVIMMKalmanFilter::test_AVIMMKalmanFilter_predict()
     QVERIFY(AVIMMTester::getMatricesEqual(tester.getData().x_prior, ref_state).first);
     QVERIFY(AVIMMTester::getMatricesEqual(tester.getData().P_prior, ref_cov).first);
     
-    tester.m_data.x = ini_state;
-    tester.m_data.x_prior = ini_state;
-    tester.m_data.P = covariance_matrix;
-    tester.m_data.P_prior = covariance_matrix;
+    tester.getData().x = ini_state;
+    tester.getData().x_prior = ini_state;
+    tester.getData().P = covariance_matrix;
+    tester.getData().P_prior = covariance_matrix;
     
     Vector ref_state_input(3,1);
     ref_state_input << 8,6,3;
@@ -153,8 +154,8 @@ void TstAVIMMKalmanFilter::test_AVIMMKalmanFilter_update()
     Vector measurement(3,1);
     measurement << 4,4,4;
     
-    tester.m_data.x_prior = ini_state;
-    tester.m_data.P_prior = covariance_matrix;
+    tester.getData().x_prior = ini_state;
+    tester.getData().P_prior = covariance_matrix;
     
     tester.update(measurement, R);
     
@@ -190,5 +191,52 @@ void TstAVIMMKalmanFilter::test_AVIMMKalmanFilter_getFilterInfo()
     QVERIFY(tester.getFilterInfo() == QString("IMM Kalman Filter"));
 }
 
+//--------------------------------------------------------------------------
+
+void TstAVIMMKalmanFilter::test_AVIMMKalmanFilter_previousData()
+{
+    // Full state size, the innovation does not have to be expanded
+    Vector ini_state(6,1);
+    ini_state << 1,2,3,4,5,6;
+    Matrix transitions_matrix = Matrix::Identity(6,6);
+    transitions_matrix(0,1) = 1.0;
+    Matrix identity = Matrix::Identity(6,6);
+    
+    AVIMMKalmanFilter tester(ini_state, transitions_matrix, identity, identity, identity, identity, identity, "Test");
+    
+    Vector measurement(6,1);
+    measurement << 4,4,4,4,4,4;
+    tester.predict();
+    tester.update(measurement, identity);
+    
+    // The previous data is the data the step started with, the model is carried over into the new data
+    QVERIFY(tester.getPreviousData().x == ini_state);
+    QVERIFY(tester.getPreviousData().P == identity);
+    QVERIFY(tester.getData().F == transitions_matrix);
+    QVERIFY(tester.getData().x == tester.getData().x_post);
+    
+    Vector x_first_step = tester.getData().x;
+    Matrix P_first_step = tester.getData().P;
+    tester.predict();
+    tester.update(measurement, identity);
+    
+    QVERIFY(tester.getPreviousData().x == x_first_step);
+    QVERIFY(tester.getPreviousData().P == P_first_step);
+    QVERIFY(tester.getData().F == transitions_matrix);
+    QVERIFY(tester.getData().Q == identity);
+    
+    // A model written into the current data before the prediction, as the estimator does, is used and moved on
+    Matrix faster_transitions = transitions_matrix;
+    faster_transitions(0,1) = 2.0;
+    tester.getData().F = faster_transitions;
+    Vector x_second_step = tester.getData().x;
+    tester.predict();
+    
+    QVERIFY(AVIMMTester::getMatricesEqual(tester.getData().x_prior, faster_transitions * x_second_step).first);
+    QVERIFY(tester.getData().F == faster_transitions);
+    QVERIFY(tester.getData().H == identity);
+    QVERIFY(tester.getData().R == identity);
+}
+
 AV_QTEST_MAIN(TstAVIMMKalmanFilter)
 #include "tstavimmkalmanfilter.moc"
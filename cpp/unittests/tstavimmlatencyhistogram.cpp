@@ -0,0 +1,125 @@
+//
+// Created by felix on 9/1/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMLatencyHistogram
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+#include "../utils/avimmlatencyhistogram.h"
+
+class TstAVIMMLatencyHistogram : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMLatencyHistogram() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMLatencyHistogram_buckets();
+    void test_AVIMMLatencyHistogram_percentiles();
+    void test_AVIMMLatencyHistogram_merge();
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLatencyHistogram::test_AVIMMLatencyHistogram_buckets()
+{
+    // Small values have their own bucket
+    for (quint64 value = 0; value < AVIMMLatencyHistogram::EXACT_BUCKETS; value++)
+        QVERIFY(AVIMMLatencyHistogram::getBucket(value) == static_cast<int>(value));
+
+    // Every value lies within its bucket, the buckets are contiguous and at most 1/16 wide
+    const quint64 values[] = { 32, 33, 47, 48, 63, 64, 100, 1000, 12345, 999999, 1ULL << 40, ~0ULL };
+    for (quint64 value : values)
+    {
+        const int bucket = AVIMMLatencyHistogram::getBucket(value);
+        QVERIFY(bucket < AVIMMLatencyHistogram::NUMBER_OF_BUCKETS);
+        QVERIFY(AVIMMLatencyHistogram::getBucketLowerBound(bucket) <= value);
+        QVERIFY(AVIMMLatencyHistogram::getBucketUpperBound(bucket) >= value);
+        QVERIFY(AVIMMLatencyHistogram::getBucketUpperBound(bucket) - AVIMMLatencyHistogram::getBucketLowerBound(bucket)
+                <= value / 16);
+    }
+    for (int bucket = 1; bucket < AVIMMLatencyHistogram::NUMBER_OF_BUCKETS; bucket++)
+        QVERIFY(AVIMMLatencyHistogram::getBucketLowerBound(bucket) ==
+                AVIMMLatencyHistogram::getBucketUpperBound(bucket - 1) + 1);
+    QVERIFY(AVIMMLatencyHistogram::getBucketUpperBound(AVIMMLatencyHistogram::NUMBER_OF_BUCKETS - 1) == ~0ULL);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLatencyHistogram::test_AVIMMLatencyHistogram_percentiles()
+{
+    AVIMMLatencyHistogram histogram;
+    QVERIFY(histogram.getCount() == 0);
+    QVERIFY(histogram.getPercentile(50.0) == 0);
+    QVERIFY(histogram.getMin() == 0);
+
+    for (quint64 value = 1; value <= 1000; value++)
+        histogram.record(value * 100);
+    QVERIFY(histogram.getCount() == 1000);
+    QVERIFY(histogram.getMin() == 100);
+    QVERIFY(histogram.getMax() == 100000);
+    QVERIFY(histogram.getMean() == 50050.0);
+
+    // The percentiles are exact up to the bucket width
+    const double percentiles[] = { 1.0, 50.0, 90.0, 99.0, 99.9 };
+    for (double percentile : percentiles)
+    {
+        const double exact = percentile * 1000.0;
+        const double value = histogram.getPercentile(percentile);
+        QVERIFY(value >= exact && value <= exact * (1.0 + 1.0 / 16.0));
+    }
+    QVERIFY(histogram.getPercentile(100.0) == 100000);
+
+    histogram.reset();
+    QVERIFY(histogram.getCount() == 0);
+    QVERIFY(histogram.getMax() == 0);
+    QVERIFY(histogram.getPercentile(99.0) == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLatencyHistogram::test_AVIMMLatencyHistogram_merge()
+{
+    AVIMMLatencyHistogram fast;
+    AVIMMLatencyHistogram slow;
+    for (int i = 0; i < 90; i++)
+        fast.record(10);
+    for (int i = 0; i < 10; i++)
+        slow.record(5000);
+
+    AVIMMLatencyHistogram merged = fast;
+    merged.merge(slow);
+    QVERIFY(merged.getCount() == 100);
+    QVERIFY(merged.getMin() == 10);
+    QVERIFY(merged.getMax() == 5000);
+    QVERIFY(merged.getPercentile(90.0) == 10);
+    QVERIFY(merged.getPercentile(91.0) == 5000);
+    QVERIFY(fast.getCount() == 90);
+}
+
+AV_QTEST_MAIN(TstAVIMMLatencyHistogram)
+#include "tstavimmlatencyhistogram.moc"
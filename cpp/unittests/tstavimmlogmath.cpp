@@ -0,0 +1,131 @@
+//
+// Created by felix on 8/4/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMLogMath
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+#include "../utils/avimmlogmath.h"
+
+class TstAVIMMLogMath : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMLogMath() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMLogMath_logSumExp();
+    void test_AVIMMLogMath_calculateMixingProbabilities();
+    void test_AVIMMLogMath_calculateModeProbabilities();
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLogMath::test_AVIMMLogMath_logSumExp()
+{
+    Vector values(3,1);
+    values << 0.5, -1.0, 2.0;
+    QVERIFY(std::abs(AVIMMLogMath::logSumExp(values.array()) - std::log(values.array().exp().sum())) < 1e-12);
+
+    // Values whose exponentials under- or overflow
+    values << -2000.0, -2000.0, -3000.0;
+    QVERIFY(std::abs(AVIMMLogMath::logSumExp(values.array()) - (-2000.0 + std::log(2.0))) < 1e-9);
+    values << 1000.0, 0.0, -1000.0;
+    QVERIFY(std::abs(AVIMMLogMath::logSumExp(values.array()) - 1000.0) < 1e-9);
+
+    // A probability of zero in log space
+    values << -std::numeric_limits<double>::infinity(), 0.0, 0.0;
+    QVERIFY(std::abs(AVIMMLogMath::logSumExp(values.array()) - std::log(2.0)) < 1e-12);
+
+    // Only probabilities of zero
+    values.setConstant(-std::numeric_limits<double>::infinity());
+    QVERIFY(AVIMMLogMath::logSumExp(values.array()) == -std::numeric_limits<double>::infinity());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLogMath::test_AVIMMLogMath_calculateMixingProbabilities()
+{
+    Matrix transition(3,3);
+    transition << 0.9,  0.05, 0.05,
+                  0.05, 0.9,  0.05,
+                  0.05, 0.05, 0.9;
+    Vector mode_probabilities(3,1);
+    mode_probabilities << 0.2, 0.7, 0.1;
+
+    // Reference calculated in linear space like AVIMMEstimator::calculateModeProbabilityMatrix
+    Vector c_ref = transition * mode_probabilities;
+    Matrix mixing_ref(3,3);
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            mixing_ref(i,j) = transition(i,j) * mode_probabilities[i] / c_ref[j];
+
+    Matrix log_transition = transition.array().log();
+    Vector log_mode_probabilities = mode_probabilities.array().log();
+    Vector log_c(3,1);
+    Matrix mixing;
+    AVIMMLogMath::calculateMixingProbabilities(log_transition, log_mode_probabilities, log_c, mixing);
+
+    QVERIFY(AVIMMTester::getMatricesEqual(Vector(log_c.array().exp()), c_ref).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(mixing, mixing_ref).first);
+
+    // Fixed size types give the same result
+    Eigen::Matrix3d mixing_fixed;
+    Eigen::Vector3d log_c_fixed;
+    AVIMMLogMath::calculateMixingProbabilities(Eigen::Matrix3d(log_transition), Eigen::Vector3d(log_mode_probabilities),
+                                               log_c_fixed, mixing_fixed);
+    QVERIFY(AVIMMTester::getMatricesEqual(mixing_fixed, mixing_ref).first);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMLogMath::test_AVIMMLogMath_calculateModeProbabilities()
+{
+    Vector c(2,1);
+    c << 0.4, 0.6;
+    Vector likelihoods(2,1);
+    likelihoods << 0.02, 0.05;
+
+    Vector log_c = c.array().log();
+    Vector log_likelihoods = likelihoods.array().log();
+    Vector log_mode_probabilities;
+    AVIMMLogMath::calculateModeProbabilities(log_c, log_likelihoods, log_mode_probabilities);
+
+    Vector ref = c.cwiseProduct(likelihoods);
+    ref /= ref.sum();
+    QVERIFY(AVIMMTester::getMatricesEqual(Vector(log_mode_probabilities.array().exp()), ref).first);
+
+    // Likelihoods far below the clamp of getLikelihood() keep their ratio
+    log_likelihoods << -5000.0, -5002.0;
+    AVIMMLogMath::calculateModeProbabilities(log_c, log_likelihoods, log_mode_probabilities);
+    Vector mode_probabilities = log_mode_probabilities.array().exp();
+    QVERIFY(std::abs(mode_probabilities.sum() - 1.0) < 1e-12);
+    QVERIFY(std::abs(mode_probabilities[0] / mode_probabilities[1] - (0.4 / 0.6) * std::exp(2.0)) < 1e-9);
+}
+
+AV_QTEST_MAIN(TstAVIMMLogMath)
+#include "tstavimmlogmath.moc"
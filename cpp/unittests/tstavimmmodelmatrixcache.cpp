@@ -0,0 +1,299 @@
+//
+// Created by felix on 7/21/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMModelMatrixCache
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include <future>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMModelMatrixCache : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMModelMatrixCache() {}
+
+public slots:
+    void initTestCase()
+    {
+        AVIMMTester::initializeSingletons();
+        
+        AVMatrix<QString> F(2,2, "0");
+        F.set(0,0, "1");
+        F.set(0,1, "dt");
+        F.set(1,1, "1");
+        
+        AVMatrix<QString> Q(2,2, "0");
+        Q.set(0,0, "sigma*dt^3/3");
+        Q.set(0,1, "sigma*dt^2/2");
+        Q.set(1,0, "sigma*dt^2/2");
+        Q.set(1,1, "sigma*dt");
+        
+        AVMatrix<QString> I(2,2, "0");
+        I.set(0,0, "1");
+        I.set(1,1, "1");
+        
+        auto& parser = AVIMMConfigParser::singleton();
+        m_programs.F = parser.compileMatrixProgram(F);
+        m_programs.Q = parser.compileMatrixProgram(Q);
+        m_programs.B = parser.compileMatrixProgram(I);
+        m_programs.H = parser.compileMatrixProgram(I);
+        m_programs.P = parser.compileMatrixProgram(I);
+        m_programs.R = parser.compileMatrixProgram(I);
+    }
+    void cleanupTestCase()
+    {
+        AVIMMTester::deleteSingletons();
+    };
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMModelMatrixCache_getModelId();
+    void test_AVIMMModelMatrixCache_getModelMatrices();
+    void test_AVIMMModelMatrixCache_quantization();
+    void test_AVIMMModelMatrixCache_eviction();
+    void test_AVIMMModelMatrixCache_prewarm();
+    void test_AVIMMModelMatrixCache_switchCache();
+    void test_AVIMMModelMatrixCache_threadCacheIsNotLocked();
+
+private:
+    AVIMMCompiledSubfilterMatrices m_programs;
+
+    // Runs the estimator with the first cache and then with the second one, the states must match the reference
+    // estimator calculated without a cache
+    static void runWithCaches(AVIMMEstimatorInterface& estimator, AVIMMEstimatorInterface& reference,
+                              AVIMMModelMatrixCache& first, AVIMMModelMatrixCache& second);
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_getModelId()
+{
+    AVIMMModelMatrixCache cache(0.001, 16);
+    
+    int id_kf  = cache.getModelId("Apron", "kf");
+    int id_kf1 = cache.getModelId("Apron", "kf1");
+    int id_kf_approach = cache.getModelId("ApproachEast", "kf");
+    
+    QVERIFY(id_kf != id_kf1);
+    QVERIFY(id_kf != id_kf_approach);
+    QVERIFY(cache.getModelId("Apron", "kf") == id_kf);
+
+    // Ids are shared by all caches
+    AVIMMModelMatrixCache other_cache(0.1, 4);
+    QVERIFY(other_cache.getModelId("Apron", "kf1") == id_kf1);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_getModelMatrices()
+{
+    AVIMMModelMatrixCache cache(0.001, 16);
+    int model_id = cache.getModelId("Apron", "kf");
+    
+    const AVIMMModelMatrices& first = cache.getModelMatrices(model_id, m_programs, 1.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(first.F, m_programs.F->evaluate(1.0)).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(first.Q, m_programs.Q->evaluate(1.0)).first);
+    QVERIFY(cache.getMisses() == 1);
+    QVERIFY(cache.getHits() == 0);
+    
+    const AVIMMModelMatrices& second = cache.getModelMatrices(model_id, m_programs, 1.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(second.F, m_programs.F->evaluate(1.0)).first);
+    QVERIFY(cache.getMisses() == 1);
+    QVERIFY(cache.getHits() == 1);
+    
+    // A different sigma must not share the entry
+    const AVIMMModelMatrices& other_sigma = cache.getModelMatrices(model_id, m_programs, 1.0, 2.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(other_sigma.Q, m_programs.Q->evaluate(1.0, 2.0)).first);
+    QVERIFY(cache.getMisses() == 2);
+    
+    cache.resetStatistics();
+    QVERIFY(cache.getMisses() == 0);
+    QVERIFY(cache.getHits() == 0);
+    QVERIFY(cache.getSize() == 2);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_quantization()
+{
+    AVIMMModelMatrixCache cache(0.1, 16);
+    int model_id = cache.getModelId("Apron", "kf");
+    
+    // Both time deltas are rounded to 1.0, the matrices are calculated for the rounded value
+    cache.getModelMatrices(model_id, m_programs, 1.02);
+    const AVIMMModelMatrices& matrices = cache.getModelMatrices(model_id, m_programs, 0.98);
+    QVERIFY(cache.getHits() == 1);
+    QVERIFY(cache.getMisses() == 1);
+    QVERIFY(AVIMMTester::getMatricesEqual(matrices.F, m_programs.F->evaluate(1.0)).first);
+    
+    cache.getModelMatrices(model_id, m_programs, 1.2);
+    QVERIFY(cache.getMisses() == 2);
+    
+    // Without quantization only identical time deltas share an entry
+    AVIMMModelMatrixCache exact_cache(0.0, 16);
+    exact_cache.getModelMatrices(model_id, m_programs, 1.02);
+    exact_cache.getModelMatrices(model_id, m_programs, 1.02);
+    exact_cache.getModelMatrices(model_id, m_programs, 0.98);
+    QVERIFY(exact_cache.getHits() == 1);
+    QVERIFY(exact_cache.getMisses() == 2);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_eviction()
+{
+    AVIMMModelMatrixCache cache(0.001, 2);
+    int model_id = cache.getModelId("Apron", "kf");
+    
+    cache.getModelMatrices(model_id, m_programs, 1.0);
+    cache.getModelMatrices(model_id, m_programs, 2.0);
+    // Use 1.0 again, 2.0 is now the least recently used entry and is evicted by 3.0
+    cache.getModelMatrices(model_id, m_programs, 1.0);
+    const AVIMMModelMatrices& matrices = cache.getModelMatrices(model_id, m_programs, 3.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(matrices.F, m_programs.F->evaluate(3.0)).first);
+    QVERIFY(cache.getSize() == 2);
+    
+    cache.resetStatistics();
+    cache.getModelMatrices(model_id, m_programs, 1.0);
+    QVERIFY(cache.getHits() == 1);
+    cache.getModelMatrices(model_id, m_programs, 2.0);
+    QVERIFY(cache.getMisses() == 1);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_prewarm()
+{
+    AVIMMModelMatrixCache cache(0.001, 16);
+    int model_id = cache.getModelId("Apron", "kf");
+    
+    QList<float> sensor_periods = {1.0, 4.0};
+    cache.prewarm(model_id, m_programs, sensor_periods);
+    QVERIFY(cache.getSize() == 2);
+    QVERIFY(cache.getMisses() == 0);
+    
+    const AVIMMModelMatrices& matrices = cache.getModelMatrices(model_id, m_programs, 4.0);
+    QVERIFY(AVIMMTester::getMatricesEqual(matrices.Q, m_programs.Q->evaluate(4.0)).first);
+    QVERIFY(cache.getHits() == 1);
+    QVERIFY(cache.getMisses() == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::runWithCaches(AVIMMEstimatorInterface& estimator, AVIMMEstimatorInterface& reference,
+                                             AVIMMModelMatrixCache& first, AVIMMModelMatrixCache& second)
+{
+    Vector z(6,1);
+    for (int step = 1; step <= 20; step++)
+    {
+        z << 10.0 * step + (step % 3), 10, -5.0 * step - (step % 2), -5, 0, 0;
+        const qint64 timestamp = step * 1000000000LL;
+
+        AVIMMConfigParser::setThreadModelMatrixCache(nullptr);
+        reference.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+        AVIMMConfigParser::setThreadModelMatrixCache(step <= 10 ? &first : &second);
+        estimator.predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, timestamp);
+
+        QVERIFY(AVIMMTester::getMatricesEqual(estimator.getStateVector(), reference.getStateVector()).first);
+        QVERIFY(AVIMMTester::getMatricesEqual(estimator.getCovarianceMatrix(),
+                                              reference.getCovarianceMatrix()).first);
+        QVERIFY(AVIMMTester::getMatricesEqual(estimator.getModeProbabilityVector(),
+                                              reference.getModeProbabilityVector()).first);
+    }
+    AVIMMConfigParser::setThreadModelMatrixCache(nullptr);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_switchCache()
+{
+    // The dynamic estimator calculates with the full state size, both estimators measure the whole state
+    const AVIMMConfigData config = AVIMMTester::createConfigData(6);
+    Vector initial_state(6,1);
+    initial_state << 0,10,0,-5,0,0;
+
+    // The second cache holds the same subfilters of another area with a much larger process noise, the estimator
+    // must only find the matrices of its own models there
+    AVIMMCompiledSubfilterMatrices other = config.compiled_map.value(config.sub_filter_config_keys.first());
+    other.Q = AVIMMConfigParser::singleton().compileMatrixProgram(AVIMMTester::createProcessNoise(6, "1000"));
+
+    for (bool fixed : {false, true})
+    {
+        AVIMMModelMatrixCache first(0.0, 16);
+        AVIMMModelMatrixCache second(0.0, 16);
+        for (const auto& key : config.sub_filter_config_keys)
+            second.prewarm(second.getModelId("Other", key), other, {1.0f});
+
+        std::unique_ptr<AVIMMEstimatorInterface> estimator;
+        std::unique_ptr<AVIMMEstimatorInterface> reference;
+        if (fixed)
+        {
+            estimator.reset(new AVIMMFixedEstimator<6,6,2,2>(config, initial_state));
+            reference.reset(new AVIMMFixedEstimator<6,6,2,2>(config, initial_state));
+        }
+        else
+        {
+            estimator.reset(new AVIMMEstimator(config, initial_state));
+            reference.reset(new AVIMMEstimator(config, initial_state));
+        }
+        estimator->setTimestamp(0);
+        reference->setTimestamp(0);
+
+        runWithCaches(*estimator, *reference, first, second);
+        QVERIFY(first.getMisses() > 0);
+        QVERIFY(second.getMisses() > 0);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMModelMatrixCache::test_AVIMMModelMatrixCache_threadCacheIsNotLocked()
+{
+    auto& parser = AVIMMConfigParser::singleton();
+    parser.enableModelMatrixCache(0.001, 16);
+    Vector initial_state = Vector::Zero(6);
+    AVIMMEstimator estimator(AVIMMTester::createConfigData(6), initial_state);
+    estimator.setTimestamp(0);
+
+    // The cache of a thread is only used by that thread, holding the lock of the global cache must not block it
+    AVIMMModelMatrixCache thread_cache(0.001, 16);
+    std::unique_lock<std::mutex> global_lock = parser.getGlobalModelMatrixCache()->lock();
+    std::future<void> step = std::async(std::launch::async, [&]()
+    {
+        AVIMMConfigParser::setThreadModelMatrixCache(&thread_cache);
+        estimator.predictAndUpdate(initial_state, DEFAULT_MATRIX, DEFAULT_VECTOR, 1000000000LL);
+        AVIMMConfigParser::setThreadModelMatrixCache(nullptr);
+    });
+    const bool finished = step.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+    global_lock.unlock();
+    step.wait();
+    parser.disableModelMatrixCache();
+
+    QVERIFY(finished);
+    QVERIFY(thread_cache.getMisses() > 0);
+    QVERIFY(thread_cache.getContentions() == 0);
+}
+
+AV_QTEST_MAIN(TstAVIMMModelMatrixCache)
+#include "tstavimmmodelmatrixcache.moc"
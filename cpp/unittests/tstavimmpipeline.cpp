@@ -0,0 +1,358 @@
+//
+// Created by felix on 8/26/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMPipeline
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMPipeline : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMPipeline() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMPipeline_matchesTrackTable();
+    void test_AVIMMPipeline_gate();
+    void test_AVIMMPipeline_backpressure();
+    void test_AVIMMPipeline_sensorMerge();
+    void test_AVIMMPipeline_targetTimeout();
+    void test_AVIMMPipeline_mergeTargetTimeout();
+
+private:
+    // Decodes records "target,time in ms,x,vx,y,vy"
+    static bool decode(const QByteArray& record, QString& target, AVIMMPlot& plot);
+    // Creates the record of the target at the given scan, measured offset_ms after the scan
+    static QByteArray createRecord(int target, int step, int offset_ms=0);
+};
+
+//--------------------------------------------------------------------------
+
+bool TstAVIMMPipeline::decode(const QByteArray& record, QString& target, AVIMMPlot& plot)
+{
+    const QList<QByteArray> fields = record.split(',');
+    if (fields.size() != 6)
+        return false;
+
+    bool ok = true;
+    target    = QString::fromLatin1(fields[0]);
+    plot.time = fields[1].toLongLong(&ok) * 1000000LL;
+    plot.z    = Vector(4,1);
+    for (int i = 0; i < 4 && ok; i++)
+        plot.z(i) = fields[i + 2].toDouble(&ok);
+    plot.R      = Matrix();
+    plot.sensor = 0;
+    return ok;
+}
+
+//--------------------------------------------------------------------------
+
+QByteArray TstAVIMMPipeline::createRecord(int target, int step, int offset_ms)
+{
+    const double noise = step % 2 ? 0.5 : -0.5;
+    return QString("target_%1,%2,%3,10,%4,-5").arg(target).arg(step * 1000 + offset_ms)
+                                              .arg(target + 10.0 * step).arg(-target - 5.0 * step + noise).toLatin1();
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_matchesTrackTable()
+{
+    const int TARGETS = 100;
+    const int STEPS   = 5;
+
+    // Every batch is one scan of all targets, followed by the extrapolation to the end of the scan
+    std::vector<std::vector<QByteArray>> scans(STEPS);
+    for (int step = 0; step < STEPS; step++)
+        for (int target = 0; target < TARGETS; target++)
+            scans[step].push_back(createRecord(target, step));
+
+    AVIMMTrackTable table(AVIMMTester::createConfigData(4));
+    std::vector<std::vector<AVIMMTrackOutput>> expected(STEPS);
+    for (int step = 0; step < STEPS; step++)
+    {
+        for (const auto& record : scans[step])
+        {
+            QString target;
+            AVIMMPlot plot;
+            QVERIFY(decode(record, target, plot));
+            plot.handle = table.internTarget(target);
+            table.addPlot(plot);
+        }
+        table.extrapolateAll(step * 1000000000LL + 500000000LL, expected[step]);
+    }
+
+    std::vector<std::vector<AVIMMTrackOutput>> published;
+    std::vector<std::vector<QString>> published_targets;
+    {
+        AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), &decode,
+                               [&](const std::vector<AVIMMTrackOutput>& output, const std::vector<QString>& targets) {
+            published.push_back(output);
+            published_targets.push_back(targets);
+        }, 1.0, 2);
+
+        for (int step = 0; step < STEPS; step++)
+        {
+            std::vector<QByteArray> records = scans[step];
+            pipeline.push(records, step * 1000000000LL + 500000000LL);
+            QVERIFY(records.empty());
+        }
+        pipeline.flush();
+
+        for (int stage = 0; stage < AVIMMPipeline::NUMBER_OF_STAGES; stage++)
+        {
+            const auto current_stage = static_cast<AVIMMPipeline::Stage>(stage);
+            QVERIFY(pipeline.getNumberOfBatches(current_stage) == STEPS);
+            QVERIFY(pipeline.getNumberOfPlots(current_stage) == TARGETS * STEPS);
+            QVERIFY(pipeline.getQueueDepth(current_stage) == 0);
+            QVERIFY(pipeline.getMaxQueueDepth(current_stage) <= pipeline.getQueueCapacity());
+        }
+        QVERIFY(pipeline.getNumberOfDecodeErrors() == 0);
+        QVERIFY(pipeline.getNumberOfGatedPlots() == 0);
+    }
+
+    QVERIFY(published.size() == static_cast<size_t>(STEPS));
+    for (int step = 0; step < STEPS; step++)
+    {
+        QVERIFY(published[step].size() == expected[step].size());
+        for (size_t i = 0; i < expected[step].size(); i++)
+        {
+            QVERIFY(published_targets[step][i] == table.getTarget(expected[step][i].handle));
+            QVERIFY(AVIMMTester::getMatricesEqual(published[step][i].x, expected[step][i].x).first);
+            QVERIFY(AVIMMTester::getMatricesEqual(published[step][i].P, expected[step][i].P).first);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_gate()
+{
+    int published_tracks = -1;
+    AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), &decode,
+                           [&](const std::vector<AVIMMTrackOutput>& output, const std::vector<QString>&) {
+        published_tracks = output.size();
+    });
+
+    std::vector<QByteArray> records;
+    records.push_back(createRecord(0, 1));
+    records.push_back("invalid");
+    records.push_back("target_1,1000,nan,10,0,-5");
+    records.push_back(createRecord(2, 1));
+    // Not newer than the previous plot of the target
+    records.push_back(createRecord(0, 0));
+    records.push_back(createRecord(2, 1));
+    pipeline.push(records, 1500000000LL);
+    pipeline.flush();
+
+    QVERIFY(pipeline.getNumberOfDecodeErrors() == 1);
+    QVERIFY(pipeline.getNumberOfGatedPlots() == 3);
+    QVERIFY(pipeline.getNumberOfPlots(AVIMMPipeline::INGEST) == 5);
+    QVERIFY(pipeline.getNumberOfPlots(AVIMMPipeline::GATE) == 2);
+    QVERIFY(published_tracks == 2);
+
+    // A custom gate replaces the check of the time
+    AVIMMPipeline gated_pipeline(AVIMMTester::createConfigData(4), &decode, AVIMMPipeline::Publisher());
+    gated_pipeline.setGate([](const AVIMMPlot& last_plot, const AVIMMPlot& plot) {
+        return (plot.z - last_plot.z).norm() < 100.0;
+    });
+    records.push_back(createRecord(0, 0));
+    records.push_back(createRecord(0, 1));
+    records.push_back(createRecord(0, 100));
+    gated_pipeline.push(records);
+    gated_pipeline.flush();
+    QVERIFY(gated_pipeline.getNumberOfGatedPlots() == 1);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_backpressure()
+{
+    const int BATCHES = 50;
+
+    // The publisher is the slowest stage, the producer has to wait for it
+    int published_batches = 0;
+    AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), &decode,
+                           [&](const std::vector<AVIMMTrackOutput>&, const std::vector<QString>&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        published_batches++;
+    }, 1.0, 4);
+
+    bool rejected = false;
+    for (int step = 0; step < BATCHES; step++)
+    {
+        std::vector<QByteArray> records { createRecord(0, step), createRecord(1, step) };
+        if (!pipeline.tryPush(records, step * 1000000000LL))
+        {
+            rejected = true;
+            QVERIFY(records.size() == 2);
+            pipeline.push(records, step * 1000000000LL);
+        }
+    }
+    pipeline.flush();
+
+    QVERIFY(rejected);
+    QVERIFY(published_batches == BATCHES);
+    QVERIFY(pipeline.getMaxQueueDepth(AVIMMPipeline::PUBLISH) > 1);
+    for (int stage = 0; stage < AVIMMPipeline::NUMBER_OF_STAGES; stage++)
+        QVERIFY(pipeline.getMaxQueueDepth(static_cast<AVIMMPipeline::Stage>(stage)) <= 4);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_sensorMerge()
+{
+    const int STEPS = 10;
+
+    // Records "sensor:target,time in ms,x,vx,y,vy"
+    auto decoder = [](const QByteArray& record, QString& target, AVIMMPlot& plot) {
+        const int separator = record.indexOf(':');
+        if (separator <= 0 || !decode(record.mid(separator + 1), target, plot))
+            return false;
+        plot.sensor = record.left(separator).toInt();
+        return true;
+    };
+
+    // The plots of the second sensor arrive one scan late, without the merge they are rejected by the gate
+    std::vector<std::vector<QByteArray>> scans(STEPS + 1);
+    for (int step = 0; step < STEPS; step++)
+    {
+        scans[step].push_back("1:" + createRecord(0, step));
+        scans[step + 1].push_back("2:" + createRecord(0, step, 500));
+    }
+
+    for (bool merge : { false, true })
+    {
+        AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), decoder, AVIMMPipeline::Publisher());
+        if (merge)
+            pipeline.enableSensorMerge(1000 * 1000000LL);
+        for (auto scan : scans)
+            pipeline.push(scan);
+        pipeline.releaseMergedPlots();
+        pipeline.flush();
+
+        QVERIFY(pipeline.getNumberOfDecodeErrors() == 0);
+        QVERIFY(pipeline.getNumberOfLatePlots() == 0);
+        if (!merge)
+        {
+            QVERIFY(pipeline.getNumberOfGatedPlots() > 0);
+            continue;
+        }
+        QVERIFY(pipeline.getNumberOfGatedPlots() == 0);
+        QVERIFY(pipeline.getNumberOfPlots(AVIMMPipeline::FILTER) == 2 * STEPS);
+
+        // Older than the released plots
+        std::vector<QByteArray> records { "1:" + createRecord(0, 0) };
+        pipeline.push(records);
+        pipeline.flush();
+        QVERIFY(pipeline.getNumberOfLatePlots() == 1);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_targetTimeout()
+{
+    const int STEPS = 5;
+
+    // The second target only has a plot in the first scan
+    for (double target_timeout : { 1.0, 10.0 })
+    {
+        int published_tracks = -1;
+        AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), &decode,
+                               [&](const std::vector<AVIMMTrackOutput>& output, const std::vector<QString>&) {
+            published_tracks = output.size();
+        }, 1.0);
+        pipeline.setTargetTimeout(target_timeout);
+
+        for (int step = 0; step < STEPS; step++)
+        {
+            std::vector<QByteArray> records { createRecord(0, step) };
+            if (step == 0)
+                records.push_back(createRecord(1, step));
+            pipeline.push(records, step * 1000000000LL + 500000000LL);
+        }
+        pipeline.flush();
+
+        // The track is dropped after the track timeout either way, the target only after the target timeout
+        QVERIFY(published_tracks == 1);
+        const int targets = target_timeout < STEPS ? 1 : 2;
+        QVERIFY(pipeline.m_last_plots.size() == targets);
+        QVERIFY(pipeline.m_table.getNumberOfTargets() == targets);
+        QVERIFY(pipeline.m_last_plots.contains("target_0"));
+
+        // A forgotten target starts a new track with its next plot
+        std::vector<QByteArray> records { createRecord(1, STEPS) };
+        pipeline.push(records, STEPS * 1000000000LL + 500000000LL);
+        pipeline.flush();
+        QVERIFY(pipeline.getNumberOfGatedPlots() == 0);
+        QVERIFY(pipeline.m_table.findTarget("target_1") >= 0);
+        QVERIFY(pipeline.m_table.hasTrack(pipeline.m_table.findTarget("target_1")));
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMPipeline::test_AVIMMPipeline_mergeTargetTimeout()
+{
+    const int STEPS = 5;
+
+    // The second target only has a plot in the first scan, the sensor merge forgets it after the target timeout
+    for (double target_timeout : { 1.0, 10.0 })
+    {
+        AVIMMPipeline pipeline(AVIMMTester::createConfigData(4), &decode, AVIMMPipeline::Publisher(), 1.0);
+        pipeline.setTargetTimeout(target_timeout);
+        pipeline.enableSensorMerge(100 * 1000000LL);
+
+        for (int step = 0; step < STEPS; step++)
+        {
+            std::vector<QByteArray> records { createRecord(0, step) };
+            if (step == 0)
+                records.push_back(createRecord(1, step));
+            pipeline.push(records, step * 1000000000LL + 500000000LL);
+        }
+        pipeline.flush();
+
+        const int targets = target_timeout < STEPS ? 1 : 2;
+        QVERIFY(pipeline.m_merge_handles.size() == targets);
+        QVERIFY(static_cast<int>(pipeline.m_merge_targets.size() - pipeline.m_free_merge_handles.size()) == targets);
+        QVERIFY(pipeline.m_merge_handles.contains("target_0"));
+
+        // The handle of a forgotten target is reused by the next new target
+        std::vector<QByteArray> records { createRecord(1, STEPS) };
+        pipeline.push(records, STEPS * 1000000000LL + 500000000LL);
+        pipeline.flush();
+        QVERIFY(pipeline.m_merge_handles.size() == 2);
+        QVERIFY(pipeline.m_merge_targets.size() == 2);
+        QVERIFY(pipeline.m_free_merge_handles.empty());
+        QVERIFY(pipeline.m_table.hasTrack(pipeline.m_table.findTarget("target_1")));
+    }
+}
+
+AV_QTEST_MAIN(TstAVIMMPipeline)
+#include "tstavimmpipeline.moc"
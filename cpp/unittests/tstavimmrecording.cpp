@@ -0,0 +1,395 @@
+//
+// Created by felix on 9/2/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMRecording
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "testhelper/avimmtester.h"
+
+#include <cstddef>
+
+class TstAVIMMRecording : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMRecording() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMRecording_columns();
+    void test_AVIMMRecording_plots();
+    void test_AVIMMRecording_tracks();
+    void test_AVIMMRecording_plotsWithoutCovariance();
+    void test_AVIMMRecording_append();
+    void test_AVIMMRecording_invalidFiles();
+    void test_AVIMMRecording_convert();
+
+private:
+    static AVIMMPlot createPlot(int i);
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMPlot TstAVIMMRecording::createPlot(int i)
+{
+    AVIMMPlot plot;
+    plot.handle = i % 7;
+    plot.sensor = i % 3;
+    plot.time   = i * 1000000LL;
+    plot.z      = Vector(2);
+    plot.z << i, -i;
+    plot.R      = Matrix(2, 2);
+    plot.R << i, 0.5 * i,
+              0.5 * i, 2 * i;
+    return plot;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_columns()
+{
+    // Measurement or state first, then the upper triangle of the covariance row by row, then the mode probabilities
+    QVERIFY(AVIMMRecording::getNumberOfValueColumns(AVIMMRecording::PLOTS, 2, 0, false) == 2);
+    QVERIFY(AVIMMRecording::getNumberOfValueColumns(AVIMMRecording::PLOTS, 2, 0, true) == 5);
+    QVERIFY(AVIMMRecording::getNumberOfValueColumns(AVIMMRecording::TRACKS, 6, 3, false) == 30);
+
+    int column = 3;
+    for (int i = 0; i < 3; i++)
+        for (int j = i; j < 3; j++)
+        {
+            QVERIFY(AVIMMRecording::getCovarianceColumn(3, i, j) == column);
+            QVERIFY(AVIMMRecording::getCovarianceColumn(3, j, i) == column);
+            column++;
+        }
+    QVERIFY(AVIMMRecording::getModeProbabilityColumn(3, 0) == column);
+
+    // Every column starts 8 byte aligned
+    const AVIMMRecording::BlockLayout layout(AVIMMRecording::PLOTS, 5, 3);
+    QVERIFY(layout.targets == 24);
+    QVERIFY(layout.sensors == 40);
+    QVERIFY(layout.values == 56);
+    QVERIFY(layout.value_column_size == 24);
+    QVERIFY(layout.size == 56 + 5 * 24);
+    QVERIFY(layout.row_flags == -1);
+
+    // The row flags of plots with covariance follow the sensors
+    const AVIMMRecording::BlockLayout flags_layout(AVIMMRecording::PLOTS, 5, 3, true);
+    QVERIFY(flags_layout.row_flags == 56);
+    QVERIFY(flags_layout.values == 64);
+    QVERIFY(flags_layout.size == 64 + 5 * 24);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_plots()
+{
+    QTemporaryDir dir;
+    const QString file_name = dir.path() + "/plots.rec";
+    {
+        AVIMMRecordingWriter writer(file_name, AVIMMRecording::PLOTS, 2, 0, true, 4096);
+        QVERIFY(writer.isOpen());
+        for (int i = 0; i < 10000; i++)
+            writer.addPlot(createPlot(i));
+        QVERIFY(writer.getNumberOfRows() == 10000);
+    }
+
+    AVIMMRecordingReader reader(file_name);
+    QVERIFY(reader.isValid());
+    QVERIFY(reader.getType() == AVIMMRecording::PLOTS);
+    QVERIFY(reader.getVersion() == AVIMMRecording::VERSION);
+    QVERIFY(reader.getDimension() == 2);
+    QVERIFY(reader.hasCovariance());
+    QVERIFY(reader.getNumberOfRows() == 10000);
+    QVERIFY(reader.getNumberOfBlocks() == 3);
+    QVERIFY(reader.getBlockRows(2) == 10000 - 2 * 4096);
+    QVERIFY(reader.getValidSize() == QFileInfo(file_name).size());
+
+    int i = 0;
+    AVIMMPlot plot;
+    for (int block = 0; block < reader.getNumberOfBlocks(); block++)
+    {
+        // The columns are read in place
+        const qint64* times = reader.getTimes(block);
+        const AVIMMRecordingReader::Column x = reader.getColumn(block, AVIMMRecording::getValueColumn(0));
+        for (int row = 0; row < reader.getBlockRows(block); row++, i++)
+        {
+            const AVIMMPlot expected = createPlot(i);
+            QVERIFY(times[row] == expected.time);
+            QVERIFY(reader.getTargets(block)[row] == expected.handle);
+            QVERIFY(reader.getSensors(block)[row] == expected.sensor);
+            QVERIFY(x(row) == expected.z(0));
+
+            reader.getPlot(block, row, plot);
+            QVERIFY(plot.time == expected.time);
+            QVERIFY(plot.z == expected.z);
+            QVERIFY(plot.R == expected.R);
+        }
+    }
+    QVERIFY(i == 10000);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_tracks()
+{
+    QTemporaryDir dir;
+    const QString file_name = dir.path() + "/tracks.rec";
+    std::vector<AVIMMTrackOutput> tracks(250);
+    {
+        AVIMMRecordingWriter writer(file_name, AVIMMRecording::TRACKS, 6, 3, false, 100);
+        QVERIFY(writer.isOpen());
+        for (int i = 0; i < 250; i++)
+        {
+            AVIMMTrackOutput& track = tracks[i];
+            track.handle = i;
+            track.time   = i * 500000000LL;
+            track.x      = Vector::LinSpaced(6, i, i + 5);
+            const Matrix A = Matrix::Random(6, 6);
+            track.P = A.selfadjointView<Eigen::Upper>();
+            track.mode_probabilities = Vector(3);
+            track.mode_probabilities << 0.7, 0.2, 0.1;
+            writer.addTrack(track);
+        }
+    }
+
+    AVIMMRecordingReader reader(file_name);
+    QVERIFY(reader.isValid());
+    QVERIFY(reader.getType() == AVIMMRecording::TRACKS);
+    // The covariance is always stored for tracks
+    QVERIFY(reader.hasCovariance());
+    QVERIFY(reader.getNumberOfModes() == 3);
+    QVERIFY(reader.getNumberOfBlocks() == 3);
+    QVERIFY(reader.getSensors(0) == nullptr);
+
+    AVIMMTrackOutput track;
+    for (int i = 0; i < 250; i++)
+    {
+        reader.getTrack(i / 100, i % 100, track);
+        QVERIFY(track.handle == tracks[i].handle);
+        QVERIFY(track.time == tracks[i].time);
+        QVERIFY(track.x == tracks[i].x);
+        QVERIFY(track.P == tracks[i].P);
+        QVERIFY(track.mode_probabilities == tracks[i].mode_probabilities);
+    }
+    const AVIMMRecordingReader::Column probabilities =
+        reader.getColumn(1, AVIMMRecording::getModeProbabilityColumn(6, 0));
+    QVERIFY(probabilities.size() == 100);
+    QVERIFY((probabilities.array() == 0.7).all());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_plotsWithoutCovariance()
+{
+    QTemporaryDir dir;
+    const QString file_name = dir.path() + "/plots.rec";
+    {
+        // Every third plot has no measurement covariance
+        AVIMMRecordingWriter writer(file_name, AVIMMRecording::PLOTS, 2, 0, true, 100);
+        for (int i = 0; i < 150; i++)
+        {
+            AVIMMPlot plot = createPlot(i);
+            if (i % 3 == 0)
+                plot.R = Matrix();
+            writer.addPlot(plot);
+        }
+    }
+
+    AVIMMRecordingReader reader(file_name);
+    QVERIFY(reader.isValid());
+    QVERIFY(reader.hasCovariance());
+    QVERIFY(reader.getRowFlags(0) != nullptr);
+
+    AVIMMPlot plot;
+    for (int i = 0; i < 150; i++)
+    {
+        const int block = i / 100;
+        const int row   = i % 100;
+        reader.getPlot(block, row, plot);
+        QVERIFY(plot.z == createPlot(i).z);
+        if (i % 3 == 0)
+        {
+            QVERIFY(plot.R.size() == 0);
+            QVERIFY(reader.getRowFlags(block)[row] == 0);
+        }
+        else
+        {
+            QVERIFY(plot.R == createPlot(i).R);
+            QVERIFY(reader.getRowFlags(block)[row] == AVIMMRecording::ROW_COVARIANCE);
+        }
+    }
+
+    // Recordings without covariance have no row flags
+    AVIMMRecordingWriter(dir.path() + "/positions.rec", AVIMMRecording::PLOTS, 2, 0, false).addPlot(createPlot(1));
+    AVIMMRecordingReader positions(dir.path() + "/positions.rec");
+    QVERIFY(positions.getNumberOfRows() == 1);
+    QVERIFY(positions.getRowFlags(0) == nullptr);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_append()
+{
+    QTemporaryDir dir;
+    const QString file_name = dir.path() + "/plots.rec";
+    {
+        AVIMMRecordingWriter writer(file_name, AVIMMRecording::PLOTS, 2, 0, true, 100);
+        for (int i = 0; i < 150; i++)
+            writer.addPlot(createPlot(i));
+    }
+
+    // A crash while writing the second block leaves it incomplete
+    QFile file(file_name);
+    QVERIFY(file.resize(file.size() - 5));
+    {
+        AVIMMRecordingReader reader(file_name);
+        QVERIFY(reader.isValid());
+        QVERIFY(reader.getNumberOfRows() == 100);
+        QVERIFY(reader.getValidSize() < file.size());
+    }
+
+    // The writer continues after the last complete block
+    {
+        AVIMMRecordingWriter writer(file_name, AVIMMRecording::PLOTS, 2, 0, true, 100);
+        QVERIFY(writer.isOpen());
+        QVERIFY(writer.getNumberOfRows() == 100);
+        for (int i = 100; i < 150; i++)
+            writer.addPlot(createPlot(i));
+    }
+    AVIMMRecordingReader reader(file_name);
+    QVERIFY(reader.getNumberOfRows() == 150);
+    QVERIFY(reader.getNumberOfBlocks() == 2);
+    QVERIFY(reader.getValidSize() == QFileInfo(file_name).size());
+    AVIMMPlot plot;
+    reader.getPlot(1, 49, plot);
+    QVERIFY(plot.time == createPlot(149).time);
+
+    // Recordings with another layout are not continued
+    AVIMMRecordingWriter writer(file_name, AVIMMRecording::PLOTS, 2, 0, false);
+    QVERIFY(!writer.isOpen());
+    QVERIFY(!writer.flush());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_invalidFiles()
+{
+    QTemporaryDir dir;
+    QVERIFY(!AVIMMRecordingReader(dir.path() + "/missing.rec").isValid());
+
+    const QString file_name = dir.path() + "/invalid.rec";
+    QFile file(file_name);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray(64, 'x'));
+    file.close();
+    QVERIFY(!AVIMMRecordingReader(file_name).isValid());
+
+    // Written with the other byte order
+    {
+        AVIMMRecordingWriter writer(file_name + "2", AVIMMRecording::PLOTS, 2);
+    }
+    QFile swapped(file_name + "2");
+    QVERIFY(swapped.open(QIODevice::ReadWrite));
+    const quint32 byte_order_mark = 0x04030201;
+    swapped.seek(offsetof(AVIMMRecordingHeader, byte_order_mark));
+    swapped.write(reinterpret_cast<const char*>(&byte_order_mark), sizeof(byte_order_mark));
+    swapped.close();
+    QVERIFY(!AVIMMRecordingReader(file_name + "2").isValid());
+
+    // Headers of other versions or with dimensions beyond the limits are rejected before the blocks are indexed
+    const auto write_header_field = [&](size_t offset, quint32 value)
+    {
+        // The writer does not replace invalid files
+        QFile::remove(file_name + "3");
+        {
+            AVIMMRecordingWriter writer(file_name + "3", AVIMMRecording::TRACKS, 2, 2);
+        }
+        QFile header(file_name + "3");
+        QVERIFY(header.open(QIODevice::ReadWrite));
+        header.seek(offset);
+        header.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    write_header_field(offsetof(AVIMMRecordingHeader, version), AVIMMRecording::VERSION + 1);
+    QVERIFY(!AVIMMRecordingReader(file_name + "3").isValid());
+    write_header_field(offsetof(AVIMMRecordingHeader, dimension), 0x7fffffff);
+    QVERIFY(!AVIMMRecordingReader(file_name + "3").isValid());
+    write_header_field(offsetof(AVIMMRecordingHeader, number_of_modes), AVIMMRecording::MAX_NUMBER_OF_MODES + 1);
+    QVERIFY(!AVIMMRecordingReader(file_name + "3").isValid());
+    write_header_field(offsetof(AVIMMRecordingHeader, number_of_modes), 2);
+    QVERIFY(AVIMMRecordingReader(file_name + "3").isValid());
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMRecording::test_AVIMMRecording_convert()
+{
+    QTemporaryDir dir;
+    const QString slow_file = dir.path() + "/slow.csv";
+    const QString fast_file = dir.path() + "/fast.csv";
+    for (const QString& file_name : { slow_file, fast_file })
+    {
+        QFile file(file_name);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        QTextStream stream(&file);
+        const int period = file_name == slow_file ? 300 : 100;
+        for (int time = 0; time <= 3000; time += period)
+            stream << time << "," << time * 1e-3 << ",1,0," << time * 2e-3 << ",2,0\n";
+    }
+
+    const QString recording = dir.path() + "/plots.rec";
+    QVERIFY(AVIMMTester::convertToRecording(QStringList() << slow_file << fast_file, recording, 20));
+    QVERIFY(!AVIMMTester::convertToRecording(QStringList() << dir.path() + "/missing.csv", recording));
+
+    AVIMMRecordingReader reader(recording);
+    QVERIFY(reader.isValid());
+    QVERIFY(reader.getDimension() == 6);
+    QVERIFY(!reader.hasCovariance());
+    QVERIFY(reader.getNumberOfRows() == 11 + 31);
+
+    // Ordered by time, the target is the index of the file
+    AVIMMPlot plot;
+    qint64 last_time = 0;
+    int slow_plots = 0;
+    for (int row = 0; row < reader.getBlockRows(0); row++)
+    {
+        reader.getPlot(0, row, plot);
+        QVERIFY(plot.time >= last_time);
+        QVERIFY(plot.sensor == 20);
+        QVERIFY(plot.R.size() == 0);
+        QVERIFY(qFuzzyCompare(plot.z(0) + 1.0, plot.time * 1e-9 + 1.0));
+        QVERIFY(qFuzzyCompare(plot.z(3) + 1.0, plot.time * 2e-9 + 1.0));
+        last_time = plot.time;
+        if (plot.handle == 0)
+            slow_plots++;
+    }
+    QVERIFY(slow_plots == 11);
+}
+
+AV_QTEST_MAIN(TstAVIMMRecording)
+#include "tstavimmrecording.moc"
@@ -0,0 +1,222 @@
+//
+// Created by felix on 9/1/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMReplay
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <sstream>
+
+#include "testhelper/avimmreplay.h"
+
+class TstAVIMMReplay : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMReplay() {}
+
+public slots:
+    void initTestCase()
+    {
+        // Set singletons
+        std::vector<char*> args;
+        QByteArray         dummy_arg("dummy");  // program name, is ignored by config
+        args.push_back(dummy_arg.data());
+
+        AVEnvironment::setProcessName("imm_tester");
+        AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+        AVConfig2Global::singleton().initialize();
+
+        // Reads the airport areas and their configs, the estimators are created with the config of their area
+        AVIMMAirportConfigs::initializeSingleton();
+    }
+    void cleanupTestCase()
+    {
+        AVIMMAirportConfigs::deleteSingleton();
+        AVConfig2Global::deleteSingleton();
+    };
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMReplay_asFastAsPossible();
+    void test_AVIMMReplay_realTime();
+    void test_AVIMMReplay_invalidRecording();
+    void test_AVIMMReplay_perfCounters();
+
+private:
+    // Writes a uniform motion with the given velocity in x, one record every period
+    static void writeRecording(QTemporaryFile& file, double velocity, int number_of_records, int period_ms);
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMReplay::writeRecording(QTemporaryFile& file, double velocity, int number_of_records, int period_ms)
+{
+    QVERIFY(file.open());
+    QTextStream stream(&file);
+    for (int i = 0; i <= number_of_records; i++)
+    {
+        const double time = i * period_ms * 1e-3;
+        stream << i * period_ms << "," << velocity * time << "," << velocity << ",0," << time << ",1,0\n";
+    }
+    stream.flush();
+    file.flush();
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMReplay::test_AVIMMReplay_asFastAsPossible()
+{
+    QTemporaryFile slow_recording;
+    QTemporaryFile fast_recording;
+    writeRecording(slow_recording, 1.0, 200, 100);
+    writeRecording(fast_recording, 5.0, 100, 250);
+
+    AVIMMReplay replay;
+    replay.setDynamicEstimators(true);
+    QVERIFY(replay.addRecording(slow_recording.fileName(), 3));
+    QVERIFY(replay.addRecording(fast_recording.fileName(), 2));
+    QVERIFY(replay.getNumberOfEstimators() == 5);
+    replay.run();
+
+    QVERIFY(replay.getNumberOfRecords() == 300);
+    QVERIFY(replay.getNumberOfPlots() == 200 * 3 + 100 * 2);
+    QVERIFY(replay.getLatency().getCount() == replay.getNumberOfPlots());
+    QVERIFY(replay.getLatency().getPercentile(50.0) <= replay.getLatency().getPercentile(99.0));
+    QVERIFY(replay.getElapsedTime() > 0.0);
+    QVERIFY(replay.getPlotsPerSecond() > 0.0);
+    QVERIFY(replay.getMaxLag() == 0.0);
+
+    // The streamed replay gives the same states as the replay of AVIMMTester
+    AVIMMTester tester(slow_recording.fileName());
+    tester.run_sim();
+    for (int i = 0; i < 3; i++)
+        QVERIFY(AVIMMTester::getMatricesEqual(replay.getEstimator(0, i).getStateVector(),
+                                              tester.getResultingStates().last()).first);
+    QVERIFY(replay.getEstimator(1, 0).getTimestamp() == 25000000000LL);
+    QVERIFY(replay.getEstimator(1, 1).getStateVector() == replay.getEstimator(1, 0).getStateVector());
+
+    std::ostringstream report;
+    replay.printReport(report);
+    QVERIFY(report.str().find("plots/s") != std::string::npos);
+    QVERIFY(report.str().find("p99") != std::string::npos);
+#ifdef __linux__
+    QVERIFY(AVIMMReplay::getPeakRss() > 0);
+#endif
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMReplay::test_AVIMMReplay_realTime()
+{
+    // 200ms of recording replayed at double speed
+    QTemporaryFile recording;
+    writeRecording(recording, 1.0, 20, 10);
+
+    AVIMMReplay replay(AVIMMReplay::REAL_TIME, 2.0);
+    QVERIFY(replay.addRecording(recording.fileName()));
+    replay.run();
+
+    QVERIFY(replay.getNumberOfPlots() == 20);
+    QVERIFY(replay.getElapsedTime() >= 0.1);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMReplay::test_AVIMMReplay_invalidRecording()
+{
+    AVIMMReplay replay;
+    QVERIFY(!replay.addRecording("/nonexistent/recording.csv"));
+
+    QTemporaryFile empty_recording;
+    QVERIFY(empty_recording.open());
+    QVERIFY(!replay.addRecording(empty_recording.fileName()));
+
+    QVERIFY(replay.getNumberOfEstimators() == 0);
+    replay.run();
+    QVERIFY(replay.getNumberOfPlots() == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMReplay::test_AVIMMReplay_perfCounters()
+{
+    QTemporaryFile recording;
+    writeRecording(recording, 1.0, 250, 100);
+
+    // Disabled by default, nothing is counted or reported
+    AVIMMReplay replay;
+    QVERIFY(replay.addRecording(recording.fileName(), 2));
+    replay.run();
+    QVERIFY(!replay.getPerfProfile().isEnabled());
+    QVERIFY(!replay.getPerfProfile().isAvailable());
+    QVERIFY(replay.getPerfProfile().getNumberOfSteps() == 0);
+    std::ostringstream report;
+    replay.printReport(report);
+    QVERIFY(report.str().find("perf counters") == std::string::npos);
+
+    // Counts every step, the values are only checked if the counters can be opened (e.g. not in most containers)
+    AVIMMReplay per_step;
+    per_step.setPerfCounterMode(AVIMMPerfProfile::PER_STEP);
+    QVERIFY(per_step.addRecording(recording.fileName(), 2));
+    per_step.run();
+    const AVIMMPerfProfile& step_profile = per_step.getPerfProfile();
+    QVERIFY(step_profile.getNumberOfSteps() == 500);
+    QVERIFY(step_profile.getNumberOfBatches() == 500);
+    if (step_profile.isAvailable(AVIMMPerfCounters::CYCLES))
+    {
+        QVERIFY(step_profile.getCyclesPerStep().getCount() == 500);
+        QVERIFY(step_profile.getTotal(AVIMMPerfCounters::CYCLES) > 0);
+    }
+    if (step_profile.isAvailable(AVIMMPerfCounters::INSTRUCTIONS))
+        QVERIFY(step_profile.getPerStep(AVIMMPerfCounters::INSTRUCTIONS) > 100.0);
+    for (int event = 0; event < AVIMMPerfCounters::NUMBER_OF_EVENTS; event++)
+    {
+        const AVIMMPerfCounters::Event counter = static_cast<AVIMMPerfCounters::Event>(event);
+        if (!step_profile.isAvailable(counter))
+            QVERIFY(step_profile.getTotal(counter) == 0);
+    }
+    std::ostringstream step_report;
+    per_step.printReport(step_report);
+    QVERIFY(step_report.str().find("perf counters: per step") != std::string::npos);
+    if (!step_profile.isAvailable())
+        QVERIFY(step_report.str().find("unavailable") != std::string::npos);
+
+    // The last incomplete batch is counted as well
+    AVIMMTester tester(recording.fileName());
+    tester.setPerfCounterMode(AVIMMPerfProfile::PER_BATCH, 40);
+    tester.run_sim();
+    const AVIMMPerfProfile& batch_profile = tester.getPerfProfile();
+    QVERIFY(batch_profile.getBatchSize() == 40);
+    QVERIFY(batch_profile.getNumberOfSteps() == 250);
+    QVERIFY(batch_profile.getNumberOfBatches() == 7);
+    QVERIFY(batch_profile.getCyclesPerStep().getCount() == 0);
+    if (batch_profile.isAvailable(AVIMMPerfCounters::INSTRUCTIONS))
+        QVERIFY(batch_profile.getPerStep(AVIMMPerfCounters::INSTRUCTIONS) > 100.0);
+
+    // The replayed states do not depend on the counters
+    QVERIFY(AVIMMTester::getMatricesEqual(per_step.getEstimator(0, 1).getStateVector(),
+                                          replay.getEstimator(0, 1).getStateVector()).first);
+}
+
+AV_QTEST_MAIN(TstAVIMMReplay)
+#include "tstavimmreplay.moc"
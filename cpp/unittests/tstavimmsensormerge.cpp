@@ -0,0 +1,205 @@
+//
+// Created by felix on 8/28/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMSensorMerge
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+#include <random>
+
+class TstAVIMMSensorMerge : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMSensorMerge() {}
+
+public slots:
+    void initTestCase() {}
+    void cleanupTestCase() {};
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMSensorMerge_order();
+    void test_AVIMMSensorMerge_reorderWindow();
+    void test_AVIMMSensorMerge_reorderedPlots();
+    void test_AVIMMSensorMerge_latePlots();
+
+private:
+    static AVIMMPlot createPlot(int sensor, qint64 time_ms);
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMPlot TstAVIMMSensorMerge::createPlot(int sensor, qint64 time_ms)
+{
+    AVIMMPlot plot;
+    plot.handle = 0;
+    plot.sensor = sensor;
+    plot.time   = time_ms * 1000000LL;
+    plot.z      = Vector::Constant(2, time_ms);
+    return plot;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMSensorMerge::test_AVIMMSensorMerge_order()
+{
+    // ADS-B, MLAT and radar with different periods and latencies, the latency jitters by up to 50ms
+    const int sensors[]   = { 20, 25188, 1 };
+    const int periods[]   = { 500, 1000, 4000 };
+    const int latencies[] = { 100, 300, 800 };
+
+    struct Arrival
+    {
+        qint64 arrival;
+        int stream;
+        AVIMMPlot plot;
+    };
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> jitter(0, 50);
+    std::vector<Arrival> arrivals;
+    for (int stream = 0; stream < 3; stream++)
+        for (qint64 time = 0; time < 60000; time += periods[stream])
+            arrivals.push_back({ time + latencies[stream] + jitter(generator), stream,
+                                 createPlot(sensors[stream], time) });
+    std::stable_sort(arrivals.begin(), arrivals.end(),
+                     [](const Arrival& a, const Arrival& b) { return a.arrival < b.arrival; });
+
+    AVIMMSensorMerge merge(1000 * 1000000LL);
+    for (int sensor : sensors)
+        merge.addSensor(sensor);
+    QVERIFY(merge.getNumberOfSensors() == 3);
+    QVERIFY(merge.getSensorId(1) == 25188);
+
+    std::vector<AVIMMPlot> plots;
+    std::vector<int> streams;
+    for (const auto& arrival : arrivals)
+    {
+        QVERIFY(merge.addPlot(arrival.stream, arrival.plot));
+        merge.releasePlots(plots, &streams);
+    }
+    merge.releaseAllPlots(plots, &streams);
+
+    QVERIFY(plots.size() == arrivals.size());
+    QVERIFY(streams.size() == plots.size());
+    QVERIFY(merge.getNumberOfBufferedPlots() == 0);
+    QVERIFY(merge.getNumberOfLatePlots() == 0);
+    for (size_t i = 0; i < plots.size(); i++)
+    {
+        QVERIFY(plots[i].sensor == sensors[streams[i]]);
+        QVERIFY(plots[i].z(0) * 1000000LL == plots[i].time);
+        if (i > 0)
+            QVERIFY(plots[i].time > plots[i - 1].time ||
+                    (plots[i].time == plots[i - 1].time && streams[i] > streams[i - 1]));
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMSensorMerge::test_AVIMMSensorMerge_reorderWindow()
+{
+    AVIMMSensorMerge merge(1000 * 1000000LL);
+    const int adsb  = merge.addSensor(20);
+    const int radar = merge.addSensor(1);
+
+    std::vector<AVIMMPlot> plots;
+    merge.releasePlots(plots);
+    QVERIFY(plots.empty());
+
+    // Plots are held back until they are older than the newest plot minus the window
+    merge.addPlot(adsb, createPlot(20, 0));
+    merge.addPlot(adsb, createPlot(20, 500));
+    merge.releasePlots(plots);
+    QVERIFY(plots.empty());
+
+    merge.addPlot(radar, createPlot(1, 200));
+    merge.addPlot(adsb, createPlot(20, 1000));
+    merge.releasePlots(plots);
+    QVERIFY(plots.size() == 1);
+    QVERIFY(merge.getReleaseTime() == 0);
+    QVERIFY(merge.getNumberOfBufferedPlots() == 3);
+
+    // Advancing the time releases plots without new ones
+    merge.advanceTime(1600 * 1000000LL);
+    merge.releasePlots(plots);
+    QVERIFY(plots.size() == 3);
+    QVERIFY(plots[1].time == 200 * 1000000LL);
+    QVERIFY(plots[2].time == 500 * 1000000LL);
+    QVERIFY(merge.getNumberOfBufferedPlots() == 1);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMSensorMerge::test_AVIMMSensorMerge_reorderedPlots()
+{
+    AVIMMSensorMerge merge(1000 * 1000000LL);
+    const int mlat  = merge.addSensor(25188);
+    const int radar = merge.addSensor(1);
+
+    // Out of order plots of one sensor are sorted into its buffer, also in front of the oldest one
+    merge.addPlot(mlat, createPlot(25188, 300));
+    merge.addPlot(radar, createPlot(1, 200));
+    merge.addPlot(mlat, createPlot(25188, 100));
+    merge.addPlot(mlat, createPlot(25188, 400));
+    merge.addPlot(mlat, createPlot(25188, 350));
+    QVERIFY(merge.getNumberOfReorderedPlots(mlat) == 2);
+    QVERIFY(merge.getNumberOfReorderedPlots(radar) == 0);
+
+    std::vector<AVIMMPlot> plots;
+    merge.releaseAllPlots(plots);
+    const qint64 expected[] = { 100, 200, 300, 350, 400 };
+    QVERIFY(plots.size() == 5);
+    for (int i = 0; i < 5; i++)
+        QVERIFY(plots[i].time == expected[i] * 1000000LL);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMSensorMerge::test_AVIMMSensorMerge_latePlots()
+{
+    AVIMMSensorMerge merge(100 * 1000000LL);
+    const int adsb  = merge.addSensor(20);
+    const int radar = merge.addSensor(1);
+
+    merge.addPlot(adsb, createPlot(20, 1000));
+    merge.addPlot(adsb, createPlot(20, 1500));
+    std::vector<AVIMMPlot> plots;
+    merge.releasePlots(plots);
+    QVERIFY(plots.size() == 1);
+
+    // Older than the released plot, it would cause a negative time delta
+    QVERIFY(!merge.addPlot(radar, createPlot(1, 900)));
+    // Same time as the released plot is still in time
+    QVERIFY(merge.addPlot(radar, createPlot(1, 1000)));
+    QVERIFY(merge.getNumberOfLatePlots(radar) == 1);
+    QVERIFY(merge.getNumberOfLatePlots(adsb) == 0);
+    QVERIFY(merge.getNumberOfLatePlots() == 1);
+
+    merge.releaseAllPlots(plots);
+    QVERIFY(plots.size() == 3);
+    for (size_t i = 1; i < plots.size(); i++)
+        QVERIFY(plots[i].time >= plots[i - 1].time);
+}
+
+AV_QTEST_MAIN(TstAVIMMSensorMerge)
+#include "tstavimmsensormerge.moc"
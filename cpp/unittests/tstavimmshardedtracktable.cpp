@@ -0,0 +1,207 @@
+//
+// Created by felix on 8/24/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMSpscQueue and AVIMMShardedTrackTable
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMShardedTrackTable : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMShardedTrackTable() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMSpscQueue_pushPop();
+    void test_AVIMMSpscQueue_concurrent();
+    void test_AVIMMShardedTrackTable_matchesTrackTable();
+    void test_AVIMMShardedTrackTable_releaseTarget();
+
+private:
+    // Creates the plot of the target at the given scan
+    static AVIMMPlot createPlot(int handle, int target, int step);
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMPlot TstAVIMMShardedTrackTable::createPlot(int handle, int target, int step)
+{
+    AVIMMPlot plot;
+    plot.handle = handle;
+    plot.time   = step * 1000000000LL;
+    plot.z      = Vector(4,1);
+    plot.z << target + 10.0 * step, 10.0, -target - 5.0 * step + (step % 2 ? 0.5 : -0.5), -5.0;
+    return plot;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMShardedTrackTable::test_AVIMMSpscQueue_pushPop()
+{
+    // The capacity is rounded up to a power of two
+    AVIMMSpscQueue<int> queue(5);
+    QVERIFY(queue.getCapacity() == 8);
+
+    int value = 0;
+    QVERIFY(!queue.tryPop(value));
+    for (int i = 0; i < 8; i++)
+    {
+        value = i;
+        QVERIFY(queue.tryPush(value));
+    }
+    QVERIFY(queue.size() == 8);
+
+    // A full queue rejects the value and leaves it untouched
+    value = 8;
+    QVERIFY(!queue.tryPush(value));
+    QVERIFY(value == 8);
+
+    // First in, first out across the wrap around of the ring buffer
+    for (int round = 0; round < 3; round++)
+        for (int i = 0; i < 8; i++)
+        {
+            QVERIFY(queue.tryPop(value));
+            QVERIFY(value == round * 8 + i);
+            value = (round + 1) * 8 + i;
+            QVERIFY(queue.tryPush(value));
+        }
+    QVERIFY(queue.size() == 8);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMShardedTrackTable::test_AVIMMSpscQueue_concurrent()
+{
+    const int COUNT = 200000;
+    AVIMMSpscQueue<int> queue(64);
+
+    bool in_order = true;
+    std::thread consumer([&]() {
+        int value;
+        for (int expected = 0; expected < COUNT; expected++)
+        {
+            while (!queue.tryPop(value))
+                std::this_thread::yield();
+            in_order = in_order && value == expected;
+        }
+    });
+
+    for (int i = 0; i < COUNT; i++)
+    {
+        int value = i;
+        while (!queue.tryPush(value))
+            std::this_thread::yield();
+    }
+    consumer.join();
+
+    QVERIFY(in_order);
+    QVERIFY(queue.size() == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMShardedTrackTable::test_AVIMMShardedTrackTable_matchesTrackTable()
+{
+    const int TARGETS = 200;
+    const int STEPS   = 5;
+
+    AVIMMTrackTable expected_table(AVIMMTester::createConfigData(4));
+    for (int step = 0; step < STEPS; step++)
+        for (int target = 0; target < TARGETS; target++)
+            expected_table.addPlot(createPlot(expected_table.internTarget(QString("target_%1").arg(target)),
+                                              target, step));
+    std::vector<AVIMMTrackOutput> expected;
+    expected_table.extrapolateAll(4500000000LL, expected);
+
+    for (int number_of_shards : { 1, 3, 8 })
+    {
+        // Small queues make the producer wait for the shards
+        AVIMMShardedTrackTable table(AVIMMTester::createConfigData(4), number_of_shards, 1.0, false, 16);
+        QVERIFY(table.getNumberOfShards() == number_of_shards);
+
+        for (int step = 0; step < STEPS; step++)
+            for (int target = 0; target < TARGETS; target++)
+                table.addPlot(createPlot(table.internTarget(QString("target_%1").arg(target)), target, step));
+        QVERIFY(table.getNumberOfTracks() == TARGETS);
+
+        table.extrapolateAll(4500000000LL);
+        std::vector<AVIMMTrackOutput> output;
+        table.collectOutput(output);
+
+        QVERIFY(output.size() == expected.size());
+        for (size_t i = 0; i < output.size(); i++)
+        {
+            QVERIFY(table.getTarget(output[i].handle) == expected_table.getTarget(expected[i].handle));
+            QVERIFY(output[i].time == expected[i].time);
+            QVERIFY(AVIMMTester::getMatricesEqual(output[i].x, expected[i].x).first);
+            QVERIFY(AVIMMTester::getMatricesEqual(output[i].P, expected[i].P).first);
+        }
+
+        // The output is only collected once
+        output.clear();
+        table.collectOutput(output);
+        QVERIFY(output.empty());
+        for (int shard = 0; shard < number_of_shards; shard++)
+            QVERIFY(table.getQueueDepth(shard) == 0);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMShardedTrackTable::test_AVIMMShardedTrackTable_releaseTarget()
+{
+    AVIMMShardedTrackTable table(AVIMMTester::createConfigData(4), 4, 1.0, true);
+
+    const int first = table.internTarget("first");
+    const int second = table.internTarget("second");
+    QVERIFY(table.findTarget("second") == second);
+    table.addPlot(createPlot(first, 0, 0));
+    table.addPlot(createPlot(second, 1, 0));
+    QVERIFY(table.getNumberOfTracks() == 2);
+
+    // The released handle is reused and starts a new track in the same shard
+    const int shard = table.getShard(first);
+    table.releaseTarget(first);
+    QVERIFY(table.findTarget("first") == -1);
+    const int third = table.internTarget("third");
+    QVERIFY(third == first);
+    QVERIFY(table.getShard(third) == shard);
+    QVERIFY(table.getNumberOfTracks() == 1);
+
+    table.addPlot(createPlot(third, 2, 1));
+    QVERIFY(table.getNumberOfTracks() == 2);
+
+    table.extrapolateAll(1500000000LL);
+    std::vector<AVIMMTrackOutput> output;
+    table.collectOutput(output);
+    QVERIFY(output.size() == 1);
+    QVERIFY(output[0].handle == third);
+}
+
+AV_QTEST_MAIN(TstAVIMMShardedTrackTable)
+#include "tstavimmshardedtracktable.moc"
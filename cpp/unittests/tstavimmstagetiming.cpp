@@ -0,0 +1,165 @@
+//
+// Created by felix on 9/8/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMStageTiming
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMStageTiming : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMStageTiming() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() { AVIMMStageTiming::reset(); }
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMStageTiming_record();
+    void test_AVIMMStageTiming_reset();
+    void test_AVIMMStageTiming_estimators();
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMStageTiming::test_AVIMMStageTiming_record()
+{
+    AVIMMStageTiming::record(AVIMMStageTiming::PREPARE, 100);
+    AVIMMStageTiming::record(AVIMMStageTiming::PREPARE, 300);
+
+    // The histograms of finished threads are kept
+    std::thread thread([]()
+    {
+        for (int i = 0; i < 10; i++)
+            AVIMMStageTiming::record(AVIMMStageTiming::SUBFILTER_UPDATE, 1000);
+    });
+    thread.join();
+
+    AVIMMStageTiming::Snapshot snapshot = AVIMMStageTiming::getSnapshot();
+    QCOMPARE(snapshot[AVIMMStageTiming::PREPARE].getCount(), quint64(2));
+    QCOMPARE(snapshot[AVIMMStageTiming::PREPARE].getSum(), quint64(400));
+    QCOMPARE(snapshot[AVIMMStageTiming::SUBFILTER_UPDATE].getCount(), quint64(10));
+    QCOMPARE(snapshot[AVIMMStageTiming::SUBFILTER_UPDATE].getMax(), quint64(1000));
+    QCOMPARE(snapshot[AVIMMStageTiming::IMM_STATE_POST].getCount(), quint64(0));
+
+    // The timer records the time since the previous lap
+    AVIMMStageTiming::Timer timer;
+    timer.lap(AVIMMStageTiming::MIXED_STATES);
+    timer.lap(AVIMMStageTiming::MIXED_STATES);
+    snapshot = AVIMMStageTiming::getSnapshot();
+    QCOMPARE(snapshot[AVIMMStageTiming::MIXED_STATES].getCount(), quint64(2));
+    QCOMPARE(QString(AVIMMStageTiming::getStageName(AVIMMStageTiming::MIXED_STATES)), QString("mixed states"));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMStageTiming::test_AVIMMStageTiming_reset()
+{
+    AVIMMStageTiming::record(AVIMMStageTiming::PREPARE, 100);
+    std::thread finished([]() { AVIMMStageTiming::record(AVIMMStageTiming::PREPARE, 100); });
+    finished.join();
+
+    // A thread which does not record after the reset keeps its histograms, they are ignored by the snapshots
+    std::mutex mutex;
+    std::condition_variable condition;
+    int phase = 0;
+    std::thread waiting([&]()
+    {
+        AVIMMStageTiming::record(AVIMMStageTiming::PREPARE, 100);
+        std::unique_lock<std::mutex> lock(mutex);
+        phase = 1;
+        condition.notify_all();
+        condition.wait(lock, [&]() { return phase == 2; });
+        AVIMMStageTiming::record(AVIMMStageTiming::IMM_STATE_POST, 5);
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return phase == 1; });
+    }
+    QCOMPARE(AVIMMStageTiming::getSnapshot()[AVIMMStageTiming::PREPARE].getCount(), quint64(3));
+
+    AVIMMStageTiming::reset();
+    QCOMPARE(AVIMMStageTiming::getSnapshot()[AVIMMStageTiming::PREPARE].getCount(), quint64(0));
+
+    // The first recording after the reset clears the old histograms of the thread
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase = 2;
+        condition.notify_all();
+    }
+    waiting.join();
+    AVIMMStageTiming::record(AVIMMStageTiming::IMM_STATE_POST, 7);
+
+    const AVIMMStageTiming::Snapshot snapshot = AVIMMStageTiming::getSnapshot();
+    QCOMPARE(snapshot[AVIMMStageTiming::PREPARE].getCount(), quint64(0));
+    QCOMPARE(snapshot[AVIMMStageTiming::IMM_STATE_POST].getCount(), quint64(2));
+    QCOMPARE(snapshot[AVIMMStageTiming::IMM_STATE_POST].getSum(), quint64(12));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMStageTiming::test_AVIMMStageTiming_estimators()
+{
+    if (!AVIMMStageTiming::isEnabled())
+        QSKIP("The stage timing is not compiled in, see AVIMM_STAGE_TIMING");
+
+    Vector x = Vector::Zero(6);
+    x << 0, 10, 0, 5, 0, 0;
+    const AVIMMConfigData config = AVIMMTester::createConfigData(6);
+
+    // The dynamic and the fixed size estimator record the same stages
+    std::vector<AVIMMEstimatorPtr> estimators;
+    estimators.push_back(AVIMMEstimatorFactory::createDynamicEstimator(config, x));
+    estimators.push_back(AVIMMEstimatorFactory::createEstimator(config, x));
+
+    const int steps = 10;
+    Vector z = x;
+    for (auto& estimator : estimators)
+    {
+        estimator->setTimestamp(0);
+        for (int i = 1; i <= steps; i++)
+        {
+            z << 10.0 * i, 10, 5.0 * i, 5, 0, 0;
+            estimator->predictAndUpdate(z, DEFAULT_MATRIX, DEFAULT_VECTOR, i * 1000000000LL);
+        }
+    }
+
+    const AVIMMStageTiming::Snapshot snapshot = AVIMMStageTiming::getSnapshot();
+    const quint64 expected = 2 * steps;
+    QCOMPARE(snapshot[AVIMMStageTiming::PREPARE].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::MIXED_STATES].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::SUBFILTER_PREDICT].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::IMM_STATE_PRIOR].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::SUBFILTER_UPDATE].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::MODE_PROBABILITIES].getCount(), expected);
+    QCOMPARE(snapshot[AVIMMStageTiming::IMM_STATE_POST].getCount(), expected);
+    QVERIFY(snapshot[AVIMMStageTiming::SUBFILTER_UPDATE].getSum() > 0);
+}
+
+AV_QTEST_MAIN(TstAVIMMStageTiming)
+#include "tstavimmstagetiming.moc"
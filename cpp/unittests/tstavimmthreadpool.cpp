@@ -0,0 +1,225 @@
+//
+// Created by felix on 8/20/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMThreadPool and the parallel track updates
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMThreadPool : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMThreadPool() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMThreadPool_parallelFor();
+    void test_AVIMMThreadPool_stealing();
+    void test_AVIMMTrackTable_parallelUpdateIsDeterministic();
+    void test_AVIMMTrackTable_threadCaches();
+    void benchmark_AVIMMTrackTable_parallelUpdate_data();
+    void benchmark_AVIMMTrackTable_parallelUpdate();
+
+private:
+    // Creates the plots of steps scans of number_of_targets targets, interning the targets in the table
+    static std::vector<AVIMMPlot> createPlots(AVIMMTrackTable& table, int number_of_targets, int steps);
+};
+
+//--------------------------------------------------------------------------
+
+std::vector<AVIMMPlot> TstAVIMMThreadPool::createPlots(AVIMMTrackTable& table, int number_of_targets, int steps)
+{
+    std::vector<AVIMMPlot> plots;
+    for (int step = 0; step < steps; step++)
+        for (int target = 0; target < number_of_targets; target++)
+        {
+            AVIMMPlot plot;
+            plot.handle = table.internTarget(QString("target_%1").arg(target));
+            plot.time   = step * 1000000000LL;
+            plot.z      = Vector(4,1);
+            plot.z << target + 10.0 * step, 10.0, -target - 5.0 * step + (step % 2 ? 0.5 : -0.5), -5.0;
+            plots.push_back(plot);
+        }
+    return plots;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::test_AVIMMThreadPool_parallelFor()
+{
+    for (int number_of_threads = 1; number_of_threads <= 8; number_of_threads++)
+    {
+        AVIMMThreadPool pool(number_of_threads);
+        QVERIFY(pool.getNumberOfThreads() == number_of_threads);
+
+        // Every item is processed exactly once, whatever the chunk size
+        for (int chunk_size : { 0, 1, 7, 1000 })
+        {
+            std::vector<int> calls(997, 0);
+            pool.parallelFor(calls.size(), [&](int i) { calls[i]++; }, chunk_size);
+            QVERIFY(std::all_of(calls.begin(), calls.end(), [](int count) { return count == 1; }));
+        }
+
+        // Empty ranges return immediately
+        bool called = false;
+        pool.parallelFor(0, [&](int) { called = true; });
+        QVERIFY(!called);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::test_AVIMMThreadPool_stealing()
+{
+    AVIMMThreadPool pool(4);
+
+    // The chunks of thread 0 are slow, the other threads have to steal them
+    std::vector<int> calls(64, 0);
+    pool.parallelFor(calls.size(), [&](int i) {
+        if (i % 4 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        calls[i]++;
+    }, 4);
+    QVERIFY(std::all_of(calls.begin(), calls.end(), [](int count) { return count == 1; }));
+    QVERIFY(pool.getNumberOfSteals() > 0);
+
+    // Every item knows the pool thread it runs on, the calling thread is thread 0
+    std::vector<int> threads(calls.size(), -1);
+    pool.parallelFor(threads.size(), [&](int i) { threads[i] = AVIMMThreadPool::getCurrentThread(); }, 1);
+    QVERIFY(std::all_of(threads.begin(), threads.end(), [](int thread) { return thread >= 0 && thread < 4; }));
+    QVERIFY(AVIMMThreadPool::getCurrentThread() == 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::test_AVIMMTrackTable_parallelUpdateIsDeterministic()
+{
+    const int TARGETS = 200;
+    AVIMMTrackTable sequential(AVIMMTester::createConfigData(4));
+    const std::vector<AVIMMPlot> plots = createPlots(sequential, TARGETS, 5);
+    sequential.addPlots(plots);
+
+    for (int number_of_threads : { 1, 2, 3, 8 })
+    {
+        AVIMMThreadPool pool(number_of_threads);
+        AVIMMTrackTable parallel(AVIMMTester::createConfigData(4));
+        parallel.setThreadPool(&pool);
+        for (int target = 0; target < TARGETS; target++)
+            parallel.internTarget(QString("target_%1").arg(target));
+        parallel.addPlots(plots);
+
+        // Every track is calculated by exactly one thread with the same operations, the results are bit identical
+        QVERIFY(parallel.getNumberOfTracks() == TARGETS);
+        for (int handle = 0; handle < TARGETS; handle++)
+        {
+            const AVIMMEstimatorInterface* expected = sequential.getEstimator(handle);
+            const AVIMMEstimatorInterface* actual   = parallel.getEstimator(handle);
+            QVERIFY(actual->getStateVector() == expected->getStateVector());
+            QVERIFY(actual->getCovarianceMatrix() == expected->getCovarianceMatrix());
+            QVERIFY(actual->getModeProbabilityVector() == expected->getModeProbabilityVector());
+        }
+
+        // The extrapolations are returned in the order of the handles
+        std::vector<AVIMMTrackOutput> output;
+        parallel.extrapolateAll(4500000000LL, output);
+        QVERIFY(output.size() == static_cast<size_t>(TARGETS));
+        for (int handle = 0; handle < TARGETS; handle++)
+            QVERIFY(output[handle].handle == handle);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::test_AVIMMTrackTable_threadCaches()
+{
+    const int TARGETS = 200;
+    AVIMMTrackTable sequential(AVIMMTester::createConfigData(4));
+    const std::vector<AVIMMPlot> plots = createPlots(sequential, TARGETS, 5);
+    sequential.addPlots(plots);
+
+    // Without quantization the cached matrices are the same as the evaluated ones
+    auto& parser = AVIMMConfigParser::singleton();
+    parser.enableModelMatrixCache(0.0, 64);
+
+    AVIMMThreadPool pool(4);
+    AVIMMTrackTable parallel(AVIMMTester::createConfigData(4));
+    parallel.setThreadPool(&pool);
+    for (int target = 0; target < TARGETS; target++)
+        parallel.internTarget(QString("target_%1").arg(target));
+    parallel.addPlots(plots);
+
+    for (int handle = 0; handle < TARGETS; handle++)
+        QVERIFY(AVIMMTester::getMatricesEqual(parallel.getEstimator(handle)->getStateVector(),
+                                              sequential.getEstimator(handle)->getStateVector()).first);
+
+    // Every pool thread looked up the matrices in its own cache, none of them had to wait for a lock
+    QVERIFY(parallel.m_thread_caches.size() == 4);
+    quint64 hits = 0;
+    for (const auto& cache : parallel.m_thread_caches)
+    {
+        hits += cache->getHits();
+        QVERIFY(cache->getContentions() == 0);
+    }
+    QVERIFY(hits > 0);
+    QVERIFY(parser.getGlobalModelMatrixCache()->getHits() == 0);
+    QVERIFY(parser.getGlobalModelMatrixCache()->getMisses() == 0);
+    QVERIFY(AVIMMConfigParser::getThreadModelMatrixCache() == nullptr);
+
+    parser.disableModelMatrixCache();
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::benchmark_AVIMMTrackTable_parallelUpdate_data()
+{
+    QTest::addColumn<int>("number_of_threads");
+    for (int number_of_threads : { 1, 2, 4, 8, 16, 32 })
+        QTest::newRow(qPrintable(QString("%1 threads").arg(number_of_threads))) << number_of_threads;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMThreadPool::benchmark_AVIMMTrackTable_parallelUpdate()
+{
+    QFETCH(int, number_of_threads);
+
+    // One scan of 2000 targets per iteration, the tracks are created before measuring
+    const int TARGETS = 2000;
+    AVIMMThreadPool pool(number_of_threads);
+    AVIMMTrackTable table(AVIMMTester::createConfigData(4));
+    table.setThreadPool(&pool);
+    table.addPlots(createPlots(table, TARGETS, 1));
+    const std::vector<AVIMMPlot> scan = createPlots(table, TARGETS, 2);
+
+    QBENCHMARK {
+        table.addPlots(scan.data() + TARGETS, TARGETS);
+    }
+    QVERIFY(table.getNumberOfTracks() == TARGETS);
+}
+
+AV_QTEST_MAIN(TstAVIMMThreadPool)
+#include "tstavimmthreadpool.moc"
@@ -0,0 +1,155 @@
+//
+// Created by felix on 8/18/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMTrackTable
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmtester.h"
+
+class TstAVIMMTrackTable : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMTrackTable() {}
+
+public slots:
+    void initTestCase() { AVIMMTester::initializeSingletons(); }
+    void cleanupTestCase() { AVIMMTester::deleteSingletons(); }
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMTrackTable_internTarget();
+    void test_AVIMMTrackTable_addPlots();
+    void test_AVIMMTrackTable_extrapolateAll();
+
+private:
+    static AVIMMPlot createPlot(int handle, qint64 time, double x, double y);
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMPlot TstAVIMMTrackTable::createPlot(int handle, qint64 time, double x, double y)
+{
+    AVIMMPlot plot;
+    plot.handle = handle;
+    plot.time   = time;
+    plot.z      = Vector(4,1);
+    plot.z << x, 0, y, 0;
+    return plot;
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTrackTable::test_AVIMMTrackTable_internTarget()
+{
+    AVIMMTrackTable table(AVIMMTester::createConfigData(4));
+
+    const int first  = table.internTarget("AUA123");
+    const int second = table.internTarget("DLH456");
+    QVERIFY(first == 0);
+    QVERIFY(second == 1);
+    QVERIFY(table.internTarget("AUA123") == first);
+    QVERIFY(table.findTarget("DLH456") == second);
+    QVERIFY(table.findTarget("unknown") == -1);
+    QVERIFY(table.getTarget(second) == "DLH456");
+    QVERIFY(table.getNumberOfTargets() == 2);
+
+    // Released handles are reused
+    table.releaseTarget(first);
+    QVERIFY(table.findTarget("AUA123") == -1);
+    QVERIFY(table.getNumberOfTargets() == 1);
+    QVERIFY(table.internTarget("SWR789") == first);
+    QVERIFY(table.getTarget(first) == "SWR789");
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTrackTable::test_AVIMMTrackTable_addPlots()
+{
+    AVIMMTrackTable table(AVIMMTester::createConfigData(4));
+    const int first  = table.internTarget("AUA123");
+    const int second = table.internTarget("DLH456");
+    QVERIFY(!table.hasTrack(first));
+
+    // The first plot of a target creates its track with the plot as initial state
+    std::vector<AVIMMPlot> plots;
+    plots.push_back(createPlot(first,  0, 100.0, 200.0));
+    plots.push_back(createPlot(second, 0, -50.0, 10.0));
+    table.addPlots(plots);
+    QVERIFY(table.getNumberOfTracks() == 2);
+    QVERIFY(table.hasTrack(first) && table.hasTrack(second));
+    QVERIFY(AVIMMTester::getMatricesEqual(table.getEstimator(first)->getStateVector(), plots[0].z).first);
+    QVERIFY(AVIMMTester::getMatricesEqual(table.getEstimator(second)->getStateVector(), plots[1].z).first);
+
+    // Further plots update the tracks
+    plots.clear();
+    plots.push_back(createPlot(first, 1000000000, 101.0, 201.0));
+    table.addPlots(plots);
+    QVERIFY(table.getNumberOfTracks() == 2);
+    QVERIFY(table.getEstimator(first)->getStateVector()[0] > 100.0);
+    const Vector second_state = table.getEstimator(second)->getStateVector();
+    QVERIFY(AVIMMTester::getMatricesEqual(second_state, createPlot(second, 0, -50.0, 10.0).z).first);
+
+    // Releasing the target drops its track
+    table.releaseTarget(second);
+    QVERIFY(table.getNumberOfTracks() == 1);
+    QVERIFY(!table.hasTrack(second));
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTrackTable::test_AVIMMTrackTable_extrapolateAll()
+{
+    AVIMMTrackTable table(AVIMMTester::createConfigData(4), 1.0);
+    const int first  = table.internTarget("AUA123");
+    const int second = table.internTarget("DLH456");
+
+    table.addPlot(createPlot(first,  0,         100.0, 200.0));
+    table.addPlot(createPlot(second, 500000000, -50.0, 10.0));
+
+    std::vector<AVIMMTrackOutput> output;
+    table.extrapolateAll(800000000, output);
+    QVERIFY(output.size() == 2);
+    QVERIFY(output[0].handle == first);
+    QVERIFY(output[1].handle == second);
+    QVERIFY(output[0].time == 800000000);
+    QVERIFY(output[0].x.size() == 4);
+    QVERIFY(output[0].P.rows() == 4);
+    QVERIFY(std::abs(output[0].mode_probabilities.sum() - 1.0) < 1e-12);
+
+    // The first track was not updated for the track timeout and is dropped, its handle stays valid
+    output.clear();
+    table.extrapolateAll(1200000000, output);
+    QVERIFY(output.size() == 1);
+    QVERIFY(output[0].handle == second);
+    QVERIFY(!table.hasTrack(first));
+    QVERIFY(table.findTarget("AUA123") == first);
+    QVERIFY(table.getNumberOfTracks() == 1);
+
+    // A new plot starts a new track
+    table.addPlot(createPlot(first, 1300000000, 110.0, 210.0));
+    QVERIFY(table.hasTrack(first));
+    QVERIFY(table.getEstimator(first)->getStateVector()[0] == 110.0);
+}
+
+AV_QTEST_MAIN(TstAVIMMTrackTable)
+#include "tstavimmtracktable.moc"
@@ -0,0 +1,197 @@
+//
+// Created by felix on 9/7/20.
+//
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Package:    AVCOMMON
+// QT-Version: QT5
+// Copyright:  AviBit data processing GmbH, 2001-2018
+//
+// Module:     UnitTests
+//
+///////////////////////////////////////////////////////////////////////////////
+
+/*! \file
+    \brief   Function level test cases for AVIMMTrafficGenerator and AVIMMScalability
+ */
+
+#include <QObject>
+#include <QTest>
+#include <avunittest.h>
+#include <QApplication>
+
+#include "testhelper/avimmscalability.h"
+
+class TstAVIMMTraffic : public QObject
+{
+Q_OBJECT
+
+public:
+    TstAVIMMTraffic() {}
+
+public slots:
+    void initTestCase()
+    {
+        // Set singletons
+        std::vector<char*> args;
+        QByteArray         dummy_arg("dummy");  // program name, is ignored by config
+        args.push_back(dummy_arg.data());
+
+        AVEnvironment::setProcessName("imm_tester");
+        AVConfig2Global::initializeSingleton(args.size(), args.data(), false, AVEnvironment::APP_ASTOS, "imm_tester");
+        AVConfig2Global::singleton().initialize();
+
+        // Reads the airport areas and their configs, the estimators are created with the config of their area
+        AVIMMAirportConfigs::initializeSingleton();
+    }
+    void cleanupTestCase()
+    {
+        AVIMMAirportConfigs::deleteSingleton();
+        AVConfig2Global::deleteSingleton();
+    };
+    void init() {}
+    void cleanup() {}
+
+private slots:
+    void test_AVIMMTrafficGenerator_deterministic();
+    void test_AVIMMTrafficGenerator_targets();
+    void test_AVIMMScalability_run();
+
+private:
+    static QStringList getStateDefinition() { return { "pos_x", "vel_x", "acc_x", "pos_y", "vel_y", "acc_y" }; }
+    static QList<QPolygon> getAreas()
+    {
+        QPolygon square;
+        square << QPoint(0, 0) << QPoint(1000, 0) << QPoint(1000, 1000) << QPoint(0, 1000);
+        QPolygon triangle;
+        triangle << QPoint(-2000, 0) << QPoint(-1000, 0) << QPoint(-1000, 1000);
+        return { square, triangle };
+    }
+};
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTraffic::test_AVIMMTrafficGenerator_deterministic()
+{
+    AVIMMTrafficGenerator forward(getAreas(), getStateDefinition(), 20, 7);
+    AVIMMTrafficGenerator backward(getAreas(), getStateDefinition(), 20, 7);
+    AVIMMTrafficGenerator other_seed(getAreas(), getStateDefinition(), 20, 8);
+
+    // The plots of a target do not depend on the order in which the targets are advanced
+    std::vector<std::vector<Vector>> forward_plots(20);
+    std::vector<std::vector<Vector>> backward_plots(20);
+    Vector z;
+    for (int target = 0; target < 20; target++)
+        for (int i = 0; i < 50; i++)
+        {
+            forward.nextPlot(target, z);
+            forward_plots[target].push_back(z);
+        }
+    for (int i = 0; i < 50; i++)
+        for (int target = 19; target >= 0; target--)
+        {
+            backward.nextPlot(target, z);
+            backward_plots[target].push_back(z);
+        }
+    QVERIFY(forward_plots == backward_plots);
+
+    int differing = 0;
+    for (int target = 0; target < 20; target++)
+    {
+        other_seed.nextPlot(target, z);
+        if (z != forward_plots[target][0])
+            differing++;
+    }
+    QCOMPARE(differing, 20);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTraffic::test_AVIMMTrafficGenerator_targets()
+{
+    const int number_of_targets = 1000;
+    const QList<QPolygon> areas = getAreas();
+    AVIMMTrafficGenerator traffic(areas, getStateDefinition(), number_of_targets);
+    QCOMPARE(traffic.getNumberOfTargets(), number_of_targets);
+    QCOMPARE(traffic.getDimension(), 6);
+
+    int stationary = 0;
+    int turning = 0;
+    Vector z;
+    Vector x;
+    for (int target = 0; target < number_of_targets; target++)
+    {
+        // Targets start inside their area
+        const QPointF start = traffic.getTruePosition(target);
+        QVERIFY(areas[target % areas.size()].containsPoint(start.toPoint(), Qt::OddEvenFill));
+
+        const double period = traffic.getSensor(target).period;
+        QVERIFY(traffic.getNextPlotTime(target) >= 0.0 && traffic.getNextPlotTime(target) < period);
+
+        // Simulates two minutes, the plots follow the sensor period
+        double last_time = -1.0;
+        while (traffic.getNextPlotTime(target) < 120.0)
+        {
+            const double time = traffic.getNextPlotTime(target);
+            if (last_time >= 0.0)
+                QVERIFY(std::abs(time - last_time - period) <= 0.01 * period + 1e-9);
+            last_time = time;
+            traffic.nextPlot(target, z);
+            QCOMPARE(int(z.size()), 6);
+            if (traffic.getSegment(target) == AVIMMTrafficGenerator::TURN)
+                turning++;
+        }
+
+        // The noise of the plots is in the order of the sensor's
+        traffic.getTrueState(target, x);
+        QVERIFY((z - x).head(1).norm() < 6.0 * traffic.getSensor(target).position_sigma);
+
+        if (traffic.isStationary(target))
+        {
+            stationary++;
+            QCOMPARE(traffic.getTruePosition(target), start);
+            QCOMPARE(x(1), 0.0);
+            QCOMPARE(x(4), 0.0);
+        }
+        else
+        {
+            const double speed = std::hypot(x(1), x(4));
+            QVERIFY(speed > 2.9 && speed < 80.1);
+        }
+    }
+
+    // About a fifth of the targets stand on the apron
+    QVERIFY(stationary > 150 && stationary < 250);
+    QVERIFY(turning > 0);
+}
+
+//--------------------------------------------------------------------------
+
+void TstAVIMMTraffic::test_AVIMMScalability_run()
+{
+    const QList<QPolygon> areas = AVIMMTrafficGenerator::getAirportAreas();
+    QVERIFY(!areas.isEmpty());
+    AVIMMScalability scalability(areas, AVIMMStaticConfigContainer::singleton().state_definition);
+
+    const AVIMMScalability::Result single = scalability.run(200, 1, 10.0);
+    const AVIMMScalability::Result multiple = scalability.run(200, 3, 10.0);
+
+    // The traffic is the same for any number of threads, every target gets a plot per sensor period
+    QCOMPARE(single.targets, 200);
+    QCOMPARE(multiple.threads, 3);
+    QCOMPARE(single.plots, multiple.plots);
+    QVERIFY(single.plots > 200 * 8);
+    QVERIFY(single.plots < 200 * 20);
+    QVERIFY(single.plots_per_second > 0.0);
+    QVERIFY(single.latency_p50 <= single.latency_p99);
+    QVERIFY(single.latency_p99 <= single.latency_p999);
+    QVERIFY(single.latency_p999 <= single.latency_max);
+
+    // The tracks follow the targets and do not depend on the threads
+    QVERIFY(single.position_error < 50.0);
+    QVERIFY(std::abs(single.position_error - multiple.position_error) < 1e-9);
+}
+
+AV_QTEST_MAIN(TstAVIMMTraffic)
+#include "tstavimmtraffic.moc"
@@ -3,6 +3,7 @@
 //
 
 #include "avimmairportconfigs.h"
+#include "avimmmodelmatrixcache.h"
 
 #define CFGPATH "/home/users/felix/workspace/trunk/svn/avcommon/src5/avimmlib/config/imm_airport_areas.cc"
 #define AREACFG "areas"
@@ -25,10 +26,14 @@ AVIMMAreaConfig::AVIMMAreaConfig(const QString &prefix, AVConfig2Container &conf
     AVIMMConfigData area_config_data;
     area_config_data.markov_transition_matrix    = avimm_dynamic_config.area_filter_configs[m_area_name]->markov_transition_matrix;
     area_config_data.sigma                       = avimm_dynamic_config.area_filter_configs[m_area_name]->sigma;
+    area_config_data.area_name                   = m_area_name;
     area_config_data.expansion_matrix            = avimm_static_config.expansion_matrix;
     area_config_data.expansion_matrix_covariance = avimm_static_config.expansion_matrix_covariance;
     area_config_data.expansion_matrix_innovation = avimm_static_config.expansion_matrix_innovation;
     area_config_data.shrinking_matrix            = avimm_static_config.shrinking_matrix;
+    area_config_data.expansion_map               = avimm_static_config.expansion_map;
+    area_config_data.expansion_map_covariance    = avimm_static_config.expansion_map_covariance;
+    area_config_data.shrinking_map               = avimm_static_config.shrinking_map;
     area_config_data.initial_mode_probabilities  = avimm_static_config.mode_probabilities;
     area_config_data.sub_filter_config_keys      = avimm_static_config.sub_filter_config_definitions;
     
@@ -43,6 +48,27 @@ AVIMMAreaConfig::AVIMMAreaConfig(const QString &prefix, AVConfig2Container &conf
         area_config_data.J_map[filter_name] = avimm_static_config.filters[filter_name]->jacobi_matrix;
     }
     m_config = area_config_data;
+    
+    compileMatrices();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMAreaConfig::compileMatrices()
+{
+    auto& parser = AVIMMConfigParser::singleton();
+    for (const auto& filter_name : m_config.sub_filter_config_keys)
+    {
+        AVIMMCompiledSubfilterMatrices compiled;
+        compiled.F = parser.compileMatrixProgram(m_config.F_map[filter_name]);
+        compiled.P = parser.compileMatrixProgram(m_config.P_map[filter_name]);
+        compiled.H = parser.compileMatrixProgram(m_config.H_map[filter_name]);
+        compiled.B = parser.compileMatrixProgram(m_config.B_map[filter_name]);
+        compiled.R = parser.compileMatrixProgram(m_config.R_map[filter_name]);
+        compiled.J = parser.compileMatrixProgram(m_config.J_map[filter_name]);
+        compiled.Q = parser.compileMatrixProgram(m_config.Q_map[filter_name]);
+        m_config.compiled_map[filter_name] = compiled;
+    }
 }
 
 //--------------------------------------------------------------------------
@@ -88,16 +114,19 @@ AVIMMAirportAreaConfigContainer::AVIMMAirportAreaConfigContainer()
 
 AVIMMAirportConfigs::AVIMMAirportConfigs()
 {
-    // Initialize singletons of config containers to read in imm configs
+    // Initialize singletons of config containers to read in imm configs. The parser has to exist before the area
+    // configs are read, since those compile their matrices on creation
+    AVIMMConfigParser::initializeSingleton();
     AVIMMStaticConfigContainer::initializeSingleton();
     AVIMMDynamicConfigContainer::initializeSingleton();
     AVIMMAirportAreaConfigContainer::initializeSingleton();
-    AVIMMConfigParser::initializeSingleton();
     for (auto& config : AVIMMAirportAreaConfigContainer::singleton().getAiportAreaConfigs())
     {
         m_airport_config_areas.append(config->getAreaName());
         m_airport_configs.append(*config.get());
     }
+    
+    initializeModelMatrixCache();
 }
 
 //--------------------------------------------------------------------------
@@ -105,10 +134,49 @@ AVIMMAirportConfigs::AVIMMAirportConfigs()
 AVIMMAirportConfigs::~AVIMMAirportConfigs()
 {
     // Delete all singletons of the config containers
-    AVIMMConfigParser::deleteSingleton();
     AVIMMAirportAreaConfigContainer::deleteSingleton();
     AVIMMDynamicConfigContainer::deleteSingleton();
     AVIMMStaticConfigContainer::deleteSingleton();
+    AVIMMConfigParser::deleteSingleton();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMAirportConfigs::initializeModelMatrixCache()
+{
+    const auto& static_config = AVIMMStaticConfigContainer::singleton();
+    auto& parser = AVIMMConfigParser::singleton();
+    if (!static_config.model_matrix_cache_enabled)
+    {
+        parser.disableModelMatrixCache();
+        return;
+    }
+    
+    parser.enableModelMatrixCache(static_config.model_matrix_cache_quantization_step,
+                                  static_config.model_matrix_cache_capacity);
+    prewarmModelMatrixCache(*parser.getGlobalModelMatrixCache());
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMAirportConfigs::prewarmModelMatrixCache(AVIMMModelMatrixCache& cache) const
+{
+    // Fill the cache with the known sensor periods of all areas and subfilters
+    for (const auto& area : m_airport_configs)
+        prewarmModelMatrixCache(cache, area.getConfigData());
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMAirportConfigs::prewarmModelMatrixCache(AVIMMModelMatrixCache& cache, const AVIMMConfigData& config)
+{
+    const auto& static_config = AVIMMStaticConfigContainer::singleton();
+    for (const auto& sub_filter_key : config.sub_filter_config_keys)
+    {
+        int model_id = cache.getModelId(config.area_name, sub_filter_key);
+        cache.prewarm(model_id, config.compiled_map.value(sub_filter_key),
+                      static_config.model_matrix_cache_prewarm_periods);
+    }
 }
 
 //--------------------------------------------------------------------------
@@ -7,6 +7,7 @@
 
 #include "avimmconfig.h"
 #include "avimmconfigparser.h"
+#include "avimmmatrixprogram.h"
 
 // AviBit common includes
 #include "avconfig2.h"
@@ -26,6 +27,10 @@ struct AVIMMConfigData
     Matrix expansion_matrix_covariance;
     Matrix expansion_matrix_innovation;
     Matrix shrinking_matrix;
+    // Gather versions of the matrices above
+    AVIMMIndexMap expansion_map;
+    AVIMMIndexMap expansion_map_covariance;
+    AVIMMIndexMap shrinking_map;
     Vector initial_mode_probabilities;
     QStringList sub_filter_config_keys;
     
@@ -33,6 +38,10 @@ struct AVIMMConfigData
     QMap<QString, AVMatrix<QString>> Q_map;
     Matrix markov_transition_matrix;
     float sigma;
+    QString area_name;
+    
+    // Compiled versions of the matrix maps above, shared between all estimators using this config
+    QMap<QString, AVIMMCompiledSubfilterMatrices> compiled_map;
 };
 // used to define areas
 class AVIMMAreaConfig : public AVConfig2
@@ -47,8 +56,11 @@ public:
     
     DEFINE_ACCESSORS_REF(ConfigData, AVIMMConfigData, m_config);
     DEFINE_ACCESSORS_REF(AreaName, QString, m_area_name);
+    DEFINE_ACCESSORS_REF(Area, QPolygon, m_area);
     
     void createArea(QList<QList<float>> corners);
+    // Compile all time dependent matrices of the config data, this has to be done only once per area
+    void compileMatrices();
     // Todo: proper implement this, find suitable algorithm for this.
     bool isInsideArea(const Vector& current_state) const;
 };
@@ -71,12 +83,19 @@ public:
     // This is selected from the defined airport map
     AVIMMConfigData getIMMConfigData(const Vector& current_state) const;
     
+    // Calculates the model matrices of the configured sensor periods for all areas, respectively the given config
+    void prewarmModelMatrixCache(AVIMMModelMatrixCache& cache) const;
+    static void prewarmModelMatrixCache(AVIMMModelMatrixCache& cache, const AVIMMConfigData& config);
+    
     DEFINE_ACCESSORS_REF(AirportAreas, QStringList, m_airport_config_areas);
     DEFINE_ACCESSORS_REF(AirportAreaConfigs, QList<AVIMMAreaConfig>, m_airport_configs);
     
 private:
     QStringList m_airport_config_areas;
     QList<AVIMMAreaConfig> m_airport_configs;
+    
+    // Enables the model matrix cache of the parser if configured and fills it with the configured sensor periods
+    void initializeModelMatrixCache();
 };
 
 // Class used to configure the areas of the airport. This is needed to establish a map of areas with the according IMM matrices.
@@ -0,0 +1,68 @@
+//
+// Created by felix on 8/31/20.
+//
+
+#ifndef AVIMMCLOCK_H
+#define AVIMMCLOCK_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <chrono>
+
+// Source of the current time in nanoseconds since epoch. The estimators only ask the clock if a calculation step is
+// made without a measurement time.
+class AVIMMClock
+{
+public:
+    virtual ~AVIMMClock() = default;
+
+    virtual qint64 now() const = 0;
+
+    // Returns the clock used by all estimators without an own clock, the system clock unless another one is set
+    static const AVIMMClock* getDefault();
+    // Sets the default clock, it is not owned. nullptr sets the system clock again.
+    static void setDefault(const AVIMMClock* clock) { defaultClock().store(clock, std::memory_order_release); }
+
+private:
+    static std::atomic<const AVIMMClock*>& defaultClock()
+    {
+        static std::atomic<const AVIMMClock*> clock(nullptr);
+        return clock;
+    }
+};
+
+// UTC wall clock time, without the QDateTime conversions
+class AVIMMSystemClock : public AVIMMClock
+{
+public:
+    qint64 now() const override
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Clock which only advances when told to, for replays and tests
+class AVIMMManualClock : public AVIMMClock
+{
+public:
+    explicit AVIMMManualClock(qint64 time=0) : m_time(time) {}
+
+    qint64 now() const override { return m_time.load(std::memory_order_relaxed); }
+    void setTime(qint64 time) { m_time.store(time, std::memory_order_relaxed); }
+    void advance(qint64 duration) { m_time.fetch_add(duration, std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_time;
+};
+
+//--------------------------------------------------------------------------
+
+inline const AVIMMClock* AVIMMClock::getDefault()
+{
+    static const AVIMMSystemClock system_clock;
+    const AVIMMClock* clock = defaultClock().load(std::memory_order_acquire);
+    return clock ? clock : &system_clock;
+}
+
+#endif //AVIMMCLOCK_H
@@ -114,6 +114,31 @@ AVIMMStaticConfigContainer::AVIMMStaticConfigContainer()
                       "Matrix which defines how the state and covariance of the subfilter are shrunk to subfilter size").
             setSuggestedValue(AVMatrix<float>());
     
+    registerParameter("model_matrix_cache_enabled", &model_matrix_cache_enabled,
+                      "Bool which defines if the model matrices are cached for recurring time deltas").
+            setSuggestedValue(false);
+    
+    registerParameter("model_matrix_cache_quantization_step", &model_matrix_cache_quantization_step,
+                      "Float which defines the step in seconds time deltas are rounded to for the model matrix cache").
+            setSuggestedValue(0.001);
+    
+    registerParameter("model_matrix_cache_capacity", &model_matrix_cache_capacity,
+                      "Integer which defines the maximum number of cached model matrix sets").
+            setSuggestedValue(256);
+    
+    QList<float> suggested_prewarm_periods = {1.0, 4.0};
+    registerParameter("model_matrix_cache_prewarm_periods", &model_matrix_cache_prewarm_periods,
+                      "List which defines the sensor periods in seconds the model matrix cache is filled with on startup").
+            setSuggestedValue(suggested_prewarm_periods);
+    
+    registerParameter("fixed_size_estimators_enabled", &fixed_size_estimators_enabled,
+                      "Bool which defines if estimators with compile time dimensions are used for supported configs").
+            setSuggestedValue(true);
+    
+    registerParameter("log_domain_mode_probabilities", &log_domain_mode_probabilities,
+                      "Bool which defines if likelihoods and mode probabilities are calculated in log space").
+            setSuggestedValue(false);
+    
     // Read subconfigs
     registerSubconfig(m_prefix + ".subfilters", &filters);
     
@@ -128,6 +153,10 @@ AVIMMStaticConfigContainer::AVIMMStaticConfigContainer()
     expansion_matrix_covariance = convertAVMatrixFloatToEigenMatrix(expansion_matrix_covariance_helper);
     expansion_matrix_innovation = convertAVMatrixFloatToEigenMatrix(expansion_matrix_innovation_helper);
     shrinking_matrix            = convertAVMatrixFloatToEigenMatrix(shrinking_matrix_helper);
+    expansion_map               = AVIMMIndexMap(expansion_matrix);
+    expansion_map_covariance    = AVIMMIndexMap(expansion_matrix_covariance);
+    expansion_map_innovation    = AVIMMIndexMap(expansion_matrix_innovation);
+    shrinking_map               = AVIMMIndexMap(shrinking_matrix);
     
     // Create a dict so we know with what type of filter we are dealing with when initializing the IMM
     for (auto &subfilter : filters)
@@ -6,6 +6,7 @@
 #define AVIMM_CONFIG_H
 #include "utils/avimmmakros.h"
 #include "utils/avimmtypedefs.h"
+#include "utils/avimmindexmap.h"
 #include <map>
 #include <QString>
 
@@ -75,6 +76,21 @@ public:
     Matrix expansion_matrix_covariance;
     Matrix expansion_matrix_innovation;
     Matrix shrinking_matrix;
+    // Gather versions of the matrices above, compiled once the config is loaded
+    AVIMMIndexMap expansion_map;
+    AVIMMIndexMap expansion_map_covariance;
+    AVIMMIndexMap expansion_map_innovation;
+    AVIMMIndexMap shrinking_map;
+    
+    // Optional cache of the model matrices for sensors with fixed update rates
+    bool model_matrix_cache_enabled;
+    float model_matrix_cache_quantization_step;
+    int model_matrix_cache_capacity;
+    QList<float> model_matrix_cache_prewarm_periods;
+    // Use the fixed size estimators if the subfilter dimensions allow it
+    bool fixed_size_estimators_enabled;
+    // Keep likelihoods and mode probabilities in log space
+    bool log_domain_mode_probabilities;
     
     FilterTypeMap filter_type_map;
     AVConfig2Map<AVIMMStaticSubfilterConfig> filters;
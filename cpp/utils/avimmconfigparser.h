@@ -8,6 +8,8 @@
 #include "avimmtypedefs.h"
 #include "exprtk.hpp"
 
+#include <mutex>
+
 // AviBit common includes
 #include "avconfig2.h"
 #include "avexplicitsingleton.h"
@@ -17,48 +19,146 @@ typedef exprtk::symbol_table<T> symbol_table_t;
 typedef exprtk::expression<T> expression_t;
 typedef exprtk::parser<T> parser_t;
 
+// Holds the expressions of a config matrix compiled once. The variables dt and sigma are bound to members of this
+// class, evaluating the matrix for a new time step only writes those and re-evaluates each cell.
+// Since the compiled expressions reference the addresses of the bound variables, objects of this class must not be
+// copied or moved and are shared using AVIMMCompiledMatrixPtr. Evaluation writes the bound variables, so an object
+// must only be evaluated by one thread at a time, use AVIMMMatrixProgram for matrices shared between threads.
+class AVIMMCompiledMatrix
+{
+public:
+    AVIMMCompiledMatrix(const AVMatrix<QString> &M, parser_t& parser)
+        : m_rows(M.getRows()), m_cols(M.getColumns()), m_dt(T(0.0)), m_sigma(T(1.0))
+    {
+        m_symbol_table.add_variable("dt", m_dt);
+        m_symbol_table.add_variable("sigma", m_sigma);
+
+        // Compile data element wise, expressions are stored in column major order like the eigen matrices
+        m_expressions.resize(m_rows * m_cols);
+        for (int j = 0; j < m_cols; j++)
+            for (int i = 0; i < m_rows; i++)
+            {
+                expression_t& expression = m_expressions[j * m_rows + i];
+                expression.register_symbol_table(m_symbol_table);
+                std::string expression_string = M.get(i,j).toStdString();
+                if (!parser.compile(expression_string, expression))
+                {
+                    assert(("Could not compile expression: \"" + expression_string + "\"!", false));
+                }
+            }
+    }
+
+    AVIMMCompiledMatrix(const AVIMMCompiledMatrix&) = delete;
+    AVIMMCompiledMatrix& operator=(const AVIMMCompiledMatrix&) = delete;
+
+    int rows() const { return m_rows; }
+    int cols() const { return m_cols; }
+
+    // Evaluates all cells for the given time delta and variance. The result matrix is resized if necessary.
+    void evaluate(Matrix& result, float time_delta=0.0, float variance=1.0)
+    {
+        m_dt    = T(time_delta);
+        m_sigma = T(variance);
+
+        result.resize(m_rows, m_cols);
+        for (int i = 0; i < m_rows * m_cols; i++)
+            result(i) = m_expressions[i].value();
+    }
+
+    Matrix evaluate(float time_delta=0.0, float variance=1.0)
+    {
+        Matrix result(m_rows, m_cols);
+        evaluate(result, time_delta, variance);
+        return result;
+    }
+
+private:
+    int m_rows;
+    int m_cols;
+    T m_dt;
+    T m_sigma;
+    symbol_table_t m_symbol_table;
+    std::vector<expression_t> m_expressions;
+};
+
+typedef std::shared_ptr<AVIMMCompiledMatrix> AVIMMCompiledMatrixPtr;
+
+class AVIMMMatrixProgram;
+typedef std::shared_ptr<AVIMMMatrixProgram> AVIMMMatrixProgramPtr;
+class AVIMMModelMatrixCache;
+
+//--------------------------------------------------------------------------
+
 class AVIMMConfigParser : public AVExplicitSingleton<AVIMMConfigParser>
 {
 public:
     explicit AVIMMConfigParser() {};
     virtual ~AVIMMConfigParser() = default;
-    
+
     //! Initialise the global configuration data instance
     static AVIMMConfigParser& initializeSingleton()
     { return setSingleton(new AVIMMConfigParser()); }
-    
+
+    // Returns the exprtk parser of the calling thread. Compiling modifies the parser, so every thread uses its own
+    // and all functions of this class may be called from several threads.
+    static parser_t& getThreadParser()
+    {
+        thread_local parser_t parser;
+        return parser;
+    }
+
+    // Compiles the given matrix once, the result can be evaluated for any number of time steps
+    AVIMMCompiledMatrixPtr compileMatrix(const AVMatrix<QString> &M)
+    {
+        return std::make_shared<AVIMMCompiledMatrix>(M, getThreadParser());
+    }
+
+    // Compiles the given matrix into a single program with folded constants and shared powers of dt and sigma.
+    // Defined in avimmmatrixprogram.cpp
+    AVIMMMatrixProgramPtr compileMatrixProgram(const AVMatrix<QString> &M);
+
+    // Compiles and evaluates the given matrix, use compileMatrix() for matrices which are evaluated repeatedly
     Matrix calculateTimeDependentMatrices(const AVMatrix<QString> &M, float time_delta=0.0, float variance=1.0)
     {
-        int rows = M.getRows();
-        int cols = M.getColumns();
-        Matrix calculated_matrix(rows, cols);
-        
-        T dt    = T(time_delta);
-        T sigma = T(variance);
-        
-        symbol_table_t symbol_table;
-        symbol_table.add_variable("dt", dt);
-        symbol_table.add_variable("sigma", sigma);
-        
-        expression_t expression;
-        expression.register_symbol_table(symbol_table);
-        
-        // Convert Data element wise
-        for (int i = 0; i < rows; i++)
-            for (int j = 0; j < cols; j++)
-            {
-                std::string expression_string = M.get(i,j).toStdString();
-                if (!m_parser.compile(expression_string, expression))
-                {
-                    assert(("Could not compile expression: \"" + expression_string + "\"!", false));
-                }
-                calculated_matrix(i,j) = expression.value();
-            }
-        return calculated_matrix;
+        AVIMMCompiledMatrix compiled_matrix(M, getThreadParser());
+        return compiled_matrix.evaluate(time_delta, variance);
     }
 
+    Matrix calculateTimeDependentMatrices(const AVIMMCompiledMatrixPtr &M, float time_delta=0.0, float variance=1.0)
+    {
+        return M->evaluate(time_delta, variance);
+    }
+
+    // Enables the optional cache of model matrices keyed by the time delta, replaces an already existing cache.
+    // Model ids are shared by all caches, existing estimators use the new cache on their next calculation step.
+    // Defined in avimmmodelmatrixcache.cpp
+    void enableModelMatrixCache(double quantization_step, int capacity);
+    void disableModelMatrixCache() { m_model_matrix_cache.reset(); }
+    // Returns the model matrix cache of the calling thread if one is set, otherwise the global model matrix cache or
+    // nullptr if it is not enabled
+    AVIMMModelMatrixCache* getModelMatrixCache()
+    {
+        AVIMMModelMatrixCache* thread_cache = threadModelMatrixCache();
+        return thread_cache ? thread_cache : m_model_matrix_cache.get();
+    }
+    // Like getModelMatrixCache(), but the global cache is locked into lock. The cache of the calling thread is only
+    // used by this thread, it is returned without locking. Defined in avimmmodelmatrixcache.cpp
+    AVIMMModelMatrixCache* lockModelMatrixCache(std::unique_lock<std::mutex>& lock);
+    AVIMMModelMatrixCache* getGlobalModelMatrixCache() { return m_model_matrix_cache.get(); }
+
+    // Sets a cache used instead of the global one by all estimators calculated in the calling thread, e.g. by threads
+    // which own their estimators. The cache is not owned, nullptr uses the global cache again.
+    static void setThreadModelMatrixCache(AVIMMModelMatrixCache* cache) { threadModelMatrixCache() = cache; }
+    static AVIMMModelMatrixCache* getThreadModelMatrixCache() { return threadModelMatrixCache(); }
+
 private:
-    parser_t m_parser;
+    static AVIMMModelMatrixCache*& threadModelMatrixCache()
+    {
+        thread_local AVIMMModelMatrixCache* cache = nullptr;
+        return cache;
+    }
+
+    std::shared_ptr<AVIMMModelMatrixCache> m_model_matrix_cache;
 };
 
 
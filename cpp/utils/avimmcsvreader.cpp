@@ -0,0 +1,247 @@
+//
+// Created by felix on 9/3/20.
+//
+
+#include "avimmcsvreader.h"
+
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+#if !defined(__cpp_lib_to_chars)
+    bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    // Powers of ten which are exact doubles
+    const double EXACT_POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    // Parses numbers with up to 15 significant digits and a small exponent, there the mantissa and the power of
+    // ten are exact doubles and a single multiplication or division rounds correctly. Returns false for all other
+    // numbers, without deciding whether they are valid.
+    bool parseDoubleFast(const char* begin, const char* end, double& value)
+    {
+        const char* p = begin;
+        const bool negative = p != end && *p == '-';
+        if (p != end && (*p == '-' || *p == '+'))
+            p++;
+
+        quint64 mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any_digit = false;
+        for (; p != end && isDigit(*p); p++)
+        {
+            any_digit = true;
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa > 0 && ++digits > 15)
+                return false;
+        }
+        if (p != end && *p == '.')
+        {
+            for (p++; p != end && isDigit(*p); p++)
+            {
+                any_digit = true;
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+                if (mantissa > 0 && ++digits > 15)
+                    return false;
+            }
+        }
+        if (!any_digit)
+            return false;
+
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            p++;
+            const bool negative_exponent = p != end && *p == '-';
+            if (p != end && (*p == '-' || *p == '+'))
+                p++;
+            if (p == end || !isDigit(*p))
+                return false;
+            int explicit_exponent = 0;
+            for (; p != end && isDigit(*p) && explicit_exponent < 1000; p++)
+                explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+        }
+        if (p != end || exponent < -22 || exponent > 22)
+            return false;
+
+        value = static_cast<double>(mantissa);
+        value = exponent < 0 ? value / EXACT_POWERS_OF_TEN[-exponent] : value * EXACT_POWERS_OF_TEN[exponent];
+        if (negative)
+            value = -value;
+        return true;
+    }
+
+    // Parses any number with strtod on a copy of the field, the decimal point is replaced by the one of the locale
+    bool parseDoubleSlow(const char* begin, const char* end, double& value)
+    {
+        char buffer[128];
+        const size_t size = end - begin;
+        if (size == 0 || size >= sizeof(buffer))
+            return false;
+        std::memcpy(buffer, begin, size);
+        buffer[size] = '\0';
+
+        const char decimal_point = *std::localeconv()->decimal_point;
+        for (size_t i = 0; i < size; i++)
+        {
+            if (buffer[i] == decimal_point && decimal_point != '.')
+                return false;
+            if (buffer[i] == '.')
+                buffer[i] = decimal_point;
+        }
+
+        char* parsed_end;
+        value = std::strtod(buffer, &parsed_end);
+        return parsed_end == buffer + size;
+    }
+#endif
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMCsvReader::AVIMMCsvReader(const QString& file_name, char delimiter)
+    : m_file(file_name), m_begin(nullptr), m_end(nullptr), m_delimiter(delimiter), m_valid(false)
+{
+    if (m_file.open(QIODevice::ReadOnly))
+    {
+        const qint64 size = m_file.size();
+        // An empty file cannot be mapped
+        const uchar* data = size > 0 ? m_file.map(0, size) : nullptr;
+        if (data != nullptr)
+        {
+            m_begin = reinterpret_cast<const char*>(data);
+            m_end   = m_begin + size;
+#ifdef __linux__
+            // The file is read once from front to back
+            madvise(const_cast<uchar*>(data), size, MADV_SEQUENTIAL);
+#endif
+        }
+        m_valid = data != nullptr || size == 0;
+    }
+    initialize();
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMCsvReader::AVIMMCsvReader(const char* data, qint64 size, char delimiter)
+    : m_begin(data), m_end(data + size), m_delimiter(delimiter), m_valid(true)
+{
+    initialize();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMCsvReader::initialize()
+{
+    m_errors = 0;
+    reset();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMCsvReader::reset()
+{
+    m_position = m_begin;
+    m_line_number = 0;
+    m_number_of_fields = 0;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMCsvReader::readRow()
+{
+    while (m_position != m_end)
+    {
+        const char* line_begin = m_position;
+        const char* line_end = static_cast<const char*>(std::memchr(line_begin, '\n', m_end - line_begin));
+        if (line_end == nullptr)
+            line_end = m_end;
+        m_position = line_end == m_end ? m_end : line_end + 1;
+        m_line_number++;
+
+        if (parseLine(line_begin, line_end))
+        {
+            if (m_number_of_fields > 0)
+                return true;
+        }
+        else
+            m_errors++;
+    }
+    m_number_of_fields = 0;
+    return false;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMCsvReader::parseLine(const char* begin, const char* end)
+{
+    m_number_of_fields = 0;
+    while (begin != end)
+    {
+        const char* field_end = static_cast<const char*>(std::memchr(begin, m_delimiter, end - begin));
+        if (field_end == nullptr)
+            field_end = end;
+        const char* next = field_end == end ? end : field_end + 1;
+
+        while (begin != field_end && isBlank(*begin))
+            begin++;
+        while (field_end != begin && isBlank(*(field_end - 1)))
+            field_end--;
+
+        if (begin != field_end && m_number_of_fields < MAX_FIELDS)
+        {
+            if (!parseDouble(begin, field_end, m_fields[m_number_of_fields]))
+                return false;
+            m_number_of_fields++;
+        }
+        begin = next;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMCsvReader::readRecord(double& time_ms, Vector& values)
+{
+    if (!readRow())
+        return false;
+
+    time_ms = m_fields[0];
+    if (values.size() != m_number_of_fields - 1)
+        values.resize(m_number_of_fields - 1);
+    for (int i = 1; i < m_number_of_fields; i++)
+        values(i - 1) = m_fields[i];
+    return true;
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMCsvReader::parseDouble(const char* begin, const char* end, double& value)
+{
+    // std::from_chars rejects a leading plus sign
+    if (end - begin > 1 && *begin == '+' && *(begin + 1) != '-')
+        begin++;
+
+#if defined(__cpp_lib_to_chars)
+    const std::from_chars_result result = std::from_chars(begin, end, value);
+    return result.ec == std::errc() && result.ptr == end;
+#else
+    return parseDoubleFast(begin, end, value) || parseDoubleSlow(begin, end, value);
+#endif
+}
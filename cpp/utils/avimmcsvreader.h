@@ -0,0 +1,70 @@
+//
+// Created by felix on 9/3/20.
+//
+
+#ifndef AVIMMCSVREADER_H
+#define AVIMMCSVREADER_H
+
+#include "avimmtypedefs.h"
+
+#include <QFile>
+
+// Reads rows of numbers from CSV data in place, e.g. the test data files. Files are mapped into memory and parsed
+// row by row without copying or allocating, the fields of the current row are kept in a fixed size buffer.
+// Fields are separated by the delimiter, surrounding blanks are ignored and empty fields are skipped. Empty lines are
+// skipped, rows with a field which is no number (e.g. a header line) are skipped and counted as errors.
+class AVIMMCsvReader
+{
+public:
+    enum
+    {
+        MAX_FIELDS = 64 // Further fields of a row are ignored
+    };
+
+    // Maps the file, the reader is invalid if it cannot be opened
+    explicit AVIMMCsvReader(const QString& file_name, char delimiter=',');
+    // Reads the data in the buffer, it is not owned and has to exist as long as the reader
+    AVIMMCsvReader(const char* data, qint64 size, char delimiter=',');
+    virtual ~AVIMMCsvReader() = default;
+
+    bool isValid() const { return m_valid; }
+
+    // Parses the next row, returns false at the end of the data
+    bool readRow();
+    // Fields of the current row
+    int getNumberOfFields() const { return m_number_of_fields; }
+    const double* getFields() const { return m_fields; }
+    double getField(int i) const { return m_fields[i]; }
+
+    // Reads the next row in the test data format, the time in milliseconds since the start and the values. The
+    // values are only resized if the number of fields changes.
+    bool readRecord(double& time_ms, Vector& values);
+
+    // Number of the line of the current row, starting with 1
+    qint64 getLineNumber() const { return m_line_number; }
+    quint64 getNumberOfErrors() const { return m_errors; }
+    // Rewinds to the first row
+    void reset();
+
+    // Parses the whole field as number in the C locale, returns false if it is no number
+    static bool parseDouble(const char* begin, const char* end, double& value);
+
+private:
+    void initialize();
+    // Parses the fields of the line, returns false if a field is no number
+    bool parseLine(const char* begin, const char* end);
+
+    QFile m_file;
+    const char* m_begin;
+    const char* m_end;
+    const char* m_position;
+    char m_delimiter;
+    bool m_valid;
+
+    qint64 m_line_number;
+    quint64 m_errors;
+    int m_number_of_fields;
+    double m_fields[MAX_FIELDS];
+};
+
+#endif //AVIMMCSVREADER_H
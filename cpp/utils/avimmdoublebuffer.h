@@ -0,0 +1,39 @@
+//
+// Created by felix on 8/7/20.
+//
+
+#ifndef AVIMMDOUBLEBUFFER_H
+#define AVIMMDOUBLEBUFFER_H
+
+// Holds the data of the current and the previous calculation step in two slots. Starting a new step only flips the
+// slot index instead of copying the current data into the previous data. The new current slot still holds the data
+// of the step before the previous one, the caller carries over what the new step reads.
+template<typename T>
+class AVIMMDoubleBuffer
+{
+public:
+    T& current() { return m_slots[m_current]; }
+    const T& current() const { return m_slots[m_current]; }
+    T& previous() { return m_slots[m_current ^ 1]; }
+    const T& previous() const { return m_slots[m_current ^ 1]; }
+    
+    // Makes the current slot the previous one and returns the new current slot
+    T& flip()
+    {
+        m_current ^= 1;
+        return current();
+    }
+    
+    // Sets both slots to value, e.g. on initialization to avoid stale data in the starting phase
+    void reset(const T& value)
+    {
+        m_slots[0] = value;
+        m_slots[1] = value;
+    }
+
+private:
+    T m_slots[2];
+    int m_current = 0;
+};
+
+#endif //AVIMMDOUBLEBUFFER_H
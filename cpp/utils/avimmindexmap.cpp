@@ -0,0 +1,67 @@
+//
+// Created by felix on 8/10/20.
+//
+
+#include "avimmindexmap.h"
+
+#include <cassert>
+
+AVIMMIndexMap::AVIMMIndexMap(const Matrix &map)
+    : m_indices(map.rows(), -1), m_factors(map.rows(), 0.0), m_valid(map.size() > 0)
+{
+    for (int i = 0; i < map.rows(); i++)
+    {
+        for (int j = 0; j < map.cols(); j++)
+        {
+            if (map(i, j) == 0.0)
+                continue;
+            
+            // More than one entry per row is a real linear combination
+            if (m_indices[i] >= 0)
+                m_valid = false;
+            m_indices[i] = j;
+            m_factors[i] = map(i, j);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMIndexMap::apply(const Vector &x, Vector &result) const
+{
+    assert(m_valid);
+    const int rows = m_indices.size();
+    result.resize(rows);
+    for (int i = 0; i < rows; i++)
+    {
+        const int j = m_indices[i];
+        if (j < 0)
+            result(i) = 0.0;
+        else
+            result(i) = m_factors[i] * (j < x.size() ? x(j) : 1.0);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMIndexMap::applySymmetric(const Matrix &M, Matrix &result) const
+{
+    assert(m_valid);
+    const int rows = m_indices.size();
+    const int size = M.rows();
+    result.resize(rows, rows);
+    for (int k = 0; k < rows; k++)
+    {
+        const int l = m_indices[k];
+        for (int i = 0; i < rows; i++)
+        {
+            const int j = m_indices[i];
+            if (j < 0 || l < 0)
+                result(i, k) = 0.0;
+            else if (j < size && l < size)
+                result(i, k) = m_factors[i] * m_factors[k] * M(j, l);
+            else
+                result(i, k) = j == l ? m_factors[i] * m_factors[k] : 0.0;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+//
+// Created by felix on 8/10/20.
+//
+
+#ifndef AVIMMINDEXMAP_H
+#define AVIMMINDEXMAP_H
+
+#include "avimmtypedefs.h"
+
+#include <vector>
+
+// Sparse form of the expansion and shrinking matrices of the config. Those only select (and scale) single entries
+// of the subfilter state, so every row of the matrix is stored as the index of its non zero column and the factor.
+// Applying the map is then a gather instead of a dense matrix product.
+// Like the dense version the source is padded to the columns of the matrix, vectors with ones and matrices with the
+// identity. Padded entries are the fill values of states the subfilter does not have.
+// Matrices with more than one non zero entry in a row can not be mapped, isValid() is false for those and the
+// dense product has to be used.
+class AVIMMIndexMap
+{
+public:
+    AVIMMIndexMap() = default;
+    explicit AVIMMIndexMap(const Matrix& map);
+    virtual ~AVIMMIndexMap() = default;
+
+    bool isValid() const { return m_valid; }
+    // Number of rows of the matrix the map was compiled from, 0 if not compiled
+    int rows() const { return m_indices.size(); }
+
+    // result = map * [x; 1]
+    void apply(const Vector& x, Vector& result) const;
+    // result = map * [M 0; 0 I] * map'
+    void applySymmetric(const Matrix& M, Matrix& result) const;
+
+private:
+    // Column of the non zero entry of each row, -1 for rows which are zero
+    std::vector<int> m_indices;
+    std::vector<double> m_factors;
+    bool m_valid = false;
+};
+
+#endif //AVIMMINDEXMAP_H
@@ -0,0 +1,151 @@
+//
+// Created by felix on 9/1/20.
+//
+
+#ifndef AVIMMLATENCYHISTOGRAM_H
+#define AVIMMLATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+// Histogram of durations (or any other non negative counts) with logarithmic buckets. Values below 32 are counted
+// exactly, above every power of two is split into 16 buckets, so percentiles have a relative error below 1/16.
+// The memory is fixed, recording never allocates. The histogram has a single writer, other threads may read it
+// concurrently, they see a consistent count per bucket but not necessarily over all buckets.
+class AVIMMLatencyHistogram
+{
+public:
+    enum
+    {
+        SUB_BUCKETS       = 16,
+        EXACT_BUCKETS     = 2 * SUB_BUCKETS,
+        NUMBER_OF_BUCKETS = EXACT_BUCKETS + (64 - 5) * SUB_BUCKETS
+    };
+
+    AVIMMLatencyHistogram() { reset(); }
+    AVIMMLatencyHistogram(const AVIMMLatencyHistogram& other) { reset(); merge(other); }
+    AVIMMLatencyHistogram& operator=(const AVIMMLatencyHistogram& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            merge(other);
+        }
+        return *this;
+    }
+
+    void record(quint64 value)
+    {
+        increment(m_buckets[getBucket(value)], 1);
+        increment(m_count, 1);
+        increment(m_sum, value);
+        if (value < m_min.load(std::memory_order_relaxed))
+            m_min.store(value, std::memory_order_relaxed);
+        if (value > m_max.load(std::memory_order_relaxed))
+            m_max.store(value, std::memory_order_relaxed);
+    }
+
+    // Adds the values of the other histogram, which may be written concurrently
+    void merge(const AVIMMLatencyHistogram& other)
+    {
+        for (int bucket = 0; bucket < NUMBER_OF_BUCKETS; bucket++)
+            increment(m_buckets[bucket], other.m_buckets[bucket].load(std::memory_order_relaxed));
+        increment(m_count, other.m_count.load(std::memory_order_relaxed));
+        increment(m_sum, other.m_sum.load(std::memory_order_relaxed));
+        m_min.store(std::min(m_min.load(std::memory_order_relaxed), other.m_min.load(std::memory_order_relaxed)),
+                    std::memory_order_relaxed);
+        m_max.store(std::max(m_max.load(std::memory_order_relaxed), other.m_max.load(std::memory_order_relaxed)),
+                    std::memory_order_relaxed);
+    }
+
+    // Only the writer may reset the histogram
+    void reset()
+    {
+        for (auto& bucket : m_buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_min.store(~0ULL, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    quint64 getCount() const { return m_count.load(std::memory_order_relaxed); }
+    quint64 getSum() const { return m_sum.load(std::memory_order_relaxed); }
+    quint64 getMin() const { return getCount() > 0 ? m_min.load(std::memory_order_relaxed) : 0; }
+    quint64 getMax() const { return m_max.load(std::memory_order_relaxed); }
+    double getMean() const { return getCount() > 0 ? static_cast<double>(getSum()) / getCount() : 0.0; }
+
+    // Returns the upper bound of the bucket holding the given percentile (0-100), at most the maximum value
+    quint64 getPercentile(double percentile) const
+    {
+        const quint64 count = getCount();
+        if (count == 0)
+            return 0;
+
+        const quint64 rank = std::max<quint64>(1, static_cast<quint64>(percentile / 100.0 * count + 0.5));
+        quint64 seen = 0;
+        for (int bucket = 0; bucket < NUMBER_OF_BUCKETS; bucket++)
+        {
+            seen += m_buckets[bucket].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(getBucketUpperBound(bucket), getMax());
+        }
+        return getMax();
+    }
+
+    static int getBucket(quint64 value)
+    {
+        if (value < EXACT_BUCKETS)
+            return static_cast<int>(value);
+        const int exponent = getHighestBit(value);
+        const int sub_bucket = static_cast<int>(value >> (exponent - 4)) & (SUB_BUCKETS - 1);
+        return EXACT_BUCKETS + (exponent - 5) * SUB_BUCKETS + sub_bucket;
+    }
+
+    static quint64 getBucketLowerBound(int bucket)
+    {
+        assert(bucket >= 0 && bucket < NUMBER_OF_BUCKETS);
+        if (bucket < EXACT_BUCKETS)
+            return bucket;
+        const int exponent = (bucket - EXACT_BUCKETS) / SUB_BUCKETS + 5;
+        const quint64 sub_bucket = (bucket - EXACT_BUCKETS) % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub_bucket) << (exponent - 4);
+    }
+
+    static quint64 getBucketUpperBound(int bucket)
+    {
+        if (bucket < EXACT_BUCKETS)
+            return bucket;
+        const int exponent = (bucket - EXACT_BUCKETS) / SUB_BUCKETS + 5;
+        return getBucketLowerBound(bucket) + (1ULL << (exponent - 4)) - 1;
+    }
+
+private:
+    // Only the single writer changes the values, so no read-modify-write instruction is needed
+    static void increment(std::atomic<quint64>& value, quint64 amount)
+    {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    static int getHighestBit(quint64 value)
+    {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while (value >>= 1)
+            bit++;
+        return bit;
+#endif
+    }
+
+    std::atomic<quint64> m_buckets[NUMBER_OF_BUCKETS];
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> m_sum;
+    std::atomic<quint64> m_min;
+    std::atomic<quint64> m_max;
+};
+
+#endif //AVIMMLATENCYHISTOGRAM_H
@@ -0,0 +1,60 @@
+//
+// Created by felix on 8/4/20.
+//
+
+#ifndef AVIMMLOGMATH_H
+#define AVIMMLOGMATH_H
+
+#include "avimmtypedefs.h"
+
+#include <cmath>
+#include <limits>
+
+// Helpers to keep the IMM mode probabilities in log space. The exp and log calls operate on whole eigen arrays and
+// are vectorized by eigen, the functions work with dynamic as well as fixed size vectors and matrices.
+class AVIMMLogMath
+{
+public:
+    // Returns log(sum(exp(values))) without overflow or underflow of the exponentials
+    template<typename Derived>
+    static double logSumExp(const Eigen::ArrayBase<Derived>& values)
+    {
+        const double max = values.maxCoeff();
+        // All exponentials are zero, subtracting the maximum would give NaN
+        if (max == -std::numeric_limits<double>::infinity())
+            return max;
+        if (!std::isfinite(max))
+            return max;
+        return max + std::log((values - max).exp().sum());
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Calculates log(c) = log(T * mu) and the mixing probabilities T(i,j) * mu(i) / c(j) from log(T) and log(mu).
+    // The mixing probabilities are returned in linear space since the mixed states are calculated from them.
+    template<typename MatrixType, typename VectorType>
+    static void calculateMixingProbabilities(const MatrixType& log_transition_matrix,
+                                             const VectorType& log_mode_probabilities, VectorType& log_c,
+                                             MatrixType& mixing_probabilities)
+    {
+        for (int i = 0; i < log_mode_probabilities.size(); i++)
+            log_c[i] = logSumExp(log_transition_matrix.row(i).transpose().array() + log_mode_probabilities.array());
+
+        mixing_probabilities = ((log_transition_matrix.array().colwise() + log_mode_probabilities.array()).rowwise() -
+                                log_c.transpose().array()).exp();
+    }
+
+    //--------------------------------------------------------------------------
+
+    // Calculates the normalized log mode probabilities log(c(i) * L(i) / sum(c * L)) from log(c) and the log
+    // likelihoods of the subfilters. No lower bound of the likelihoods is needed in log space.
+    template<typename VectorType>
+    static void calculateModeProbabilities(const VectorType& log_c, const VectorType& log_likelihoods,
+                                           VectorType& log_mode_probabilities)
+    {
+        log_mode_probabilities = log_c + log_likelihoods;
+        log_mode_probabilities.array() -= logSumExp(log_mode_probabilities.array());
+    }
+};
+
+#endif //AVIMMLOGMATH_H
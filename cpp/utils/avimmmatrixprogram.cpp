@@ -0,0 +1,541 @@
+//
+// Created by felix on 7/14/20.
+//
+
+#include "avimmmatrixprogram.h"
+
+#include <QString>
+
+#include <cctype>
+#include <cmath>
+#include <mutex>
+#include <set>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+// Maximum exponent accepted for dt and sigma, higher exponents are evaluated by exprtk
+#define MAX_POLYNOMIAL_POWER 16
+// Upper bound of the number of different monomials sigma^i * dt^j of a program
+#define MAX_MONOMIALS ((MAX_POLYNOMIAL_POWER + 1) * (MAX_POLYNOMIAL_POWER + 1))
+
+// Recursive descent parser which converts an expression into a polynomial of dt and sigma.
+// Grammar:
+//   expression := term (('+' | '-') term)*
+//   term       := unary (('*' | '/') unary)*
+//   unary      := ('+' | '-') unary | power
+//   power      := primary ('^' unary)?
+//   primary    := number | "dt" | "sigma" | '(' expression ')'
+// Divisions are only accepted by constants and exponents only if they are constant non negative integers.
+class AVIMMMatrixProgram::PolynomialParser
+{
+public:
+    explicit PolynomialParser(const std::string& expression) : m_expression(expression), m_pos(0) {}
+
+    // Returns false if the expression can not be represented as a polynomial
+    bool parse(Polynomial& result)
+    {
+        if (!parseExpression(result))
+            return false;
+        skipWhitespace();
+        return m_pos == m_expression.size();
+    }
+
+private:
+    const std::string& m_expression;
+    size_t m_pos;
+
+    void skipWhitespace()
+    {
+        while (m_pos < m_expression.size() && std::isspace(static_cast<unsigned char>(m_expression[m_pos])))
+            m_pos++;
+    }
+
+    bool accept(char c)
+    {
+        skipWhitespace();
+        if (m_pos < m_expression.size() && m_expression[m_pos] == c)
+        {
+            m_pos++;
+            return true;
+        }
+        return false;
+    }
+
+    static Polynomial constant(double value)
+    {
+        Polynomial p;
+        p[std::make_pair(0, 0)] = value;
+        return p;
+    }
+
+    static bool isConstant(const Polynomial& p, double& value)
+    {
+        value = 0.0;
+        for (const auto& term : p)
+        {
+            if (term.first != std::make_pair(0, 0) && term.second != 0.0)
+                return false;
+            if (term.first == std::make_pair(0, 0))
+                value = term.second;
+        }
+        return true;
+    }
+
+    static void add(Polynomial& lhs, const Polynomial& rhs, double sign)
+    {
+        for (const auto& term : rhs)
+            lhs[term.first] += sign * term.second;
+    }
+
+    static bool multiply(const Polynomial& lhs, const Polynomial& rhs, Polynomial& result)
+    {
+        Polynomial product;
+        for (const auto& l : lhs)
+            for (const auto& r : rhs)
+            {
+                int sigma_power = l.first.first + r.first.first;
+                int dt_power    = l.first.second + r.first.second;
+                if (sigma_power > MAX_POLYNOMIAL_POWER || dt_power > MAX_POLYNOMIAL_POWER)
+                    return false;
+                product[std::make_pair(sigma_power, dt_power)] += l.second * r.second;
+            }
+        result = product;
+        return true;
+    }
+
+    bool parseExpression(Polynomial& result)
+    {
+        if (!parseTerm(result))
+            return false;
+        while (true)
+        {
+            double sign;
+            if (accept('+'))
+                sign = 1.0;
+            else if (accept('-'))
+                sign = -1.0;
+            else
+                return true;
+
+            Polynomial rhs;
+            if (!parseTerm(rhs))
+                return false;
+            add(result, rhs, sign);
+        }
+    }
+
+    bool parseTerm(Polynomial& result)
+    {
+        if (!parseUnary(result))
+            return false;
+        while (true)
+        {
+            bool division;
+            if (accept('*'))
+                division = false;
+            else if (accept('/'))
+                division = true;
+            else
+                return true;
+
+            Polynomial rhs;
+            if (!parseUnary(rhs))
+                return false;
+
+            if (division)
+            {
+                double divisor;
+                if (!isConstant(rhs, divisor) || divisor == 0.0)
+                    return false;
+                rhs = constant(1.0 / divisor);
+            }
+            if (!multiply(result, rhs, result))
+                return false;
+        }
+    }
+
+    bool parseUnary(Polynomial& result)
+    {
+        if (accept('+'))
+            return parseUnary(result);
+        if (accept('-'))
+        {
+            if (!parseUnary(result))
+                return false;
+            for (auto& term : result)
+                term.second = -term.second;
+            return true;
+        }
+        return parsePower(result);
+    }
+
+    bool parsePower(Polynomial& result)
+    {
+        if (!parsePrimary(result))
+            return false;
+        if (!accept('^'))
+            return true;
+
+        Polynomial exponent_polynomial;
+        double exponent;
+        if (!parseUnary(exponent_polynomial) || !isConstant(exponent_polynomial, exponent))
+            return false;
+        if (exponent < 0.0 || exponent > MAX_POLYNOMIAL_POWER || exponent != std::floor(exponent))
+            return false;
+
+        Polynomial base = result;
+        result = constant(1.0);
+        for (int i = 0; i < static_cast<int>(exponent); i++)
+            if (!multiply(result, base, result))
+                return false;
+        return true;
+    }
+
+    bool parsePrimary(Polynomial& result)
+    {
+        skipWhitespace();
+        if (m_pos >= m_expression.size())
+            return false;
+
+        if (accept('('))
+            return parseExpression(result) && accept(')');
+
+        if (m_expression.compare(m_pos, 2, "dt") == 0 && !isIdentifierChar(m_pos + 2))
+        {
+            m_pos += 2;
+            result.clear();
+            result[std::make_pair(0, 1)] = 1.0;
+            return true;
+        }
+
+        if (m_expression.compare(m_pos, 5, "sigma") == 0 && !isIdentifierChar(m_pos + 5))
+        {
+            m_pos += 5;
+            result.clear();
+            result[std::make_pair(1, 0)] = 1.0;
+            return true;
+        }
+
+        // Numbers are read independent of the locale, a Qt application may run with a comma as decimal point
+        const char* begin = m_expression.c_str() + m_pos;
+        const char* end = scanNumber(begin, m_expression.c_str() + m_expression.size());
+        if (end == begin)
+            return false;
+        double value;
+#if defined(__cpp_lib_to_chars)
+        if (std::from_chars(begin, end, value).ptr != end)
+            return false;
+#else
+        // QString::toDouble() always uses the C locale
+        bool ok = false;
+        value = QString::fromLatin1(begin, end - begin).toDouble(&ok);
+        if (!ok)
+            return false;
+#endif
+        m_pos += end - begin;
+        result = constant(value);
+        return true;
+    }
+
+    // Returns the end of the unsigned decimal number digits[.digits][(e|E)[+|-]digits] at begin, begin if there is none
+    static const char* scanNumber(const char* begin, const char* end)
+    {
+        const char* p = begin;
+        bool any_digit = false;
+        for (; p != end && std::isdigit(static_cast<unsigned char>(*p)); p++)
+            any_digit = true;
+        if (p != end && *p == '.')
+            for (p++; p != end && std::isdigit(static_cast<unsigned char>(*p)); p++)
+                any_digit = true;
+        if (!any_digit)
+            return begin;
+
+        // The exponent only belongs to the number if it has digits
+        if (p != end && (*p == 'e' || *p == 'E'))
+        {
+            const char* exponent = p + 1;
+            if (exponent != end && (*exponent == '+' || *exponent == '-'))
+                exponent++;
+            if (exponent != end && std::isdigit(static_cast<unsigned char>(*exponent)))
+            {
+                for (p = exponent; p != end && std::isdigit(static_cast<unsigned char>(*p)); p++)
+                    ;
+            }
+        }
+        return p;
+    }
+
+    bool isIdentifierChar(size_t pos) const
+    {
+        if (pos >= m_expression.size())
+            return false;
+        unsigned char c = static_cast<unsigned char>(m_expression[pos]);
+        return std::isalnum(c) || c == '_';
+    }
+};
+
+//--------------------------------------------------------------------------
+
+// Fallback contexts of one thread, indexed by the slot of their program. The owning thread reads its contexts without
+// locking. Growing the vector and removing the context of a destroyed program take the mutex, the latter only touches
+// the slot of a program which is no longer evaluated.
+struct AVIMMMatrixProgram::ThreadContexts
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<EvaluationContext>> contexts;
+
+    ThreadContexts()
+    {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        getRegistry().insert(this);
+    }
+    ~ThreadContexts()
+    {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        getRegistry().erase(this);
+    }
+
+    // The contexts of all running threads. Never destroyed, programs may be destroyed during static destruction.
+    static std::set<ThreadContexts*>& getRegistry()
+    {
+        static std::set<ThreadContexts*>* registry = new std::set<ThreadContexts*>();
+        return *registry;
+    }
+    static std::mutex& getRegistryMutex()
+    {
+        static std::mutex* mutex = new std::mutex();
+        return *mutex;
+    }
+
+    // Slots of destroyed programs are reused, so the contexts of a thread only grow with the live programs
+    static int acquireSlot()
+    {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        std::vector<int>& free_slots = getFreeSlots();
+        if (free_slots.empty())
+            return getNumberOfSlots()++;
+        const int slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+    static std::vector<int>& getFreeSlots()
+    {
+        static std::vector<int>* free_slots = new std::vector<int>();
+        return *free_slots;
+    }
+    static int& getNumberOfSlots()
+    {
+        static int number_of_slots = 0;
+        return number_of_slots;
+    }
+};
+
+//--------------------------------------------------------------------------
+
+AVIMMMatrixProgram::AVIMMMatrixProgram(const AVMatrix<QString> &M, parser_t& parser)
+    : m_template(Matrix::Zero(M.getRows(), M.getColumns())), m_max_dt_power(0), m_max_sigma_power(0), m_slot(-1)
+{
+    int rows = M.getRows();
+    int cols = M.getColumns();
+
+    std::vector<std::pair<int, Polynomial>> polynomial_cells;
+
+    // Cells are stored in column major order like the eigen matrices
+    for (int j = 0; j < cols; j++)
+        for (int i = 0; i < rows; i++)
+        {
+            int index = j * rows + i;
+            std::string expression_string = M.get(i,j).toStdString();
+
+            Polynomial polynomial;
+            if (!PolynomialParser(expression_string).parse(polynomial))
+            {
+                FallbackCell cell;
+                cell.index      = index;
+                cell.expression = expression_string;
+                m_fallback_cells.push_back(cell);
+                continue;
+            }
+
+            // Fold the constant part into the template, keep the remaining terms
+            Polynomial time_dependent;
+            for (const auto& term : polynomial)
+            {
+                if (term.second == 0.0)
+                    continue;
+                if (term.first == std::make_pair(0, 0))
+                    m_template(index) = term.second;
+                else
+                    time_dependent[term.first] = term.second;
+            }
+            if (!time_dependent.empty())
+                polynomial_cells.push_back(std::make_pair(index, time_dependent));
+        }
+
+    for (const auto& polynomial_cell : polynomial_cells)
+    {
+        Cell cell;
+        cell.index           = polynomial_cell.first;
+        cell.first_term      = m_terms.size();
+        cell.number_of_terms = polynomial_cell.second.size();
+        // The constant part is already contained in the template and is added back on evaluation
+        for (const auto& term : polynomial_cell.second)
+        {
+            Term new_term;
+            new_term.coefficient = term.second;
+            new_term.monomial    = addMonomial(term.first.first, term.first.second);
+            m_terms.push_back(new_term);
+        }
+        m_cells.push_back(cell);
+    }
+
+    // Check the fallback cells once, the contexts compile them again for their thread
+    T dt    = T(0.0);
+    T sigma = T(1.0);
+    symbol_table_t symbol_table;
+    symbol_table.add_variable("dt", dt);
+    symbol_table.add_variable("sigma", sigma);
+    for (const auto& cell : m_fallback_cells)
+    {
+        expression_t expression;
+        expression.register_symbol_table(symbol_table);
+        if (!parser.compile(cell.expression, expression))
+        {
+            assert(("Could not compile expression: \"" + cell.expression + "\"!", false));
+        }
+    }
+    if (!m_fallback_cells.empty())
+        m_slot = ThreadContexts::acquireSlot();
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMMatrixProgram::addMonomial(int sigma_power, int dt_power)
+{
+    for (size_t i = 0; i < m_monomials.size(); i++)
+        if (m_monomials[i].sigma_power == sigma_power && m_monomials[i].dt_power == dt_power)
+            return i;
+
+    Monomial monomial;
+    monomial.sigma_power = sigma_power;
+    monomial.dt_power    = dt_power;
+    m_monomials.push_back(monomial);
+    m_max_dt_power    = std::max(m_max_dt_power, dt_power);
+    m_max_sigma_power = std::max(m_max_sigma_power, sigma_power);
+    return m_monomials.size() - 1;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMMatrixProgram::evaluate(Matrix &result, float time_delta, float variance) const
+{
+    result = m_template;
+    evaluateTimeDependentCells(result.data(), time_delta, variance);
+}
+
+//--------------------------------------------------------------------------
+
+Matrix AVIMMMatrixProgram::evaluate(float time_delta, float variance) const
+{
+    Matrix result = m_template;
+    evaluateTimeDependentCells(result.data(), time_delta, variance);
+    return result;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMMatrixProgram::evaluateTimeDependentCells(double* result, float time_delta, float variance) const
+{
+    if (!m_cells.empty())
+    {
+        // Every power of dt and sigma is calculated only once for the whole matrix
+        double dt_powers[MAX_POLYNOMIAL_POWER + 1];
+        double sigma_powers[MAX_POLYNOMIAL_POWER + 1];
+        double monomial_values[MAX_MONOMIALS];
+        dt_powers[0]    = 1.0;
+        sigma_powers[0] = 1.0;
+        for (int i = 1; i <= m_max_dt_power; i++)
+            dt_powers[i] = dt_powers[i - 1] * time_delta;
+        for (int i = 1; i <= m_max_sigma_power; i++)
+            sigma_powers[i] = sigma_powers[i - 1] * variance;
+        for (size_t i = 0; i < m_monomials.size(); i++)
+            monomial_values[i] = sigma_powers[m_monomials[i].sigma_power] * dt_powers[m_monomials[i].dt_power];
+
+        for (const auto& cell : m_cells)
+        {
+            double value = m_template(cell.index);
+            const Term* term = &m_terms[cell.first_term];
+            for (int k = 0; k < cell.number_of_terms; k++, term++)
+                value += term->coefficient * monomial_values[term->monomial];
+            result[cell.index] = value;
+        }
+    }
+
+    if (!m_fallback_cells.empty())
+    {
+        EvaluationContext& context = getThreadContext();
+        context.dt    = T(time_delta);
+        context.sigma = T(variance);
+        for (size_t k = 0; k < m_fallback_cells.size(); k++)
+            result[m_fallback_cells[k].index] = context.expressions[k].value();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMMatrixProgram::~AVIMMMatrixProgram()
+{
+    // Only programs with fallback cells have contexts
+    if (m_slot < 0)
+        return;
+
+    std::lock_guard<std::mutex> registry_lock(ThreadContexts::getRegistryMutex());
+    for (ThreadContexts* thread_contexts : ThreadContexts::getRegistry())
+    {
+        std::lock_guard<std::mutex> lock(thread_contexts->mutex);
+        if (m_slot < static_cast<int>(thread_contexts->contexts.size()))
+            thread_contexts->contexts[m_slot].reset();
+    }
+    ThreadContexts::getFreeSlots().push_back(m_slot);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMMatrixProgram::EvaluationContext& AVIMMMatrixProgram::getThreadContext() const
+{
+    thread_local ThreadContexts thread_contexts;
+    std::vector<std::unique_ptr<EvaluationContext>>& contexts = thread_contexts.contexts;
+    if (m_slot < static_cast<int>(contexts.size()) && contexts[m_slot])
+        return *contexts[m_slot];
+
+    // The context stays valid after unlocking, only this program removes it when it is destroyed
+    std::lock_guard<std::mutex> lock(thread_contexts.mutex);
+    if (m_slot >= static_cast<int>(contexts.size()))
+        contexts.resize(m_slot + 1);
+    std::unique_ptr<EvaluationContext>& context = contexts[m_slot];
+
+    context.reset(new EvaluationContext());
+    context->dt    = T(0.0);
+    context->sigma = T(1.0);
+    context->symbol_table.add_variable("dt", context->dt);
+    context->symbol_table.add_variable("sigma", context->sigma);
+
+    // The expressions must not be moved once they are compiled
+    context->expressions.resize(m_fallback_cells.size());
+    parser_t& parser = AVIMMConfigParser::getThreadParser();
+    for (size_t k = 0; k < m_fallback_cells.size(); k++)
+    {
+        context->expressions[k].register_symbol_table(context->symbol_table);
+        parser.compile(m_fallback_cells[k].expression, context->expressions[k]);
+    }
+    return *context;
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMMatrixProgramPtr AVIMMConfigParser::compileMatrixProgram(const AVMatrix<QString> &M)
+{
+    return std::make_shared<AVIMMMatrixProgram>(M, getThreadParser());
+}
@@ -0,0 +1,128 @@
+//
+// Created by felix on 7/14/20.
+//
+
+#ifndef AVIMMMATRIXPROGRAM_H
+#define AVIMMMATRIXPROGRAM_H
+
+#include "avimmtypedefs.h"
+#include "avimmconfigparser.h"
+
+// Compiles a whole config matrix into one program which is evaluated for each new time step.
+//
+// Every cell is parsed into a polynomial of dt and sigma. Cells which are constant are folded into a template matrix
+// once, all other cells are stored as a list of terms which reference a shared table of monomials (e.g. sigma*dt^3).
+// On evaluation each monomial is computed only once for the whole matrix and only the non-constant cells are written.
+// Cells which cannot be represented as a polynomial (e.g. functions or divisions by dt) are compiled with exprtk and
+// evaluated as before.
+// A compiled program is immutable and shared by all estimators of an area, it may be evaluated concurrently from any
+// number of threads without locking. The polynomial cells are evaluated on the stack. The exprtk expressions of the
+// fallback cells reference their variables, so they are compiled once per thread into a small evaluation context. The
+// contexts of a program are removed from all threads when the program is destroyed.
+class AVIMMMatrixProgram
+{
+public:
+    // The parser is only used to check the fallback cells, the contexts use the parser of their thread
+    AVIMMMatrixProgram(const AVMatrix<QString> &M, parser_t& parser);
+
+    ~AVIMMMatrixProgram();
+
+    AVIMMMatrixProgram(const AVIMMMatrixProgram&) = delete;
+    AVIMMMatrixProgram& operator=(const AVIMMMatrixProgram&) = delete;
+
+    int rows() const { return m_template.rows(); }
+    int cols() const { return m_template.cols(); }
+    // Returns true if no cell of the matrix depends on dt or sigma
+    bool isConstant() const { return m_cells.empty() && m_fallback_cells.empty(); }
+    // Returns the number of cells which have to be calculated on each evaluation
+    int getNumberOfTimeDependentCells() const { return m_cells.size() + m_fallback_cells.size(); }
+
+    // Evaluates the whole matrix for the given time delta and variance. The result matrix is resized if necessary.
+    void evaluate(Matrix& result, float time_delta=0.0, float variance=1.0) const;
+    Matrix evaluate(float time_delta=0.0, float variance=1.0) const;
+    // Only writes the non constant cells, result must already hold the template, e.g. from a previous evaluate()
+    void evaluateTimeDependentCells(Matrix& result, float time_delta=0.0, float variance=1.0) const
+    { evaluateTimeDependentCells(result.data(), time_delta, variance); }
+
+    // Evaluation into fixed size matrices, the dimensions must match the config matrix
+    template<int ROWS, int COLS>
+    void evaluate(Eigen::Matrix<double, ROWS, COLS>& result, float time_delta=0.0, float variance=1.0) const
+    {
+        assert(ROWS == rows() && COLS == cols());
+        result = m_template;
+        evaluateTimeDependentCells(result.data(), time_delta, variance);
+    }
+
+private:
+    // Index of the monomial sigma^sigma_power * dt^dt_power in the monomial table
+    struct Term
+    {
+        double coefficient;
+        int monomial;
+    };
+
+    struct Cell
+    {
+        int index; // column major index into the matrix
+        int first_term;
+        int number_of_terms;
+    };
+
+    struct Monomial
+    {
+        int sigma_power;
+        int dt_power;
+    };
+
+    struct FallbackCell
+    {
+        int index;
+        std::string expression;
+    };
+
+    // Fallback cells compiled for one thread, the expressions are bound to the variables of the context
+    struct EvaluationContext
+    {
+        T dt;
+        T sigma;
+        symbol_table_t symbol_table;
+        std::vector<expression_t> expressions;
+    };
+
+    typedef std::map<std::pair<int, int>, double> Polynomial;
+
+    class PolynomialParser;
+    struct ThreadContexts;
+
+    int addMonomial(int sigma_power, int dt_power);
+    // Writes the non constant cells into the column major data of a matrix
+    void evaluateTimeDependentCells(double* result, float time_delta, float variance) const;
+    // Returns the context of the calling thread, it is created on the first evaluation in the thread
+    EvaluationContext& getThreadContext() const;
+
+    Matrix m_template;
+    std::vector<Cell> m_cells;
+    std::vector<Term> m_terms;
+    std::vector<Monomial> m_monomials;
+    int m_max_dt_power;
+    int m_max_sigma_power;
+
+    std::vector<FallbackCell> m_fallback_cells;
+    // Index of the contexts of this program in the threads, -1 without fallback cells. Slots are reused after the
+    // program is destroyed.
+    int m_slot;
+};
+
+// Time dependent matrices of one subfilter, compiled once into matrix programs when the area config is created
+struct AVIMMCompiledSubfilterMatrices
+{
+    AVIMMMatrixProgramPtr F;
+    AVIMMMatrixProgramPtr P;
+    AVIMMMatrixProgramPtr H;
+    AVIMMMatrixProgramPtr B;
+    AVIMMMatrixProgramPtr R;
+    AVIMMMatrixProgramPtr J;
+    AVIMMMatrixProgramPtr Q;
+};
+
+#endif //AVIMMMATRIXPROGRAM_H
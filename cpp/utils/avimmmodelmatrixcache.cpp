@@ -0,0 +1,160 @@
+//
+// Created by felix on 7/21/20.
+//
+
+#include "avimmmodelmatrixcache.h"
+
+#include <cmath>
+#include <cstring>
+
+AVIMMModelMatrixCache::AVIMMModelMatrixCache(double quantization_step, int capacity)
+    : m_quantization_step(quantization_step), m_capacity(std::max(capacity, 1)), m_hits(0), m_misses(0),
+      m_contentions(0)
+{
+    m_index.reserve(m_capacity);
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMModelMatrixCache::getModelId(const QString &area_name, const QString &sub_filter_key)
+{
+    static std::mutex mutex;
+    static QMap<QString, int> model_ids;
+
+    const QString model_name = area_name + "/" + sub_filter_key;
+    std::lock_guard<std::mutex> lock(mutex);
+    int model_id = model_ids.value(model_name, -1);
+    if (model_id >= 0)
+        return model_id;
+
+    model_id = model_ids.size();
+    model_ids.insert(model_name, model_id);
+    return model_id;
+}
+
+//--------------------------------------------------------------------------
+
+const AVIMMModelMatrices& AVIMMModelMatrixCache::getModelMatrices(int model_id,
+                                                                 const AVIMMCompiledSubfilterMatrices &programs,
+                                                                 float time_delta, float variance)
+{
+    float quantized_time_delta;
+    Key key = createKey(model_id, time_delta, variance, quantized_time_delta);
+
+    auto it = m_index.find(key);
+    if (it != m_index.end())
+    {
+        // Move entry to the front, splicing does not allocate
+        m_hits++;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->matrices;
+    }
+
+    m_misses++;
+    return insert(key, programs, quantized_time_delta, variance);
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMModelMatrixCache::prewarm(int model_id, const AVIMMCompiledSubfilterMatrices &programs,
+                                    const QList<float> &time_deltas, float variance)
+{
+    for (const auto& time_delta : time_deltas)
+    {
+        float quantized_time_delta;
+        Key key = createKey(model_id, time_delta, variance, quantized_time_delta);
+        if (m_index.find(key) == m_index.end())
+            insert(key, programs, quantized_time_delta, variance);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMModelMatrixCache::clear()
+{
+    m_index.clear();
+    m_entries.clear();
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMModelMatrixCache::resetStatistics()
+{
+    m_hits   = 0;
+    m_misses = 0;
+    m_contentions.store(0, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMModelMatrixCache::Key AVIMMModelMatrixCache::createKey(int model_id, float time_delta, float variance,
+                                                            float &quantized_time_delta) const
+{
+    Key key;
+    key.model_id = model_id;
+    key.variance = variance;
+    if (m_quantization_step > 0.0)
+    {
+        key.time_delta_quantum = std::llround(time_delta / m_quantization_step);
+        quantized_time_delta   = static_cast<float>(key.time_delta_quantum * m_quantization_step);
+    }
+    else
+    {
+        // Without quantization the bit pattern of the time delta is used as key
+        qint32 bits;
+        std::memcpy(&bits, &time_delta, sizeof(bits));
+        key.time_delta_quantum = bits;
+        quantized_time_delta   = time_delta;
+    }
+    return key;
+}
+
+//--------------------------------------------------------------------------
+
+const AVIMMModelMatrices& AVIMMModelMatrixCache::insert(const Key &key, const AVIMMCompiledSubfilterMatrices &programs,
+                                                        float time_delta, float variance)
+{
+    // Reuse the least recently used entry if the cache is full, this keeps the matrix storage allocated
+    if (static_cast<int>(m_entries.size()) >= m_capacity)
+    {
+        m_index.erase(m_entries.back().key);
+        m_entries.splice(m_entries.begin(), m_entries, std::prev(m_entries.end()));
+    }
+    else
+    {
+        m_entries.push_front(Entry());
+    }
+
+    Entry& entry = m_entries.front();
+    entry.key = key;
+    programs.F->evaluate(entry.matrices.F, time_delta, variance);
+    programs.Q->evaluate(entry.matrices.Q, time_delta, variance);
+    programs.B->evaluate(entry.matrices.B, time_delta, variance);
+    programs.H->evaluate(entry.matrices.H, time_delta, variance);
+    programs.P->evaluate(entry.matrices.P, time_delta, variance);
+    programs.R->evaluate(entry.matrices.R, time_delta, variance);
+    m_index[key] = m_entries.begin();
+
+    return entry.matrices;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMConfigParser::enableModelMatrixCache(double quantization_step, int capacity)
+{
+    m_model_matrix_cache = std::make_shared<AVIMMModelMatrixCache>(quantization_step, capacity);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMModelMatrixCache* AVIMMConfigParser::lockModelMatrixCache(std::unique_lock<std::mutex>& lock)
+{
+    AVIMMModelMatrixCache* thread_cache = threadModelMatrixCache();
+    if (thread_cache)
+        return thread_cache;
+
+    AVIMMModelMatrixCache* cache = m_model_matrix_cache.get();
+    if (cache)
+        lock = cache->lock();
+    return cache;
+}
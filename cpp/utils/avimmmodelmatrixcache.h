@@ -0,0 +1,128 @@
+//
+// Created by felix on 7/21/20.
+//
+
+#ifndef AVIMMMODELMATRIXCACHE_H
+#define AVIMMMODELMATRIXCACHE_H
+
+#include "avimmtypedefs.h"
+#include "avimmmatrixprogram.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+// Model matrices of one subfilter calculated for a single time delta
+struct AVIMMModelMatrices
+{
+    Matrix F;
+    Matrix Q;
+    Matrix B;
+    Matrix H;
+    Matrix P;
+    Matrix R;
+};
+
+// LRU cache of the time dependent model matrices, keyed by area, subfilter, quantized time delta and sigma.
+// Sensors with a fixed update rate produce the same few time deltas over and over, for those the matrices only
+// have to be looked up instead of being calculated on every step.
+// Time deltas are rounded to a multiple of the quantization step and the matrices are calculated for the rounded
+// value, a quantization step <= 0 disables the rounding and only identical time deltas share an entry.
+class AVIMMModelMatrixCache
+{
+public:
+    AVIMMModelMatrixCache(double quantization_step, int capacity);
+    virtual ~AVIMMModelMatrixCache() = default;
+
+    // Returns the id of the model defined by area and subfilter key, ids are created on first use.
+    // The id should be resolved once (e.g. when creating the estimator) and reused for every lookup. Ids are shared
+    // by all caches of the process, so estimators may switch between caches (e.g. per thread caches) without
+    // resolving them again.
+    static int getModelId(const QString& area_name, const QString& sub_filter_key);
+
+    // Returns the matrices of the given model for the time delta, they are calculated using the programs on a miss.
+    // The returned reference is valid until the next call of getModelMatrices(), prewarm() or clear(). If estimators
+    // are calculated on several threads, the caller has to hold lock() until the matrices are copied.
+    const AVIMMModelMatrices& getModelMatrices(int model_id, const AVIMMCompiledSubfilterMatrices& programs,
+                                               float time_delta, float variance=1.0);
+
+    // Calculates the matrices of the given model for all time deltas in advance, e.g. the known sensor periods
+    void prewarm(int model_id, const AVIMMCompiledSubfilterMatrices& programs, const QList<float>& time_deltas,
+                 float variance=1.0);
+
+    void clear();
+    void resetStatistics();
+
+    double getQuantizationStep() const { return m_quantization_step; }
+    int getCapacity() const { return m_capacity; }
+    int getSize() const { return m_entries.size(); }
+    quint64 getHits() const { return m_hits; }
+    quint64 getMisses() const { return m_misses; }
+    // Number of lock() calls which had to wait for another thread, caches shared by busy threads serialize them
+    quint64 getContentions() const { return m_contentions.load(std::memory_order_relaxed); }
+
+    // Locks the cache for estimators calculated on several threads
+    std::unique_lock<std::mutex> lock()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            m_contentions.fetch_add(1, std::memory_order_relaxed);
+            lock.lock();
+        }
+        return lock;
+    }
+
+private:
+    struct Key
+    {
+        int model_id;
+        qint64 time_delta_quantum;
+        float variance;
+
+        bool operator==(const Key& other) const
+        {
+            return model_id == other.model_id && time_delta_quantum == other.time_delta_quantum &&
+                   variance == other.variance;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            size_t hash = std::hash<qint64>()(key.time_delta_quantum);
+            hash ^= std::hash<int>()(key.model_id) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<float>()(key.variance) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        AVIMMModelMatrices matrices;
+    };
+
+    typedef std::list<Entry> EntryList;
+
+    // Returns the key of the time delta and the time delta the matrices are calculated with
+    Key createKey(int model_id, float time_delta, float variance, float& quantized_time_delta) const;
+    const AVIMMModelMatrices& insert(const Key& key, const AVIMMCompiledSubfilterMatrices& programs,
+                                     float time_delta, float variance);
+
+    double m_quantization_step;
+    int m_capacity;
+    quint64 m_hits;
+    quint64 m_misses;
+    std::atomic<quint64> m_contentions;
+
+    // Guards the entries for estimators running on different threads
+    std::mutex m_mutex;
+
+    // Most recently used entries are at the front
+    EntryList m_entries;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> m_index;
+};
+
+#endif //AVIMMMODELMATRIXCACHE_H
@@ -0,0 +1,156 @@
+//
+// Created by felix on 8/12/20.
+//
+
+#ifndef AVIMMSIMD_H
+#define AVIMMSIMD_H
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Lanes of doubles used by the batch estimator to run the same calculation for several tracks at once. Each track
+// is one lane, the data of the tracks is stored as struct of arrays so a lane type loads the values of consecutive
+// tracks. AVIMMSimdLane is the widest lane the compiler targets (AVX-512, AVX2 or scalar), AVIMMScalarLane is used
+// for the tail of a batch which does not fill a whole lane.
+// log and exp have no SIMD instruction, they are calculated element wise. The instruction set is selected with the
+// CMake option AVIMM_SIMD (scalar, avx2 or avx512), which sets the matching compiler flags.
+
+//--------------------------------------------------------------------------
+
+struct AVIMMScalarLane
+{
+    enum { width = 1 };
+    double v;
+
+    static AVIMMScalarLane load(const double* p) { return { *p }; }
+    static AVIMMScalarLane broadcast(double value) { return { value }; }
+    void store(double* p) const { *p = v; }
+
+    friend AVIMMScalarLane operator+(AVIMMScalarLane a, AVIMMScalarLane b) { return { a.v + b.v }; }
+    friend AVIMMScalarLane operator-(AVIMMScalarLane a, AVIMMScalarLane b) { return { a.v - b.v }; }
+    friend AVIMMScalarLane operator*(AVIMMScalarLane a, AVIMMScalarLane b) { return { a.v * b.v }; }
+    friend AVIMMScalarLane operator/(AVIMMScalarLane a, AVIMMScalarLane b) { return { a.v / b.v }; }
+    AVIMMScalarLane& operator+=(AVIMMScalarLane b) { v += b.v; return *this; }
+    AVIMMScalarLane& operator-=(AVIMMScalarLane b) { v -= b.v; return *this; }
+
+    // a * b + c
+    static AVIMMScalarLane fmadd(AVIMMScalarLane a, AVIMMScalarLane b, AVIMMScalarLane c) { return { a.v * b.v + c.v }; }
+    static AVIMMScalarLane max(AVIMMScalarLane a, AVIMMScalarLane b) { return { std::max(a.v, b.v) }; }
+    static AVIMMScalarLane abs(AVIMMScalarLane a) { return { std::abs(a.v) }; }
+    // Same as AVIMMFilterBase::zeroSmallElements, every value <= threshold becomes 0
+    static AVIMMScalarLane zeroSmall(AVIMMScalarLane a, double threshold) { return { a.v <= threshold ? 0.0 : a.v }; }
+    static AVIMMScalarLane log(AVIMMScalarLane a) { return { std::log(a.v) }; }
+    static AVIMMScalarLane exp(AVIMMScalarLane a) { return { std::exp(a.v) }; }
+};
+
+//--------------------------------------------------------------------------
+
+#if defined(__AVX512F__)
+
+struct AVIMMAvx512Lane
+{
+    enum { width = 8 };
+    __m512d v;
+
+    static AVIMMAvx512Lane load(const double* p) { return { _mm512_loadu_pd(p) }; }
+    static AVIMMAvx512Lane broadcast(double value) { return { _mm512_set1_pd(value) }; }
+    void store(double* p) const { _mm512_storeu_pd(p, v); }
+
+    friend AVIMMAvx512Lane operator+(AVIMMAvx512Lane a, AVIMMAvx512Lane b) { return { _mm512_add_pd(a.v, b.v) }; }
+    friend AVIMMAvx512Lane operator-(AVIMMAvx512Lane a, AVIMMAvx512Lane b) { return { _mm512_sub_pd(a.v, b.v) }; }
+    friend AVIMMAvx512Lane operator*(AVIMMAvx512Lane a, AVIMMAvx512Lane b) { return { _mm512_mul_pd(a.v, b.v) }; }
+    friend AVIMMAvx512Lane operator/(AVIMMAvx512Lane a, AVIMMAvx512Lane b) { return { _mm512_div_pd(a.v, b.v) }; }
+    AVIMMAvx512Lane& operator+=(AVIMMAvx512Lane b) { v = _mm512_add_pd(v, b.v); return *this; }
+    AVIMMAvx512Lane& operator-=(AVIMMAvx512Lane b) { v = _mm512_sub_pd(v, b.v); return *this; }
+
+    static AVIMMAvx512Lane fmadd(AVIMMAvx512Lane a, AVIMMAvx512Lane b, AVIMMAvx512Lane c)
+    { return { _mm512_fmadd_pd(a.v, b.v, c.v) }; }
+    static AVIMMAvx512Lane max(AVIMMAvx512Lane a, AVIMMAvx512Lane b) { return { _mm512_max_pd(a.v, b.v) }; }
+    static AVIMMAvx512Lane abs(AVIMMAvx512Lane a) { return { _mm512_abs_pd(a.v) }; }
+    static AVIMMAvx512Lane zeroSmall(AVIMMAvx512Lane a, double threshold)
+    {
+        const __mmask8 keep = _mm512_cmp_pd_mask(a.v, _mm512_set1_pd(threshold), _CMP_GT_OQ);
+        return { _mm512_maskz_mov_pd(keep, a.v) };
+    }
+    static AVIMMAvx512Lane log(AVIMMAvx512Lane a) { return elementWise(a, [](double x) { return std::log(x); }); }
+    static AVIMMAvx512Lane exp(AVIMMAvx512Lane a) { return elementWise(a, [](double x) { return std::exp(x); }); }
+
+private:
+    template<typename Function>
+    static AVIMMAvx512Lane elementWise(AVIMMAvx512Lane a, Function function)
+    {
+        alignas(64) double values[width];
+        _mm512_store_pd(values, a.v);
+        for (double& value : values)
+            value = function(value);
+        return { _mm512_load_pd(values) };
+    }
+};
+
+typedef AVIMMAvx512Lane AVIMMSimdLane;
+
+//--------------------------------------------------------------------------
+
+#elif defined(__AVX2__)
+
+struct AVIMMAvx2Lane
+{
+    enum { width = 4 };
+    __m256d v;
+
+    static AVIMMAvx2Lane load(const double* p) { return { _mm256_loadu_pd(p) }; }
+    static AVIMMAvx2Lane broadcast(double value) { return { _mm256_set1_pd(value) }; }
+    void store(double* p) const { _mm256_storeu_pd(p, v); }
+
+    friend AVIMMAvx2Lane operator+(AVIMMAvx2Lane a, AVIMMAvx2Lane b) { return { _mm256_add_pd(a.v, b.v) }; }
+    friend AVIMMAvx2Lane operator-(AVIMMAvx2Lane a, AVIMMAvx2Lane b) { return { _mm256_sub_pd(a.v, b.v) }; }
+    friend AVIMMAvx2Lane operator*(AVIMMAvx2Lane a, AVIMMAvx2Lane b) { return { _mm256_mul_pd(a.v, b.v) }; }
+    friend AVIMMAvx2Lane operator/(AVIMMAvx2Lane a, AVIMMAvx2Lane b) { return { _mm256_div_pd(a.v, b.v) }; }
+    AVIMMAvx2Lane& operator+=(AVIMMAvx2Lane b) { v = _mm256_add_pd(v, b.v); return *this; }
+    AVIMMAvx2Lane& operator-=(AVIMMAvx2Lane b) { v = _mm256_sub_pd(v, b.v); return *this; }
+
+    static AVIMMAvx2Lane fmadd(AVIMMAvx2Lane a, AVIMMAvx2Lane b, AVIMMAvx2Lane c)
+    {
+#if defined(__FMA__)
+        return { _mm256_fmadd_pd(a.v, b.v, c.v) };
+#else
+        return { _mm256_add_pd(_mm256_mul_pd(a.v, b.v), c.v) };
+#endif
+    }
+    static AVIMMAvx2Lane max(AVIMMAvx2Lane a, AVIMMAvx2Lane b) { return { _mm256_max_pd(a.v, b.v) }; }
+    static AVIMMAvx2Lane abs(AVIMMAvx2Lane a) { return { _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v) }; }
+    static AVIMMAvx2Lane zeroSmall(AVIMMAvx2Lane a, double threshold)
+    {
+        const __m256d keep = _mm256_cmp_pd(a.v, _mm256_set1_pd(threshold), _CMP_GT_OQ);
+        return { _mm256_and_pd(keep, a.v) };
+    }
+    static AVIMMAvx2Lane log(AVIMMAvx2Lane a) { return elementWise(a, [](double x) { return std::log(x); }); }
+    static AVIMMAvx2Lane exp(AVIMMAvx2Lane a) { return elementWise(a, [](double x) { return std::exp(x); }); }
+
+private:
+    template<typename Function>
+    static AVIMMAvx2Lane elementWise(AVIMMAvx2Lane a, Function function)
+    {
+        alignas(32) double values[width];
+        _mm256_store_pd(values, a.v);
+        for (double& value : values)
+            value = function(value);
+        return { _mm256_load_pd(values) };
+    }
+};
+
+typedef AVIMMAvx2Lane AVIMMSimdLane;
+
+//--------------------------------------------------------------------------
+
+#else
+
+typedef AVIMMScalarLane AVIMMSimdLane;
+
+#endif
+
+#endif //AVIMMSIMD_H
@@ -0,0 +1,116 @@
+//
+// Created by felix on 8/24/20.
+//
+
+#ifndef AVIMMSPSCQUEUE_H
+#define AVIMMSPSCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Size of a cache line, the indices of producer and consumer are kept on different lines
+#define AVIMM_CACHE_LINE_SIZE 64
+
+// Bounded lock free queue for exactly one producer thread and one consumer thread. The elements are stored in a ring
+// buffer whose capacity is rounded up to a power of two. Each side caches the index of the other side and only
+// reloads it once the queue looks full (producer) or empty (consumer), so the cache lines are rarely shared.
+template<typename T>
+class AVIMMSpscQueue
+{
+public:
+    explicit AVIMMSpscQueue(int capacity)
+        : m_head(0), m_cached_tail(0), m_tail(0), m_cached_head(0)
+    {
+        int size = 1;
+        while (size < capacity)
+            size *= 2;
+        m_buffer.resize(size);
+        m_mask = size - 1;
+    }
+
+    AVIMMSpscQueue(const AVIMMSpscQueue&) = delete;
+    AVIMMSpscQueue& operator=(const AVIMMSpscQueue&) = delete;
+
+    int getCapacity() const { return m_mask + 1; }
+
+    // Producer side, returns false if the queue is full. The value is only moved from if it was pushed.
+    bool tryPush(T& value)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head > m_mask)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head > m_mask)
+                return false;
+        }
+        m_buffer[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, returns false if the queue is empty
+    bool tryPop(T& value)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+                return false;
+        }
+        value = std::move(m_buffer[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Number of queued elements, exact only if called by the producer or the consumer while the other side is idle
+    int size() const
+    {
+        return static_cast<int>(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire));
+    }
+
+private:
+    std::vector<T> m_buffer;
+    size_t m_mask;
+
+    // Consumer side
+    alignas(AVIMM_CACHE_LINE_SIZE) std::atomic<size_t> m_head;
+    size_t m_cached_tail;
+    // Producer side
+    alignas(AVIMM_CACHE_LINE_SIZE) std::atomic<size_t> m_tail;
+    size_t m_cached_head;
+};
+
+// Waiting strategy of a thread polling a queue: spins for the first polls, then yields and finally sleeps between
+// polls. reset() is called whenever the poll succeeded.
+class AVIMMBackoff
+{
+public:
+    AVIMMBackoff() : m_polls(0) {}
+
+    void reset() { m_polls = 0; }
+    void wait()
+    {
+        m_polls++;
+        if (m_polls < SPIN_POLLS)
+            return;
+        if (m_polls < YIELD_POLLS)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(SLEEP_US));
+    }
+
+private:
+    static const int SPIN_POLLS  = 64;
+    static const int YIELD_POLLS = 4096;
+    static const int SLEEP_US    = 50;
+
+    int m_polls;
+};
+
+#endif //AVIMMSPSCQUEUE_H
@@ -0,0 +1,132 @@
+//
+// Created by felix on 9/8/20.
+//
+
+#include "avimmstagetiming.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+    struct ThreadTimings
+    {
+        AVIMMStageTiming::Snapshot histograms;
+        // Generation of the histograms, only written by the owning thread
+        std::atomic<quint64> generation;
+    };
+
+    struct Registry
+    {
+        Registry() : generation(0) {}
+
+        std::mutex mutex;
+        std::vector<ThreadTimings*> threads;
+        // Histograms of the threads which finished in the current generation
+        AVIMMStageTiming::Snapshot finished;
+        // Incremented by every reset
+        std::atomic<quint64> generation;
+    };
+
+    Registry& registry()
+    {
+        // Never destroyed, threads may still finish while static objects are destroyed at exit
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    // Registers the histograms of a thread on creation and keeps them when the thread finishes
+    class ThreadRegistration
+    {
+    public:
+        ThreadRegistration() : m_timings(new ThreadTimings())
+        {
+            Registry& timing_registry = registry();
+            std::lock_guard<std::mutex> lock(timing_registry.mutex);
+            m_timings->generation.store(timing_registry.generation.load(std::memory_order_relaxed),
+                                        std::memory_order_relaxed);
+            timing_registry.threads.push_back(m_timings.get());
+        }
+
+        ~ThreadRegistration()
+        {
+            Registry& timing_registry = registry();
+            std::lock_guard<std::mutex> lock(timing_registry.mutex);
+            if (m_timings->generation.load(std::memory_order_relaxed) ==
+                timing_registry.generation.load(std::memory_order_relaxed))
+            {
+                for (int stage = 0; stage < AVIMMStageTiming::NUMBER_OF_STAGES; stage++)
+                    timing_registry.finished[stage].merge(m_timings->histograms[stage]);
+            }
+            timing_registry.threads.erase(std::find(timing_registry.threads.begin(), timing_registry.threads.end(),
+                                                    m_timings.get()));
+        }
+
+        ThreadTimings& getTimings() { return *m_timings; }
+
+    private:
+        std::unique_ptr<ThreadTimings> m_timings;
+    };
+}
+
+//--------------------------------------------------------------------------
+
+const char* AVIMMStageTiming::getStageName(Stage stage)
+{
+    static const char* const NAMES[NUMBER_OF_STAGES] = {
+        "prepare", "mixed states", "subfilter predict", "imm state prior", "subfilter update", "mode probabilities",
+        "imm state post"
+    };
+    return NAMES[stage];
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMStageTiming::record(Stage stage, quint64 ticks)
+{
+    thread_local ThreadRegistration registration;
+    ThreadTimings& timings = registration.getTimings();
+
+    // Clears the histograms of an old generation first, the new generation is published after clearing
+    const quint64 generation = registry().generation.load(std::memory_order_relaxed);
+    if (timings.generation.load(std::memory_order_relaxed) != generation)
+    {
+        for (auto& histogram : timings.histograms)
+            histogram.reset();
+        timings.generation.store(generation, std::memory_order_release);
+    }
+    timings.histograms[stage].record(ticks);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMStageTiming::Snapshot AVIMMStageTiming::getSnapshot()
+{
+    Registry& timing_registry = registry();
+    std::lock_guard<std::mutex> lock(timing_registry.mutex);
+
+    Snapshot snapshot = timing_registry.finished;
+    const quint64 generation = timing_registry.generation.load(std::memory_order_relaxed);
+    for (const ThreadTimings* timings : timing_registry.threads)
+    {
+        // Histograms of an older generation have not been cleared by their thread yet
+        if (timings->generation.load(std::memory_order_acquire) != generation)
+            continue;
+        for (int stage = 0; stage < NUMBER_OF_STAGES; stage++)
+            snapshot[stage].merge(timings->histograms[stage]);
+    }
+    return snapshot;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMStageTiming::reset()
+{
+    Registry& timing_registry = registry();
+    std::lock_guard<std::mutex> lock(timing_registry.mutex);
+    timing_registry.generation.fetch_add(1, std::memory_order_relaxed);
+    for (auto& histogram : timing_registry.finished)
+        histogram.reset();
+}
@@ -0,0 +1,98 @@
+//
+// Created by felix on 9/8/20.
+//
+
+#ifndef AVIMMSTAGETIMING_H
+#define AVIMMSTAGETIMING_H
+
+#include "avimmlatencyhistogram.h"
+
+#include <array>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Optional timing of the stages of an estimator step. It is compiled in with the preprocessor flag
+// AVIMM_STAGE_TIMING, otherwise the AVIMM_STAGE_TIMER and AVIMM_STAGE_LAP macros expand to nothing.
+// The durations are counted in ticks of the time stamp counter (cycles of the reference clock) on x86, of the
+// virtual counter on arm64 and in nanoseconds elsewhere. Every thread records into its own histograms without
+// locking, only the first recording of a thread registers its histograms. Histograms of finished threads are kept
+// until the next reset.
+class AVIMMStageTiming
+{
+public:
+    enum Stage
+    {
+        PREPARE,
+        MIXED_STATES,
+        SUBFILTER_PREDICT,
+        IMM_STATE_PRIOR,    // IMM state after the predictions
+        SUBFILTER_UPDATE,
+        MODE_PROBABILITIES, // Mode probabilities and the mixing probability matrix
+        IMM_STATE_POST,     // IMM state after the updates
+        NUMBER_OF_STAGES
+    };
+
+    typedef std::array<AVIMMLatencyHistogram, NUMBER_OF_STAGES> Snapshot;
+
+    // Measures the time since its creation or the previous lap
+    class Timer
+    {
+    public:
+        Timer() : m_last(now()) {}
+
+        void lap(Stage stage)
+        {
+            const quint64 time = now();
+            record(stage, time - m_last);
+            m_last = time;
+        }
+
+    private:
+        quint64 m_last;
+    };
+
+    static bool isEnabled()
+    {
+#ifdef AVIMM_STAGE_TIMING
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static const char* getStageName(Stage stage);
+
+    static quint64 now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        quint64 ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Records the duration into the histogram of the calling thread
+    static void record(Stage stage, quint64 ticks);
+    // Merges the histograms of all threads since the last reset, may be called from any thread
+    static Snapshot getSnapshot();
+    // Clears the histograms of all threads, a thread clears its own histograms with its next recording
+    static void reset();
+};
+
+#ifdef AVIMM_STAGE_TIMING
+#define AVIMM_STAGE_TIMER(timer) AVIMMStageTiming::Timer timer
+#define AVIMM_STAGE_LAP(timer, stage) timer.lap(AVIMMStageTiming::stage)
+#else
+#define AVIMM_STAGE_TIMER(timer)
+#define AVIMM_STAGE_LAP(timer, stage)
+#endif
+
+#endif //AVIMMSTAGETIMING_H
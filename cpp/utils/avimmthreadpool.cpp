@@ -0,0 +1,158 @@
+//
+// Created by felix on 8/20/20.
+//
+
+#include "avimmthreadpool.h"
+
+#include <algorithm>
+
+// Number of chunks per thread if no chunk size is given, more chunks balance better but cost more queue operations
+#define CHUNKS_PER_THREAD 4
+
+namespace
+{
+    // Index of the pool thread, threads calling parallelFor() work as thread 0
+    thread_local int current_thread = 0;
+}
+
+AVIMMThreadPool::AVIMMThreadPool(int number_of_threads)
+    : m_generation(0), m_stop(false), m_function(nullptr), m_pending_chunks(0), m_steals(0)
+{
+    if (number_of_threads <= 0)
+        number_of_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 0; i < number_of_threads; i++)
+        m_queues.emplace_back(new Queue());
+
+    // Thread 0 is the thread calling parallelFor()
+    for (int i = 1; i < number_of_threads; i++)
+        m_threads.emplace_back(&AVIMMThreadPool::workerLoop, this, i);
+}
+
+//--------------------------------------------------------------------------
+
+AVIMMThreadPool::~AVIMMThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+//--------------------------------------------------------------------------
+
+int AVIMMThreadPool::getCurrentThread()
+{
+    return current_thread;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMThreadPool::parallelFor(int count, const std::function<void(int)>& function, int chunk_size)
+{
+    if (count <= 0)
+        return;
+
+    const int number_of_threads = getNumberOfThreads();
+    if (number_of_threads == 1)
+    {
+        for (int i = 0; i < count; i++)
+            function(i);
+        return;
+    }
+
+    if (chunk_size <= 0)
+        chunk_size = std::max(1, count / (number_of_threads * CHUNKS_PER_THREAD));
+    const int number_of_chunks = (count + chunk_size - 1) / chunk_size;
+
+    m_function = &function;
+    m_pending_chunks.store(number_of_chunks, std::memory_order_relaxed);
+
+    // Consecutive chunks go to different threads, so neighbouring items are spread from the start
+    for (int chunk = 0; chunk < number_of_chunks; chunk++)
+    {
+        Queue& queue = *m_queues[chunk % number_of_threads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.chunks.push_back({ chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size) });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    // Work as thread 0 until all chunks are finished, chunks still running on other threads are waited for
+    while (m_pending_chunks.load(std::memory_order_acquire) > 0)
+    {
+        if (!runChunk(0))
+            std::this_thread::yield();
+    }
+    m_function = nullptr;
+}
+
+//--------------------------------------------------------------------------
+
+void AVIMMThreadPool::workerLoop(int thread)
+{
+    current_thread = thread;
+    quint64 generation = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+            if (m_stop)
+                return;
+            generation = m_generation;
+        }
+
+        while (runChunk(thread)) {}
+    }
+}
+
+//--------------------------------------------------------------------------
+
+bool AVIMMThreadPool::runChunk(int thread)
+{
+    const int number_of_threads = getNumberOfThreads();
+
+    Chunk chunk;
+    bool found = false;
+    {
+        Queue& queue = *m_queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.chunks.empty())
+        {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+            found = true;
+        }
+    }
+
+    // Steal the oldest chunk of the next thread which still has work
+    for (int i = 1; !found && i < number_of_threads; i++)
+    {
+        Queue& queue = *m_queues[(thread + i) % number_of_threads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.chunks.empty())
+        {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+            found = true;
+            m_steals.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (!found)
+        return false;
+
+    const std::function<void(int)>& function = *m_function;
+    for (int i = chunk.begin; i < chunk.end; i++)
+        function(i);
+    m_pending_chunks.fetch_sub(1, std::memory_order_release);
+    return true;
+}
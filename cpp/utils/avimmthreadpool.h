@@ -0,0 +1,76 @@
+//
+// Created by felix on 8/20/20.
+//
+
+#ifndef AVIMMTHREADPOOL_H
+#define AVIMMTHREADPOOL_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool used to run independent work items, e.g. the updates of different tracks, on all cores.
+// parallelFor() splits the index range into chunks which are distributed over one queue per thread. Each thread
+// takes chunks from the back of its own queue and steals from the front of the other queues once its own queue is
+// empty, so threads which hit expensive items do not hold up the others.
+// The calling thread works as thread 0, a pool with one thread runs everything in the calling thread. The order in
+// which the items are processed is not defined, results are only deterministic if every item writes its own output.
+class AVIMMThreadPool
+{
+public:
+    // A number of threads <= 0 uses one thread per core
+    explicit AVIMMThreadPool(int number_of_threads=0);
+    virtual ~AVIMMThreadPool();
+
+    AVIMMThreadPool(const AVIMMThreadPool&) = delete;
+    AVIMMThreadPool& operator=(const AVIMMThreadPool&) = delete;
+
+    int getNumberOfThreads() const { return m_queues.size(); }
+    // Number of chunks which were stolen from another thread's queue since the pool was created
+    quint64 getNumberOfSteals() const { return m_steals.load(std::memory_order_relaxed); }
+    // Index of the pool thread running the calling function in [0, getNumberOfThreads()), 0 for threads which do
+    // not belong to a pool. Allows the items to use per thread resources, e.g. a model matrix cache per thread.
+    static int getCurrentThread();
+
+    // Calls function(i) for all i in [0, count) and returns once all calls finished. A chunk size <= 0 chooses a
+    // chunk size which gives every thread several chunks. Must not be called concurrently or from within function.
+    void parallelFor(int count, const std::function<void(int)>& function, int chunk_size=0);
+
+private:
+    struct Chunk
+    {
+        int begin;
+        int end;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+
+    void workerLoop(int thread);
+    // Runs one chunk from the own queue or stolen from another queue, returns false if all queues are empty
+    bool runChunk(int thread);
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    quint64 m_generation;
+    bool m_stop;
+
+    const std::function<void(int)>* m_function;
+    std::atomic<int> m_pending_chunks;
+    std::atomic<quint64> m_steals;
+};
+
+#endif //AVIMMTHREADPOOL_H